@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# time vips stats, avg and deviate for each band format
+
+uname -a
+gcc --version
+vips --version
+
+# sample2.v is 290x442 pixels ... replicate this many times horizontally and 
+# vertically to get a large image
+tile=13
+
+echo building test image ...
+vips replicate sample2.v temp.v $tile $tile
+if [ $? != 0 ]; then
+  echo "build of test image failed -- out of disc space?"
+  exit 1
+fi
+echo -n "test image is" `vipsheader -f width temp.v` 
+echo " by" `vipsheader -f height temp.v` "pixels"
+
+echo reported real-time is best of three runs
+echo format operation real-time
+
+for format in uchar char ushort short uint int float double; do
+  vips cast temp.v temp2.v $format
+  if [ $? != 0 ]; then
+    echo "cast failed -- out of disc space?"
+    exit 1
+  fi
+
+  for op in stats avg deviate; do
+    if [ $op == stats ]; then
+      args="temp2.v temp3.v"
+    else
+      args="temp2.v"
+    fi
+
+    t1=`/usr/bin/time -f %e vips $op $args 2>&1 >/dev/null`
+    t2=`/usr/bin/time -f %e vips $op $args 2>&1 >/dev/null`
+    t3=`/usr/bin/time -f %e vips $op $args 2>&1 >/dev/null`
+
+    if [[ $t2 < $t1 ]]; then
+      t1=$t2
+    fi
+    if [[ $t3 < $t1 ]]; then
+      t1=$t3
+    fi
+    echo $format $op $t1
+  done
+done
+
+rm -f temp.v temp2.v temp3.v
@@ -8,6 +8,8 @@
  * 	  corresponding pixel in the input)
  * 	- LUT-able: ie. arithmetic (image) can be exactly replaced by
  * 	  maplut (image, arithmetic (lut)) for 8/16 bit int images
+ * 	- fusable: chains of arithmetic operations run as a single pass, 
+ * 	  see vips_arithmetic_fuse()
  */
 
 /*
@@ -457,17 +459,95 @@ vips__bandalike( const char *domain,
  */
 #define MAX_INPUT_IMAGES (64)
 
+/* Maximum number of operations we fuse into one line program.
+ */
+#define MAX_FUSED_STEPS (32)
+
+/* Our sequence value: the leaf regions, plus a line buffer for the output
+ * of each step but the last.
+ */
+typedef struct {
+	VipsRegion **ir;
+
+	VipsPel **buf;
+	int n_buf;
+
+	/* Pixels each buffer can hold.
+	 */
+	int width;
+} VipsArithmeticSequence;
+
+static int
+vips_arithmetic_stop( void *vseq, void *a, void *b )
+{
+	VipsArithmeticSequence *seq = (VipsArithmeticSequence *) vseq;
+
+	int i;
+
+	if( seq->ir )
+		vips_stop_many( seq->ir, NULL, NULL );
+	if( seq->buf ) 
+		for( i = 0; i < seq->n_buf; i++ )
+			VIPS_FREE( seq->buf[i] );
+	VIPS_FREE( seq->buf );
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_arithmetic_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage **leaf = (VipsImage **) a;
+	VipsArithmetic *arithmetic = VIPS_ARITHMETIC( b ); 
+	VipsArithmeticSequence *seq;
+
+	int i;
+
+	if( !(seq = VIPS_NEW( NULL, VipsArithmeticSequence )) )
+		return( NULL );
+	seq->ir = NULL;
+	seq->n_buf = arithmetic->n_step - 1;
+	seq->buf = NULL;
+	seq->width = 0;
+
+	if( !(seq->ir = vips_start_many( out, leaf, NULL )) ||
+		!(seq->buf = VIPS_ARRAY( NULL, seq->n_buf + 1, VipsPel * )) ) {
+		vips_arithmetic_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+	for( i = 0; i < seq->n_buf + 1; i++ )
+		seq->buf[i] = NULL;
+
+	return( seq );
+}
+
 static int
 vips_arithmetic_gen( VipsRegion *or, 
-	void *seq, void *a, void *b, gboolean *stop )
+	void *vseq, void *a, void *b, gboolean *stop )
 {
-	VipsRegion **ir = (VipsRegion **) seq;
+	VipsArithmeticSequence *seq = (VipsArithmeticSequence *) vseq;
+	VipsRegion **ir = seq->ir;
 	VipsArithmetic *arithmetic = VIPS_ARITHMETIC( b ); 
-	VipsArithmeticClass *class = VIPS_ARITHMETIC_GET_CLASS( arithmetic ); 
 	VipsRect *r = &or->valid;
 
 	VipsPel *p[MAX_INPUT_IMAGES], *q;
-	int i, y;
+	int i, s, y;
+
+	/* Make sure we have enough line buffer for the intermediate steps.
+	 */
+	if( seq->width < r->width ) {
+		for( s = 0; s < seq->n_buf; s++ ) {
+			VipsImage *im = arithmetic->step[s].arithmetic->out;
+
+			VIPS_FREE( seq->buf[s] );
+			if( !(seq->buf[s] = VIPS_ARRAY( NULL, 
+				r->width * VIPS_IMAGE_SIZEOF_PEL( im ), 
+				VipsPel )) )
+				return( -1 );
+		}
+		seq->width = r->width;
+	}
 
 	/* Prepare all input regions and make buffer pointers.
 	 */
@@ -482,7 +562,23 @@ vips_arithmetic_gen( VipsRegion *or,
 	VIPS_GATE_START( "vips_arithmetic_gen: work" );
 
 	for( y = 0; y < r->height; y++ ) {
-		class->process_line( arithmetic, q, p, r->width );
+		for( s = 0; s < arithmetic->n_step; s++ ) {
+			VipsArithmeticStep *step = &arithmetic->step[s];
+			VipsArithmeticClass *class = 
+				VIPS_ARITHMETIC_GET_CLASS( step->arithmetic ); 
+
+			VipsPel *sp[MAX_INPUT_IMAGES + 1];
+
+			for( i = 0; i < step->arithmetic->n; i++ )
+				sp[i] = step->in[i] >= 0 ? 
+					p[step->in[i]] : 
+					seq->buf[-step->in[i] - 1];
+			sp[i] = NULL;
+
+			class->process_line( step->arithmetic, 
+				s == arithmetic->n_step - 1 ? q : seq->buf[s], 
+				sp, r->width );
+		}
 
 		for( i = 0; ir[i]; i++ )
 			p[i] += VIPS_REGION_LSKIP( ir[i] );
@@ -494,6 +590,179 @@ vips_arithmetic_gen( VipsRegion *or,
 	return( 0 );
 }
 
+/* If @in is the output of an arithmetic operation and @ready, the input
+ * after casting to a common format, bands and size, has the same pixels, 
+ * return the operation.
+ */
+static VipsArithmetic *
+vips_arithmetic_upstream( VipsImage *in, VipsImage *ready )
+{
+	if( in->generate_fn == vips_arithmetic_gen &&
+		in->Coding == VIPS_CODING_NONE &&
+		in->BandFmt == ready->BandFmt &&
+		in->Bands == ready->Bands &&
+		in->Xsize == ready->Xsize &&
+		in->Ysize == ready->Ysize )
+		return( VIPS_ARITHMETIC( in->client2 ) );
+
+	return( NULL );
+}
+
+/* Add @image, made from @source, to the leaf list, or find a leaf with the 
+ * same pixels if there's one there already. 
+ */
+static int
+vips_arithmetic_add_leaf( VipsImage **leaf, VipsImage **leaf_source, 
+	int *n_leaf, VipsImage *image, VipsImage *source )
+{
+	int i;
+
+	for( i = 0; i < *n_leaf; i++ )
+		if( leaf[i] == image ||
+			(leaf_source[i] == source &&
+			 leaf[i]->BandFmt == image->BandFmt &&
+			 leaf[i]->Bands == image->Bands &&
+			 leaf[i]->Xsize == image->Xsize &&
+			 leaf[i]->Ysize == image->Ysize) )
+			return( i );
+
+	leaf[*n_leaf] = image;
+	leaf_source[*n_leaf] = source;
+
+	return( (*n_leaf)++ );
+}
+
+/* Build our line program. 
+ *
+ * Chains of point operations spend most of their time moving pixels
+ * between the regions of each operation. If an input is the unaltered
+ * output of an upstream arithmetic operation, we copy that operation's 
+ * program into ours and read its leaf images instead. Each line is then 
+ * made in a single pass through short line buffers, with no intermediate 
+ * regions.
+ *
+ * Steps are identified by their operation, so a step reached by several 
+ * paths, for example in c = b * b, or where two inputs share an upstream 
+ * operation, is only copied and computed once. Leaves made from the same 
+ * image are read once too.
+ *
+ * The upstream image can still be used by other operations as normal. 
+ */
+static int
+vips_arithmetic_fuse( VipsArithmetic *arithmetic )
+{
+	VipsImage *leaf[MAX_INPUT_IMAGES];
+	VipsImage *leaf_source[MAX_INPUT_IMAGES];
+	VipsArithmeticStep step[MAX_FUSED_STEPS];
+	int input[MAX_INPUT_IMAGES];
+	int n_leaf;
+	int n_step;
+	int i, j, k;
+
+	n_leaf = 0;
+	n_step = 0;
+	for( i = 0; i < arithmetic->n; i++ ) {
+		VipsArithmetic *upstream;
+
+		/* The same image as an earlier input? 
+		 */
+		for( j = 0; j < i; j++ )
+			if( arithmetic->in[j] == arithmetic->in[i] )
+				break;
+		if( j < i ) {
+			input[i] = input[j];
+			continue;
+		}
+
+		upstream = vips_arithmetic_upstream( 
+			arithmetic->in[i], arithmetic->ready[i] );
+
+		/* The remaining inputs must still fit.
+		 */
+		if( upstream &&
+			n_leaf + upstream->n_leaf + 
+				(arithmetic->n - i - 1) <= MAX_INPUT_IMAGES &&
+			n_step + upstream->n_step < MAX_FUSED_STEPS ) {
+			int leaf_map[MAX_INPUT_IMAGES];
+			int step_map[MAX_FUSED_STEPS];
+
+			for( j = 0; j < upstream->n_leaf; j++ ) 
+				leaf_map[j] = vips_arithmetic_add_leaf( 
+					leaf, leaf_source, &n_leaf, 
+					upstream->leaf[j], 
+					upstream->leaf_source[j] );
+
+			for( j = 0; j < upstream->n_step; j++ ) {
+				VipsArithmeticStep *from = &upstream->step[j];
+
+				VipsArithmeticStep *to;
+
+				/* Already in our program from another input?
+				 */
+				for( k = 0; k < n_step; k++ )
+					if( step[k].arithmetic == 
+						from->arithmetic )
+						break;
+				step_map[j] = k;
+				if( k < n_step )
+					continue;
+
+				to = &step[n_step++];
+				to->arithmetic = from->arithmetic;
+				if( !(to->in = VIPS_ARRAY( arithmetic, 
+					from->arithmetic->n, int )) )
+					return( -1 );
+
+				for( k = 0; k < from->arithmetic->n; k++ )
+					to->in[k] = from->in[k] >= 0 ?
+						leaf_map[from->in[k]] :
+						-step_map[-from->in[k] - 1] - 1;
+			}
+
+			/* The output of upstream's last step.
+			 */
+			input[i] = -step_map[upstream->n_step - 1] - 1;
+		}
+		else 
+			input[i] = vips_arithmetic_add_leaf( 
+				leaf, leaf_source, &n_leaf, 
+				arithmetic->ready[i], arithmetic->in[i] );
+	}
+
+	/* And finally, us.
+	 */
+	step[n_step].arithmetic = arithmetic;
+	if( !(step[n_step].in = VIPS_ARRAY( arithmetic, arithmetic->n, int )) )
+		return( -1 );
+	for( i = 0; i < arithmetic->n; i++ )
+		step[n_step].in[i] = input[i];
+	n_step += 1;
+
+	if( !(arithmetic->leaf = 
+		VIPS_ARRAY( arithmetic, n_leaf + 1, VipsImage * )) ||
+		!(arithmetic->leaf_source = 
+			VIPS_ARRAY( arithmetic, n_leaf, VipsImage * )) ||
+		!(arithmetic->step = 
+			VIPS_ARRAY( arithmetic, n_step, VipsArithmeticStep )) )
+		return( -1 );
+	for( i = 0; i < n_leaf; i++ ) {
+		arithmetic->leaf[i] = leaf[i];
+		arithmetic->leaf_source[i] = leaf_source[i];
+	}
+	arithmetic->leaf[n_leaf] = NULL;
+	arithmetic->n_leaf = n_leaf;
+	for( i = 0; i < n_step; i++ )
+		arithmetic->step[i] = step[i];
+	arithmetic->n_step = n_step;
+
+#ifdef DEBUG
+	printf( "vips_arithmetic_fuse: %d steps, %d leaves\n", 
+		n_step, n_leaf );
+#endif /*DEBUG*/
+
+	return( 0 );
+}
+
 static int
 vips_arithmetic_build( VipsObject *object )
 {
@@ -565,9 +834,12 @@ vips_arithmetic_build( VipsObject *object )
 		arithmetic->out->BandFmt = 
 			aclass->format_table[arithmetic->ready[0]->BandFmt];
 
+	if( vips_arithmetic_fuse( arithmetic ) )
+		return( -1 );
+
 	if( vips_image_generate( arithmetic->out,
-		vips_start_many, vips_arithmetic_gen, vips_stop_many, 
-		arithmetic->ready, arithmetic ) ) 
+		vips_arithmetic_start, vips_arithmetic_gen, vips_arithmetic_stop, 
+		arithmetic->leaf, arithmetic ) ) 
 		return( -1 );
 
 	return( 0 );
@@ -699,6 +971,7 @@ vips_arithmetic_operation_init( void )
 	extern GType vips_min_get_type( void ); 
 	extern GType vips_max_get_type( void ); 
 	extern GType vips_deviate_get_type( void ); 
+	extern GType vips_quantile_get_type( void ); 
 	extern GType vips_linear_get_type( void ); 
 	extern GType vips_math_get_type( void ); 
 	extern GType vips_abs_get_type( void ); 
@@ -711,6 +984,7 @@ vips_arithmetic_operation_init( void )
 	extern GType vips_hough_circle_get_type( void ); 
 	extern GType vips_project_get_type( void ); 
 	extern GType vips_profile_get_type( void ); 
+	extern GType vips_integral_image_get_type( void ); 
 	extern GType vips_measure_get_type( void ); 
 	extern GType vips_getpoint_get_type( void ); 
 	extern GType vips_round_get_type( void ); 
@@ -737,6 +1011,7 @@ vips_arithmetic_operation_init( void )
 	vips_min_get_type();
 	vips_max_get_type();
 	vips_deviate_get_type();
+	vips_quantile_get_type();
 	vips_linear_get_type();
 	vips_math_get_type();
 	vips_abs_get_type();
@@ -749,6 +1024,7 @@ vips_arithmetic_operation_init( void )
 	vips_hough_circle_get_type(); 
 	vips_project_get_type(); 
 	vips_profile_get_type(); 
+	vips_integral_image_get_type(); 
 	vips_measure_get_type();
 	vips_getpoint_get_type();
 	vips_round_get_type();
@@ -34,6 +34,8 @@
  * 	- rewrite as a class
  * 12/9/14
  * 	- oops, fix complex avg
+ * 20/10/14
+ * 	- use vips__statistic_sum() for non-complex formats
  */
 
 /*
@@ -134,15 +136,6 @@ vips_avg_stop( VipsStatistic *statistic, void *seq )
 	return( 0 );
 }
 
-/* Sum pels in this section.
- */
-#define LOOP( TYPE ) { \
-	TYPE *p = (TYPE *) in; \
-	\
-	for( i = 0; i < sz; i++ ) \
-		m += p[i]; \
-}
-
 #define CLOOP( TYPE ) { \
 	TYPE *p = (TYPE *) in; \
 	\
@@ -162,32 +155,26 @@ vips_avg_scan( VipsStatistic *statistic, void *seq,
 {
 	const int sz = n * vips_image_get_bands( statistic->in );
 
+	const VipsBandFormat format = vips_image_get_format( statistic->in );
+
 	double *sum = (double *) seq;
 
 	int i;
 	double m;
 
-	m = *sum;
+	m = 0.0;
 
 	/* Now generate code for all types. 
 	 */
-	switch( vips_image_get_format( statistic->in ) ) {
-	case VIPS_FORMAT_UCHAR:		LOOP( unsigned char ); break; 
-	case VIPS_FORMAT_CHAR:		LOOP( signed char ); break; 
-	case VIPS_FORMAT_USHORT:	LOOP( unsigned short ); break; 
-	case VIPS_FORMAT_SHORT:		LOOP( signed short ); break; 
-	case VIPS_FORMAT_UINT:		LOOP( unsigned int ); break;
-	case VIPS_FORMAT_INT:		LOOP( signed int ); break; 
-	case VIPS_FORMAT_FLOAT:		LOOP( float ); break; 
-	case VIPS_FORMAT_DOUBLE:	LOOP( double ); break; 
+	switch( format ) {
 	case VIPS_FORMAT_COMPLEX:	CLOOP( float ); break; 
 	case VIPS_FORMAT_DPCOMPLEX:	CLOOP( double ); break; 
 
 	default: 
-		g_assert( 0 );
+		vips__statistic_sum( format, in, sz, &m, NULL );
 	}
 
-	*sum = m;
+	*sum += m;
 
 	return( 0 );
 }
@@ -31,6 +31,8 @@
  * 	- remove liboil
  * 6/11/11
  * 	- rewrite as a class
+ * 20/10/14
+ * 	- use vips__statistic_sum()
  */
 
 /*
@@ -152,17 +154,6 @@ vips_deviate_stop( VipsStatistic *statistic, void *seq )
 	return( 0 );
 }
 
-#define LOOP( TYPE ) { \
-	TYPE *p = (TYPE *) in; \
-	\
-	for( x = 0; x < sz; x++ ) { \
-		TYPE v = p[x]; \
-		\
-		sum += v; \
-		sum2 += (double) v * (double) v; \
-	} \
-}
-
 static int
 vips_deviate_scan( VipsStatistic *statistic, void *seq, 
 	int x, int y, void *in, int n )
@@ -174,27 +165,11 @@ vips_deviate_scan( VipsStatistic *statistic, void *seq,
 	double sum;
 	double sum2;
 
-	sum = ss2[0];
-	sum2 = ss2[1];
+	vips__statistic_sum( vips_image_get_format( statistic->in ), 
+		in, sz, &sum, &sum2 );
 
-	/* Now generate code for all types. 
-	 */
-	switch( vips_image_get_format( statistic->in ) ) {
-	case VIPS_FORMAT_UCHAR:		LOOP( unsigned char ); break; 
-	case VIPS_FORMAT_CHAR:		LOOP( signed char ); break; 
-	case VIPS_FORMAT_USHORT:	LOOP( unsigned short ); break; 
-	case VIPS_FORMAT_SHORT:		LOOP( signed short ); break; 
-	case VIPS_FORMAT_UINT:		LOOP( unsigned int ); break;
-	case VIPS_FORMAT_INT:		LOOP( signed int ); break; 
-	case VIPS_FORMAT_FLOAT:		LOOP( float ); break; 
-	case VIPS_FORMAT_DOUBLE:	LOOP( double ); break; 
-
-	default: 
-		g_assert( 0 );
-	}
-
-	ss2[0] = sum;
-	ss2[1] = sum2;
+	ss2[0] += sum;
+	ss2[1] += sum2;
 
 	return( 0 );
 }
@@ -6,6 +6,9 @@
  * 	- gtkdoc
  * 17/8/13
  * 	- redo as a class
+ * 20/10/14
+ * 	- uchar index sub-hists keep several copies of the bins, so runs of 
+ * 	  equal index don't serialise on one set of adds
  */
 
 /*
@@ -58,10 +61,16 @@ typedef struct {
 	VipsRegion *reg;	/* Get index pixels with this */
 
 	int size;		/* Length of bins */
+	int copies;		/* Number of copies of the bins */
 	int mx;			/* Maximum value we have seen */
 	double *bins;		/* All the bins! */
 } Histogram;
 
+/* Sub-hists for uchar index images have this many copies of the bins, one
+ * after the other. Pixels are dealt across the copies in turn.
+ */
+#define HISTOGRAM_COPIES (4)
+
 typedef struct _VipsHistFindIndexed {
 	VipsStatistic parent_instance;
 
@@ -87,11 +96,12 @@ G_DEFINE_TYPE( VipsHistFindIndexed,
 	vips_hist_find_indexed, VIPS_TYPE_STATISTIC );
 
 static Histogram *
-histogram_new( VipsHistFindIndexed *indexed )
+histogram_new( VipsHistFindIndexed *indexed, int copies )
 {
 	VipsStatistic *statistic = VIPS_STATISTIC( indexed ); 
 	int bands = statistic->ready->Bands; 
 	Histogram *hist;
+	int length;
 
 	if( !(hist = VIPS_NEW( indexed, Histogram )) )
 		return( NULL );
@@ -100,14 +110,16 @@ histogram_new( VipsHistFindIndexed *indexed )
 	hist->reg = NULL;
 	hist->size = indexed->index_ready->BandFmt == VIPS_FORMAT_UCHAR ? 
 		256 : 65536;
+	hist->copies = copies;
 	hist->mx = 0;
 	hist->bins = NULL;
 
-	if( !(hist->bins = VIPS_ARRAY( indexed, bands * hist->size, double )) ||
+	length = bands * hist->size * copies;
+	if( !(hist->bins = VIPS_ARRAY( indexed, length, double )) ||
 		!(hist->reg = vips_region_new( indexed->index_ready )) ) 
 		return( NULL );
 
-	memset( hist->bins, 0, bands * hist->size * sizeof( double ) );
+	memset( hist->bins, 0, length * sizeof( double ) );
 
 	return( hist );
 }
@@ -191,9 +203,13 @@ vips_hist_find_indexed_start( VipsStatistic *statistic )
 	/* Make the main hist, if necessary.
 	 */
 	if( !indexed->hist ) 
-		indexed->hist = histogram_new( indexed );  
+		indexed->hist = histogram_new( indexed, 1 );  
 
-	return( (void *) histogram_new( indexed ) );
+	/* A ushort index would need 65536 bins per band per copy, too
+	 * big to be worth it.
+	 */
+	return( (void *) histogram_new( indexed, 
+		indexed->hist->size == 256 ? HISTOGRAM_COPIES : 1 ) );
 }
 
 /* Join a sub-hist onto the main hist.
@@ -206,14 +222,20 @@ vips_hist_find_indexed_stop( VipsStatistic *statistic, void *seq )
 	Histogram *hist = indexed->hist; 
 	int bands = statistic->ready->Bands; 
 
-	int i;
+	int length = bands * hist->size;
 
-	/* Add on sub-data.
+	int i, c;
+
+	/* Add on sub-data, summing the copies.
 	 */
 	hist->mx = VIPS_MAX( hist->mx, sub_hist->mx );
-	for( i = 0; i < bands * hist->size; i++ ) {
-		hist->bins[i] += sub_hist->bins[i];
-		sub_hist->bins[i] = 0;
+	for( c = 0; c < sub_hist->copies; c++ ) {
+		double *p = sub_hist->bins + c * length;
+
+		for( i = 0; i < length; i++ ) {
+			hist->bins[i] += p[i];
+			p[i] = 0;
+		}
 	}
 
 	VIPS_UNREF( sub_hist->reg );
@@ -221,13 +243,30 @@ vips_hist_find_indexed_stop( VipsStatistic *statistic, void *seq )
 	return( 0 );
 }
 
-/* Accumulate a buffer of pels, uchar index.
+/* Accumulate a buffer of pels, uchar index. Groups of four pels go to the
+ * four copies of the bins, the tail to the first.
  */
 #define ACCUMULATE_UCHAR( TYPE ) { \
 	int x, z; \
 	TYPE *tv = (TYPE *) in; \
 	\
-	for( x = 0; x < n; x++ ) { \
+	for( x = 0; x + 4 <= n; x += 4 ) { \
+		double *b0 = hist->bins + i[x] * bands; \
+		double *b1 = hist->bins + o + i[x + 1] * bands; \
+		double *b2 = hist->bins + 2 * o + i[x + 2] * bands; \
+		double *b3 = hist->bins + 3 * o + i[x + 3] * bands; \
+		\
+		for( z = 0; z < bands; z++ ) { \
+			b0[z] += tv[z]; \
+			b1[z] += tv[z + bands]; \
+			b2[z] += tv[z + 2 * bands]; \
+			b3[z] += tv[z + 3 * bands]; \
+		} \
+		\
+		tv += 4 * bands; \
+	} \
+	\
+	for( ; x < n; x++ ) { \
 		double *bin = hist->bins + i[x] * bands; \
 		\
 		for( z = 0; z < bands; z++ ) \
@@ -247,6 +286,11 @@ vips_hist_find_indexed_uchar_scan( VipsHistFindIndexed *indexed,
 	int bands = statistic->ready->Bands;
 	unsigned char *i = (unsigned char *) index;
 
+	/* Offset between copies. With a single copy, all four land in the 
+	 * same bins.
+	 */
+	int o = hist->copies >= HISTOGRAM_COPIES ? bands * hist->size : 0;
+
 	switch( statistic->ready->BandFmt ) {
 	case VIPS_FORMAT_UCHAR: 	
 		ACCUMULATE_UCHAR( unsigned char ); break; 
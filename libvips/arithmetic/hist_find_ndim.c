@@ -8,6 +8,8 @@
  * 	- small celanups
  * 17/8/13
  * 	- redo as a class
+ * 20/10/14
+ * 	- look up bin indexes in a table rather than dividing
  */
 
 /*
@@ -73,6 +75,11 @@ typedef struct _VipsHistFindNDim {
 	 */
 	Histogram *hist;
 
+	/* Map pixel values to bin index. Made with the main hist, then
+	 * shared read-only by all the scan threads.
+	 */
+	int *lut;
+
 	/* Write hist to this output image.
 	 */
 	VipsImage *out; 
@@ -187,8 +194,24 @@ vips_hist_find_ndim_start( VipsStatistic *statistic )
 
 	/* Make the main hist, if necessary.
 	 */
-	if( !ndim->hist ) 
-		ndim->hist = histogram_new( ndim );  
+	if( !ndim->hist ) {
+		Histogram *hist;
+		double scale;
+		int i;
+
+		if( !(hist = histogram_new( ndim )) ||
+			!(ndim->lut = VIPS_ARRAY( ndim, 
+				hist->max_val, int )) )
+			return( NULL );
+
+		/* The same sum the scan used to do for every pixel.
+		 */
+		scale = (double) (hist->max_val + 1) / hist->bins;
+		for( i = 0; i < hist->max_val; i++ )
+			ndim->lut[i] = i / scale;
+
+		ndim->hist = hist;
+	}
 
 	return( (void *) histogram_new( ndim ) );
 }
@@ -225,7 +248,7 @@ vips_hist_find_ndim_stop( VipsStatistic *statistic, void *seq )
 	\
 	for( i = 0, j = 0; j < n; j++ ) { \
 		for( k = 0; k < nb; k++, i++ ) \
-			index[k] = p[i] / scale; \
+			index[k] = lut[p[i]]; \
  		\
 		hist->data[index[2]][index[1]][index[0]] += 1; \
 	} \
@@ -238,7 +261,7 @@ vips_hist_find_ndim_scan( VipsStatistic *statistic, void *seq,
 	Histogram *hist = (Histogram *) seq;
 	VipsImage *im = statistic->ready;
 	int nb = im->Bands;
-	double scale = (double) (hist->max_val + 1) / hist->bins;
+	int *lut = ((VipsHistFindNDim *) statistic)->lut;
 	int i, j, k; 
 	int index[3];
 
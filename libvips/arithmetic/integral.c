@@ -0,0 +1,394 @@
+/* integral image (summed-area table)
+ *
+ * 19/10/14
+ * 	- from profile.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+typedef struct _VipsIntegralImage {
+	VipsOperation parent_instance;
+
+	VipsImage *in;
+	VipsImage *out;
+
+	/* The decoded input.
+	 */
+	VipsImage *ready;
+
+	/* The previous line of output, plus a running sum for each band of
+	 * the current line.
+	 */
+	double *line;
+	double *acc;
+
+} VipsIntegralImage;
+
+typedef VipsOperationClass VipsIntegralImageClass;
+
+G_DEFINE_TYPE( VipsIntegralImage, vips_integral_image, VIPS_TYPE_OPERATION );
+
+/* Sum a line of pixels onto the previous output line.
+ */
+#define INTEGRAL_LINE( TYPE ) { \
+	TYPE *p = (TYPE *) in; \
+	\
+	for( x = 0; x < width; x++ ) \
+		for( b = 0; b < bands; b++ ) { \
+			acc[b] += p[i]; \
+			line[i] += acc[b]; \
+			i += 1; \
+		} \
+}
+
+/* vips_sink_disc() calls us with strips of input in top-to-bottom order, so
+ * we can carry the sum down the image in a single line buffer.
+ */
+static int
+vips_integral_image_write( VipsRegion *region, VipsRect *area, void *a )
+{
+	VipsIntegralImage *integral = (VipsIntegralImage *) a;
+	VipsImage *ready = integral->ready;
+	int width = ready->Xsize;
+	int bands = ready->Bands;
+	double *line = integral->line;
+	double *acc = integral->acc;
+
+	int x, y, b, i;
+
+	for( y = 0; y < area->height; y++ ) {
+		VipsPel *in = VIPS_REGION_ADDR( region, 0, area->top + y );
+
+		for( b = 0; b < bands; b++ )
+			acc[b] = 0.0;
+
+		i = 0;
+		switch( ready->BandFmt ) {
+		case VIPS_FORMAT_UCHAR:
+			INTEGRAL_LINE( unsigned char ); break;
+		case VIPS_FORMAT_CHAR:
+			INTEGRAL_LINE( signed char ); break;
+		case VIPS_FORMAT_USHORT:
+			INTEGRAL_LINE( unsigned short ); break;
+		case VIPS_FORMAT_SHORT:
+			INTEGRAL_LINE( signed short ); break;
+		case VIPS_FORMAT_UINT:
+			INTEGRAL_LINE( unsigned int ); break;
+		case VIPS_FORMAT_INT:
+			INTEGRAL_LINE( signed int ); break;
+		case VIPS_FORMAT_FLOAT:
+			INTEGRAL_LINE( float ); break;
+		case VIPS_FORMAT_DOUBLE:
+			INTEGRAL_LINE( double ); break;
+
+		default:
+			g_assert( 0 );
+		}
+
+		if( vips_image_write_line( integral->out,
+			area->top + y, (VipsPel *) line ) )
+			return( -1 );
+	}
+
+	return( 0 );
+}
+
+static int
+vips_integral_image_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsIntegralImage *integral = (VipsIntegralImage *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
+
+	g_object_set( object, "out", vips_image_new(), NULL );
+
+	if( VIPS_OBJECT_CLASS( vips_integral_image_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	if( vips_image_decode( integral->in, &t[0] ) )
+		return( -1 );
+	integral->ready = t[0];
+
+	if( vips_check_noncomplex( class->nickname, integral->ready ) )
+		return( -1 );
+
+	if( !(integral->line = VIPS_ARRAY( object,
+		VIPS_IMAGE_N_ELEMENTS( integral->ready ), double )) ||
+		!(integral->acc = VIPS_ARRAY( object,
+			integral->ready->Bands, double )) )
+		return( -1 );
+	memset( integral->line, 0,
+		VIPS_IMAGE_N_ELEMENTS( integral->ready ) * sizeof( double ) );
+
+	if( vips_image_pipelinev( integral->out,
+		VIPS_DEMAND_STYLE_ANY, integral->ready, NULL ) )
+		return( -1 );
+	integral->out->BandFmt = VIPS_FORMAT_DOUBLE;
+	integral->out->Type = VIPS_INTERPRETATION_MULTIBAND;
+
+	if( vips_sink_disc( integral->ready,
+		vips_integral_image_write, integral ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_integral_image_class_init( VipsIntegralImageClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsOperationClass *operation_class = VIPS_OPERATION_CLASS( class );
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "integral";
+	object_class->description = _( "make a summed-area table" );
+	object_class->build = vips_integral_image_build;
+
+	operation_class->flags = VIPS_OPERATION_SEQUENTIAL_UNBUFFERED;
+
+	VIPS_ARG_IMAGE( class, "in", 1,
+		_( "Input" ),
+		_( "Input image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsIntegralImage, in ) );
+
+	VIPS_ARG_IMAGE( class, "out", 2,
+		_( "Output" ),
+		_( "Output image" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsIntegralImage, out ) );
+
+}
+
+static void
+vips_integral_image_init( VipsIntegralImage *integral )
+{
+}
+
+/**
+ * vips_integral:
+ * @in: input image
+ * @out: output image
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Make the summed-area table (integral image) of @in. Each pixel in @out
+ * is the sum of all the pixels in @in above and to the left of that point,
+ * inclusive. @out is always #VIPS_FORMAT_DOUBLE, so sums of integer images
+ * are exact up to 2^53.
+ *
+ * The sum of any rectangle of @in can then be found in constant time from
+ * the four corners of the rectangle in @out.
+ *
+ * @in is read once, top to bottom, and @out is built in memory.
+ *
+ * See also: vips_project(), vips_boxblur(), vips_stdif().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_integral( VipsImage *in, VipsImage **out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "integral", ap, in, out );
+	va_end( ap );
+
+	return( result );
+}
+
+/* Region summed-area tables.
+ *
+ * Operations like vips_stdif() need windowed sums on every tile they
+ * generate. Rather than roll a sum across the tile, build a table for the
+ * prepared input region and then read any window sum in constant time from
+ * four corners. Tables are relative to the region, so large values do not
+ * build up across the image.
+ */
+
+VipsIntegral *
+vips__integral_new( gboolean squares )
+{
+	VipsIntegral *integral;
+
+	if( !(integral = VIPS_NEW( NULL, VipsIntegral )) )
+		return( NULL );
+	integral->width = 0;
+	integral->height = 0;
+	integral->bands = 0;
+	integral->lskip = 0;
+	integral->squares = squares;
+	integral->sum = NULL;
+	integral->sum2 = NULL;
+	integral->acc = NULL;
+	integral->size = 0;
+
+	return( integral );
+}
+
+void
+vips__integral_free( VipsIntegral *integral )
+{
+	VIPS_FREE( integral->sum );
+	VIPS_FREE( integral->sum2 );
+	VIPS_FREE( integral->acc );
+	VIPS_FREE( integral );
+}
+
+/* Sum a line of pixels and add to the line above.
+ */
+#define REGION_LINE( TYPE ) { \
+	TYPE *p = (TYPE *) VIPS_REGION_ADDR( region, \
+		area->left, area->top + y ); \
+	\
+	for( x = 0; x < area->width; x++ ) \
+		for( b = 0; b < bands; b++ ) { \
+			double v = p[i]; \
+			\
+			acc[b] += v; \
+			s[i] = s[i - lskip] + acc[b]; \
+			\
+			if( s2 ) { \
+				acc2[b] += v * v; \
+				s2[i] = s2[i - lskip] + acc2[b]; \
+			} \
+			\
+			i += 1; \
+		} \
+}
+
+/* Build the table for @area of @region. @area must be within
+ * @region->valid.
+ */
+int
+vips__integral_region( VipsIntegral *integral,
+	VipsRegion *region, VipsRect *area )
+{
+	VipsImage *im = region->im;
+	int bands = im->Bands;
+	int lskip = (area->width + 1) * bands;
+	size_t size = (size_t) lskip * (area->height + 1);
+
+	double *acc;
+	double *acc2;
+	int x, y, b, i;
+
+	g_assert( vips_rect_includesrect( &region->valid, area ) );
+	g_assert( !vips_band_format_iscomplex( im->BandFmt ) );
+
+	if( size > integral->size ||
+		bands != integral->bands ) {
+		VIPS_FREE( integral->sum );
+		VIPS_FREE( integral->sum2 );
+		VIPS_FREE( integral->acc );
+		integral->size = 0;
+
+		if( !(integral->sum = VIPS_ARRAY( NULL, size, double )) ||
+			(integral->squares &&
+			 !(integral->sum2 = VIPS_ARRAY( NULL, size, double ))) ||
+			!(integral->acc = VIPS_ARRAY( NULL, 2 * bands, double )) )
+			return( -1 );
+		integral->size = size;
+	}
+
+	integral->width = area->width;
+	integral->height = area->height;
+	integral->bands = bands;
+	integral->lskip = lskip;
+	acc = integral->acc;
+	acc2 = integral->acc + bands;
+
+	/* The top line is all zero.
+	 */
+	memset( integral->sum, 0, lskip * sizeof( double ) );
+	if( integral->sum2 )
+		memset( integral->sum2, 0, lskip * sizeof( double ) );
+
+	for( y = 0; y < area->height; y++ ) {
+		/* Output starts on line y + 1, one pixel in. The first pixel
+		 * of every line is zero.
+		 */
+		double *s = integral->sum + (y + 1) * lskip + bands;
+		double *s2 = integral->sum2 ?
+			integral->sum2 + (y + 1) * lskip + bands : NULL;
+
+		for( b = 0; b < bands; b++ ) {
+			s[b - bands] = 0.0;
+			if( s2 )
+				s2[b - bands] = 0.0;
+			acc[b] = 0.0;
+			acc2[b] = 0.0;
+		}
+
+		i = 0;
+		switch( im->BandFmt ) {
+		case VIPS_FORMAT_UCHAR:
+			REGION_LINE( unsigned char ); break;
+		case VIPS_FORMAT_CHAR:
+			REGION_LINE( signed char ); break;
+		case VIPS_FORMAT_USHORT:
+			REGION_LINE( unsigned short ); break;
+		case VIPS_FORMAT_SHORT:
+			REGION_LINE( signed short ); break;
+		case VIPS_FORMAT_UINT:
+			REGION_LINE( unsigned int ); break;
+		case VIPS_FORMAT_INT:
+			REGION_LINE( signed int ); break;
+		case VIPS_FORMAT_FLOAT:
+			REGION_LINE( float ); break;
+		case VIPS_FORMAT_DOUBLE:
+			REGION_LINE( double ); break;
+
+		default:
+			g_assert( 0 );
+		}
+	}
+
+	return( 0 );
+}
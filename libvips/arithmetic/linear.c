@@ -44,6 +44,9 @@
  * 	- try an ORC path with the band loop unrolled
  * 14/1/14
  * 	- add uchar output option
+ * 20/10/14
+ * 	- per-band constants run in blocks as vector code
+ * 	- int, uint and double blocks stay in double, float is not enough
  */
 
 /*
@@ -108,12 +111,25 @@ typedef struct _VipsLinear {
 	double *a_ready;
 	double *b_ready;
 
+	/* a_ready and b_ready repeated out to VIPS_LINEAR_BLOCK + n 
+	 * elements, as double for int, uint and double input, float 
+	 * otherwise. 
+	 */
+	VipsPel *a_block;
+	VipsPel *b_block;
+
 } VipsLinear;
 
 typedef VipsUnaryClass VipsLinearClass;
 
 G_DEFINE_TYPE( VipsLinear, vips_linear, VIPS_TYPE_UNARY );
 
+/* Per-band constants are done in blocks of this many elements. Each block 
+ * starts at the right band in a_block and b_block, so the inner loop is 
+ * a fixed-length run over three arrays and gcc can vectorise it.
+ */
+#define VIPS_LINEAR_BLOCK (64)
+
 static int
 vips_linear_build( VipsObject *object )
 {
@@ -123,9 +139,10 @@ vips_linear_build( VipsObject *object )
 	VipsLinear *linear = (VipsLinear *) object;
 
 	int bands;
+	VipsBandFormat format;
 	int i;
 
-	vips_image_decode_predict( unary->in, &bands, NULL ); 
+	vips_image_decode_predict( unary->in, &bands, &format ); 
 
 	/* If we have a three-element vector we need to bandup the image to
 	 * match.
@@ -170,6 +187,52 @@ vips_linear_build( VipsObject *object )
 		}
 	}
 
+	/* And the block versions. float has only 24 bits of mantissa, so
+	 * int and uint input must be scaled in double, as before blocking.
+	 */
+	if( format == VIPS_FORMAT_INT ||
+		format == VIPS_FORMAT_UINT ||
+		format == VIPS_FORMAT_DOUBLE ) {
+		double *a_block;
+		double *b_block;
+
+		a_block = VIPS_ARRAY( linear, 
+			VIPS_LINEAR_BLOCK + linear->n, double );
+		b_block = VIPS_ARRAY( linear, 
+			VIPS_LINEAR_BLOCK + linear->n, double );
+		if( !a_block || 
+			!b_block )
+			return( -1 );
+
+		for( i = 0; i < VIPS_LINEAR_BLOCK + linear->n; i++ ) {
+			a_block[i] = linear->a_ready[i % linear->n];
+			b_block[i] = linear->b_ready[i % linear->n];
+		}
+
+		linear->a_block = (VipsPel *) a_block;
+		linear->b_block = (VipsPel *) b_block;
+	}
+	else {
+		float *a_block;
+		float *b_block;
+
+		a_block = VIPS_ARRAY( linear, 
+			VIPS_LINEAR_BLOCK + linear->n, float );
+		b_block = VIPS_ARRAY( linear, 
+			VIPS_LINEAR_BLOCK + linear->n, float );
+		if( !a_block || 
+			!b_block )
+			return( -1 );
+
+		for( i = 0; i < VIPS_LINEAR_BLOCK + linear->n; i++ ) {
+			a_block[i] = linear->a_ready[i % linear->n];
+			b_block[i] = linear->b_ready[i % linear->n];
+		}
+
+		linear->a_block = (VipsPel *) a_block;
+		linear->b_block = (VipsPel *) b_block;
+	}
+
 	if( linear->uchar )
 		arithmetic->format = VIPS_FORMAT_UCHAR;
 
@@ -192,23 +255,58 @@ vips_linear_build( VipsObject *object )
 		q[x] = a1 * (OUT) p[x] + b1; \
 }
 
-/* Non-complex input, any output.
+/* One block of non-complex input, any output, calculated as type T.
+ */
+#define BLOCK( NAME, IN, T, OUT ) \
+static void \
+NAME( OUT * restrict q, IN * restrict p, \
+	T * restrict a, T * restrict b ) \
+{ \
+	int x; \
+	\
+	for( x = 0; x < VIPS_LINEAR_BLOCK; x++ ) \
+		q[x] = a[x] * (T) p[x] + b[x]; \
+}
+
+BLOCK( vips_linear_block_uchar, unsigned char, float, float )
+BLOCK( vips_linear_block_char, signed char, float, float )
+BLOCK( vips_linear_block_ushort, unsigned short, float, float )
+BLOCK( vips_linear_block_short, signed short, float, float )
+BLOCK( vips_linear_block_uint, unsigned int, double, float )
+BLOCK( vips_linear_block_int, signed int, double, float )
+BLOCK( vips_linear_block_float, float, float, float )
+BLOCK( vips_linear_block_double, double, double, double )
+
+/* Non-complex input, any output, blocks of type T. Whole blocks, then the 
+ * odd elements at the end. k tracks the band we are on.
  */
-#define LOOPN( IN, OUT ) { \
+#define LOOPN( IN, T, OUT, BLOCK_FN ) { \
 	IN * restrict p = (IN *) in[0]; \
 	OUT * restrict q = (OUT *) out; \
+	T *ab = (T *) linear->a_block; \
+	T *bb = (T *) linear->b_block; \
+	int sz = width * nb; \
 	\
-	for( i = 0, x = 0; x < width; x++ ) \
-		for( k = 0; k < nb; k++, i++ ) \
-			q[i] = a[k] * (OUT) p[i] + b[k]; \
+	k = 0; \
+	for( i = 0; i + VIPS_LINEAR_BLOCK <= sz; i += VIPS_LINEAR_BLOCK ) { \
+		BLOCK_FN( q + i, p + i, ab + k, bb + k ); \
+		k = (k + VIPS_LINEAR_BLOCK) % nb; \
+	} \
+	\
+	for( ; i < sz; i++ ) { \
+		q[i] = ab[k] * (T) p[i] + bb[k]; \
+		\
+		if( ++k == nb ) \
+			k = 0; \
+	} \
 }
 
-#define LOOP( IN, OUT ) { \
+#define LOOP( IN, T, OUT, BLOCK_FN ) { \
 	if( linear->a->n == 1 && linear->b->n == 1 ) { \
 		LOOP1( IN, OUT ); \
 	} \
 	else { \
-		LOOPN( IN, OUT ); \
+		LOOPN( IN, T, OUT, BLOCK_FN ); \
 	} \
 }
 
@@ -244,26 +342,62 @@ vips_linear_build( VipsObject *object )
 	} \
 }
 
-/* Non-complex input, uchar output.
+/* One block of non-complex input, uchar output, calculated as type T.
+ */
+#define BLOCKuc( NAME, IN, T ) \
+static void \
+NAME( VipsPel * restrict q, IN * restrict p, \
+	T * restrict a, T * restrict b ) \
+{ \
+	int x; \
+	\
+	for( x = 0; x < VIPS_LINEAR_BLOCK; x++ ) { \
+		T t = a[x] * p[x] + b[x]; \
+		\
+		q[x] = VIPS_CLIP( 0, t, 255 ); \
+	} \
+}
+
+BLOCKuc( vips_linear_blockuc_uchar, unsigned char, float )
+BLOCKuc( vips_linear_blockuc_char, signed char, float )
+BLOCKuc( vips_linear_blockuc_ushort, unsigned short, float )
+BLOCKuc( vips_linear_blockuc_short, signed short, float )
+BLOCKuc( vips_linear_blockuc_uint, unsigned int, double )
+BLOCKuc( vips_linear_blockuc_int, signed int, double )
+BLOCKuc( vips_linear_blockuc_float, float, float )
+BLOCKuc( vips_linear_blockuc_double, double, double )
+
+/* Non-complex input, uchar output, blocks of type T.
  */
-#define LOOPNuc( IN ) { \
+#define LOOPNuc( IN, T, BLOCK_FN ) { \
 	IN * restrict p = (IN *) in[0]; \
 	VipsPel * restrict q = (VipsPel *) out; \
+	T *ab = (T *) linear->a_block; \
+	T *bb = (T *) linear->b_block; \
+	int sz = width * nb; \
 	\
-	for( i = 0, x = 0; x < width; x++ ) \
-		for( k = 0; k < nb; k++, i++ ) { \
-			double t = a[k] * p[i] + b[k]; \
-			\
-			q[i] = VIPS_CLIP( 0, t, 255 ); \
-		} \
+	k = 0; \
+	for( i = 0; i + VIPS_LINEAR_BLOCK <= sz; i += VIPS_LINEAR_BLOCK ) { \
+		BLOCK_FN( q + i, p + i, ab + k, bb + k ); \
+		k = (k + VIPS_LINEAR_BLOCK) % nb; \
+	} \
+	\
+	for( ; i < sz; i++ ) { \
+		T t = ab[k] * p[i] + bb[k]; \
+		\
+		q[i] = VIPS_CLIP( 0, t, 255 ); \
+		\
+		if( ++k == nb ) \
+			k = 0; \
+	} \
 }
 
-#define LOOPuc( IN ) { \
+#define LOOPuc( IN, T, BLOCK_FN ) { \
 	if( linear->a->n == 1 && linear->b->n == 1 ) { \
 		LOOP1uc( IN ); \
 	} \
 	else { \
-		LOOPNuc( IN ); \
+		LOOPNuc( IN, T, BLOCK_FN ); \
 	} \
 }
 
@@ -299,21 +433,29 @@ vips_linear_buffer( VipsArithmetic *arithmetic,
 	if( linear->uchar )
 		switch( vips_image_get_format( im ) ) {
 		case VIPS_FORMAT_UCHAR: 	
-			LOOPuc( unsigned char ); break;
+			LOOPuc( unsigned char, float, 
+				vips_linear_blockuc_uchar ); break;
 		case VIPS_FORMAT_CHAR: 		
-			LOOPuc( signed char ); break; 
+			LOOPuc( signed char, float, 
+				vips_linear_blockuc_char ); break; 
 		case VIPS_FORMAT_USHORT: 	
-			LOOPuc( unsigned short ); break; 
+			LOOPuc( unsigned short, float, 
+				vips_linear_blockuc_ushort ); break; 
 		case VIPS_FORMAT_SHORT: 	
-			LOOPuc( signed short ); break; 
+			LOOPuc( signed short, float, 
+				vips_linear_blockuc_short ); break; 
 		case VIPS_FORMAT_UINT: 		
-			LOOPuc( unsigned int ); break; 
+			LOOPuc( unsigned int, double, 
+				vips_linear_blockuc_uint ); break; 
 		case VIPS_FORMAT_INT: 		
-			LOOPuc( signed int );  break; 
+			LOOPuc( signed int, double, 
+				vips_linear_blockuc_int );  break; 
 		case VIPS_FORMAT_FLOAT: 	
-			LOOPuc( float ); break; 
+			LOOPuc( float, float, 
+				vips_linear_blockuc_float ); break; 
 		case VIPS_FORMAT_DOUBLE:	
-			LOOPuc( double ); break; 
+			LOOPuc( double, double, 
+				vips_linear_blockuc_double ); break; 
 		case VIPS_FORMAT_COMPLEX:	
 			LOOPCMPLXNuc( float ); break; 
 		case VIPS_FORMAT_DPCOMPLEX:	
@@ -325,21 +467,29 @@ vips_linear_buffer( VipsArithmetic *arithmetic,
 	else
 		switch( vips_image_get_format( im ) ) {
 		case VIPS_FORMAT_UCHAR: 	
-			LOOP( unsigned char, float ); break;
+			LOOP( unsigned char, float, float, 
+				vips_linear_block_uchar ); break;
 		case VIPS_FORMAT_CHAR: 		
-			LOOP( signed char, float ); break; 
+			LOOP( signed char, float, float, 
+				vips_linear_block_char ); break; 
 		case VIPS_FORMAT_USHORT: 	
-			LOOP( unsigned short, float ); break; 
+			LOOP( unsigned short, float, float, 
+				vips_linear_block_ushort ); break; 
 		case VIPS_FORMAT_SHORT: 	
-			LOOP( signed short, float ); break; 
+			LOOP( signed short, float, float, 
+				vips_linear_block_short ); break; 
 		case VIPS_FORMAT_UINT: 		
-			LOOP( unsigned int, float ); break; 
+			LOOP( unsigned int, double, float, 
+				vips_linear_block_uint ); break; 
 		case VIPS_FORMAT_INT: 		
-			LOOP( signed int, float );  break; 
+			LOOP( signed int, double, float, 
+				vips_linear_block_int );  break; 
 		case VIPS_FORMAT_FLOAT: 	
-			LOOP( float, float ); break; 
+			LOOP( float, float, float, 
+				vips_linear_block_float ); break; 
 		case VIPS_FORMAT_DOUBLE:	
-			LOOP( double, double ); break; 
+			LOOP( double, double, double, 
+				vips_linear_block_double ); break; 
 		case VIPS_FORMAT_COMPLEX:	
 			LOOPCMPLXN( float, float ); break; 
 		case VIPS_FORMAT_DPCOMPLEX:	
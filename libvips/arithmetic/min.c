@@ -25,6 +25,8 @@
  * 4/12/12
  * 	- from min.c
  * 	- track and return bottom n values
+ * 20/10/14
+ * 	- keep bottom n values in a heap
  */
 
 /*
@@ -76,8 +78,8 @@
 /* Track min values and position here. We need one of these for each thread,
  * and one for the main value.
  *
- * We will generally only be tracking a small (<10?) number of values, so
- * simple arrays will be fastest.
+ * We usually only track a few values, but @size can be large, so keep them
+ * in a heap.
  */
 typedef struct _VipsValues {
 	struct _VipsMin *min;
@@ -91,7 +93,8 @@ typedef struct _VipsValues {
 	int n;
 
 	/* Position and values. We track mod**2 for complex and do a sqrt() at
-	 * the end. The three arrays are sorted by @value, largest first.
+	 * the end. The three arrays are a heap on @value during the scan, and
+	 * are sorted by @value, largest first, at the end.
 	 */
 	double *value;
 	int *x_pos;
@@ -136,49 +139,106 @@ vips_values_init( VipsValues *values, VipsMin *min )
 	values->y_pos = VIPS_ARRAY( min, values->size, int );
 }
 
-/* Add a value. Do nothing if the value is too large.
+/* Put a value at position @i in the heap, moving it down past any children
+ * that should be above it. @n is the size of the heap.
  */
 static void
-vips_values_add( VipsValues *values, double v, int x, int y )
+vips_values_sift_down( VipsValues *values, int i, int n, 
+	double v, int x, int y )
 {
-	int i, j;
+	for(;;) {
+		int c = 2 * i + 1;
 
-	/* Find insertion point.
-	 */
-	for( i = 0; i < values->n; i++ )
-		if( v >= values->value[i] ) 
+		if( c >= n )
+			break;
+		if( c + 1 < n &&
+			values->value[c + 1] > values->value[c] )
+			c += 1;
+		if( !(values->value[c] > v) )
 			break;
 
-	/* Array full? 
-	 */
-	if( values->n == values->size ) {
-		if( i > 0 ) {
-			/* We need to move stuff to the left to make space,
-			 * shunting the largest out.
-			 */
-			for( j = 0; j < i - 1; j++ ) {
-				values->value[j] = values->value[j + 1];
-				values->x_pos[j] = values->x_pos[j + 1];
-				values->y_pos[j] = values->y_pos[j + 1];
-			}
-			values->value[i - 1] = v;
-			values->x_pos[i - 1] = x;
-			values->y_pos[i - 1] = y;
-		}
+		values->value[i] = values->value[c];
+		values->x_pos[i] = values->x_pos[c];
+		values->y_pos[i] = values->y_pos[c];
+		i = c;
 	}
-	else {
-		/* Not full, move stuff to the right into empty space.
+
+	values->value[i] = v;
+	values->x_pos[i] = x;
+	values->y_pos[i] = y;
+}
+
+/* Add a value. Do nothing if the value is too large.
+ *
+ * The arrays are a binary max-heap while we scan, so the largest value we 
+ * hold, the one to beat, is always in [0], and adding is O(log size).
+ */
+static void
+vips_values_add( VipsValues *values, double v, int x, int y )
+{
+	if( values->n < values->size ) {
+		int i;
+
+		/* Not full, add at the end and move it up past any 
+		 * parents it should be above.
 		 */
-		for( j = values->n; j > i; j-- ) {
-			values->value[j] = values->value[j - 1];
-			values->x_pos[j] = values->x_pos[j - 1];
-			values->y_pos[j] = values->y_pos[j - 1];
+		for( i = values->n; i > 0; i = (i - 1) / 2 ) {
+			int parent = (i - 1) / 2;
+
+			if( !(v > values->value[parent]) )
+				break;
+
+			values->value[i] = values->value[parent];
+			values->x_pos[i] = values->x_pos[parent];
+			values->y_pos[i] = values->y_pos[parent];
 		}
+
 		values->value[i] = v;
 		values->x_pos[i] = x;
 		values->y_pos[i] = y;
 		values->n += 1;
 	}
+	else if( v < values->value[0] ) 
+		/* Full, replace the largest and move it down.
+		 */
+		vips_values_sift_down( values, 0, values->n, v, x, y );
+}
+
+/* Heapsort the arrays into order, largest first.
+ */
+static void
+vips_values_sort( VipsValues *values )
+{
+	int i;
+
+	/* Repeatedly swap the root to the end. This leaves the arrays in 
+	 * reverse order.
+	 */
+	for( i = values->n - 1; i > 0; i-- ) {
+		double v = values->value[i];
+		int x = values->x_pos[i];
+		int y = values->y_pos[i];
+
+		values->value[i] = values->value[0];
+		values->x_pos[i] = values->x_pos[0];
+		values->y_pos[i] = values->y_pos[0];
+		vips_values_sift_down( values, 0, i, v, x, y );
+	}
+
+	for( i = 0; i < values->n / 2; i++ ) {
+		int j = values->n - i - 1;
+
+		double v = values->value[i];
+		int x = values->x_pos[i];
+		int y = values->y_pos[i];
+
+		values->value[i] = values->value[j];
+		values->x_pos[i] = values->x_pos[j];
+		values->y_pos[i] = values->y_pos[j];
+		values->value[j] = v;
+		values->x_pos[j] = x;
+		values->y_pos[j] = y;
+	}
 }
 
 typedef VipsStatisticClass VipsMinClass;
@@ -197,6 +257,8 @@ vips_min_build( VipsObject *object )
 	if( VIPS_OBJECT_CLASS( vips_min_parent_class )->build( object ) )
 		return( -1 );
 
+	vips_values_sort( values );
+
 	/* For speed we accumulate min ** 2 for complex.
 	 */
 	if( vips_band_format_iscomplex( 
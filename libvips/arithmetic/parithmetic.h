@@ -57,6 +57,15 @@ struct _VipsArithmetic;
 typedef void (*VipsArithmeticProcessFn)( struct _VipsArithmetic *arithmetic, 
 	VipsPel *out, VipsPel **in, int width );
 
+/* One step in a fused line program: run this operation's process_line. 
+ * Each element of @in says where an input line comes from: >= 0 is an 
+ * index into the leaf images, < 0 is the output of step -(in + 1).
+ */
+typedef struct _VipsArithmeticStep {
+	struct _VipsArithmetic *arithmetic;
+	int *in;
+} VipsArithmeticStep;
+
 typedef struct _VipsArithmetic {
 	VipsOperation parent_instance;
 
@@ -81,6 +90,21 @@ typedef struct _VipsArithmetic {
 	/* Set this to override class->format_table.
 	 */
 	VipsBandFormat format;
+
+	/* The line program we run. Inputs which are the unaltered output
+	 * of another arithmetic operation are fused: we run that
+	 * operation's steps ourselves and read its inputs directly. leaf is
+	 * the NULL-terminated array of images we actually read, the last 
+	 * step makes our output.
+	 *
+	 * leaf_source is the input each leaf was made from. Leaves made from
+	 * the same image with the same format, bands and size are the same.
+	 */
+	VipsImage **leaf;
+	VipsImage **leaf_source;
+	int n_leaf;
+	VipsArithmeticStep *step;
+	int n_step;
 } VipsArithmetic;
 
 typedef struct _VipsArithmeticClass {
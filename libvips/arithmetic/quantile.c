@@ -0,0 +1,500 @@
+/* estimate image quantiles with a streaming sketch
+ *
+ * 20/10/14
+ * 	- from max.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+#include "statistic.h"
+
+/* Enough levels for 2^64 values.
+ */
+#define VIPS_SKETCH_MAX_LEVELS (64)
+
+/* A compactor sketch, in the style of KLL. Values go into level 0. When a
+ * level fills, we sort it and move every other value up a level, where each
+ * value stands for twice as many pixels. We need one of these for each
+ * thread, and one for the main value.
+ */
+typedef struct _VipsSketch {
+	/* Number of values each level can hold. Always even.
+	 */
+	int size;
+
+	/* Number of levels in use.
+	 */
+	int n_levels;
+
+	/* The values at each level, and how many there are.
+	 */
+	double *level[VIPS_SKETCH_MAX_LEVELS];
+	int n[VIPS_SKETCH_MAX_LEVELS];
+
+	/* We alternate between keeping the odd and even values at each
+	 * level, so the errors tend to cancel.
+	 */
+	gboolean odd[VIPS_SKETCH_MAX_LEVELS];
+} VipsSketch;
+
+/* A value and how many pixels it stands for, for finding ranks.
+ */
+typedef struct _VipsSketchItem {
+	double value;
+	double weight;
+} VipsSketchItem;
+
+typedef struct _VipsQuantile {
+	VipsStatistic parent_instance;
+
+	/* The quantile we find.
+	 */
+	double q;
+
+	/* Values per sketch level.
+	 */
+	int size;
+
+	/* More quantiles to find in the same pass.
+	 */
+	VipsArrayDouble *q_array;
+
+	double out;
+	VipsArrayDouble *out_array;
+
+	/* Global state here.
+	 */
+	VipsSketch sketch;
+} VipsQuantile;
+
+typedef VipsStatisticClass VipsQuantileClass;
+
+G_DEFINE_TYPE( VipsQuantile, vips_quantile, VIPS_TYPE_STATISTIC );
+
+static void
+vips_sketch_init( VipsSketch *sketch, int size )
+{
+	int i;
+
+	sketch->size = (size + 1) & ~1;
+	sketch->n_levels = 0;
+	for( i = 0; i < VIPS_SKETCH_MAX_LEVELS; i++ ) {
+		sketch->level[i] = NULL;
+		sketch->n[i] = 0;
+		sketch->odd[i] = FALSE;
+	}
+}
+
+static void
+vips_sketch_free( VipsSketch *sketch )
+{
+	int i;
+
+	for( i = 0; i < VIPS_SKETCH_MAX_LEVELS; i++ ) {
+		VIPS_FREE( sketch->level[i] );
+		sketch->n[i] = 0;
+	}
+	sketch->n_levels = 0;
+}
+
+static int
+vips_sketch_compare( const void *a, const void *b )
+{
+	double x = *((double *) a);
+	double y = *((double *) b);
+
+	return( x < y ? -1 : x > y ? 1 : 0 );
+}
+
+static void vips_sketch_push( VipsSketch *sketch, int l, double v );
+
+/* Level @l is full: sort it and move every other value up a level.
+ */
+static void
+vips_sketch_compact( VipsSketch *sketch, int l )
+{
+	double *level = sketch->level[l];
+	int n = sketch->n[l];
+
+	int i;
+
+	g_assert( l + 1 < VIPS_SKETCH_MAX_LEVELS );
+
+	qsort( level, n, sizeof( double ), vips_sketch_compare );
+
+	sketch->n[l] = 0;
+	for( i = sketch->odd[l] ? 1 : 0; i < n; i += 2 )
+		vips_sketch_push( sketch, l + 1, level[i] );
+	sketch->odd[l] = !sketch->odd[l];
+}
+
+/* Add a value at level @l, ie. standing for 2^l pixels.
+ */
+static void
+vips_sketch_push( VipsSketch *sketch, int l, double v )
+{
+	if( !sketch->level[l] ) {
+		sketch->level[l] = g_new( double, sketch->size );
+		sketch->n_levels = VIPS_MAX( sketch->n_levels, l + 1 );
+	}
+
+	sketch->level[l][sketch->n[l]++] = v;
+	if( sketch->n[l] == sketch->size )
+		vips_sketch_compact( sketch, l );
+}
+
+/* Merge @from into @sketch.
+ */
+static void
+vips_sketch_merge( VipsSketch *sketch, VipsSketch *from )
+{
+	int l, i;
+
+	for( l = 0; l < from->n_levels; l++ )
+		for( i = 0; i < from->n[l]; i++ )
+			vips_sketch_push( sketch, l, from->level[l][i] );
+}
+
+static int
+vips_sketch_item_compare( const void *a, const void *b )
+{
+	VipsSketchItem *x = (VipsSketchItem *) a;
+	VipsSketchItem *y = (VipsSketchItem *) b;
+
+	return( x->value < y->value ? -1 : x->value > y->value ? 1 : 0 );
+}
+
+/* Find the values below which fractions @q of the pixels fall. Return -1 if
+ * the sketch is empty.
+ */
+static int
+vips_sketch_quantiles( VipsSketch *sketch, double *q, double *out, int n )
+{
+	VipsSketchItem *items;
+	int n_items;
+	double total;
+	int i, j, l;
+
+	n_items = 0;
+	for( l = 0; l < sketch->n_levels; l++ )
+		n_items += sketch->n[l];
+	if( n_items == 0 )
+		return( -1 );
+
+	items = g_new( VipsSketchItem, n_items );
+	j = 0;
+	total = 0.0;
+	for( l = 0; l < sketch->n_levels; l++ ) {
+		double weight = ldexp( 1.0, l );
+
+		for( i = 0; i < sketch->n[l]; i++ ) {
+			items[j].value = sketch->level[l][i];
+			items[j].weight = weight;
+			j += 1;
+		}
+
+		total += weight * sketch->n[l];
+	}
+
+	qsort( items, n_items, sizeof( VipsSketchItem ),
+		vips_sketch_item_compare );
+
+	for( i = 0; i < n; i++ ) {
+		double target = VIPS_CLIP( 0.0, q[i], 1.0 ) * total;
+
+		double sum;
+
+		sum = 0.0;
+		for( j = 0; j < n_items - 1; j++ ) {
+			sum += items[j].weight;
+			if( sum >= target )
+				break;
+		}
+
+		out[i] = items[j].value;
+	}
+
+	g_free( items );
+
+	return( 0 );
+}
+
+static void
+vips_quantile_dispose( GObject *gobject )
+{
+	VipsQuantile *quantile = (VipsQuantile *) gobject;
+
+	vips_sketch_free( &quantile->sketch );
+
+	G_OBJECT_CLASS( vips_quantile_parent_class )->dispose( gobject );
+}
+
+static int
+vips_quantile_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsStatistic *statistic = VIPS_STATISTIC( object );
+	VipsQuantile *quantile = (VipsQuantile *) object;
+
+	double out;
+
+	if( statistic->in &&
+		vips_check_noncomplex( class->nickname, statistic->in ) )
+		return( -1 );
+
+	vips_sketch_init( &quantile->sketch, quantile->size );
+
+	if( VIPS_OBJECT_CLASS( vips_quantile_parent_class )->build( object ) )
+		return( -1 );
+
+	/* Don't set if there's no value (eg. if every pixel is NaN). This
+	 * will trigger an error later.
+	 */
+	if( vips_sketch_quantiles( &quantile->sketch,
+		&quantile->q, &out, 1 ) )
+		return( 0 );
+
+	g_object_set( quantile, "out", out, NULL );
+
+	if( quantile->q_array ) {
+		VipsArea *area = (VipsArea *) quantile->q_array;
+		double *values = VIPS_ARRAY( quantile, area->n, double );
+
+		VipsArrayDouble *out_array;
+
+		if( !values )
+			return( -1 );
+		(void) vips_sketch_quantiles( &quantile->sketch,
+			(double *) area->data, values, area->n );
+
+		out_array = vips_array_double_new( values, area->n );
+		g_object_set( quantile, "out_array", out_array, NULL );
+		vips_area_unref( (VipsArea *) out_array );
+	}
+
+	vips_sketch_free( &quantile->sketch );
+
+	return( 0 );
+}
+
+/* New sequence value. Make a private sketch for this thread.
+ */
+static void *
+vips_quantile_start( VipsStatistic *statistic )
+{
+	VipsQuantile *quantile = (VipsQuantile *) statistic;
+
+	VipsSketch *sketch;
+
+	sketch = g_new( VipsSketch, 1 );
+	vips_sketch_init( sketch, quantile->size );
+
+	return( (void *) sketch );
+}
+
+/* Merge the sequence value back into the per-call state.
+ */
+static int
+vips_quantile_stop( VipsStatistic *statistic, void *seq )
+{
+	VipsQuantile *quantile = (VipsQuantile *) statistic;
+	VipsSketch *sketch = (VipsSketch *) seq;
+
+	vips_sketch_merge( &quantile->sketch, sketch );
+	vips_sketch_free( sketch );
+	g_free( sketch );
+
+	return( 0 );
+}
+
+#define LOOP( TYPE ) { \
+	TYPE *p = (TYPE *) in; \
+	\
+	for( i = 0; i < sz; i++ ) \
+		vips_sketch_push( sketch, 0, p[i] ); \
+}
+
+/* float/double ... we have to avoid NaN.
+ */
+#define LOOPF( TYPE ) { \
+	TYPE *p = (TYPE *) in; \
+	\
+	for( i = 0; i < sz; i++ ) \
+		if( !isnan( p[i] ) ) \
+			vips_sketch_push( sketch, 0, p[i] ); \
+}
+
+/* Loop over region, adding to seq.
+ */
+static int
+vips_quantile_scan( VipsStatistic *statistic, void *seq,
+	int x, int y, void *in, int n )
+{
+	VipsSketch *sketch = (VipsSketch *) seq;
+	const int sz = n * vips_image_get_bands( statistic->in );
+
+	int i;
+
+	switch( vips_image_get_format( statistic->in ) ) {
+	case VIPS_FORMAT_UCHAR:		LOOP( unsigned char ); break;
+	case VIPS_FORMAT_CHAR:		LOOP( signed char ); break;
+	case VIPS_FORMAT_USHORT:	LOOP( unsigned short ); break;
+	case VIPS_FORMAT_SHORT:		LOOP( signed short ); break;
+	case VIPS_FORMAT_UINT:		LOOP( unsigned int ); break;
+	case VIPS_FORMAT_INT:		LOOP( signed int ); break;
+	case VIPS_FORMAT_FLOAT:		LOOPF( float ); break;
+	case VIPS_FORMAT_DOUBLE:	LOOPF( double ); break;
+
+	default:
+		g_assert( 0 );
+	}
+
+	return( 0 );
+}
+
+static void
+vips_quantile_class_init( VipsQuantileClass *class )
+{
+	GObjectClass *gobject_class = (GObjectClass *) class;
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsStatisticClass *sclass = VIPS_STATISTIC_CLASS( class );
+
+	gobject_class->dispose = vips_quantile_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "quantile";
+	object_class->description = _( "estimate an image quantile" );
+	object_class->build = vips_quantile_build;
+
+	sclass->start = vips_quantile_start;
+	sclass->scan = vips_quantile_scan;
+	sclass->stop = vips_quantile_stop;
+
+	VIPS_ARG_DOUBLE( class, "q", 2,
+		_( "Quantile" ),
+		_( "Fraction of pixels below the output value" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsQuantile, q ),
+		0.0, 1.0, 0.5 );
+
+	VIPS_ARG_DOUBLE( class, "out", 3,
+		_( "Output" ),
+		_( "Output value" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsQuantile, out ),
+		-INFINITY, INFINITY, 0.0 );
+
+	VIPS_ARG_INT( class, "size", 4,
+		_( "Size" ),
+		_( "Values held at each level of the sketch" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsQuantile, size ),
+		8, 1000000, 1024 );
+
+	VIPS_ARG_BOXED( class, "q_array", 5,
+		_( "Quantile array" ),
+		_( "Array of quantiles to find" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsQuantile, q_array ),
+		VIPS_TYPE_ARRAY_DOUBLE );
+
+	VIPS_ARG_BOXED( class, "out_array", 6,
+		_( "Output array" ),
+		_( "Array of output values" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsQuantile, out_array ),
+		VIPS_TYPE_ARRAY_DOUBLE );
+}
+
+static void
+vips_quantile_init( VipsQuantile *quantile )
+{
+	quantile->q = 0.5;
+	quantile->size = 1024;
+}
+
+/**
+ * vips_quantile:
+ * @in: input #VipsImage
+ * @q: fraction of pixels below the output value, 0 to 1
+ * @out: output value
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * @size: values held at each level of the sketch
+ * @q_array: more quantiles to find in the same pass
+ * @out_array: return array of values for @q_array
+ *
+ * This operation estimates the value below which a fraction @q of the
+ * pixels in @in fall, so @q of 0.5 finds the median. It operates on all
+ * bands of the input image. NaN values are ignored.
+ *
+ * Unlike vips_percent(), it needs no histogram, so it works for any
+ * non-complex format. Pixels are summarised in a streaming sketch in the
+ * style of KLL: memory use is about @size * log2(pixels / @size) values,
+ * and in the worst case the rank of the value found can be out by about
+ * log2(pixels / @size) / @size of the number of pixels. Typical errors are
+ * much smaller. Make @size larger for more accuracy.
+ *
+ * Set @q_array to find several quantiles with a single pass over the
+ * image, and read the results from @out_array.
+ *
+ * See also: vips_percent(), vips_max(), vips_min(), vips_stats().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_quantile( VipsImage *in, double q, double *out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "quantile", ap, in, q, out );
+	va_end( ap );
+
+	return( result );
+}
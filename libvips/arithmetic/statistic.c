@@ -6,6 +6,10 @@
  *
  * 24/8/11
  * 	- from im_avg.c
+ * 20/10/14
+ * 	- add vips_statistic_group() to share one scan between several
+ * 	  statistics
+ * 	- add vips__statistic_sum(), a vectorisable sum and sum of squares
  */
 
 /*
@@ -46,6 +50,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <vips/vips.h>
@@ -54,8 +59,200 @@
 
 #include "statistic.h"
 
+/* A set of statistics being built together. Each member is built in a
+ * thread of its own and parks in vips_statistic_group_wait() when it gets to 
+ * its scan. Once every member has either parked or finished, the group makes 
+ * one pass over the image and feeds every line to every parked member.
+ */
+typedef struct _VipsStatisticGroup {
+	/* The image all members were asked to scan.
+	 */
+	VipsImage *in;
+
+	/* Number of members.
+	 */
+	int n;
+
+	/* Members parked waiting for the scan, and members which finished
+	 * their build (usually with an error) without reaching the scan.
+	 */
+	VipsStatistic **waiting;
+	int n_waiting;
+	int n_early;
+
+	/* Members which were able to share the scan.
+	 */
+	VipsStatistic **sharing;
+	int n_sharing;
+
+	/* Set once the shared scan is over, with the result.
+	 */
+	gboolean scanned;
+	int result;
+
+	GMutex *lock;
+	GCond *cond;
+} VipsStatisticGroup;
+
 G_DEFINE_ABSTRACT_TYPE( VipsStatistic, vips_statistic, VIPS_TYPE_OPERATION );
 
+/* Number of independent accumulators for the float sum.
+ */
+#define VIPS_STATISTIC_LANES (8)
+
+/* Sum a block of 8- or 16-bit elements exactly in integer accumulators. The
+ * fixed trip count of the full-block case lets the compiler vectorise it.
+ */
+#define SUM_INT_LOOP( N, SQUARES ) { \
+	for( j = 0; j < N; j++ ) { \
+		ACC v = p[j]; \
+		\
+		bsum += v; \
+		if( SQUARES ) \
+			bsum2 += (ACC2) v * v; \
+	} \
+}
+
+#define SUM_INT( TYPE, SQUARES ) { \
+	TYPE * restrict p = (TYPE *) in + i; \
+	ACC bsum; \
+	ACC2 bsum2; \
+	\
+	bsum = 0; \
+	bsum2 = 0; \
+	if( m == VIPS_STATISTIC_BLOCK ) \
+		SUM_INT_LOOP( VIPS_STATISTIC_BLOCK, SQUARES ) \
+	else \
+		SUM_INT_LOOP( m, SQUARES ) \
+	\
+	isum += bsum; \
+	isum2 += bsum2; \
+}
+
+/* Other formats sum into a set of independent double accumulators. This 
+ * breaks the dependency between adds so the loop can vectorise, and is more 
+ * accurate than a single running sum, since each lane sees fewer values. 
+ */
+#define SUM_FLOAT( TYPE, SQUARES ) { \
+	TYPE * restrict p = (TYPE *) in + i; \
+	\
+	for( j = 0; j + VIPS_STATISTIC_LANES <= m; \
+		j += VIPS_STATISTIC_LANES ) { \
+		int k; \
+		\
+		for( k = 0; k < VIPS_STATISTIC_LANES; k++ ) { \
+			double v = p[j + k]; \
+			\
+			lane[k] += v; \
+			if( SQUARES ) \
+				lane2[k] += v * v; \
+		} \
+	} \
+	\
+	for( ; j < m; j++ ) { \
+		double v = p[j]; \
+		\
+		lane[0] += v; \
+		if( SQUARES ) \
+			lane2[0] += v * v; \
+	} \
+}
+
+#define SUM_SWITCH( SQUARES ) { \
+	switch( format ) { \
+	case VIPS_FORMAT_UCHAR: { \
+		typedef unsigned int ACC; \
+		typedef unsigned int ACC2; \
+		\
+		SUM_INT( unsigned char, SQUARES ); \
+		break; \
+	} \
+	\
+	case VIPS_FORMAT_CHAR: { \
+		typedef int ACC; \
+		typedef unsigned int ACC2; \
+		\
+		SUM_INT( signed char, SQUARES ); \
+		break; \
+	} \
+	\
+	case VIPS_FORMAT_USHORT: { \
+		typedef unsigned int ACC; \
+		typedef guint64 ACC2; \
+		\
+		SUM_INT( unsigned short, SQUARES ); \
+		break; \
+	} \
+	\
+	case VIPS_FORMAT_SHORT: { \
+		typedef int ACC; \
+		typedef guint64 ACC2; \
+		\
+		SUM_INT( signed short, SQUARES ); \
+		break; \
+	} \
+	\
+	case VIPS_FORMAT_UINT:		SUM_FLOAT( unsigned int, SQUARES ); break; \
+	case VIPS_FORMAT_INT:		SUM_FLOAT( signed int, SQUARES ); break; \
+	case VIPS_FORMAT_FLOAT:		SUM_FLOAT( float, SQUARES ); break; \
+	case VIPS_FORMAT_DOUBLE:	SUM_FLOAT( double, SQUARES ); break; \
+	\
+	default: \
+		g_assert( 0 ); \
+	} \
+}
+
+/* Find the sum, and optionally the sum of squares, of @n elements of a 
+ * non-complex @format. 8- and 16-bit formats are summed exactly in integer 
+ * blocks and converted to double once per call, others are summed in several 
+ * double accumulators. 
+ */
+void
+vips__statistic_sum( VipsBandFormat format, 
+	void *in, int n, double *sum, double *sum2 )
+{
+	gint64 isum;
+	guint64 isum2;
+	double lane[VIPS_STATISTIC_LANES];
+	double lane2[VIPS_STATISTIC_LANES];
+	int i, j;
+
+	isum = 0;
+	isum2 = 0;
+	for( j = 0; j < VIPS_STATISTIC_LANES; j++ ) {
+		lane[j] = 0.0;
+		lane2[j] = 0.0;
+	}
+
+	for( i = 0; i < n; i += VIPS_STATISTIC_BLOCK ) {
+		int m = VIPS_MIN( VIPS_STATISTIC_BLOCK, n - i );
+
+		if( sum2 )
+			SUM_SWITCH( TRUE )
+		else
+			SUM_SWITCH( FALSE )
+	}
+
+	if( vips_band_format_is8bit( format ) ||
+		format == VIPS_FORMAT_USHORT ||
+		format == VIPS_FORMAT_SHORT ) {
+		*sum = isum;
+		if( sum2 )
+			*sum2 = isum2;
+	}
+	else {
+		*sum = 0.0;
+		for( j = 0; j < VIPS_STATISTIC_LANES; j++ )
+			*sum += lane[j];
+
+		if( sum2 ) {
+			*sum2 = 0.0;
+			for( j = 0; j < VIPS_STATISTIC_LANES; j++ )
+				*sum2 += lane2[j];
+		}
+	}
+}
+
 static void *
 vips_statistic_scan_start( VipsImage *in, void *a, void *b )
 {
@@ -106,6 +303,37 @@ vips_statistic_scan_stop( void *seq, void *a, void *b )
 	return( class->stop( statistic, seq ) );
 }
 
+/* Called from a member's build: park until the group has run the shared scan.
+ * Return 0 if our scan was done for us, -1 on error, and 1 if we couldn't
+ * share and must scan for ourselves.
+ */
+static int
+vips_statistic_group_wait( VipsStatisticGroup *group, 
+	VipsStatistic *statistic )
+{
+	int i;
+	int result;
+
+	g_mutex_lock( group->lock );
+
+	group->waiting[group->n_waiting++] = statistic;
+	g_cond_broadcast( group->cond );
+
+	while( !group->scanned )
+		g_cond_wait( group->cond, group->lock );
+
+	result = 1;
+	for( i = 0; i < group->n_sharing; i++ )
+		if( group->sharing[i] == statistic ) {
+			result = group->result;
+			break;
+		}
+
+	g_mutex_unlock( group->lock );
+
+	return( result );
+}
+
 static int
 vips_statistic_build( VipsObject *object )
 {
@@ -137,6 +365,18 @@ vips_statistic_build( VipsObject *object )
 		statistic->ready = t[1];
 	}
 
+	/* If we're in a group, try to share a scan. We fall back to our own 
+	 * scan if the group can't take us.
+	 */
+	if( statistic->group ) {
+		int result;
+
+		result = vips_statistic_group_wait( statistic->group, 
+			statistic );
+		if( result <= 0 )
+			return( result );
+	}
+
 	if( vips_sink( statistic->ready, 
 		vips_statistic_scan_start, 
 		vips_statistic_scan, 
@@ -174,3 +414,298 @@ static void
 vips_statistic_init( VipsStatistic *statistic )
 {
 }
+
+static void *
+vips_statistic_group_start( VipsImage *in, void *a, void *b )
+{
+	VipsStatisticGroup *group = (VipsStatisticGroup *) a;
+
+	void **seq;
+	int i;
+
+	seq = g_new0( void *, group->n_sharing );
+	for( i = 0; i < group->n_sharing; i++ ) {
+		VipsStatistic *statistic = group->sharing[i];
+		VipsStatisticClass *class = 
+			VIPS_STATISTIC_GET_CLASS( statistic );
+
+		if( !(seq[i] = class->start( statistic )) ) {
+			int j;
+
+			for( j = 0; j < i; j++ ) {
+				statistic = group->sharing[j];
+				class = VIPS_STATISTIC_GET_CLASS( statistic );
+
+				(void) class->stop( statistic, seq[j] );
+			}
+			g_free( seq );
+
+			return( NULL );
+		}
+	}
+
+	return( (void *) seq );
+}
+
+/* Feed each line to every member. We can only stop early once every member
+ * has asked to stop.
+ */
+static int
+vips_statistic_group_scan( VipsRegion *region, 
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsStatisticGroup *group = (VipsStatisticGroup *) a;
+	void **seq = (void **) vseq;
+	VipsRect *r = &region->valid;
+	int lsk = VIPS_REGION_LSKIP( region );
+
+	int y, i;
+	VipsPel *p;
+	gboolean all_stopped;
+
+	VIPS_DEBUG_MSG( "vips_statistic_group_scan: %d x %d @ %d x %d\n",
+		r->width, r->height, r->left, r->top );
+
+	p = VIPS_REGION_ADDR( region, r->left, r->top ); 
+	for( y = 0; y < r->height; y++ ) { 
+		for( i = 0; i < group->n_sharing; i++ ) {
+			VipsStatistic *statistic = group->sharing[i];
+			VipsStatisticClass *class = 
+				VIPS_STATISTIC_GET_CLASS( statistic );
+
+			if( !statistic->stop &&
+				class->scan( statistic, seq[i], 
+					r->left, r->top + y, p, r->width ) ) 
+				return( -1 );
+		}
+
+		p += lsk;
+	} 
+
+	all_stopped = TRUE;
+	for( i = 0; i < group->n_sharing; i++ )
+		if( !group->sharing[i]->stop )
+			all_stopped = FALSE;
+	if( all_stopped )
+		*stop = TRUE;
+
+	return( 0 );
+}
+
+static int
+vips_statistic_group_stop( void *vseq, void *a, void *b )
+{
+	VipsStatisticGroup *group = (VipsStatisticGroup *) a;
+	void **seq = (void **) vseq;
+
+	int i;
+	int result;
+
+	result = 0;
+	for( i = 0; i < group->n_sharing; i++ ) {
+		VipsStatistic *statistic = group->sharing[i];
+		VipsStatisticClass *class = 
+			VIPS_STATISTIC_GET_CLASS( statistic );
+
+		if( class->stop( statistic, seq[i] ) )
+			result = -1;
+	}
+
+	g_free( seq );
+
+	return( result );
+}
+
+/* The thread we build each member in. 
+ */
+static void *
+vips_statistic_group_build( void *data )
+{
+	VipsStatistic *statistic = VIPS_STATISTIC( data );
+	VipsStatisticGroup *group = statistic->group;
+
+	int result;
+
+	result = vips_object_build( VIPS_OBJECT( statistic ) );
+
+	/* If the scan hasn't happened, we must have finished (probably with 
+	 * an error) before we got to it. Let the group know.
+	 */
+	g_mutex_lock( group->lock );
+	if( !group->scanned ) {
+		group->n_early += 1;
+		g_cond_broadcast( group->cond );
+	}
+	g_mutex_unlock( group->lock );
+
+	return( GINT_TO_POINTER( result ) );
+}
+
+/* Can this member share a scan of @image?
+ */
+static gboolean
+vips_statistic_group_compatible( VipsStatisticGroup *group, 
+	VipsStatistic *statistic, VipsImage *image )
+{
+	VipsImage *ready = statistic->ready;
+
+	return( statistic->in == group->in &&
+		ready->Xsize == image->Xsize &&
+		ready->Ysize == image->Ysize &&
+		ready->Bands == image->Bands &&
+		ready->BandFmt == image->BandFmt &&
+		ready->Coding == image->Coding );
+}
+
+/**
+ * vips_statistic_group: 
+ * @operations: (array length=n) (transfer none): statistic operations to build
+ * @n: number of operations
+ *
+ * Build a set of statistic operations, such as "avg", "deviate", "min", 
+ * "max" and "hist_find", with a single pass over their input image. 
+ *
+ * Each operation must have all of its arguments set but not yet be built, 
+ * and all must have the same input image. Build each with vips_object_build()
+ * as part of the group and read the results with g_object_get() afterwards. 
+ * Don't pass the operations through vips_cache_operation_build().
+ *
+ * Each operation keeps its own per-thread state during the scan and merges 
+ * it in the usual way at the end, so the results are the same as building 
+ * the operations one by one. Operations which need their input cast to a 
+ * different format from the others, or which alter their input during 
+ * build, cannot share the scan and make a pass of their own.
+ *
+ * For example:
+ *
+ * |[
+ * VipsOperation *ops[2];
+ * double avg, deviate;
+ *
+ * ops[0] = vips_operation_new( "avg" );
+ * ops[1] = vips_operation_new( "deviate" );
+ * g_object_set( ops[0], "in", image, NULL );
+ * g_object_set( ops[1], "in", image, NULL );
+ * if( vips_statistic_group( ops, 2 ) )
+ * 	error ..
+ * g_object_get( ops[0], "out", &avg, NULL );
+ * g_object_get( ops[1], "out", &deviate, NULL );
+ * ]|
+ *
+ * See also: vips_avg(), vips_deviate(), vips_stats(), vips_hist_find().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_statistic_group( VipsOperation **operations, int n )
+{
+	VipsStatisticGroup group;
+	GThread **threads;
+	int i;
+	int result;
+
+	for( i = 0; i < n; i++ ) {
+		if( !VIPS_IS_STATISTIC( operations[i] ) ) {
+			vips_error( "vips_statistic_group", 
+				"%s", _( "not a statistic operation" ) );
+			return( -1 );
+		}
+
+		if( VIPS_OBJECT( operations[i] )->constructed ) {
+			vips_error( "vips_statistic_group", 
+				"%s", _( "operation has already been built" ) );
+			return( -1 );
+		}
+
+		if( !VIPS_STATISTIC( operations[i] )->in ||
+			VIPS_STATISTIC( operations[i] )->in != 
+				VIPS_STATISTIC( operations[0] )->in ) { 
+			vips_error( "vips_statistic_group", 
+				"%s", _( "operations must share an input image" ) );
+			return( -1 );
+		}
+	}
+
+	if( n == 0 )
+		return( 0 );
+
+	memset( &group, 0, sizeof( group ) );
+	group.in = VIPS_STATISTIC( operations[0] )->in;
+	group.n = n;
+	group.waiting = VIPS_ARRAY( NULL, n, VipsStatistic * );
+	group.sharing = VIPS_ARRAY( NULL, n, VipsStatistic * );
+	threads = VIPS_ARRAY( NULL, n, GThread * );
+	if( !group.waiting ||
+		!group.sharing ||
+		!threads ) {
+		VIPS_FREE( group.waiting );
+		VIPS_FREE( group.sharing );
+		VIPS_FREE( threads );
+		return( -1 );
+	}
+	group.lock = vips_g_mutex_new();
+	group.cond = vips_g_cond_new();
+
+	result = 0;
+
+	for( i = 0; i < n; i++ ) {
+		VipsStatistic *statistic = VIPS_STATISTIC( operations[i] );
+
+		statistic->group = &group;
+		if( !(threads[i] = vips_g_thread_new( "statistic", 
+			vips_statistic_group_build, statistic )) ) {
+			g_mutex_lock( group.lock );
+			group.n_early += 1;
+			g_mutex_unlock( group.lock );
+			result = -1;
+		}
+	}
+
+	/* Wait for every member to either park at its scan or finish.
+	 */
+	g_mutex_lock( group.lock );
+	while( group.n_waiting + group.n_early < group.n )
+		g_cond_wait( group.cond, group.lock );
+	g_mutex_unlock( group.lock );
+
+	/* All members are now either parked or done, so we can look at the
+	 * group without the lock. Scan the first member's ready image and
+	 * share it with everyone who can use it.
+	 */
+	if( group.n_waiting > 0 ) {
+		VipsImage *image = group.waiting[0]->ready;
+
+		for( i = 0; i < group.n_waiting; i++ ) 
+			if( vips_statistic_group_compatible( &group, 
+				group.waiting[i], image ) )
+				group.sharing[group.n_sharing++] = 
+					group.waiting[i];
+
+		group.result = vips_sink( image, 
+			vips_statistic_group_start, 
+			vips_statistic_group_scan, 
+			vips_statistic_group_stop, 
+			&group, NULL );
+	}
+
+	g_mutex_lock( group.lock );
+	group.scanned = TRUE;
+	g_cond_broadcast( group.cond );
+	g_mutex_unlock( group.lock );
+
+	for( i = 0; i < n; i++ ) 
+		if( threads[i] &&
+			GPOINTER_TO_INT( g_thread_join( threads[i] ) ) )
+			result = -1;
+
+	for( i = 0; i < n; i++ ) 
+		VIPS_STATISTIC( operations[i] )->group = NULL;
+
+	VIPS_FREE( group.waiting );
+	VIPS_FREE( group.sharing );
+	VIPS_FREE( threads );
+	vips_g_mutex_free( group.lock );
+	vips_g_cond_free( group.cond );
+
+	return( result );
+}
@@ -79,6 +79,11 @@ struct _VipsStatistic {
 	 */
 	void *a; 
 	void *b;
+
+	/* Set if we are being built as part of a group sharing a single
+	 * scan, see vips_statistic_group().
+	 */
+	struct _VipsStatisticGroup *group;
 };
 
 struct _VipsStatisticClass {
@@ -97,6 +102,14 @@ struct _VipsStatisticClass {
 
 GType vips_statistic_get_type( void );
 
+/* Elements per block for vips__statistic_sum(). Small enough that 8- and 
+ * 16-bit values can be summed in 32-bit integers without overflow.
+ */
+#define VIPS_STATISTIC_BLOCK (256)
+
+void vips__statistic_sum( VipsBandFormat format, 
+	void *in, int n, double *sum, double *sum2 );
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
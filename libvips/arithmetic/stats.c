@@ -27,6 +27,8 @@
  * 7/11/11
  * 	- redone as a class
  * 	- track maxpos / minpos too
+ * 20/10/14
+ * 	- scan 8- and 16-bit images in blocks with vips__statistic_sum()
  */
 
 /*
@@ -370,6 +372,107 @@ vips_stats_start( VipsStatistic *statistic )
 	local->set = TRUE; \
 } 
 
+/* Find the min and max of a block. We start from the running values, so
+ * the block only wins if it beats them, as in LOOP() above.
+ */
+#define MINMAX_LOOP( N ) { \
+	for( j = 0; j < N; j++ ) { \
+		bmin = VIPS_MIN( block[j], bmin ); \
+		bmax = VIPS_MAX( block[j], bmax ); \
+	} \
+}
+
+/* For 8- and 16-bit types, take each band in blocks, copied out to a buffer 
+ * if it's interleaved, so that the sums can be done exactly in integer 
+ * arithmetic and the sums and the min/max can vectorise. 
+ */
+#define BLOCK_LOOP( TYPE ) { \
+	TYPE buf[VIPS_STATISTIC_BLOCK]; \
+	\
+	for( b = 0; b < bands; b++ ) { \
+		TYPE *p = ((TYPE *) in) + b; \
+		double *q = VIPS_MATRIX( local->out, 0, b + 1 ); \
+		TYPE small, big; \
+		double sum, sum2; \
+		int xmin, ymin; \
+		int xmax, ymax; \
+		\
+		if( local->set ) { \
+			small = q[COL_MIN]; \
+			big = q[COL_MAX]; \
+			sum = q[COL_SUM]; \
+			sum2 = q[COL_SUM2]; \
+			xmin = q[COL_XMIN]; \
+			ymin = q[COL_YMIN]; \
+			xmax = q[COL_XMAX]; \
+			ymax = q[COL_YMAX]; \
+		} \
+		else { \
+			small = p[0]; \
+			big = p[0]; \
+			sum = 0; \
+			sum2 = 0; \
+			xmin = x; \
+			ymin = y; \
+			xmax = x; \
+			ymax = y; \
+		} \
+		\
+		for( i = 0; i < n; i += VIPS_STATISTIC_BLOCK ) { \
+			int m = VIPS_MIN( VIPS_STATISTIC_BLOCK, n - i ); \
+			TYPE *block; \
+			TYPE bmin, bmax; \
+			double bsum, bsum2; \
+			\
+			if( bands == 1 ) \
+				block = p + i; \
+			else { \
+				for( j = 0; j < m; j++ ) \
+					buf[j] = p[(i + j) * bands]; \
+				block = buf; \
+			} \
+			\
+			vips__statistic_sum( format, block, m, &bsum, &bsum2 ); \
+			sum += bsum; \
+			sum2 += bsum2; \
+			\
+			bmin = small; \
+			bmax = big; \
+			if( m == VIPS_STATISTIC_BLOCK ) \
+				MINMAX_LOOP( VIPS_STATISTIC_BLOCK ) \
+			else \
+				MINMAX_LOOP( m ) \
+			\
+			if( bmax > big ) { \
+				for( j = 0; block[j] != bmax; j++ ) \
+					; \
+				big = bmax; \
+				xmax = x + i + j; \
+				ymax = y; \
+			} \
+			\
+			if( bmin < small ) { \
+				for( j = 0; block[j] != bmin; j++ ) \
+					; \
+				small = bmin; \
+				xmin = x + i + j; \
+				ymin = y; \
+			} \
+		} \
+		\
+		q[COL_MIN] = small; \
+		q[COL_MAX] = big; \
+		q[COL_SUM] = sum; \
+		q[COL_SUM2] = sum2; \
+		q[COL_XMIN] = xmin; \
+		q[COL_YMIN] = ymin; \
+		q[COL_XMAX] = xmax; \
+		q[COL_YMAX] = ymax; \
+	} \
+	\
+	local->set = TRUE; \
+} 
+
 /* Loop over region, accumulating a sum in *tmp.
  */
 static int
@@ -377,15 +480,16 @@ vips_stats_scan( VipsStatistic *statistic, void *seq,
 	int x, int y, void *in, int n )
 {
 	const int bands = vips_image_get_bands( statistic->in );
+	const VipsBandFormat format = vips_image_get_format( statistic->in );
 	VipsStats *local = (VipsStats *) seq;
 
-	int b, i;
+	int b, i, j;
 
-	switch( vips_image_get_format( statistic->in ) ) {
-	case VIPS_FORMAT_UCHAR:		LOOP( unsigned char ); break; 
-	case VIPS_FORMAT_CHAR:		LOOP( signed char ); break; 
-	case VIPS_FORMAT_USHORT:	LOOP( unsigned short ); break; 
-	case VIPS_FORMAT_SHORT:		LOOP( signed short ); break; 
+	switch( format ) {
+	case VIPS_FORMAT_UCHAR:		BLOCK_LOOP( unsigned char ); break; 
+	case VIPS_FORMAT_CHAR:		BLOCK_LOOP( signed char ); break; 
+	case VIPS_FORMAT_USHORT:	BLOCK_LOOP( unsigned short ); break; 
+	case VIPS_FORMAT_SHORT:		BLOCK_LOOP( signed short ); break; 
 	case VIPS_FORMAT_UINT:		LOOP( unsigned int ); break;
 	case VIPS_FORMAT_INT:		LOOP( signed int ); break; 
 	case VIPS_FORMAT_FLOAT:		LOOP( float ); break; 
@@ -31,6 +31,8 @@
  *	- cleanups
  * 20/9/12
  * 	- redo as a class
+ * 20/10/14
+ * 	- pack in blocks so the compiler can vectorise
  */
 
 /*
@@ -66,6 +68,7 @@
 #include <vips/intl.h>
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include <vips/vips.h>
@@ -83,42 +86,75 @@ G_DEFINE_TYPE( VipsLab2LabQ, vips_Lab2LabQ, VIPS_TYPE_COLOUR_CODE );
  * Modified: 3/5/93, 16/6/93
  */
 static void
-vips_Lab2LabQ_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
+vips_Lab2LabQ_block( VipsPel * restrict q, float * restrict p )
 {
-	float * restrict p = (float *) in[0];
-	VipsPel * restrict q = out; 
-
-	float fval;
-	int lsbs;
-	int intv;
+	float fL[VIPS_LABQ_BLOCK], fa[VIPS_LABQ_BLOCK], fb[VIPS_LABQ_BLOCK];
+	int L[VIPS_LABQ_BLOCK], a[VIPS_LABQ_BLOCK], b[VIPS_LABQ_BLOCK];
 	int i;
 
-	for( i = 0; i < width; i++) {
+	for( i = 0; i < VIPS_LABQ_BLOCK; i++ ) {
+		fL[i] = p[3 * i];
+		fa[i] = p[3 * i + 1];
+		fb[i] = p[3 * i + 2];
+	}
+
+	for( i = 0; i < VIPS_LABQ_BLOCK; i++ ) {
+		double fval;
+
 		/* Scale L up to 10 bits. Add 0.5 rather than call VIPS_RINT 
 		 * for speed. This will not round negatives correctly! But 
 		 * this does not matter, since L is >0. L*=100.0 -> 1023.
 		 */
-		intv = 10.23 * p[0] + 0.5;	/* scale L up to 10 bits */
-		intv = VIPS_CLIP( 0, intv, 1023 );
-		lsbs = (intv & 0x3) << 6;       /* 00000011 -> 11000000 */
-		q[0] = (intv >> 2); 		/* drop bot 2 bits and store */
-
-		fval = 8.0 * p[1];              /* do a */
-		intv = VIPS_RINT( fval );
-		intv = VIPS_CLIP( -1024, intv, 1023 );
-		lsbs |= (intv & 0x7) << 3;      /* 00000111 -> 00111000 */
-		q[1] = (intv >> 3);   		/* drop bot 3 bits & store */
-
-		fval = 8.0 * p[2];              /* do b */
-		intv = VIPS_RINT( fval );
-		intv = VIPS_CLIP( -1024, intv, 1023 );
-		lsbs |= (intv & 0x7);
-		q[2] = (intv >> 3);
-
-		q[3] = lsbs;                	/* store lsb band */
-
-		p += 3;
-		q += 4;
+		L[i] = 10.23 * fL[i] + 0.5;
+
+		/* a and b go to 11 bits. This is VIPS_RINT() written as a
+		 * select.
+		 */
+		fval = 8.0 * fa[i];
+		a[i] = fval + (fval > 0 ? 0.5 : -0.5);
+		fval = 8.0 * fb[i];
+		b[i] = fval + (fval > 0 ? 0.5 : -0.5);
+	}
+
+	for( i = 0; i < VIPS_LABQ_BLOCK; i++ ) {
+		int l = VIPS_CLIP( 0, L[i], 1023 );
+		int A = VIPS_CLIP( -1024, a[i], 1023 );
+		int B = VIPS_CLIP( -1024, b[i], 1023 );
+
+		/* Top 8 bits of each, then the lsbs packed into the 4th 
+		 * byte as llaaabbb.
+		 */
+		q[4 * i] = l >> 2;
+		q[4 * i + 1] = A >> 3;
+		q[4 * i + 2] = B >> 3;
+		q[4 * i + 3] = ((l & 0x3) << 6) | ((A & 0x7) << 3) | (B & 0x7);
+	}
+}
+
+static void
+vips_Lab2LabQ_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
+{
+	float *p = (float *) in[0];
+	VipsPel *q = out; 
+
+	int x;
+
+	for( x = 0; x + VIPS_LABQ_BLOCK <= width; x += VIPS_LABQ_BLOCK ) {
+		vips_Lab2LabQ_block( q, p );
+
+		p += 3 * VIPS_LABQ_BLOCK;
+		q += 4 * VIPS_LABQ_BLOCK;
+	}
+
+	/* Do any stragglers via a zero-padded block.
+	 */
+	if( x < width ) {
+		float tp[3 * VIPS_LABQ_BLOCK] = { 0 };
+		VipsPel tq[4 * VIPS_LABQ_BLOCK];
+
+		memcpy( tp, p, 3 * sizeof( float ) * (width - x) );
+		vips_Lab2LabQ_block( tq, tp );
+		memcpy( q, tq, 4 * (width - x) );
 	}
 }
 
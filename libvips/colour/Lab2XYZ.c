@@ -15,6 +15,8 @@
  * 	- cleanups
  * 18/9/12
  * 	- redone as a class
+ * 20/10/14
+ * 	- branch-free inner loop so it can vectorise
  */
 
 /*
@@ -80,7 +82,10 @@ typedef VipsColourSpaceClass VipsLab2XYZClass;
 
 G_DEFINE_TYPE( VipsLab2XYZ, vips_Lab2XYZ, VIPS_TYPE_COLOUR_SPACE );
 
-/* Process a buffer of data.
+/* Process a buffer of data. There's no table here, just some cubes, so 
+ * rather than a separate vector path we compute both sides of each test 
+ * and select. The compiler can vectorise this, and results are the same 
+ * as the if/else version.
  */
 static void
 vips_Lab2XYZ_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
@@ -88,6 +93,9 @@ vips_Lab2XYZ_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 	VipsLab2XYZ *Lab2XYZ = (VipsLab2XYZ *) colour;
 	float * restrict p = (float *) in[0];
 	float * restrict q = (float *) out;
+	double X0 = Lab2XYZ->X0;
+	double Y0 = Lab2XYZ->Y0;
+	double Z0 = Lab2XYZ->Z0;
 
 	int x;
 
@@ -97,33 +105,30 @@ vips_Lab2XYZ_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 	for( x = 0; x < width; x++ ) {
 		float L, a, b;
 		float X, Y, Z;
-		double cby, tmp;
+		float Ylo, Yhi;
+		double cby, cbylo, cbyhi, tmp;
 
 		L = p[0];
 		a = p[1];
 		b = p[2];
 		p += 3;
 
-		if( L < 8.0 ) {
-			Y = (L * Lab2XYZ->Y0) / 903.3;
-			cby = 7.787 * (Y / Lab2XYZ->Y0) + 16.0 / 116.0;
-		}
-		else {
-			cby = (L + 16.0) / 116.0;
-			Y = Lab2XYZ->Y0 * cby * cby * cby;
-		}
+		Ylo = (L * Y0) / 903.3;
+		cbylo = 7.787 * (Ylo / Y0) + 16.0 / 116.0;
+		cbyhi = (L + 16.0) / 116.0;
+		Yhi = Y0 * cbyhi * cbyhi * cbyhi;
+		Y = L < 8.0 ? Ylo : Yhi;
+		cby = L < 8.0 ? cbylo : cbyhi;
 
 		tmp = a / 500.0 + cby;
-		if( tmp < 0.2069 )
-			X = Lab2XYZ->X0 * (tmp - 0.13793) / 7.787;
-		else    
-			X = Lab2XYZ->X0 * tmp * tmp * tmp;
+		X = tmp < 0.2069 ? 
+			X0 * (tmp - 0.13793) / 7.787 : 
+			X0 * tmp * tmp * tmp;
 
 		tmp = cby - b / 200.0;
-		if( tmp < 0.2069 )
-			Z = Lab2XYZ->Z0 * (tmp - 0.13793) / 7.787;
-		else    
-			Z = Lab2XYZ->Z0 * tmp * tmp * tmp;
+		Z = tmp < 0.2069 ? 
+			Z0 * (tmp - 0.13793) / 7.787 : 
+			Z0 * tmp * tmp * tmp;
 
 		/* Write.
 		 */
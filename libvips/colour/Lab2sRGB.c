@@ -0,0 +1,210 @@
+/* Turn Lab or LCh directly into displayable rgb.
+ *
+ * 20/10/14
+ * 	- from scRGB2sRGB.c, fuse the Lab -> XYZ -> scRGB -> sRGB chain
+ * 	- follow scRGB2sRGB onto the fast path
+ */
+
+/*
+
+    This file is part of VIPS.
+    
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <math.h>
+
+#include <vips/vips.h>
+
+#include "pcolour.h"
+
+typedef VipsColourSpace VipsLab2sRGB;
+typedef VipsColourSpaceClass VipsLab2sRGBClass;
+
+G_DEFINE_TYPE( VipsLab2sRGB, vips_Lab2sRGB, VIPS_TYPE_COLOUR_SPACE );
+
+typedef VipsColourSpace VipsLCh2sRGB;
+typedef VipsColourSpaceClass VipsLCh2sRGBClass;
+
+G_DEFINE_TYPE( VipsLCh2sRGB, vips_LCh2sRGB, VIPS_TYPE_COLOUR_SPACE );
+
+/* The same per-pixel functions as LCh2Lab, Lab2XYZ, XYZ2scRGB and 
+ * scRGB2sRGB, so we match the long route exactly. Like scRGB2sRGB, we 
+ * compute the gamma directly after vips_colour_set_fast().
+ */
+static void
+vips_Lab2sRGB_line_LCh( VipsPel * restrict q, float * restrict p, 
+	int width, gboolean LCh )
+{
+	gboolean fast = vips_colour_get_fast();
+
+	int i;
+
+	for( i = 0; i < width; i++ ) {
+		float L = p[0];
+		float a = p[1];
+		float b = p[2];
+
+		float X, Y, Z;
+		float R, G, B;
+		int r, g, bl;
+		int or;
+
+		p += 3;
+
+		if( LCh )
+			vips_col_Ch2ab( a, b, &a, &b );
+
+		vips_col_Lab2XYZ( L, a, b, &X, &Y, &Z );
+		vips_col_XYZ2scRGB( X, Y, Z, &R, &G, &B );
+		if( fast )
+			vips__col_scRGB2sRGB_vector( R, G, B, 255, 
+				&r, &g, &bl );
+		else
+			vips_col_scRGB2sRGB_8( R, G, B, &r, &g, &bl, &or );
+
+		q[0] = r;
+		q[1] = g;
+		q[2] = bl;
+
+		q += 3;
+	}
+}
+
+static void
+vips_Lab2sRGB_line( VipsColour *colour, 
+	VipsPel *out, VipsPel **in, int width )
+{
+	vips_Lab2sRGB_line_LCh( out, (float *) in[0], width, FALSE );
+}
+
+static void
+vips_LCh2sRGB_line( VipsColour *colour, 
+	VipsPel *out, VipsPel **in, int width )
+{
+	vips_Lab2sRGB_line_LCh( out, (float *) in[0], width, TRUE );
+}
+
+static void
+vips_Lab2sRGB_class_init( VipsLab2sRGBClass *class )
+{
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsColourClass *colour_class = VIPS_COLOUR_CLASS( class );
+
+	object_class->nickname = "Lab2sRGB";
+	object_class->description = _( "convert a Lab image to sRGB" );
+
+	colour_class->process_line = vips_Lab2sRGB_line;
+}
+
+static void
+vips_Lab2sRGB_init( VipsLab2sRGB *Lab2sRGB )
+{
+	VipsColour *colour = VIPS_COLOUR( Lab2sRGB );
+
+	colour->interpretation = VIPS_INTERPRETATION_sRGB;
+	colour->format = VIPS_FORMAT_UCHAR;
+}
+
+static void
+vips_LCh2sRGB_class_init( VipsLCh2sRGBClass *class )
+{
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsColourClass *colour_class = VIPS_COLOUR_CLASS( class );
+
+	object_class->nickname = "LCh2sRGB";
+	object_class->description = _( "convert an LCh image to sRGB" );
+
+	colour_class->process_line = vips_LCh2sRGB_line;
+}
+
+static void
+vips_LCh2sRGB_init( VipsLCh2sRGB *LCh2sRGB )
+{
+	VipsColour *colour = VIPS_COLOUR( LCh2sRGB );
+
+	colour->interpretation = VIPS_INTERPRETATION_sRGB;
+	colour->format = VIPS_FORMAT_UCHAR;
+}
+
+/**
+ * vips_Lab2sRGB:
+ * @in: input image
+ * @out: output image
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Convert a Lab image to 8-bit sRGB, D65. 
+ *
+ * This gives the same result as vips_Lab2XYZ(), vips_XYZ2scRGB() and 
+ * vips_scRGB2sRGB() in turn, but does it in one pass with no intermediate 
+ * images. vips_colourspace() uses it for Lab to sRGB.
+ *
+ * See also: vips_LCh2sRGB(), vips_sRGB2Lab(), vips_LabQ2sRGB().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_Lab2sRGB( VipsImage *in, VipsImage **out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "Lab2sRGB", ap, in, out );
+	va_end( ap );
+
+	return( result );
+}
+
+/**
+ * vips_LCh2sRGB:
+ * @in: input image
+ * @out: output image
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Convert an LCh image to 8-bit sRGB, D65. 
+ *
+ * This is vips_LCh2Lab() followed by vips_Lab2sRGB(), but in one pass.
+ *
+ * See also: vips_Lab2sRGB(), vips_sRGB2LCh().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_LCh2sRGB( VipsImage *in, VipsImage **out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "LCh2sRGB", ap, in, out );
+	va_end( ap );
+
+	return( result );
+}
@@ -18,6 +18,8 @@
  * 	- gtkdoc
  * 20/9/12
  * 	- redo as a class
+ * 20/10/14
+ * 	- unpack in blocks so the compiler can vectorise
  */
 
 /*
@@ -53,6 +55,7 @@
 #include <vips/intl.h>
 
 #include <stdio.h>
+#include <string.h>
 
 #include <vips/vips.h>
 
@@ -71,40 +74,64 @@ G_DEFINE_TYPE( VipsLabQ2Lab, vips_LabQ2Lab, VIPS_TYPE_COLOUR_CODE );
  * (C) K.Martinez 2/5/93
  */
 static void
-vips_LabQ2Lab_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
+vips_LabQ2Lab_block( float * restrict q, VipsPel * restrict p )
 {
-	signed char * restrict p = (signed char *) in[0];
-	float * restrict q = (float *) out;
-
-	int l;
-	int lsbs;               /* for lsbs byte */
-	int i;                  /* counter      */
+	int l[VIPS_LABQ_BLOCK], a[VIPS_LABQ_BLOCK], b[VIPS_LABQ_BLOCK];
+	float L[VIPS_LABQ_BLOCK], A[VIPS_LABQ_BLOCK], B[VIPS_LABQ_BLOCK];
+	int i;
 
-	/* Read input with a signed pointer to get signed ab easily.
-	 */
-	for( i = 0; i < width; i++ ) {
+	for( i = 0; i < VIPS_LABQ_BLOCK; i++ ) {
 		/* Get extra bits.
 		 */
-		lsbs = ((unsigned char *) p)[3];
+		int lsbs = p[4 * i + 3];
 
-		/* Build L.
+		/* Build L, a and b. Read ab as signed char to get the sign
+		 * easily.
 		 */
-		l = ((unsigned char *)p)[0];
-		l = (l << 2) | (lsbs >> 6);
-		q[0] = (float) l * (100.0 / 1023.0);
+		l[i] = (p[4 * i] << 2) | (lsbs >> 6);
+		a[i] = ((signed char) p[4 * i + 1] << 3) | 
+			((lsbs >> 3) & 0x7);
+		b[i] = ((signed char) p[4 * i + 2] << 3) | 
+			(lsbs & 0x7);
+	}
 
-		/* Build a.
-		 */
-		l = (p[1] << 3) | ((lsbs >> 3) & 0x7);
-		q[1] = (float) l * 0.125;
+	for( i = 0; i < VIPS_LABQ_BLOCK; i++ ) {
+		L[i] = l[i] * (100.0 / 1023.0);
+		A[i] = a[i] * 0.125f;
+		B[i] = b[i] * 0.125f;
+	}
 
-		/* And b.
-		 */
-		l = (p[2] << 3) | (lsbs & 0x7);
-		q[2] = (float) l * 0.125;        
+	for( i = 0; i < VIPS_LABQ_BLOCK; i++ ) {
+		q[3 * i] = L[i];
+		q[3 * i + 1] = A[i];
+		q[3 * i + 2] = B[i];
+	}
+}
+
+static void
+vips_LabQ2Lab_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
+{
+	VipsPel *p = in[0];
+	float *q = (float *) out;
+
+	int x;
+
+	for( x = 0; x + VIPS_LABQ_BLOCK <= width; x += VIPS_LABQ_BLOCK ) {
+		vips_LabQ2Lab_block( q, p );
+
+		p += 4 * VIPS_LABQ_BLOCK;
+		q += 3 * VIPS_LABQ_BLOCK;
+	}
+
+	/* Do any stragglers via a zero-padded block.
+	 */
+	if( x < width ) {
+		VipsPel tp[4 * VIPS_LABQ_BLOCK] = { 0 };
+		float tq[3 * VIPS_LABQ_BLOCK];
 
-		p += 4;
-		q += 3;
+		memcpy( tp, p, 4 * (width - x) );
+		vips_LabQ2Lab_block( tq, tp );
+		memcpy( q, tq, 3 * sizeof( float ) * (width - x) );
 	}
 }
 
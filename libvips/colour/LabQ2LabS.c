@@ -10,6 +10,8 @@
  * 	- gtkdoc
  * 21/9/12
  * 	- redo as a class
+ * 20/10/14
+ * 	- unpack in blocks so the compiler can vectorise
  */
 
 /*
@@ -45,6 +47,7 @@
 #include <vips/intl.h>
 
 #include <stdio.h>
+#include <string.h>
 
 #include <vips/vips.h>
 
@@ -58,39 +61,55 @@ G_DEFINE_TYPE( VipsLabQ2LabS, vips_LabQ2LabS, VIPS_TYPE_COLOUR_CODE );
 /* CONVERT n pels from packed 32bit Lab to signed short.
  */
 static void
-vips_LabQ2LabS_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
+vips_LabQ2LabS_block( signed short * restrict q, VipsPel * restrict p )
 {
-	unsigned char * restrict p = (unsigned char *) in[0];
-	signed short * restrict q = (signed short *) out;
-
+	signed short l[VIPS_LABQ_BLOCK], a[VIPS_LABQ_BLOCK], b[VIPS_LABQ_BLOCK];
 	int i;
-	unsigned char ext;
-	signed short l, a, b;
-
-	for( i = 0; i < width; i++ ) {
-		/* Get most significant 8 bits of lab.
-		 */
-		l = p[0] << 7;
-		a = p[1] << 8;
-		b = p[2] << 8;
 
+	for( i = 0; i < VIPS_LABQ_BLOCK; i++ ) {
 		/* Get x-tra bits.
 		 */
-		ext = p[3];
-		p += 4;
+		int ext = p[4 * i + 3];
 
-		/* Shift and mask in to lab.
+		/* Most significant 8 bits of lab, then shift and mask in the
+		 * extra bits.
 		 */
-		l |= (unsigned char) (ext & 0xc0) >> 1;
-		a |= (ext & 0x38) << 2;
-		b |= (ext & 0x7) << 5;
+		l[i] = (p[4 * i] << 7) | ((ext & 0xc0) >> 1);
+		a[i] = (p[4 * i + 1] << 8) | ((ext & 0x38) << 2);
+		b[i] = (p[4 * i + 2] << 8) | ((ext & 0x7) << 5);
+	}
 
-		/* Write!
-		 */
-		q[0] = l;
-		q[1] = a;
-		q[2] = b;
-		q += 3;
+	for( i = 0; i < VIPS_LABQ_BLOCK; i++ ) {
+		q[3 * i] = l[i];
+		q[3 * i + 1] = a[i];
+		q[3 * i + 2] = b[i];
+	}
+}
+
+static void
+vips_LabQ2LabS_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
+{
+	VipsPel *p = in[0];
+	signed short *q = (signed short *) out;
+
+	int x;
+
+	for( x = 0; x + VIPS_LABQ_BLOCK <= width; x += VIPS_LABQ_BLOCK ) {
+		vips_LabQ2LabS_block( q, p );
+
+		p += 4 * VIPS_LABQ_BLOCK;
+		q += 3 * VIPS_LABQ_BLOCK;
+	}
+
+	/* Do any stragglers via a zero-padded block.
+	 */
+	if( x < width ) {
+		VipsPel tp[4 * VIPS_LABQ_BLOCK] = { 0 };
+		signed short tq[3 * VIPS_LABQ_BLOCK];
+
+		memcpy( tp, p, 4 * (width - x) );
+		vips_LabQ2LabS_block( tq, tp );
+		memcpy( q, tq, 3 * sizeof( signed short ) * (width - x) );
 	}
 }
 
@@ -22,6 +22,8 @@
  * 	- spot NaN, Inf in XYZ2RGB, they break LUT indexing
  * 	- split sRGB <-> XYZ into sRGB <-> scRGB <-> XYZ so we can support
  * 	  scRGB as a colourspace
+ * 20/10/14
+ * 	- add whole-line sRGB -> scRGB for the vector paths
  */
 
 /*
@@ -220,6 +222,34 @@ vips_col_sRGB2scRGB_16( int r, int g, int b, float *R, float *G, float *B )
 	return( vips_col_sRGB2scRGB( 65536, vips_v2Y_16, r, g, b, R, G, B ) ); 
 }
 
+/* sRGB to scRGB for @n samples. Input is already in range, so this is 
+ * just a lookup, with no clipping and no calls. Decode stays a table since
+ * the tables are exact for 8- and 16-bit input.
+ */
+void
+vips__col_sRGB2scRGB_line_8( float * restrict q, 
+	VipsPel * restrict p, int n )
+{
+	int i;
+
+	vips_col_make_tables_RGB_8();
+
+	for( i = 0; i < n; i++ )
+		q[i] = vips_v2Y_8[p[i]];
+}
+
+void
+vips__col_sRGB2scRGB_line_16( float * restrict q, 
+	unsigned short * restrict p, int n )
+{
+	int i;
+
+	vips_col_make_tables_RGB_16();
+
+	for( i = 0; i < n; i++ )
+		q[i] = vips_v2Y_16[p[i]];
+}
+
 /* The matrix already includes the D65 channel weighting, so we just scale by
  * Y.
  */
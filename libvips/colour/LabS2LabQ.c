@@ -15,6 +15,8 @@
  * 	- gtkdoc, cleanup
  * 21/9/12
  * 	- redo as a class
+ * 20/10/14
+ * 	- restrict pointers, so the loop can vectorise
  */
 
 /*
@@ -65,8 +67,8 @@ G_DEFINE_TYPE( VipsLabS2LabQ, vips_LabS2LabQ, VIPS_TYPE_COLOUR_CODE );
 static void
 vips_LabS2LabQ_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 {
-	signed short *p = (signed short *) in[0];
-	unsigned char *q = (unsigned char *) out;
+	signed short * restrict p = (signed short *) in[0];
+	unsigned char * restrict q = (unsigned char *) out;
 
 	int i;
 	int l, a, b;
@@ -19,6 +19,8 @@
  * 	- fix a race in the table build
  * 19/9/12
  * 	- redone as a class
+ * 20/10/14
+ * 	- add a fast path with no LUT, see vips_colour_set_fast()
  */
 
 /*
@@ -107,10 +109,11 @@ table_init( void *client )
 	return( NULL );
 }
 
-/* Process a buffer of data.
+/* Process a buffer of data with the cbrt LUT.
  */
 static void
-vips_XYZ2Lab_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
+vips_XYZ2Lab_line_table( VipsColour *colour, 
+	VipsPel *out, VipsPel **in, int width )
 {
 	static GOnce once = G_ONCE_INIT;
 
@@ -152,6 +155,40 @@ vips_XYZ2Lab_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 	}
 }
 
+/* Compute the cube root directly, see vips__col_cbrt(). Within 1e-6 of the 
+ * LUT for XYZ between black and white, so within 1e-3 in Lab.
+ */
+static void
+vips_XYZ2Lab_line_vector( VipsColour *colour, 
+	VipsPel *out, VipsPel **in, int width )
+{
+	VipsXYZ2Lab *XYZ2Lab = (VipsXYZ2Lab *) colour;
+	float * restrict p = (float *) in[0];
+	float * restrict q = (float *) out;
+	float rX0 = 1.0 / XYZ2Lab->X0;
+	float rY0 = 1.0 / XYZ2Lab->Y0;
+	float rZ0 = 1.0 / XYZ2Lab->Z0;
+
+	int x;
+
+	for( x = 0; x < width; x++ ) {
+		vips__col_XYZ2Lab_vector( p[0], p[1], p[2], rX0, rY0, rZ0, 
+			&q[0], &q[1], &q[2] );
+
+		p += 3;
+		q += 3;
+	}
+}
+
+static void
+vips_XYZ2Lab_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
+{
+	if( vips_colour_get_fast() )
+		vips_XYZ2Lab_line_vector( colour, out, in, width );
+	else
+		vips_XYZ2Lab_line_table( colour, out, in, width );
+}
+
 /**
  * vips_col_XYZ2Lab:
  * @X: Input CIE XYZ colour
@@ -180,7 +217,7 @@ vips_col_XYZ2Lab( float X, float Y, float Z, float *L, float *a, float *b )
 	XYZ2Lab.X0 = VIPS_D65_X0;
 	XYZ2Lab.Y0 = VIPS_D65_Y0;
 	XYZ2Lab.Z0 = VIPS_D65_Z0;
-	vips_XYZ2Lab_line( (VipsColour *) &XYZ2Lab, 
+	vips_XYZ2Lab_line_table( (VipsColour *) &XYZ2Lab, 
 		(VipsPel *) out, (VipsPel **) &x, 1 );
 	*L = out[0];
 	*a = out[1];
@@ -257,6 +294,11 @@ vips_XYZ2Lab_init( VipsXYZ2Lab *XYZ2Lab )
  * Turn XYZ to Lab, optionally specifying the colour temperature. @temp
  * defaults to D65. 
  *
+ * The cube root is interpolated from a table. After 
+ * vips_colour_set_fast(), it's computed directly instead. For colours 
+ * between black and white the two paths differ by less than 0.001 in L, a 
+ * and b.
+ *
  * Returns: 0 on success, -1 on error.
  */
 int
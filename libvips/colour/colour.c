@@ -241,17 +241,115 @@
  * Areas under curves for black body at 3250K, 2 degree observer.
  */
 
+/* Set by the --vips-fast-colour switch, the VIPS_FAST_COLOUR env var and
+ * vips_colour_set_fast().
+ */
+gboolean vips__fast_colour = FALSE;
+
+/**
+ * vips_colour_set_fast:
+ * @fast: %TRUE to use the fast paths
+ *
+ * vips_XYZ2Lab() and vips_scRGB2sRGB() normally interpolate the cube root 
+ * and the sRGB gamma from tables. Set @fast to compute them directly 
+ * instead, with loops the compiler can vectorise. This is quicker, but
+ * results can change slightly: Lab differs by less than 0.001 for colours 
+ * between black and white, and 8- and 16-bit sRGB by up to 1. 
+ *
+ * This is off by default, so results don't depend on the machine or the 
+ * build. It's independent of vips_vector_set_enabled(). You can also turn 
+ * it on with the `--vips-fast-colour` command-line switch, or by setting 
+ * the environment variable `VIPS_FAST_COLOUR`.
+ *
+ * See also: vips_colour_get_fast().
+ */
+void
+vips_colour_set_fast( gboolean fast )
+{
+	vips__fast_colour = fast;
+}
+
+/**
+ * vips_colour_get_fast:
+ *
+ * See vips_colour_set_fast().
+ *
+ * Returns: %TRUE if colour operations are using the fast paths.
+ */
+gboolean
+vips_colour_get_fast( void )
+{
+	return( vips__fast_colour );
+}
+
 G_DEFINE_ABSTRACT_TYPE( VipsColour, vips_colour, VIPS_TYPE_OPERATION );
 
 /* Maximum number of input images -- why not?
  */
 #define MAX_INPUT_IMAGES (64)
 
+/* Per-thread state: the input regions, plus a line buffer for each LABQ 
+ * input we unpack.
+ */
+typedef struct _VipsColourSequence {
+	VipsRegion **ir;
+	float **buf;
+} VipsColourSequence;
+
+static int
+vips_colour_stop( void *vseq, void *a, void *b )
+{
+	VipsColourSequence *seq = (VipsColourSequence *) vseq;
+	VipsColour *colour = VIPS_COLOUR( b ); 
+
+	int i;
+
+	if( seq->ir ) 
+		vips_stop_many( seq->ir, a, b );
+	if( seq->buf ) {
+		for( i = 0; i < colour->n; i++ )
+			VIPS_FREE( seq->buf[i] );
+		VIPS_FREE( seq->buf );
+	}
+	g_free( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_colour_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage **in = (VipsImage **) a;
+	VipsColour *colour = VIPS_COLOUR( b ); 
+
+	VipsColourSequence *seq;
+	int i;
+
+	seq = g_new0( VipsColourSequence, 1 );
+	if( !(seq->ir = vips_start_many( out, a, b )) ) {
+		vips_colour_stop( seq, a, b );
+		return( NULL );
+	}
+
+	seq->buf = g_new0( float *, colour->n );
+	for( i = 0; in[i]; i++ ) 
+		if( colour->decode_labq &&
+			in[i]->Coding == VIPS_CODING_LABQ &&
+			!(seq->buf[i] = 
+				VIPS_ARRAY( NULL, 3 * out->Xsize, float )) ) {
+			vips_colour_stop( seq, a, b );
+			return( NULL );
+		}
+
+	return( (void *) seq );
+}
+
 static int
 vips_colour_gen( VipsRegion *or, 
-	void *seq, void *a, void *b, gboolean *stop )
+	void *vseq, void *a, void *b, gboolean *stop )
 {
-	VipsRegion **ir = (VipsRegion **) seq;
+	VipsColourSequence *seq = (VipsColourSequence *) vseq;
+	VipsRegion **ir = seq->ir;
 	VipsColour *colour = VIPS_COLOUR( b ); 
 	VipsColourClass *class = VIPS_COLOUR_GET_CLASS( colour ); 
 	VipsRect *r = &or->valid;
@@ -266,8 +364,17 @@ vips_colour_gen( VipsRegion *or,
 	VIPS_GATE_START( "vips_colour_gen: work" ); 
 
 	for( y = 0; y < r->height; y++ ) {
-		for( i = 0; ir[i]; i++ )
+		for( i = 0; ir[i]; i++ ) {
 			p[i] = VIPS_REGION_ADDR( ir[i], r->left, r->top + y );
+
+			/* Unpack LABQ inputs as we go.
+			 */
+			if( seq->buf[i] ) {
+				vips__LabQ2Lab_vec( seq->buf[i], 
+					p[i], r->width );
+				p[i] = (VipsPel *) seq->buf[i];
+			}
+		}
 		p[i] = NULL;
 		q = VIPS_REGION_ADDR( or, r->left, r->top + y );
 
@@ -342,6 +449,15 @@ vips_colour_build( VipsObject *object )
 			vips_object_local_array( object, colour->n );
 
 		for( i = 0; i < colour->n; i++ ) {
+			/* LABQ inputs we unpack have no extra bands.
+			 */
+			if( colour->decode_labq &&
+				in[i]->Coding == VIPS_CODING_LABQ ) {
+				new_in[i] = in[i];
+				g_object_ref( new_in[i] );
+				continue;
+			}
+
 			if( vips_check_bands_atleast( class->nickname, 
 				in[i], colour->input_bands ) )
 				return( -1 ); 
@@ -382,7 +498,7 @@ vips_colour_build( VipsObject *object )
 		}
 
 	if( vips_image_generate( out,
-		vips_start_many, vips_colour_gen, vips_stop_many, 
+		vips_colour_start, vips_colour_gen, vips_colour_stop, 
 		in, colour ) ) {
 		g_object_unref( out );
 		return( -1 );
@@ -467,9 +583,15 @@ vips_colour_space_build( VipsObject *object )
 	VipsColourSpace *space = VIPS_COLOUR_SPACE( object );
 	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
 
-	/* We only process float.
+	/* We only process float. LABQ is unpacked to float as we read it.
 	 */
-	if( vips_cast_float( space->in, &t[0], NULL ) )
+	if( space->in &&
+		space->in->Coding == VIPS_CODING_LABQ ) {
+		colour->decode_labq = TRUE;
+		t[0] = space->in;
+		g_object_ref( t[0] );
+	}
+	else if( vips_cast_float( space->in, &t[0], NULL ) )
 		return( -1 );
 
 	/* We always do 3 bands -> 3 bands. 
@@ -534,22 +656,31 @@ vips_colour_code_build( VipsObject *object )
 
 	in = code->in;
 
-	/* If this is a LABQ and the coder wants uncoded, unpack.
+	/* If this is a LABQ and the coder wants uncoded, unpack. If it just 
+	 * wants float, we can unpack a line at a time as we read.
 	 */
 	if( in && 
 		in->Coding == VIPS_CODING_LABQ &&
 		code->input_coding == VIPS_CODING_NONE ) {
-		if( vips_LabQ2Lab( in, &t[0], NULL ) )
-			return( -1 );
-		in = t[0];
+		if( code->input_format == VIPS_FORMAT_FLOAT &&
+			code->input_interpretation == 
+				VIPS_INTERPRETATION_ERROR ) 
+			colour->decode_labq = TRUE;
+		else {
+			if( vips_LabQ2Lab( in, &t[0], NULL ) )
+				return( -1 );
+			in = t[0];
+		}
 	}
 
 	if( in && 
+		!colour->decode_labq &&
 		vips_check_coding( VIPS_OBJECT_CLASS( class )->nickname,
 			in, code->input_coding ) )
 		return( -1 );
 
 	if( in &&
+		!colour->decode_labq &&
 		code->input_coding == VIPS_CODING_NONE &&
 		code->input_format != VIPS_FORMAT_NOTSET ) {
 		if( vips_cast( in, &t[3], code->input_format, NULL ) )
@@ -558,6 +689,7 @@ vips_colour_code_build( VipsObject *object )
 	}
 
 	if( in &&
+		!colour->decode_labq &&
 		code->input_coding == VIPS_CODING_NONE &&
 		code->input_interpretation != VIPS_INTERPRETATION_ERROR ) {
 		if( vips_colourspace( in, &t[4], 
@@ -622,37 +754,41 @@ vips_colour_difference_build( VipsObject *object )
 	left = difference->left;
 	right = difference->right;
 
-	if( left ) {
-		if( vips_image_decode( left, &t[0] ) )
-			return( -1 );
-		left = t[0];
-	}
-
-	if( right ) {
-		if( vips_image_decode( right, &t[1] ) )
-			return( -1 );
-		right = t[1];
-	}
+	/* If we want Lab, LABQ inputs can be unpacked a line at a time as we
+	 * read them.
+	 */
+	if( left && 
+		right &&
+		difference->interpretation == VIPS_INTERPRETATION_LAB &&
+		(left->Coding == VIPS_CODING_LABQ ||
+		 right->Coding == VIPS_CODING_LABQ) )
+		colour->decode_labq = TRUE;
 
 	/* Detach and reattach any extra bands. 
 	 */
 	colour->input_bands = 3;
 
-	if( vips_colourspace( left, &t[6], difference->interpretation, NULL ) )
-		return( -1 );
-	left = t[6];
-	if( vips_colourspace( right, &t[7], difference->interpretation, NULL ) )
-		return( -1 );
-	right = t[7];
+	if( left &&
+		!(colour->decode_labq && left->Coding == VIPS_CODING_LABQ) ) {
+		/* We only process float.
+		 */
+		if( vips_image_decode( left, &t[0] ) ||
+			vips_colourspace( t[0], &t[6], 
+				difference->interpretation, NULL ) ||
+			vips_cast_float( t[6], &t[8], NULL ) )
+			return( -1 );
+		left = t[8];
+	}
 
-	/* We only process float.
-	 */
-	if( vips_cast_float( left, &t[8], NULL ) )
-		return( -1 );
-	left = t[8];
-	if( vips_cast_float( right, &t[9], NULL ) )
-		return( -1 );
-	right = t[9];
+	if( right &&
+		!(colour->decode_labq && right->Coding == VIPS_CODING_LABQ) ) {
+		if( vips_image_decode( right, &t[1] ) ||
+			vips_colourspace( t[1], &t[7], 
+				difference->interpretation, NULL ) ||
+			vips_cast_float( t[7], &t[9], NULL ) )
+			return( -1 );
+		right = t[9];
+	}
 
 	if( vips__sizealike( left, right, &t[10], &t[11] ) )
 		return( -1 );
@@ -740,6 +876,11 @@ vips_colour_operation_init( void )
 	extern GType vips_scRGB2XYZ_get_type( void ); 
 	extern GType vips_XYZ2scRGB_get_type( void ); 
 	extern GType vips_scRGB2sRGB_get_type( void ); 
+	extern GType vips_sRGB2Lab_get_type( void ); 
+	extern GType vips_sRGB2LCh_get_type( void ); 
+	extern GType vips_Lab2sRGB_get_type( void ); 
+	extern GType vips_LCh2sRGB_get_type( void ); 
+	extern GType vips_lut3d_get_type( void ); 
 #if defined(HAVE_LCMS) || defined(HAVE_LCMS2)
 	extern GType vips_icc_import_get_type( void ); 
 	extern GType vips_icc_export_get_type( void ); 
@@ -747,6 +888,7 @@ vips_colour_operation_init( void )
 #endif
 	extern GType vips_dE76_get_type( void ); 
 	extern GType vips_dE00_get_type( void ); 
+	extern GType vips_dE00_stats_get_type( void ); 
 	extern GType vips_dECMC_get_type( void ); 
 
 	vips_colourspace_get_type();
@@ -771,12 +913,18 @@ vips_colour_operation_init( void )
 	vips_scRGB2XYZ_get_type();
 	vips_XYZ2scRGB_get_type();
 	vips_scRGB2sRGB_get_type();
+	vips_sRGB2Lab_get_type();
+	vips_sRGB2LCh_get_type();
+	vips_Lab2sRGB_get_type();
+	vips_LCh2sRGB_get_type();
+	vips_lut3d_get_type();
 #if defined(HAVE_LCMS) || defined(HAVE_LCMS2)
 	vips_icc_import_get_type();
 	vips_icc_export_get_type();
 	vips_icc_transform_get_type();
 #endif
 	vips_dE76_get_type(); 
-	vips_dE00_get_type(); 
+	vips_dE00_get_type();
+	vips_dE00_stats_get_type();
 	vips_dECMC_get_type(); 
 }
@@ -14,6 +14,11 @@
  * 	- oops, don't treat RGB16 as sRGB
  * 9/9/14	
  * 	- mono <-> rgb converters were not handling extra bands, thanks James
+ * 20/10/14
+ * 	- use the fused sRGB <-> Lab / LCh converters where we can
+ * 	- add VipsColourPipeline: resolve a route once, then run it as a 
+ * 	  single pass
+ * 	- skip a leading LabQ2Lab, colour ops unpack LABQ as they read
  */
 
 /*
@@ -54,6 +59,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <vips/vips.h>
@@ -223,9 +229,8 @@ static VipsColourRoute vips_colour_routes[] = {
 	{ LAB, CMC, { vips_Lab2LCh, vips_LCh2CMC, NULL } },
 	{ LAB, LABS, { vips_Lab2LabS, NULL } },
 	{ LAB, scRGB, { vips_Lab2XYZ, vips_XYZ2scRGB, NULL } },
-	{ LAB, sRGB, { vips_Lab2XYZ, vips_XYZ2scRGB, vips_scRGB2sRGB, NULL } },
-	{ LAB, BW, { vips_Lab2XYZ, vips_XYZ2scRGB, vips_scRGB2sRGB, 
-		vips_sRGB2BW, NULL } },
+	{ LAB, sRGB, { vips_Lab2sRGB, NULL } },
+	{ LAB, BW, { vips_Lab2sRGB, vips_sRGB2BW, NULL } },
 	{ LAB, RGB16, { vips_Lab2XYZ, vips_XYZ2scRGB, 
 		vips_scRGB2RGB16, NULL } },
 	{ LAB, GREY16, { vips_Lab2XYZ, vips_XYZ2scRGB, 
@@ -252,10 +257,8 @@ static VipsColourRoute vips_colour_routes[] = {
 	{ LCH, CMC, { vips_LCh2CMC, NULL } },
 	{ LCH, LABS, { vips_LCh2Lab, vips_Lab2LabS, NULL } },
 	{ LCH, scRGB, { vips_LCh2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, NULL } },
-	{ LCH, sRGB, { vips_LCh2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2sRGB, NULL } },
-	{ LCH, BW, { vips_LCh2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2sRGB, vips_sRGB2BW, NULL } },
+	{ LCH, sRGB, { vips_LCh2sRGB, NULL } },
+	{ LCH, BW, { vips_LCh2sRGB, vips_sRGB2BW, NULL } },
 	{ LCH, RGB16, { vips_LCh2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
 		vips_scRGB2RGB16, NULL } },
 	{ LCH, GREY16, { vips_LCh2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
@@ -269,10 +272,8 @@ static VipsColourRoute vips_colour_routes[] = {
 	{ CMC, LABS, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2LabS, NULL } },
 	{ CMC, scRGB, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, 
 		vips_XYZ2scRGB, NULL } },
-	{ CMC, sRGB, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, 
-		vips_XYZ2scRGB, vips_scRGB2sRGB, NULL } },
-	{ CMC, BW, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, 
-		vips_XYZ2scRGB, vips_scRGB2sRGB, vips_sRGB2BW, NULL } },
+	{ CMC, sRGB, { vips_CMC2LCh, vips_LCh2sRGB, NULL } },
+	{ CMC, BW, { vips_CMC2LCh, vips_LCh2sRGB, vips_sRGB2BW, NULL } },
 	{ CMC, RGB16, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, 
 		vips_XYZ2scRGB, vips_scRGB2RGB16, NULL } },
 	{ CMC, GREY16, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, 
@@ -286,10 +287,8 @@ static VipsColourRoute vips_colour_routes[] = {
 	{ LABS, LCH, { vips_LabS2Lab, vips_Lab2LCh, NULL } },
 	{ LABS, CMC, { vips_LabS2Lab, vips_Lab2LCh, vips_LCh2CMC, NULL } },
 	{ LABS, scRGB, { vips_LabS2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, NULL } },
-	{ LABS, sRGB, { vips_LabS2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2sRGB, NULL } },
-	{ LABS, BW, { vips_LabS2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2sRGB, vips_sRGB2BW, NULL } },
+	{ LABS, sRGB, { vips_LabS2Lab, vips_Lab2sRGB, NULL } },
+	{ LABS, BW, { vips_LabS2Lab, vips_Lab2sRGB, vips_sRGB2BW, NULL } },
 	{ LABS, RGB16, { vips_LabS2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
 		vips_scRGB2RGB16, NULL } },
 	{ LABS, GREY16, { vips_LabS2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
@@ -310,72 +309,57 @@ static VipsColourRoute vips_colour_routes[] = {
 	{ scRGB, YXY, { vips_scRGB2XYZ, vips_XYZ2Yxy, NULL } },
 
 	{ sRGB, XYZ, { vips_sRGB2scRGB, vips_scRGB2XYZ, NULL } },
-	{ sRGB, LAB, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, NULL } },
-	{ sRGB, LABQ, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LabQ, NULL } },
-	{ sRGB, LCH, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LCh, NULL } },
-	{ sRGB, CMC, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LCh, vips_LCh2CMC, NULL } },
+	{ sRGB, LAB, { vips_sRGB2Lab, NULL } },
+	{ sRGB, LABQ, { vips_sRGB2Lab, vips_Lab2LabQ, NULL } },
+	{ sRGB, LCH, { vips_sRGB2LCh, NULL } },
+	{ sRGB, CMC, { vips_sRGB2LCh, vips_LCh2CMC, NULL } },
 	{ sRGB, scRGB, { vips_sRGB2scRGB, NULL } },
 	{ sRGB, BW, { vips_sRGB2BW, NULL } },
-	{ sRGB, LABS, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LabS, NULL } },
+	{ sRGB, LABS, { vips_sRGB2Lab, vips_Lab2LabS, NULL } },
 	{ sRGB, RGB16, { vips_sRGB2scRGB, vips_scRGB2RGB16, NULL } },
 	{ sRGB, GREY16, { vips_sRGB2scRGB, vips_scRGB2RGB16, 
 		vips_RGB162GREY16, NULL } },
 	{ sRGB, YXY, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Yxy, NULL } },
 
 	{ RGB16, XYZ, { vips_sRGB2scRGB, vips_scRGB2XYZ, NULL } },
-	{ RGB16, LAB, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, NULL } },
-	{ RGB16, LABQ, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LabQ, NULL } },
-	{ RGB16, LCH, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LCh, NULL } },
-	{ RGB16, CMC, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LCh, vips_LCh2CMC, NULL } },
+	{ RGB16, LAB, { vips_sRGB2Lab, NULL } },
+	{ RGB16, LABQ, { vips_sRGB2Lab, vips_Lab2LabQ, NULL } },
+	{ RGB16, LCH, { vips_sRGB2LCh, NULL } },
+	{ RGB16, CMC, { vips_sRGB2LCh, vips_LCh2CMC, NULL } },
 	{ RGB16, scRGB, { vips_sRGB2scRGB, NULL } },
 	{ RGB16, sRGB, { vips_sRGB2scRGB, vips_scRGB2sRGB, NULL } },
 	{ RGB16, BW, { vips_sRGB2scRGB, vips_scRGB2sRGB, vips_sRGB2BW, NULL } },
-	{ RGB16, LABS, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LabS, NULL } },
+	{ RGB16, LABS, { vips_sRGB2Lab, vips_Lab2LabS, NULL } },
 	{ RGB16, GREY16, { vips_RGB162GREY16, NULL } },
 	{ RGB16, YXY, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Yxy, NULL } },
 
 	{ GREY16, XYZ, { vips_GREY162RGB16, vips_sRGB2scRGB, 
 		vips_scRGB2XYZ, NULL } },
-	{ GREY16, LAB, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, NULL } },
-	{ GREY16, LABQ, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LabQ, NULL } },
-	{ GREY16, LCH, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LCh, NULL } },
-	{ GREY16, CMC, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LCh, vips_LCh2CMC, NULL } },
+	{ GREY16, LAB, { vips_GREY162RGB16, vips_sRGB2Lab, NULL } },
+	{ GREY16, LABQ, { vips_GREY162RGB16, vips_sRGB2Lab, 
+		vips_Lab2LabQ, NULL } },
+	{ GREY16, LCH, { vips_GREY162RGB16, vips_sRGB2LCh, NULL } },
+	{ GREY16, CMC, { vips_GREY162RGB16, vips_sRGB2LCh, 
+		vips_LCh2CMC, NULL } },
 	{ GREY16, scRGB, { vips_GREY162RGB16, vips_sRGB2scRGB, NULL } },
 	{ GREY16, sRGB, { vips_GREY162RGB16, vips_sRGB2scRGB, 
 		vips_scRGB2sRGB, NULL } },
 	{ GREY16, BW, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2sRGB, 
 		vips_sRGB2BW, NULL } },
-	{ GREY16, LABS, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LabS, NULL } },
+	{ GREY16, LABS, { vips_GREY162RGB16, vips_sRGB2Lab, 
+		vips_Lab2LabS, NULL } },
 	{ GREY16, RGB16, { vips_GREY162RGB16, NULL } },
 	{ GREY16, YXY, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2XYZ, 
 		vips_XYZ2Yxy, NULL } },
 
 	{ BW, XYZ, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, NULL } },
-	{ BW, LAB, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, NULL } },
-	{ BW, LABQ, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LabQ, NULL } },
-	{ BW, LCH, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LCh, NULL } },
-	{ BW, CMC, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LCh, vips_LCh2CMC, NULL } },
+	{ BW, LAB, { vips_BW2sRGB, vips_sRGB2Lab, NULL } },
+	{ BW, LABQ, { vips_BW2sRGB, vips_sRGB2Lab, vips_Lab2LabQ, NULL } },
+	{ BW, LCH, { vips_BW2sRGB, vips_sRGB2LCh, NULL } },
+	{ BW, CMC, { vips_BW2sRGB, vips_sRGB2LCh, vips_LCh2CMC, NULL } },
 	{ BW, scRGB, { vips_BW2sRGB, vips_sRGB2scRGB, NULL } },
 	{ BW, sRGB, { vips_BW2sRGB, NULL } },
-	{ BW, LABS, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LabS, NULL } },
+	{ BW, LABS, { vips_BW2sRGB, vips_sRGB2Lab, vips_Lab2LabS, NULL } },
 	{ BW, RGB16, { vips_BW2sRGB, vips_sRGB2scRGB, 
 		vips_scRGB2RGB16, NULL } },
 	{ BW, GREY16, { vips_BW2sRGB, vips_sRGB2scRGB, 
@@ -400,6 +384,30 @@ static VipsColourRoute vips_colour_routes[] = {
 		vips_scRGB2RGB16, vips_RGB162GREY16, NULL } }
 };
 
+/* Find the route between two spaces, or NULL.
+ */
+static VipsColourRoute *
+vips_colour_route_find( VipsInterpretation from, VipsInterpretation to )
+{
+	int i;
+
+	for( i = 0; i < VIPS_NUMBER( vips_colour_routes ); i++ )
+		if( vips_colour_routes[i].from == from &&
+			vips_colour_routes[i].to == to )
+			return( &vips_colour_routes[i] );
+
+	return( NULL );
+}
+
+static void
+vips_colour_route_error( VipsInterpretation from, VipsInterpretation to )
+{
+	vips_error( "vips_colourspace", 
+		_( "no known route between '%s' and '%s'" ),
+		vips_enum_nick( VIPS_TYPE_INTERPRETATION, from ),
+		vips_enum_nick( VIPS_TYPE_INTERPRETATION, to ) );
+}
+
 /* Is an image in a supported colourspace.
  */
 
@@ -452,7 +460,8 @@ vips_colourspace_build( VipsObject *object )
 {
 	VipsColourspace *colourspace = (VipsColourspace *) object; 
 
-	int i, j;
+	int j;
+	VipsColourRoute *route;
 	VipsImage *x;
 	VipsImage **t = (VipsImage **) 
 		vips_object_local_array( object, 1 );
@@ -497,22 +506,23 @@ vips_colourspace_build( VipsObject *object )
 		return( vips_image_write( colourspace->in, colourspace->out ) );
 	}
 
-	for( i = 0; i < VIPS_NUMBER( vips_colour_routes ); i++ )
-		if( vips_colour_routes[i].from == interpretation &&
-			vips_colour_routes[i].to == colourspace->space )
-			break;
-	if( i == VIPS_NUMBER( vips_colour_routes ) ) {
-		vips_error( "vips_colourspace", 
-			_( "no known route between '%s' and '%s'" ),
-			vips_enum_nick( VIPS_TYPE_INTERPRETATION, 
-				interpretation ),
-			vips_enum_nick( VIPS_TYPE_INTERPRETATION, 
-				colourspace->space ) );
+	if( !(route = vips_colour_route_find( interpretation, 
+		colourspace->space )) ) {
+		vips_colour_route_error( interpretation, colourspace->space );
 		return( -1 );
 	}
 
-	for( j = 0; vips_colour_routes[i].route[j]; j++ ) {
-		if( vips_colour_routes[i].route[j]( x, &pipe[j], NULL ) ) 
+	/* Colour operations unpack LABQ themselves as they read it, so we can
+	 * skip a leading LabQ2Lab if something follows it.
+	 */
+	j = 0;
+	if( x->Coding == VIPS_CODING_LABQ &&
+		route->route[0] == vips_LabQ2Lab &&
+		route->route[1] )
+		j = 1;
+
+	for( ; route->route[j]; j++ ) {
+		if( route->route[j]( x, &pipe[j], NULL ) ) 
 			return( -1 );
 		x = pipe[j];
 	}
@@ -594,7 +604,7 @@ vips_colourspace_init( VipsColourspace *colourspace )
  * convert with vips_Yxy2XYZ() and vips_XYZ2Lab().
  *
  * See also: vips_colourspace_issupported(),
- * vips_image_guess_interpretation().
+ * vips_image_guess_interpretation(), vips_colour_pipeline_new().
  *
  * Returns: 0 on success, -1 on error.
  */
@@ -611,3 +621,599 @@ vips_colourspace( VipsImage *in, VipsImage **out,
 
 	return( result );
 }
+
+/* A compiled step in a VipsColourPipeline. 
+ */
+typedef struct _VipsColourStage VipsColourStage;
+
+typedef void (*VipsColourStageFn)( VipsColourStage *stage, 
+	VipsPel *out, VipsPel *in, int width );
+
+struct _VipsColourStage {
+	VipsColourStageFn fn;
+
+	/* The built operation whose process_line we run, or NULL for band
+	 * shuffles.
+	 */
+	VipsColour *colour;
+
+	/* Element size, for band shuffles.
+	 */
+	int esize;
+};
+
+/* How we compile each of the transform functions in the route table. 
+ */
+typedef struct _VipsColourStep {
+	VipsColourTransformFn fn;
+
+	/* Build this operation and use its process_line.
+	 */
+	const char *nickname;
+	int depth;
+
+	/* Or move bands about: 3 means pick G from RGB, 1 means copy mono 
+	 * out to RGB.
+	 */
+	int shuffle;
+} VipsColourStep;
+
+static VipsColourStep vips_colour_steps[] = {
+	{ vips_XYZ2Lab, "XYZ2Lab" },
+	{ vips_XYZ2scRGB, "XYZ2scRGB" },
+	{ vips_XYZ2Yxy, "XYZ2Yxy" },
+	{ vips_Yxy2XYZ, "Yxy2XYZ" },
+	{ vips_Lab2XYZ, "Lab2XYZ" },
+	{ vips_Lab2LabQ, "Lab2LabQ" },
+	{ vips_Lab2LCh, "Lab2LCh" },
+	{ vips_Lab2LabS, "Lab2LabS" },
+	{ vips_Lab2sRGB, "Lab2sRGB" },
+	{ vips_LabQ2Lab, "LabQ2Lab" },
+	{ vips_LabQ2LabS, "LabQ2LabS" },
+	{ vips_LabQ2sRGB, "LabQ2sRGB" },
+	{ vips_LabS2Lab, "LabS2Lab" },
+	{ vips_LabS2LabQ, "LabS2LabQ" },
+	{ vips_LCh2Lab, "LCh2Lab" },
+	{ vips_LCh2CMC, "LCh2CMC" },
+	{ vips_LCh2sRGB, "LCh2sRGB" },
+	{ vips_CMC2LCh, "CMC2LCh" },
+	{ vips_scRGB2XYZ, "scRGB2XYZ" },
+	{ vips_scRGB2sRGB, "scRGB2sRGB" },
+	{ vips_scRGB2RGB16, "scRGB2sRGB", 16 },
+	{ vips_sRGB2scRGB, "sRGB2scRGB" },
+	{ vips_sRGB2Lab, "sRGB2Lab" },
+	{ vips_sRGB2LCh, "sRGB2LCh" },
+	{ vips_sRGB2BW, NULL, 0, 3 },
+	{ vips_RGB162GREY16, NULL, 0, 3 },
+	{ vips_BW2sRGB, NULL, 0, 1 },
+	{ vips_GREY162RGB16, NULL, 0, 1 }
+};
+
+static void
+vips_colour_stage_colour( VipsColourStage *stage, 
+	VipsPel *out, VipsPel *in, int width )
+{
+	VipsColourClass *class = VIPS_COLOUR_GET_CLASS( stage->colour );
+
+	VipsPel *p[2];
+
+	p[0] = in;
+	p[1] = NULL;
+	class->process_line( stage->colour, out, p, width );
+}
+
+static void
+vips_colour_stage_pick( VipsColourStage *stage, 
+	VipsPel *out, VipsPel *in, int width )
+{
+	int es = stage->esize;
+
+	int x;
+
+	for( x = 0; x < width; x++ ) 
+		memcpy( out + x * es, in + (x * 3 + 1) * es, es );
+}
+
+static void
+vips_colour_stage_replicate( VipsColourStage *stage, 
+	VipsPel *out, VipsPel *in, int width )
+{
+	int es = stage->esize;
+
+	int x;
+
+	for( x = 0; x < width; x++ ) {
+		memcpy( out, in, es );
+		memcpy( out + es, in, es );
+		memcpy( out + 2 * es, in, es );
+		out += 3 * es;
+		in += es;
+	}
+}
+
+G_DEFINE_TYPE( VipsColourPipeline, vips_colour_pipeline, VIPS_TYPE_OBJECT );
+
+static void
+vips_colour_pipeline_free_stages( VipsColourPipeline *pipeline )
+{
+	int i;
+
+	for( i = 0; i < pipeline->n; i++ ) 
+		if( pipeline->stages[i].colour ) {
+			VipsObject *object = 
+				VIPS_OBJECT( pipeline->stages[i].colour );
+
+			vips_object_unref_outputs( object );
+			VIPS_UNREF( pipeline->stages[i].colour );
+		}
+
+	pipeline->n = 0;
+}
+
+static void
+vips_colour_pipeline_dispose( GObject *gobject )
+{
+	VipsColourPipeline *pipeline = (VipsColourPipeline *) gobject;
+
+	vips_colour_pipeline_free_stages( pipeline );
+
+	G_OBJECT_CLASS( vips_colour_pipeline_parent_class )->
+		dispose( gobject );
+}
+
+/* The format and bands images in each space usually have. 
+ */
+static VipsBandFormat
+vips_colour_pipeline_format( VipsInterpretation interpretation )
+{
+	switch( interpretation ) {
+	case VIPS_INTERPRETATION_sRGB:
+	case VIPS_INTERPRETATION_B_W:
+	case VIPS_INTERPRETATION_LABQ:
+		return( VIPS_FORMAT_UCHAR );
+
+	case VIPS_INTERPRETATION_RGB16:
+	case VIPS_INTERPRETATION_GREY16:
+		return( VIPS_FORMAT_USHORT );
+
+	case VIPS_INTERPRETATION_LABS:
+		return( VIPS_FORMAT_SHORT );
+
+	default:
+		return( VIPS_FORMAT_FLOAT );
+	}
+}
+
+static int
+vips_colour_pipeline_bands( VipsInterpretation interpretation )
+{
+	switch( interpretation ) {
+	case VIPS_INTERPRETATION_B_W:
+	case VIPS_INTERPRETATION_GREY16:
+		return( 1 );
+
+	case VIPS_INTERPRETATION_LABQ:
+		return( 4 );
+
+	default:
+		return( 3 );
+	}
+}
+
+/* Compile one step of the route, taking @in and making @out. Return 1 if 
+ * this step can't be run as a line function, -1 for error.
+ */
+static int
+vips_colour_pipeline_compile_step( VipsColourPipeline *pipeline, 
+	VipsColourTransformFn fn, VipsImage *in, VipsImage **out )
+{
+	VipsColourStage *stage = &pipeline->stages[pipeline->n];
+
+	VipsColourStep *step;
+	int i;
+
+	step = NULL;
+	for( i = 0; i < VIPS_NUMBER( vips_colour_steps ); i++ )
+		if( vips_colour_steps[i].fn == fn ) {
+			step = &vips_colour_steps[i];
+			break;
+		}
+	if( !step )
+		return( 1 );
+
+	if( step->nickname ) {
+		VipsOperation *operation;
+		VipsColour *colour;
+
+		if( !(operation = vips_operation_new( step->nickname )) )
+			return( -1 );
+		g_object_set( operation, "in", in, NULL );
+		if( step->depth )
+			g_object_set( operation, "depth", step->depth, NULL );
+		if( vips_cache_operation_buildp( &operation ) ) {
+			vips_object_unref_outputs( VIPS_OBJECT( operation ) );
+			g_object_unref( operation );
+			return( -1 );
+		}
+		g_object_get( operation, "out", out, NULL );
+
+		/* We feed the process_line directly, so the operation must
+		 * not be casting or unpacking in front of it.
+		 */
+		colour = VIPS_IS_COLOUR( operation ) ? 
+			VIPS_COLOUR( operation ) : NULL;
+		if( !colour ||
+			colour->n != 1 ||
+			colour->decode_labq ||
+			colour->in[0]->BandFmt != in->BandFmt ||
+			colour->in[0]->Bands != in->Bands ||
+			colour->in[0]->Coding != in->Coding ||
+			(*out)->Bands != colour->bands ) {
+			vips_object_unref_outputs( VIPS_OBJECT( operation ) );
+			g_object_unref( operation );
+
+			return( 1 );
+		}
+
+		stage->fn = vips_colour_stage_colour;
+		stage->colour = colour;
+	}
+	else {
+		if( in->Bands != step->shuffle ||
+			in->Coding != VIPS_CODING_NONE )
+			return( 1 );
+
+		/* Run the transform on the template to get the output
+		 * header.
+		 */
+		if( fn( in, out, NULL ) )
+			return( -1 );
+
+		stage->fn = step->shuffle == 3 ? 
+			vips_colour_stage_pick : vips_colour_stage_replicate;
+		stage->colour = NULL;
+		stage->esize = VIPS_IMAGE_SIZEOF_ELEMENT( in );
+	}
+
+	pipeline->n += 1;
+	pipeline->max_psize = VIPS_MAX( pipeline->max_psize, 
+		VIPS_IMAGE_SIZEOF_PEL( *out ) );
+
+	return( 0 );
+}
+
+static int
+vips_colour_pipeline_build( VipsObject *object )
+{
+	VipsColourPipeline *pipeline = (VipsColourPipeline *) object;
+	VipsImage **t = (VipsImage **) 
+		vips_object_local_array( object, MAX_STEPS + 3 );
+
+	VipsInterpretation from;
+	VipsColourRoute *route;
+	VipsImage *x;
+	int j;
+
+	if( VIPS_OBJECT_CLASS( vips_colour_pipeline_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	/* As vips_colourspace(), treat RGB as sRGB.
+	 */
+	from = pipeline->from;
+	if( from == VIPS_INTERPRETATION_RGB )
+		from = VIPS_INTERPRETATION_sRGB;
+
+	if( pipeline->format == VIPS_FORMAT_NOTSET )
+		pipeline->format = vips_colour_pipeline_format( from );
+	pipeline->in_bands = vips_colour_pipeline_bands( from );
+	pipeline->in_coding = from == VIPS_INTERPRETATION_LABQ ?
+		VIPS_CODING_LABQ : VIPS_CODING_NONE;
+
+	/* Nothing to compile, _apply() will just copy.
+	 */
+	if( from == pipeline->to ) 
+		return( 0 );
+
+	if( !(route = vips_colour_route_find( from, pipeline->to )) ) {
+		vips_colour_route_error( from, pipeline->to );
+		return( -1 );
+	}
+
+	/* Run the route once on a 1x1 template to build the operations 
+	 * and find the format at each step.
+	 */
+	if( vips_black( &t[0], 1, 1, "bands", pipeline->in_bands, NULL ) ||
+		vips_cast( t[0], &t[1], pipeline->format, NULL ) ||
+		vips_copy( t[1], &t[2], 
+			"interpretation", from, 
+			"coding", pipeline->in_coding, 
+			NULL ) )
+		return( -1 );
+	x = t[2];
+
+	pipeline->stages = VIPS_ARRAY( object, MAX_STEPS, VipsColourStage );
+	pipeline->max_psize = VIPS_IMAGE_SIZEOF_PEL( x );
+
+	for( j = 0; route->route[j]; j++ ) {
+		int result;
+
+		result = vips_colour_pipeline_compile_step( pipeline, 
+			route->route[j], x, &t[j + 3] );
+		if( result == -1 )
+			return( -1 );
+		if( result == 1 ) {
+			/* Not a problem, we'll go via vips_colourspace().
+			 */
+			vips_colour_pipeline_free_stages( pipeline );
+			return( 0 );
+		}
+
+		x = t[j + 3];
+	}
+
+	pipeline->bands = x->Bands;
+	pipeline->out_format = x->BandFmt;
+	pipeline->coding = x->Coding;
+	pipeline->interpretation = x->Type;
+
+	return( 0 );
+}
+
+static void
+vips_colour_pipeline_class_init( VipsColourPipelineClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *vobject_class = VIPS_OBJECT_CLASS( class );
+
+	gobject_class->dispose = vips_colour_pipeline_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	vobject_class->nickname = "colour_pipeline";
+	vobject_class->description = _( "a compiled colourspace route" );
+	vobject_class->build = vips_colour_pipeline_build;
+
+	VIPS_ARG_ENUM( class, "from", 1, 
+		_( "From" ), 
+		_( "Source colour space" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsColourPipeline, from ),
+		VIPS_TYPE_INTERPRETATION, VIPS_INTERPRETATION_sRGB );
+
+	VIPS_ARG_ENUM( class, "to", 2, 
+		_( "To" ), 
+		_( "Destination colour space" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsColourPipeline, to ),
+		VIPS_TYPE_INTERPRETATION, VIPS_INTERPRETATION_LAB );
+
+	VIPS_ARG_ENUM( class, "format", 3, 
+		_( "Format" ), 
+		_( "Format of input images" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsColourPipeline, format ),
+		VIPS_TYPE_BAND_FORMAT, VIPS_FORMAT_NOTSET );
+}
+
+static void
+vips_colour_pipeline_init( VipsColourPipeline *pipeline )
+{
+	pipeline->from = VIPS_INTERPRETATION_sRGB;
+	pipeline->to = VIPS_INTERPRETATION_LAB;
+	pipeline->format = VIPS_FORMAT_NOTSET;
+}
+
+/**
+ * vips_colour_pipeline_new:
+ * @from: source colour space
+ * @to: destination colour space
+ * @format: format of input images, or #VIPS_FORMAT_NOTSET
+ *
+ * Find the vips_colourspace() route from @from to @to and compile it for
+ * input images in @format. Each step is built once, and 
+ * vips_colour_pipeline_apply() then runs them all over each line of an 
+ * image in a single pass, with no further operations to construct. 
+ *
+ * If @format is #VIPS_FORMAT_NOTSET, the usual format for @from is used, 
+ * for example #VIPS_FORMAT_UCHAR for #VIPS_INTERPRETATION_sRGB.
+ *
+ * Free the pipeline with g_object_unref().
+ *
+ * See also: vips_colour_pipeline_apply(), vips_colourspace().
+ *
+ * Returns: (transfer full): a new pipeline, or %NULL on error.
+ */
+VipsColourPipeline *
+vips_colour_pipeline_new( VipsInterpretation from, VipsInterpretation to,
+	VipsBandFormat format )
+{
+	VipsColourPipeline *pipeline;
+
+	pipeline = g_object_new( VIPS_TYPE_COLOUR_PIPELINE, NULL );
+	g_object_set( pipeline, 
+		"from", from,
+		"to", to,
+		"format", format,
+		NULL );
+	if( vips_object_build( VIPS_OBJECT( pipeline ) ) ) {
+		g_object_unref( pipeline );
+		return( NULL );
+	}
+
+	return( pipeline );
+}
+
+/* Per-thread state: an input region and a pair of buffers for the 
+ * intermediate lines.
+ */
+typedef struct _VipsColourPipelineSeq {
+	VipsRegion *ir;
+	VipsPel *buf[2];
+} VipsColourPipelineSeq;
+
+static int
+vips_colour_pipeline_stop( void *vseq, void *a, void *b )
+{
+	VipsColourPipelineSeq *seq = (VipsColourPipelineSeq *) vseq;
+
+	VIPS_UNREF( seq->ir );
+	VIPS_FREE( seq->buf[0] );
+	VIPS_FREE( seq->buf[1] );
+	g_free( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_colour_pipeline_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+	VipsColourPipeline *pipeline = (VipsColourPipeline *) b;
+	size_t size = (size_t) in->Xsize * pipeline->max_psize;
+
+	VipsColourPipelineSeq *seq;
+
+	seq = g_new0( VipsColourPipelineSeq, 1 );
+	seq->ir = vips_region_new( in );
+	if( !(seq->buf[0] = vips_malloc( NULL, size )) ||
+		!(seq->buf[1] = vips_malloc( NULL, size )) ) {
+		vips_colour_pipeline_stop( seq, a, b );
+		return( NULL );
+	}
+
+	return( (void *) seq );
+}
+
+static int
+vips_colour_pipeline_gen( VipsRegion *or, 
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsColourPipelineSeq *seq = (VipsColourPipelineSeq *) vseq;
+	VipsColourPipeline *pipeline = (VipsColourPipeline *) b;
+	VipsRect *r = &or->valid;
+
+	int y, i;
+
+	if( vips_region_prepare( seq->ir, r ) )
+		return( -1 );
+
+	VIPS_GATE_START( "vips_colour_pipeline_gen: work" ); 
+
+	for( y = 0; y < r->height; y++ ) {
+		VipsPel *p = VIPS_REGION_ADDR( seq->ir, r->left, r->top + y );
+		VipsPel *q = VIPS_REGION_ADDR( or, r->left, r->top + y );
+
+		for( i = 0; i < pipeline->n; i++ ) {
+			VipsColourStage *stage = &pipeline->stages[i];
+			VipsPel *t = i == pipeline->n - 1 ? 
+				q : seq->buf[i & 1];
+
+			stage->fn( stage, t, p, r->width );
+			p = t;
+		}
+	}
+
+	VIPS_GATE_STOP( "vips_colour_pipeline_gen: work" ); 
+
+	return( 0 );
+}
+
+/* Run the compiled stages on an image with exactly @in_bands bands. 
+ */
+static int
+vips_colour_pipeline_run( VipsColourPipeline *pipeline, 
+	VipsImage *in, VipsImage **out )
+{
+	if( vips_image_pio_input( in ) )
+		return( -1 );
+
+	*out = vips_image_new();
+	if( vips_image_pipelinev( *out, 
+		VIPS_DEMAND_STYLE_THINSTRIP, in, NULL ) ) {
+		VIPS_UNREF( *out );
+		return( -1 );
+	}
+	(*out)->Coding = pipeline->coding;
+	(*out)->Type = pipeline->interpretation;
+	(*out)->BandFmt = pipeline->out_format;
+	(*out)->Bands = pipeline->bands;
+
+	/* The stages must live as long as the image.
+	 */
+	g_object_ref( pipeline );
+	vips_object_local( *out, pipeline );
+
+	if( vips_image_generate( *out,
+		vips_colour_pipeline_start, 
+		vips_colour_pipeline_gen, 
+		vips_colour_pipeline_stop, 
+		in, pipeline ) ) {
+		VIPS_UNREF( *out );
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
+/**
+ * vips_colour_pipeline_apply:
+ * @pipeline: pipeline to run
+ * @in: input image
+ * @out: (out): output image
+ *
+ * Convert @in with the route compiled into @pipeline. The result is the 
+ * same as vips_colourspace() with @source_space set, but there is only a 
+ * single operation per call, not one for each step, plus three more to 
+ * detach and reattach any extra bands.
+ *
+ * @in must be in the format the pipeline was made for, and not have fewer
+ * bands than the space needs. If it doesn't match, or if the route could
+ * not be compiled, this falls back to vips_colourspace().
+ *
+ * See also: vips_colour_pipeline_new(), vips_colourspace().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_colour_pipeline_apply( VipsColourPipeline *pipeline, 
+	VipsImage *in, VipsImage **out )
+{
+	VipsImage *scope;
+	VipsImage **t;
+
+	if( pipeline->n == 0 ||
+		in->BandFmt != pipeline->format ||
+		in->Coding != pipeline->in_coding ||
+		in->Bands < pipeline->in_bands ||
+		(in->Bands > pipeline->in_bands &&
+		 (in->Coding != VIPS_CODING_NONE ||
+		  pipeline->coding != VIPS_CODING_NONE)) )
+		return( vips_colourspace( in, out, pipeline->to, 
+			"source_space", pipeline->from, 
+			NULL ) );
+
+	if( in->Bands == pipeline->in_bands )
+		return( vips_colour_pipeline_run( pipeline, in, out ) );
+
+	/* Detach and reattach extra bands, cast to match, as 
+	 * vips_colour_build() does.
+	 */
+	scope = vips_image_new();
+	t = (VipsImage **) vips_object_local_array( VIPS_OBJECT( scope ), 4 );
+	if( vips_extract_band( in, &t[0], 0, 
+		"n", pipeline->in_bands, 
+		NULL ) ||
+		vips_extract_band( in, &t[1], pipeline->in_bands, 
+			"n", in->Bands - pipeline->in_bands, 
+			NULL ) ||
+		vips_colour_pipeline_run( pipeline, t[0], &t[2] ) ||
+		vips_cast( t[1], &t[3], pipeline->out_format, NULL ) ||
+		vips_bandjoin2( t[2], t[3], out, NULL ) ) {
+		g_object_unref( scope );
+		return( -1 );
+	}
+	g_object_unref( scope );
+
+	return( 0 );
+}
@@ -3,6 +3,10 @@
  * Modified:
  * 31/10/12
  * 	- from dE76.c
+ * 20/10/14
+ * 	- add a fast path with polynomial trig, see vips_colour_set_fast()
+ * 	- take LCh directly, if both inputs are LCh
+ * 	- add vips_dE00_stats()
  */
 
 /*
@@ -37,6 +41,7 @@
 #endif /*HAVE_CONFIG_H*/
 #include <vips/intl.h>
 
+#include <string.h>
 #include <math.h>
 
 #include <vips/vips.h>
@@ -47,6 +52,10 @@
 typedef struct _VipsdE00 {
 	VipsColourDifference parent_instance;
 
+	/* Both inputs are LCh, so we skip the conversion to Lab.
+	 */
+	gboolean LCh;
+
 } VipsdE00;
 
 typedef VipsColourSpaceClass VipsdE00Class;
@@ -204,25 +213,248 @@ vips_col_dE00( float L1, float a1, float b1,
 	return( dE00 );
 }
 
+/* Hue angle in degrees, 0 - 360, from a and b. atan() on the first octant
+ * is a polynomial, the rest is reflections.
+ */
+static inline float
+vips_dE00_ab2h( float a, float b )
+{
+	float aa = fabsf( a );
+	float ab = fabsf( b );
+	float mn = VIPS_MIN( aa, ab );
+	float mx = VIPS_MAX( aa, ab );
+	float t = mn / VIPS_MAX( mx, 1e-30f );
+	float s = t * t;
+	float h;
+
+	h = t * (0.99997726f + s * (-0.33262347f + s * (0.19354346f + 
+		s * (-0.11643287f + s * (0.05265332f + s * -0.01172120f)))));
+	h *= 180.0f / VIPS_PI;
+
+	h = ab > aa ? 90.0f - h : h;
+	h = a < 0.0f ? 180.0f - h : h;
+	h = b < 0.0f ? 360.0f - h : h;
+
+	return( h );
+}
+
+/* sin and cos of @d degrees. Reduce to +/- 45 degrees, evaluate short 
+ * Taylor series, then swap and negate for the quadrant.
+ */
+static inline void
+vips_dE00_sincos( float d, float *s, float *c )
+{
+	int n = (int) floorf( d * (1.0f / 90.0f) + 0.5f );
+	float r = (d - n * 90.0f) * (VIPS_PI / 180.0f);
+	float r2 = r * r;
+	float sp = r * (1.0f + r2 * (-1.0f / 6.0f + r2 * (1.0f / 120.0f + 
+		r2 * (-1.0f / 5040.0f))));
+	float cp = 1.0f + r2 * (-0.5f + r2 * (1.0f / 24.0f + 
+		r2 * (-1.0f / 720.0f + r2 * (1.0f / 40320.0f))));
+	float ss = (n & 2) ? -1.0f : 1.0f;
+	float sc = ((n + 1) & 2) ? -1.0f : 1.0f;
+
+	*s = ss * ((n & 1) ? cp : sp);
+	*c = sc * ((n & 1) ? sp : cp);
+}
+
+/* exp( @x ) for @x <= 0. Split into 2 ** n * 2 ** f, f is a polynomial,
+ * n goes straight into the exponent bits.
+ */
+static inline float
+vips_dE00_exp( float x )
+{
+	union {
+		float f;
+		guint32 i;
+	} u;
+	float t;
+	int n;
+	float f;
+	float p;
+
+	t = VIPS_MAX( x, -80.0f ) * 1.44269504f;
+	n = (int) floorf( t );
+	f = t - n;
+	p = 1.0f + f * (0.69314718f + f * (0.24022651f + f * (0.05550411f + 
+		f * (0.00961813f + f * (0.00133336f + f * (0.00015404f + 
+		f * 0.00001525f))))));
+	u.i = (guint32) (n + 127) << 23;
+
+	return( p * u.f );
+}
+
+/* vips_col_dE00() in float, with the trig done by the functions above, so 
+ * there are no calls and the compiler can vectorise a loop over a line. 
+ * Within 0.001 of vips_col_dE00().
+ */
+static inline float
+vips_dE00_vector( float L1, float a1, float b1, 
+	float L2, float a2, float b2 )
+{
+	const float p25_7 = 6103515625.0f;
+
+	float C1 = sqrtf( a1 * a1 + b1 * b1 );
+	float C2 = sqrtf( a2 * a2 + b2 * b2 );
+	float Cb = (C1 + C2) * 0.5f;
+	float Cb3 = Cb * Cb * Cb;
+	float Cb7 = Cb3 * Cb3 * Cb;
+	float G = 0.5f * (1.0f - sqrtf( Cb7 / (Cb7 + p25_7) ));
+
+	float a1d = (1.0f + G) * a1;
+	float C1d = sqrtf( a1d * a1d + b1 * b1 );
+	float h1d = vips_dE00_ab2h( a1d, b1 );
+
+	float a2d = (1.0f + G) * a2;
+	float C2d = sqrtf( a2d * a2d + b2 * b2 );
+	float h2d = vips_dE00_ab2h( a2d, b2 );
+
+	float Ldb = (L1 + L2) * 0.5f;
+	float Cdb = (C1d + C2d) * 0.5f;
+	int near = fabsf( h1d - h2d ) < 180.0f;
+	float hdb = near ? 
+		(h1d + h2d) * 0.5f : 
+		fabsf( h1d + h2d - 360.0f ) * 0.5f;
+
+	float hdbd = (hdb - 275.0f) * (1.0f / 25.0f);
+	float dtheta = 30.0f * vips_dE00_exp( -(hdbd * hdbd) );
+	float Cdb3 = Cdb * Cdb * Cdb;
+	float Cdb7 = Cdb3 * Cdb3 * Cdb;
+	float RC = 2.0f * sqrtf( Cdb7 / (Cdb7 + p25_7) );
+
+	float s, c;
+	float s2, c2, s3, c3, s4, c4;
+	float st, ct;
+	float RT, T;
+
+	float Ldb50, SL, SC, SH;
+	float dhd, dLd, dCd, dHd;
+	float nL, nC, nH;
+
+	vips_dE00_sincos( 2.0f * dtheta, &st, &ct );
+	RT = -st * RC;
+
+	/* The four cos() in T come from one sincos() of hdb and the 
+	 * multiple-angle formulae.
+	 */
+	vips_dE00_sincos( hdb, &s, &c );
+	c2 = 2.0f * c * c - 1.0f;
+	s2 = 2.0f * s * c;
+	c3 = c * (4.0f * c * c - 3.0f);
+	s3 = s * (3.0f - 4.0f * s * s);
+	c4 = 2.0f * c2 * c2 - 1.0f;
+	s4 = 2.0f * s2 * c2;
+	T = 1.0f - 
+		0.17f * (c * 0.86602540f + s * 0.5f) +
+		0.24f * c2 +
+		0.32f * (c3 * 0.99452190f - s3 * 0.10452846f) -
+		0.20f * (c4 * 0.45399050f + s4 * 0.89100652f);
+
+	Ldb50 = Ldb - 50.0f;
+	SL = 1.0f + (0.015f * Ldb50 * Ldb50) / sqrtf( 20.0f + Ldb50 * Ldb50 );
+	SC = 1.0f + 0.045f * Cdb;
+	SH = 1.0f + 0.015f * Cdb * T;
+
+	dhd = near ? h1d - h2d : 360.0f - (h1d - h2d);
+	vips_dE00_sincos( dhd * 0.5f, &st, &ct );
+
+	dLd = L1 - L2;
+	dCd = C1d - C2d;
+	dHd = 2.0f * sqrtf( C1d * C2d ) * st;
+
+	nL = dLd / SL;
+	nC = dCd / SC;
+	nH = dHd / SH;
+
+	return( sqrtf( nL * nL + nC * nC + nH * nH + RT * nC * nH ) );
+}
+
 /* Find the difference between two buffers of LAB data.
  */
+#define DE00_LAB( DE00 ) { \
+	for( x = 0; x < width; x++ ) { \
+		q[x] = DE00( p1[0], p1[1], p1[2], \
+			p2[0], p2[1], p2[2] ); \
+		\
+		p1 += 3; \
+		p2 += 3; \
+	} \
+}
+
+/* LCh input: make ab from Ch first. vips_col_Ch2ab() for the scalar path, 
+ * the fast sincos for the vector one.
+ */
+#define DE00_LCH( CH2AB, DE00 ) { \
+	for( x = 0; x < width; x++ ) { \
+		float a1, b1, a2, b2; \
+		\
+		CH2AB( p1[1], p1[2], &a1, &b1 ); \
+		CH2AB( p2[1], p2[2], &a2, &b2 ); \
+		q[x] = DE00( p1[0], a1, b1, p2[0], a2, b2 ); \
+		\
+		p1 += 3; \
+		p2 += 3; \
+	} \
+}
+
+static inline void
+vips_dE00_Ch2ab( float C, float h, float *a, float *b )
+{
+	float s, c;
+
+	vips_dE00_sincos( h, &s, &c );
+	*a = C * c;
+	*b = C * s;
+}
+
 void
 vips_dE00_line( VipsColour *colour, 
 	VipsPel *out, VipsPel **in, int width )
 {
-	float *p1 = (float *) in[0];
-	float *p2 = (float *) in[1];
-	float *q = (float *) out;
+	VipsdE00 *dE00 = (VipsdE00 *) colour;
+	float * restrict p1 = (float *) in[0];
+	float * restrict p2 = (float *) in[1];
+	float * restrict q = (float *) out;
 
 	int x;
 
-	for( x = 0; x < width; x++ ) {
-		q[x] = vips_col_dE00( p1[0], p1[1], p1[2], 
-			p2[0], p2[1], p2[2] );
+	if( vips_colour_get_fast() ) {
+		if( dE00->LCh )
+			DE00_LCH( vips_dE00_Ch2ab, vips_dE00_vector )
+		else
+			DE00_LAB( vips_dE00_vector )
+	}
+	else {
+		if( dE00->LCh )
+			DE00_LCH( vips_col_Ch2ab, vips_col_dE00 )
+		else
+			DE00_LAB( vips_col_dE00 )
+	}
+}
 
-		p1 += 3;
-		p2 += 3;
+static int
+vips_dE00_build( VipsObject *object )
+{
+	VipsColourDifference *difference = VIPS_COLOUR_DIFFERENCE( object );
+	VipsdE00 *dE00 = (VipsdE00 *) object;
+
+	/* If both sides are LCh already, don't go via Lab, we can make ab 
+	 * from Ch as we go.
+	 */
+	if( difference->left &&
+		difference->right &&
+		vips_image_guess_interpretation( difference->left ) == 
+			VIPS_INTERPRETATION_LCH &&
+		vips_image_guess_interpretation( difference->right ) == 
+			VIPS_INTERPRETATION_LCH ) {
+		difference->interpretation = VIPS_INTERPRETATION_LCH;
+		dE00->LCh = TRUE;
 	}
+
+	if( VIPS_OBJECT_CLASS( vips_dE00_parent_class )->build( object ) )
+		return( -1 );
+
+	return( 0 );
 }
 
 static void
@@ -233,6 +465,7 @@ vips_dE00_class_init( VipsdE00Class *class )
 
 	object_class->nickname = "dE00";
 	object_class->description = _( "calculate dE00" );
+	object_class->build = vips_dE00_build;
 
 	colour_class->process_line = vips_dE00_line;
 }
@@ -253,6 +486,15 @@ vips_dE00_init( VipsdE00 *dE00 )
  *
  * Calculate dE 00.
  *
+ * If both inputs are #VIPS_INTERPRETATION_LCH, they are used directly, 
+ * rather than being converted to Lab first. 
+ *
+ * After vips_colour_set_fast(), or with --vips-fast-colour, dE00 is 
+ * computed in float, with fast polynomial trig, and is within 0.001 of 
+ * vips_col_dE00(). 
+ *
+ * See also: vips_dE00_stats(), vips_dE76(), vips_dECMC().
+ *
  * Returns: 0 on success, -1 on error
  */
 int
@@ -267,3 +509,263 @@ vips_dE00( VipsImage *left, VipsImage *right, VipsImage **out, ... )
 
 	return( result );
 }
+
+/* Histogram dE00 into bins this wide for vips_dE00_stats() percentiles.
+ * Anything past the last bin goes into the last bin.
+ */
+#define VIPS_DE00_BINS_PER_UNIT (64)
+#define VIPS_DE00_BINS (256 * VIPS_DE00_BINS_PER_UNIT)
+
+typedef struct _VipsdE00Stats {
+	VipsOperation parent_instance;
+
+	VipsImage *left;
+	VipsImage *right;
+	double percent;
+
+	double out;
+	double max;
+	double threshold;
+
+	/* Accumulate into these, sequences merge on stop. 
+	 */
+	double sum;
+	double mx;
+	guint64 *hist;
+
+} VipsdE00Stats;
+
+typedef VipsOperationClass VipsdE00StatsClass;
+
+G_DEFINE_TYPE( VipsdE00Stats, vips_dE00_stats, VIPS_TYPE_OPERATION );
+
+/* Per-thread accumulators.
+ */
+typedef struct _VipsdE00StatsSeq {
+	double sum;
+	double mx;
+	guint64 hist[VIPS_DE00_BINS];
+} VipsdE00StatsSeq;
+
+static void *
+vips_dE00_stats_start( VipsImage *in, void *a, void *b )
+{
+	return( (void *) g_new0( VipsdE00StatsSeq, 1 ) );
+}
+
+static int
+vips_dE00_stats_scan( VipsRegion *region, 
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsdE00StatsSeq *seq = (VipsdE00StatsSeq *) vseq;
+	VipsRect *r = &region->valid;
+
+	int x, y;
+
+	for( y = 0; y < r->height; y++ ) {
+		float *p = (float *) 
+			VIPS_REGION_ADDR( region, r->left, r->top + y ); 
+
+		double sum = seq->sum;
+		double mx = seq->mx;
+
+		for( x = 0; x < r->width; x++ ) {
+			float d = p[x];
+			int i = d * VIPS_DE00_BINS_PER_UNIT;
+
+			sum += d;
+			mx = VIPS_MAX( mx, d );
+			seq->hist[VIPS_CLIP( 0, i, VIPS_DE00_BINS - 1 )] += 1;
+		}
+
+		seq->sum = sum;
+		seq->mx = mx;
+	}
+
+	return( 0 );
+}
+
+/* Add this thread's accumulators to the main ones. 
+ */
+static int
+vips_dE00_stats_stop( void *vseq, void *a, void *b )
+{
+	VipsdE00StatsSeq *seq = (VipsdE00StatsSeq *) vseq;
+	VipsdE00Stats *stats = (VipsdE00Stats *) a;
+
+	int i;
+
+	stats->sum += seq->sum;
+	stats->mx = VIPS_MAX( stats->mx, seq->mx );
+	for( i = 0; i < VIPS_DE00_BINS; i++ )
+		stats->hist[i] += seq->hist[i];
+
+	g_free( seq );
+
+	return( 0 );
+}
+
+static int
+vips_dE00_stats_build( VipsObject *object )
+{
+	VipsdE00Stats *stats = (VipsdE00Stats *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 2 );
+
+	guint64 n;
+	guint64 target;
+	guint64 total;
+	int i;
+	double threshold;
+
+	if( VIPS_OBJECT_CLASS( vips_dE00_stats_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	/* The difference is computed a region at a time as we scan, it's 
+	 * never all in memory. Extra bands on left are carried through to
+	 * the dE image, we just want band 0.
+	 */
+	if( vips_dE00( stats->left, stats->right, &t[0], NULL ) ||
+		vips_extract_band( t[0], &t[1], 0, NULL ) )
+		return( -1 );
+
+	stats->hist = VIPS_ARRAY( object, VIPS_DE00_BINS, guint64 );
+	if( !stats->hist )
+		return( -1 );
+	memset( stats->hist, 0, VIPS_DE00_BINS * sizeof( guint64 ) );
+	stats->sum = 0.0;
+	stats->mx = 0.0;
+
+	if( vips_sink( t[1], 
+		vips_dE00_stats_start, 
+		vips_dE00_stats_scan, 
+		vips_dE00_stats_stop, 
+		stats, NULL ) )
+		return( -1 );
+
+	/* Walk the histogram to the bin holding the percent point, then 
+	 * interpolate within it.
+	 */
+	n = (guint64) t[1]->Xsize * t[1]->Ysize;
+	target = ceil( n * stats->percent / 100.0 );
+	total = 0;
+	for( i = 0; i < VIPS_DE00_BINS - 1; i++ ) {
+		if( total + stats->hist[i] >= target )
+			break;
+		total += stats->hist[i];
+	}
+	threshold = i;
+	if( stats->hist[i] > 0 )
+		threshold += (double) (target - total) / stats->hist[i];
+	threshold /= VIPS_DE00_BINS_PER_UNIT;
+	threshold = VIPS_MIN( threshold, stats->mx );
+
+	g_object_set( object, 
+		"out", stats->sum / n,
+		"max", stats->mx,
+		"threshold", threshold,
+		NULL );
+
+	return( 0 );
+}
+
+static void
+vips_dE00_stats_class_init( VipsdE00StatsClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsOperationClass *operation_class = VIPS_OPERATION_CLASS( class );
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "dE00_stats";
+	object_class->description = _( "summarise dE00 between two images" );
+	object_class->build = vips_dE00_stats_build;
+
+	operation_class->flags = VIPS_OPERATION_SEQUENTIAL_UNBUFFERED;
+
+	VIPS_ARG_IMAGE( class, "left", 1, 
+		_( "Left" ), 
+		_( "Left-hand input image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT, 
+		G_STRUCT_OFFSET( VipsdE00Stats, left ) );
+
+	VIPS_ARG_IMAGE( class, "right", 2, 
+		_( "Right" ), 
+		_( "Right-hand input image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT, 
+		G_STRUCT_OFFSET( VipsdE00Stats, right ) );
+
+	VIPS_ARG_DOUBLE( class, "out", 3, 
+		_( "Output" ), 
+		_( "Mean dE00" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsdE00Stats, out ),
+		0, INFINITY, 0.0 );
+
+	VIPS_ARG_DOUBLE( class, "max", 4, 
+		_( "Max" ), 
+		_( "Maximum dE00" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsdE00Stats, max ),
+		0, INFINITY, 0.0 );
+
+	VIPS_ARG_DOUBLE( class, "percent", 5, 
+		_( "Percent" ), 
+		_( "Percent of pixels for threshold" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsdE00Stats, percent ),
+		0, 100, 95 );
+
+	VIPS_ARG_DOUBLE( class, "threshold", 6, 
+		_( "Threshold" ), 
+		_( "Percent of pixels have dE00 below this" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsdE00Stats, threshold ),
+		0, INFINITY, 0.0 );
+}
+
+static void
+vips_dE00_stats_init( VipsdE00Stats *stats )
+{
+	stats->percent = 95;
+}
+
+/**
+ * vips_dE00_stats:
+ * @left: first input image
+ * @right: second input image
+ * @out: output mean dE00
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * @max: output maximum dE00
+ * @percent: percent of pixels for @threshold, default 95
+ * @threshold: output dE00 which @percent of pixels are below
+ *
+ * Summarise the dE00 between @left and @right in a single pass. The 
+ * difference image is computed a region at a time and never held in 
+ * memory. 
+ *
+ * @out is the mean dE00. @threshold is found from a histogram with 64 bins 
+ * per unit dE00, interpolated within the bin, so it's good to about 
+ * 0.02.
+ *
+ * See also: vips_dE00(), vips_percent().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_dE00_stats( VipsImage *left, VipsImage *right, double *out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "dE00_stats", ap, left, right, out );
+	va_end( ap );
+
+	return( result );
+}
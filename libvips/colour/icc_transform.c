@@ -31,6 +31,10 @@
  * 29/9/14
  * 	- check input profiles for compatibility with the input image, thanks
  * 	  James
+ * 20/10/14
+ * 	- add @lattice: bake 3-channel transforms into a 3D LUT
+ * 	- share transforms between operations with the same profiles, intent
+ * 	  and formats
  */
 
 /*
@@ -94,6 +98,18 @@
  */
 #define PIXEL_BUFFER_SIZE (10000)
 
+/* Keep up to this many baked lattices.
+ */
+#define VIPS_ICC_LATTICE_CACHE_MAX (16)
+
+/* Keep up to this many lcms transforms.
+ */
+#define VIPS_ICC_TRANSFORM_CACHE_MAX (32)
+
+/* Keep up to this many embedded profile checksums.
+ */
+#define VIPS_ICC_DIGEST_CACHE_MAX (32)
+
 /* LCMS1 was missing some stuff.
  */
 #ifdef HAVE_LCMS
@@ -168,6 +184,29 @@ typedef struct _VipsIcc {
 	cmsUInt32Number out_icc_format;
 	cmsHTRANSFORM trans;
 
+	/* If the profiles came from image metadata, the blobs that hold them.
+	 * We use these to find cached profile checksums.
+	 */
+	VipsArea *in_blob;
+	VipsArea *out_blob;
+
+	/* Profile checksums, intent and formats. Transforms and lattices are 
+	 * shared between operations with the same key.
+	 */
+	char *key;
+
+	/* If trans came from the transform cache, the entry we hold.
+	 */
+	struct _VipsIccEntry *entry;
+
+	/* Points per axis for a baked transform, or 0 for none.
+	 */
+	int lattice;
+
+	/* The transform baked into a 3D LUT, if we were able to.
+	 */
+	VipsLattice *baked;
+
 	/* We need to single-thread calls to LCMS 1.
 	 */
 	GMutex *lock;
@@ -200,12 +239,94 @@ icc_error( int code, const char *text )
 }
 #endif
 
+#ifdef HAVE_LCMS2
+/* A shared lcms transform. lcms2 transforms made with cmsFLAGS_NOCACHE can
+ * be run from many threads at once.
+ */
+typedef struct _VipsIccEntry {
+	int ref_count;
+	cmsHTRANSFORM trans;
+
+	/* Last time this entry was fetched, for LRU eviction.
+	 */
+	int time;
+} VipsIccEntry;
+
+static GMutex *vips_icc_cache_lock = NULL;
+static GHashTable *vips_icc_transform_cache = NULL;
+static GHashTable *vips_icc_lattice_cache = NULL;
+
+/* Checksums of embedded profiles, keyed by the blob that holds the profile.
+ * The cache holds a ref to each blob, so a key can't be freed and reused
+ * while it's here.
+ */
+static GHashTable *vips_icc_digest_cache = NULL;
+
+/* Ticks on every fetch, hits and misses are counted for 
+ * vips_icc_cache_get_hits(). All protected by vips_icc_cache_lock.
+ */
+static int vips_icc_cache_time = 0;
+static int vips_icc_cache_hits = 0;
+static int vips_icc_cache_misses = 0;
+
+static void
+vips_icc_entry_unref( VipsIccEntry *entry )
+{
+	if( g_atomic_int_dec_and_test( &entry->ref_count ) ) {
+		VIPS_FREEF( cmsDeleteTransform, entry->trans );
+		vips_free( entry );
+	}
+}
+#endif /*HAVE_LCMS2*/
+
+/**
+ * vips_icc_cache_get_hits:
+ *
+ * ICC operations share lcms transforms: profile pairs are checksummed and 
+ * operations with the same profiles, intent and pixel formats use the same
+ * transform. Up to 32 transforms are kept, least-recently used ones are 
+ * dropped first, and transforms are not cached if all 32 are in use. 
+ * Embedded profiles are only checksummed once. 
+ *
+ * Returns: the number of times an ICC operation found its transform in the 
+ * cache. Always 0 with lcms1.
+ */
+int
+vips_icc_cache_get_hits( void )
+{
+#ifdef HAVE_LCMS2
+	int hits;
+
+	if( !vips_icc_cache_lock )
+		return( 0 );
+
+	g_mutex_lock( vips_icc_cache_lock );
+	hits = vips_icc_cache_hits;
+	g_mutex_unlock( vips_icc_cache_lock );
+
+	return( hits );
+#else /*HAVE_LCMS*/
+	return( 0 );
+#endif /*HAVE_LCMS2*/
+}
+
 static void
 vips_icc_dispose( GObject *gobject )
 {
 	VipsIcc *icc = (VipsIcc *) gobject;
 
+#ifdef HAVE_LCMS2
+	if( icc->entry ) {
+		vips_icc_entry_unref( icc->entry );
+		icc->entry = NULL;
+		icc->trans = NULL;
+	}
+#endif /*HAVE_LCMS2*/
 	VIPS_FREEF( cmsDeleteTransform, icc->trans );
+	VIPS_FREEF( vips__lattice_unref, icc->baked );
+	VIPS_FREE( icc->key );
+	VIPS_FREEF( vips_area_unref, icc->in_blob );
+	VIPS_FREEF( vips_area_unref, icc->out_blob );
 	VIPS_FREEF( cmsCloseProfile, icc->in_profile );
 	VIPS_FREEF( cmsCloseProfile, icc->out_profile );
 	VIPS_FREEF( vips_g_mutex_free, icc->lock );
@@ -222,6 +343,373 @@ is_pcs( cmsHPROFILE profile )
 		cmsGetColorSpace( profile ) == cmsSigXYZData ); 
 }
 
+#ifdef HAVE_LCMS2
+static void *
+vips_icc_cache_init( void *client )
+{
+	vips_icc_cache_lock = vips_g_mutex_new();
+	vips_icc_transform_cache = g_hash_table_new_full( 
+		g_str_hash, g_str_equal,
+		g_free, (GDestroyNotify) vips_icc_entry_unref );
+	vips_icc_lattice_cache = g_hash_table_new_full( 
+		g_str_hash, g_str_equal,
+		g_free, (GDestroyNotify) vips__lattice_unref );
+	vips_icc_digest_cache = g_hash_table_new_full( 
+		g_direct_hash, g_direct_equal,
+		(GDestroyNotify) vips_area_unref, g_free );
+
+	return( NULL );
+}
+
+/* Only checksums of blobs no one else is using can go.
+ */
+static gboolean
+vips_icc_digest_unused( void *key, void *value, void *user_data )
+{
+	VipsArea *area = (VipsArea *) key;
+
+	gboolean unused;
+
+	g_mutex_lock( area->lock );
+	unused = area->count == 1;
+	g_mutex_unlock( area->lock );
+
+	return( unused );
+}
+
+/* The MD5 of a profile. 
+ *
+ * Embedded profiles are checksummed straight from their blob, and the
+ * checksum is cached against the blob, so later operations on the same image 
+ * (or on any image sharing its metadata) don't need to checksum again. Other
+ * profiles have to be serialised first.
+ */
+static char *
+vips_icc_profile_digest( cmsHPROFILE profile, VipsArea *blob )
+{
+	char *digest;
+	cmsUInt32Number length;
+	guchar *data;
+
+	if( blob ) {
+		g_mutex_lock( vips_icc_cache_lock );
+		digest = g_strdup( (char *) 
+			g_hash_table_lookup( vips_icc_digest_cache, blob ) );
+		g_mutex_unlock( vips_icc_cache_lock );
+
+		if( !digest ) {
+			digest = g_compute_checksum_for_data( G_CHECKSUM_MD5, 
+				blob->data, blob->length );
+
+			/* If the cache is full and every blob is still in
+			 * use, don't cache this one.
+			 */
+			g_mutex_lock( vips_icc_cache_lock );
+			if( g_hash_table_size( vips_icc_digest_cache ) >= 
+				VIPS_ICC_DIGEST_CACHE_MAX )
+				g_hash_table_foreach_remove( 
+					vips_icc_digest_cache, 
+					vips_icc_digest_unused, NULL );
+			if( g_hash_table_size( vips_icc_digest_cache ) < 
+				VIPS_ICC_DIGEST_CACHE_MAX )
+				g_hash_table_replace( vips_icc_digest_cache, 
+					vips_area_copy( blob ), 
+					g_strdup( digest ) );
+			g_mutex_unlock( vips_icc_cache_lock );
+		}
+
+		return( digest );
+	}
+
+	if( !cmsSaveProfileToMem( profile, NULL, &length ) ||
+		!(data = VIPS_ARRAY( NULL, length, guchar )) )
+		return( NULL );
+	if( !cmsSaveProfileToMem( profile, data, &length ) ) {
+		vips_free( data );
+		return( NULL );
+	}
+	digest = g_compute_checksum_for_data( G_CHECKSUM_MD5, data, length );
+	vips_free( data );
+
+	return( digest );
+}
+
+static char *
+vips_icc_key( VipsIcc *icc )
+{
+	char *in_digest;
+	char *out_digest;
+	char *key;
+
+	in_digest = vips_icc_profile_digest( icc->in_profile, icc->in_blob );
+	out_digest = vips_icc_profile_digest( icc->out_profile, icc->out_blob );
+	if( !in_digest ||
+		!out_digest ) {
+		g_free( in_digest );
+		g_free( out_digest );
+		vips_error( "VipsIcc", "%s", _( "unable to save profile" ) );
+		return( NULL );
+	}
+	key = g_strdup_printf( "%s %s %d %u %u", 
+		in_digest, out_digest, icc->intent,
+		icc->in_icc_format, icc->out_icc_format );
+	g_free( in_digest );
+	g_free( out_digest );
+
+	return( key );
+}
+
+static void
+vips_icc_transform_cache_evict( void )
+{
+	GHashTableIter iter;
+	void *key;
+	void *value;
+	void *oldest_key;
+	int oldest_time;
+
+	oldest_key = NULL;
+	oldest_time = 0;
+	g_hash_table_iter_init( &iter, vips_icc_transform_cache );
+	while( g_hash_table_iter_next( &iter, &key, &value ) ) {
+		VipsIccEntry *entry = (VipsIccEntry *) value;
+
+		if( g_atomic_int_get( &entry->ref_count ) == 1 &&
+			(!oldest_key || 
+			 entry->time < oldest_time) ) {
+			oldest_key = key;
+			oldest_time = entry->time;
+		}
+	}
+
+	if( oldest_key )
+		g_hash_table_remove( vips_icc_transform_cache, oldest_key );
+}
+
+/* Find or make the transform for icc->key. 
+ */
+static int
+vips_icc_transform_fetch( VipsIcc *icc )
+{
+	VipsIccEntry *entry;
+	VipsIccEntry *found;
+
+	g_mutex_lock( vips_icc_cache_lock );
+	if( (entry = g_hash_table_lookup( vips_icc_transform_cache, 
+		icc->key )) ) {
+		g_atomic_int_inc( &entry->ref_count );
+		entry->time = vips_icc_cache_time++;
+		vips_icc_cache_hits += 1;
+	}
+	else
+		vips_icc_cache_misses += 1;
+	g_mutex_unlock( vips_icc_cache_lock );
+
+	/* Make outside the lock, transforms can be slow to build. If someone
+	 * else made the same one meanwhile, use theirs.
+	 */
+	if( !entry ) {
+		cmsHTRANSFORM trans;
+
+		/* Use cmsFLAGS_NOCACHE to disable the 1-pixel cache and make
+		 * calling cmsDoTransform() from multiple threads safe.
+		 */
+		if( !(trans = cmsCreateTransform( 
+			icc->in_profile, icc->in_icc_format,
+			icc->out_profile, icc->out_icc_format, 
+			icc->intent, cmsFLAGS_NOCACHE )) )
+			return( -1 );
+
+		if( !(entry = VIPS_NEW( NULL, VipsIccEntry )) ) {
+			cmsDeleteTransform( trans );
+			return( -1 );
+		}
+		entry->ref_count = 1;
+		entry->trans = trans;
+
+		g_mutex_lock( vips_icc_cache_lock );
+		if( (found = g_hash_table_lookup( vips_icc_transform_cache, 
+			icc->key )) ) {
+			vips_icc_entry_unref( entry );
+			entry = found;
+			g_atomic_int_inc( &entry->ref_count );
+		}
+		else {
+			/* If the cache is full and every transform is in use,
+			 * don't cache this one, it'll be freed with this 
+			 * operation.
+			 */
+			if( g_hash_table_size( vips_icc_transform_cache ) >= 
+				VIPS_ICC_TRANSFORM_CACHE_MAX )
+				vips_icc_transform_cache_evict();
+
+			if( g_hash_table_size( vips_icc_transform_cache ) < 
+				VIPS_ICC_TRANSFORM_CACHE_MAX ) {
+				g_atomic_int_inc( &entry->ref_count );
+				g_hash_table_insert( vips_icc_transform_cache, 
+					g_strdup( icc->key ), entry );
+			}
+
+			vips_info( "VipsIcc", "transform cache: "
+				"%d hits, %d misses, %d transforms", 
+				vips_icc_cache_hits, vips_icc_cache_misses,
+				g_hash_table_size( vips_icc_transform_cache ) );
+		}
+		entry->time = vips_icc_cache_time++;
+		g_mutex_unlock( vips_icc_cache_lock );
+	}
+
+	icc->entry = entry;
+	icc->trans = entry->trans;
+
+	return( 0 );
+}
+
+/* Only entries the cache alone holds can go.
+ */
+static gboolean
+vips_icc_lattice_unused( void *key, void *value, void *user_data )
+{
+	VipsLattice *lattice = (VipsLattice *) value;
+
+	return( g_atomic_int_get( &lattice->ref_count ) == 1 );
+}
+
+/* Run lcms over every lattice point. We always sample with 16-bit
+ * input and output, 8-bit values are just the top of that range.
+ */
+static VipsLattice *
+vips_icc_lattice_make( VipsIcc *icc )
+{
+	int n = icc->lattice;
+	cmsUInt32Number in_format = 
+		(icc->in_icc_format & ~BYTES_SH( 7 )) | BYTES_SH( 2 );
+	cmsUInt32Number out_format = 
+		(icc->out_icc_format & ~BYTES_SH( 7 )) | BYTES_SH( 2 );
+
+	VipsLattice *lattice;
+	cmsHTRANSFORM trans;
+	guint16 *samples;
+	guint16 *p;
+	int i0, i1, i2;
+
+	if( !(lattice = vips__lattice_new( n, 
+		T_CHANNELS( icc->out_icc_format ),
+		T_BYTES( icc->in_icc_format ) == 1 ? 
+			VIPS_FORMAT_UCHAR : VIPS_FORMAT_USHORT,
+		T_BYTES( icc->out_icc_format ) == 1 ? 
+			VIPS_FORMAT_UCHAR : VIPS_FORMAT_USHORT )) )
+		return( NULL );
+
+	if( !(samples = VIPS_ARRAY( NULL, 3 * n * n * n, guint16 )) ) {
+		vips__lattice_unref( lattice );
+		return( NULL );
+	}
+	p = samples;
+	for( i0 = 0; i0 < n; i0++ )
+		for( i1 = 0; i1 < n; i1++ )
+			for( i2 = 0; i2 < n; i2++ ) {
+				p[0] = VIPS_RINT( i0 * 65535.0 / (n - 1) );
+				p[1] = VIPS_RINT( i1 * 65535.0 / (n - 1) );
+				p[2] = VIPS_RINT( i2 * 65535.0 / (n - 1) );
+				p += 3;
+			}
+
+	if( !(trans = cmsCreateTransform( 
+		icc->in_profile, in_format,
+		icc->out_profile, out_format, 
+		icc->intent, cmsFLAGS_NOCACHE )) ) {
+		vips_free( samples );
+		vips__lattice_unref( lattice );
+		return( NULL );
+	}
+	cmsDoTransform( trans, samples, lattice->table, n * n * n );
+	cmsDeleteTransform( trans );
+	vips_free( samples );
+
+	return( lattice );
+}
+
+/* Find or make the lattice for this transform. 
+ */
+static int
+vips_icc_bake( VipsIcc *icc )
+{
+	char *key;
+	VipsLattice *lattice;
+	VipsLattice *found;
+
+	/* Lattices are 3D, so we can't do CMYK or mono input.
+	 */
+	if( T_CHANNELS( icc->in_icc_format ) != 3 )
+		return( 0 );
+
+	key = g_strdup_printf( "%s %d", icc->key, icc->lattice );
+
+	g_mutex_lock( vips_icc_cache_lock );
+	if( (lattice = g_hash_table_lookup( vips_icc_lattice_cache, key )) ) 
+		vips__lattice_ref( lattice );
+	g_mutex_unlock( vips_icc_cache_lock );
+
+	/* Bake outside the lock, it can take a while. If someone else made 
+	 * the same lattice meanwhile, use theirs.
+	 */
+	if( !lattice ) {
+		if( !(lattice = vips_icc_lattice_make( icc )) ) {
+			g_free( key );
+			return( -1 );
+		}
+
+		g_mutex_lock( vips_icc_cache_lock );
+		if( (found = g_hash_table_lookup( vips_icc_lattice_cache, 
+			key )) ) {
+			vips__lattice_unref( lattice );
+			lattice = vips__lattice_ref( found );
+		}
+		else {
+			/* If the cache is full, drop the lattices no one else
+			 * is using. If they are all in use, don't cache this
+			 * one, it'll be freed with this operation.
+			 */
+			if( g_hash_table_size( vips_icc_lattice_cache ) >= 
+				VIPS_ICC_LATTICE_CACHE_MAX )
+				g_hash_table_foreach_remove( 
+					vips_icc_lattice_cache, 
+					vips_icc_lattice_unused, NULL );
+			if( g_hash_table_size( vips_icc_lattice_cache ) < 
+				VIPS_ICC_LATTICE_CACHE_MAX )
+				g_hash_table_insert( vips_icc_lattice_cache, 
+					g_strdup( key ), 
+					vips__lattice_ref( lattice ) );
+		}
+		g_mutex_unlock( vips_icc_cache_lock );
+	}
+
+	g_free( key );
+	icc->baked = lattice;
+
+	return( 0 );
+}
+#endif /*HAVE_LCMS2*/
+
+/* Transform a set of pixels, with the lattice if we baked one.
+ */
+static void
+vips_icc_do_transform( VipsIcc *icc, void *in, void *out, int n )
+{
+	if( icc->baked ) 
+		vips__lattice_process( icc->baked, out, in, n );
+	else {
+#ifdef HAVE_LCMS2
+		cmsDoTransform( icc->trans, in, out, n );
+#else
+		g_mutex_lock( icc->lock );
+		cmsDoTransform( icc->trans, in, out, n );
+		g_mutex_unlock( icc->lock );
+#endif
+	}
+}
+
 static int
 vips_icc_build( VipsObject *object )
 {
@@ -369,6 +857,17 @@ vips_icc_build( VipsObject *object )
 		return( -1 );
 	}
 
+#ifdef HAVE_LCMS2
+{
+	static GOnce once = G_ONCE_INIT;
+
+	(void) g_once( &once, vips_icc_cache_init, NULL );
+
+	if( !(icc->key = vips_icc_key( icc )) ||
+		vips_icc_transform_fetch( icc ) )
+		return( -1 );
+}
+#else /*HAVE_LCMS*/
 	/* Use cmsFLAGS_NOCACHE to disable the 1-pixel cache and make
 	 * calling cmsDoTransform() from multiple threads safe.
 	 */
@@ -377,6 +876,20 @@ vips_icc_build( VipsObject *object )
 		icc->out_profile, icc->out_icc_format, 
 		icc->intent, cmsFLAGS_NOCACHE )) )
 		return( -1 );
+#endif /*HAVE_LCMS*/
+
+#ifdef HAVE_LCMS2
+	if( icc->lattice ) {
+		if( icc->lattice < 2 ) {
+			vips_error( class->nickname, 
+				"%s", _( "lattice must be at least 2" ) );
+			return( -1 );
+		}
+
+		if( vips_icc_bake( icc ) )
+			return( -1 );
+	}
+#endif /*HAVE_LCMS2*/
 
 	if( VIPS_OBJECT_CLASS( vips_icc_parent_class )->
 		build( object ) )
@@ -413,6 +926,14 @@ vips_icc_class_init( VipsIccClass *class )
 		G_STRUCT_OFFSET( VipsIcc, pcs ),
 		VIPS_TYPE_PCS, VIPS_PCS_LAB );
 
+	VIPS_ARG_INT( class, "lattice", 150, 
+		_( "Lattice" ), 
+		_( "Bake the transform into a 3D LUT with this many points "
+			"per axis" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsIcc, lattice ),
+		0, 65, 0 );
+
 #ifdef HAVE_LCMS2
 	cmsSetLogErrorHandler( icc_error );
 #else
@@ -489,8 +1010,27 @@ vips_icc_profile_needs_bands( cmsHPROFILE profile )
 	return( needs_bands );
 }
 
+/* The blob holding an image's embedded profile, with a ref added.
+ */
+static VipsArea *
+vips_icc_get_blob( VipsImage *image )
+{
+	GValue value = { 0 };
+	VipsArea *area;
+
+	if( vips_image_get( image, VIPS_META_ICC_NAME, &value ) )
+		return( NULL );
+	area = NULL;
+	if( G_VALUE_TYPE( &value ) == VIPS_TYPE_BLOB )
+		area = vips_area_copy( (VipsArea *) g_value_get_boxed( &value ) );
+	g_value_unset( &value );
+
+	return( area );
+}
+
 static cmsHPROFILE
-vips_icc_load_profile_image( const char *domain, VipsImage *image )
+vips_icc_load_profile_image( const char *domain, VipsImage *image,
+	VipsArea **blob )
 {
 	void *data;
 	size_t data_length;
@@ -515,6 +1055,8 @@ vips_icc_load_profile_image( const char *domain, VipsImage *image )
 		return( NULL );
 	}
 
+	*blob = vips_icc_get_blob( image );
+
 	return( profile );
 }
 
@@ -566,7 +1108,7 @@ vips_icc_import_build( VipsObject *object )
 		(import->embedded ||
 			!import->input_profile_filename) )
 		icc->in_profile = vips_icc_load_profile_image( class->nickname,
-			code->in );
+			code->in, &icc->in_blob );
 
 	if( !icc->in_profile &&
 		import->input_profile_filename ) 
@@ -655,13 +1197,7 @@ vips_icc_import_line( VipsColour *colour,
 	for( i = 0; i < width; i += PIXEL_BUFFER_SIZE ) {
 		const int chunk = VIPS_MIN( width - i, PIXEL_BUFFER_SIZE );
 
-#ifdef HAVE_LCMS2
-		cmsDoTransform( icc->trans, p, encoded, chunk );
-#else
-		g_mutex_lock( icc->lock );
-		cmsDoTransform( icc->trans, p, encoded, chunk );
-		g_mutex_unlock( icc->lock );
-#endif
+		vips_icc_do_transform( icc, p, encoded, chunk );
 
 		if( icc->pcs == VIPS_PCS_LAB ) 
 			decode_lab( encoded, q, chunk );
@@ -765,6 +1301,8 @@ vips_icc_export_build( VipsObject *object )
 				"%s", _( "unable to load embedded profile" ) );
 			return( -1 );
 		}
+
+		icc->out_blob = vips_icc_get_blob( code->in );
 	}
 	else if( export->output_profile_filename ) {
 		if( !(icc->out_profile = cmsOpenProfileFromFile(
@@ -891,13 +1429,7 @@ vips_icc_export_line( VipsColour *colour,
 		else
 			encode_xyz( p, encoded, chunk );
 
-#ifdef HAVE_LCMS2
-		cmsDoTransform( icc->trans, encoded, q, chunk );
-#else
-		g_mutex_lock( icc->lock );
-		cmsDoTransform( icc->trans, encoded, q, chunk );
-		g_mutex_unlock( icc->lock );
-#endif
+		vips_icc_do_transform( icc, encoded, q, chunk );
 
 		p += PIXEL_BUFFER_SIZE * 3;
 		q += PIXEL_BUFFER_SIZE * VIPS_IMAGE_SIZEOF_PEL( colour->out );
@@ -977,7 +1509,7 @@ vips_icc_transform_build( VipsObject *object )
 		(transform->embedded ||
 			!transform->input_profile_filename) )
 		icc->in_profile = vips_icc_load_profile_image( class->nickname,
-			code->in );
+			code->in, &icc->in_blob );
 
 	if( !icc->in_profile &&
 		transform->input_profile_filename ) 
@@ -1021,13 +1553,7 @@ vips_icc_transform_line( VipsColour *colour,
 {
 	VipsIcc *icc = (VipsIcc *) colour;
 
-#ifdef HAVE_LCMS2
-	cmsDoTransform( icc->trans, in[0], out, width );
-#else
-	g_mutex_lock( icc->lock );
-	cmsDoTransform( icc->trans, in[0], out, width );
-	g_mutex_unlock( icc->lock );
-#endif
+	vips_icc_do_transform( icc, in[0], out, width );
 }
 
 static void
@@ -1193,6 +1719,12 @@ vips_icc_ac2rc( VipsImage *in, VipsImage **out, const char *profile_filename )
 	return( -1 );
 }
 
+int
+vips_icc_cache_get_hits( void )
+{
+	return( 0 );
+}
+
 #endif /*HAVE_LCMS*/
 
 /**
@@ -1207,6 +1739,7 @@ vips_icc_ac2rc( VipsImage *in, VipsImage **out, const char *profile_filename )
  * @intent: transform with this intent
  * @embedded: use profile embedded in input image
  * @pcs: use XYZ or LAB PCS
+ * @lattice: bake the transform into a 3D LUT with this many points per axis
  *
  * Import an image from device space to D65 LAB with an ICC profile. If @pcs is
  * set to #VIPS_PCS_XYZ, use CIE XYZ PCS instead. 
@@ -1246,6 +1779,7 @@ vips_icc_import( VipsImage *in, VipsImage **out, ... )
  * @depth: depth of output image in bits
  * @output_profile: get the output profile from here
  * @pcs: use XYZ or LAB PCS
+ * @lattice: bake the transform into a 3D LUT with this many points per axis
  *
  * Export an image from D65 LAB to device space with an ICC profile. 
  * If @pcs is
@@ -1282,6 +1816,7 @@ vips_icc_export( VipsImage *in, VipsImage **out, ... )
  * @intent: transform with this intent
  * @depth: depth of output image in bits
  * @embedded: use profile embedded in input image
+ * @lattice: bake the transform into a 3D LUT with this many points per axis
  *
  * Transform an image with a pair of ICC profiles. The input image is moved to
  * profile-connection space with the input profile and then to the output
@@ -1298,6 +1833,14 @@ vips_icc_export( VipsImage *in, VipsImage **out, ... )
  * Use vips_icc_import() and vips_icc_export() to do either the first or 
  * second half of this operation in isolation.
  *
+ * If @lattice is set, and the input space has three channels (RGB, LAB or
+ * XYZ), the transform is run once over a @lattice by @lattice by @lattice 
+ * grid of input colours and images are then mapped through that with 
+ * tetrahedral interpolation, see vips_lut3d(). This is much faster for
+ * complex profiles, at a small cost in accuracy. 33 is a good value. Baked 
+ * lattices are shared between operations with the same profiles, intent and 
+ * formats. This needs lcms2, @lattice is ignored with lcms1.
+ *
  * Returns: 0 on success, -1 on error.
  */
 int
@@ -0,0 +1,513 @@
+/* map an image through a 3D colour lattice
+ *
+ * 20/10/14
+ * 	- from sRGB2scRGB.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <math.h>
+
+#include <vips/vips.h>
+
+#include "pcolour.h"
+
+/* Fractions are fixed-point with this many bits. Four weights add up to
+ * 1 << 15, so a weighted sum of 16-bit values fits in an unsigned int.
+ */
+#define VIPS_LATTICE_BITS (15)
+#define VIPS_LATTICE_ONE (1 << VIPS_LATTICE_BITS)
+
+/**
+ * vips__lattice_new: (skip)
+ * @n: points along each axis
+ * @bands: values at each point
+ * @in_format: #VIPS_FORMAT_UCHAR or #VIPS_FORMAT_USHORT input
+ * @format: #VIPS_FORMAT_UCHAR, #VIPS_FORMAT_USHORT or #VIPS_FORMAT_FLOAT
+ * output
+ *
+ * Make a lattice with an empty table. Fill @table, then share it with
+ * vips__lattice_ref().
+ *
+ * Returns: the new lattice, or %NULL on error.
+ */
+VipsLattice *
+vips__lattice_new( int n, int bands,
+	VipsBandFormat in_format, VipsBandFormat format )
+{
+	VipsLattice *lattice;
+	int range;
+	size_t size;
+	int v;
+
+	g_assert( n >= 2 );
+	g_assert( in_format == VIPS_FORMAT_UCHAR ||
+		in_format == VIPS_FORMAT_USHORT );
+	g_assert( format == VIPS_FORMAT_UCHAR ||
+		format == VIPS_FORMAT_USHORT ||
+		format == VIPS_FORMAT_FLOAT );
+
+	range = in_format == VIPS_FORMAT_UCHAR ? 256 : 65536;
+	size = (size_t) n * n * n * bands;
+
+	if( !(lattice = VIPS_NEW( NULL, VipsLattice )) )
+		return( NULL );
+	lattice->ref_count = 1;
+	lattice->n = n;
+	lattice->bands = bands;
+	lattice->in_format = in_format;
+	lattice->format = format;
+	lattice->table = NULL;
+	lattice->index = NULL;
+	lattice->frac = NULL;
+
+	if( format == VIPS_FORMAT_FLOAT )
+		lattice->table = VIPS_ARRAY( NULL, size, float );
+	else
+		lattice->table = VIPS_ARRAY( NULL, size, guint16 );
+	if( !lattice->table ||
+		!(lattice->index = VIPS_ARRAY( NULL, range, int )) ||
+		!(lattice->frac = VIPS_ARRAY( NULL, range, int )) ) {
+		vips__lattice_unref( lattice );
+		return( NULL );
+	}
+
+	/* The top value would index the point past the end, so clip it to
+	 * the far side of the last cell instead.
+	 */
+	for( v = 0; v < range; v++ ) {
+		gint64 pos = ((gint64) v * (n - 1) << VIPS_LATTICE_BITS) /
+			(range - 1);
+		int i = pos >> VIPS_LATTICE_BITS;
+		int f = pos & (VIPS_LATTICE_ONE - 1);
+
+		if( i >= n - 1 ) {
+			i = n - 2;
+			f = VIPS_LATTICE_ONE;
+		}
+
+		lattice->index[v] = i;
+		lattice->frac[v] = f;
+	}
+
+	return( lattice );
+}
+
+VipsLattice *
+vips__lattice_ref( VipsLattice *lattice )
+{
+	g_atomic_int_inc( &lattice->ref_count );
+
+	return( lattice );
+}
+
+void
+vips__lattice_unref( VipsLattice *lattice )
+{
+	if( g_atomic_int_dec_and_test( &lattice->ref_count ) ) {
+		VIPS_FREE( lattice->table );
+		VIPS_FREE( lattice->index );
+		VIPS_FREE( lattice->frac );
+		VIPS_FREE( lattice );
+	}
+}
+
+/* Find the tetrahedron in the cell around a point, and the weights of its
+ * four corners. Every tetrahedron shares the (0, 0, 0) and (1, 1, 1)
+ * corners and the weights are never negative.
+ */
+#define TETRAHEDRON { \
+	int f0 = frac[p[0]]; \
+	int f1 = frac[p[1]]; \
+	int f2 = frac[p[2]]; \
+	\
+	o0 = index[p[0]] * s0 + index[p[1]] * s1 + index[p[2]] * s2; \
+	o3 = o0 + s0 + s1 + s2; \
+	\
+	if( f0 >= f1 ) { \
+		if( f1 >= f2 ) { \
+			o1 = o0 + s0; \
+			o2 = o0 + s0 + s1; \
+			w0 = VIPS_LATTICE_ONE - f0; \
+			w1 = f0 - f1; \
+			w2 = f1 - f2; \
+			w3 = f2; \
+		} \
+		else if( f0 >= f2 ) { \
+			o1 = o0 + s0; \
+			o2 = o0 + s0 + s2; \
+			w0 = VIPS_LATTICE_ONE - f0; \
+			w1 = f0 - f2; \
+			w2 = f2 - f1; \
+			w3 = f1; \
+		} \
+		else { \
+			o1 = o0 + s2; \
+			o2 = o0 + s0 + s2; \
+			w0 = VIPS_LATTICE_ONE - f2; \
+			w1 = f2 - f0; \
+			w2 = f0 - f1; \
+			w3 = f1; \
+		} \
+	} \
+	else { \
+		if( f0 >= f2 ) { \
+			o1 = o0 + s1; \
+			o2 = o0 + s0 + s1; \
+			w0 = VIPS_LATTICE_ONE - f1; \
+			w1 = f1 - f0; \
+			w2 = f0 - f2; \
+			w3 = f2; \
+		} \
+		else if( f1 >= f2 ) { \
+			o1 = o0 + s1; \
+			o2 = o0 + s1 + s2; \
+			w0 = VIPS_LATTICE_ONE - f1; \
+			w1 = f1 - f2; \
+			w2 = f2 - f0; \
+			w3 = f0; \
+		} \
+		else { \
+			o1 = o0 + s2; \
+			o2 = o0 + s1 + s2; \
+			w0 = VIPS_LATTICE_ONE - f2; \
+			w1 = f2 - f1; \
+			w2 = f1 - f0; \
+			w3 = f0; \
+		} \
+	} \
+}
+
+/* Integer lattices: sum in fixed point, then round to 16 bits. 8-bit output
+ * divides by 257 to get back to 0 - 255.
+ */
+#define LATTICE_INT( IN, OUT, SCALE ) { \
+	IN * restrict p = (IN *) in; \
+	OUT * restrict q = (OUT *) out; \
+	guint16 * restrict t = (guint16 *) lattice->table; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		TETRAHEDRON \
+		\
+		for( b = 0; b < bands; b++ ) { \
+			unsigned int sum = w0 * t[o0 + b] + \
+				w1 * t[o1 + b] + \
+				w2 * t[o2 + b] + \
+				w3 * t[o3 + b]; \
+			unsigned int v = (sum + (VIPS_LATTICE_ONE >> 1)) >> \
+				VIPS_LATTICE_BITS; \
+			\
+			q[b] = SCALE( v ); \
+		} \
+		\
+		p += 3; \
+		q += bands; \
+	} \
+}
+
+#define SCALE_8( V ) (((V) + 128) / 257)
+#define SCALE_16( V ) (V)
+
+#define LATTICE_FLOAT( IN ) { \
+	IN * restrict p = (IN *) in; \
+	float * restrict q = (float *) out; \
+	float * restrict t = (float *) lattice->table; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		TETRAHEDRON \
+		\
+		for( b = 0; b < bands; b++ ) \
+			q[b] = (w0 * t[o0 + b] + \
+				w1 * t[o1 + b] + \
+				w2 * t[o2 + b] + \
+				w3 * t[o3 + b]) * (1.0f / VIPS_LATTICE_ONE); \
+		\
+		p += 3; \
+		q += bands; \
+	} \
+}
+
+#define LATTICE_FORMAT( IN ) { \
+	switch( lattice->format ) { \
+	case VIPS_FORMAT_UCHAR: \
+		LATTICE_INT( IN, unsigned char, SCALE_8 ); \
+		break; \
+	\
+	case VIPS_FORMAT_USHORT: \
+		LATTICE_INT( IN, unsigned short, SCALE_16 ); \
+		break; \
+	\
+	case VIPS_FORMAT_FLOAT: \
+		LATTICE_FLOAT( IN ); \
+		break; \
+	\
+	default: \
+		g_assert( 0 ); \
+	} \
+}
+
+/**
+ * vips__lattice_process: (skip)
+ * @lattice: lattice to use
+ * @out: output pixels
+ * @in: three band input pixels
+ * @width: number of pixels
+ *
+ * Interpolate @width pixels through @lattice. Each pixel is found from the
+ * four corners of one of the six tetrahedra that split the enclosing cell,
+ * so this is 4 table reads per band rather than 8 for trilinear.
+ */
+void
+vips__lattice_process( VipsLattice *lattice,
+	VipsPel *out, VipsPel *in, int width )
+{
+	const int bands = lattice->bands;
+	const int s2 = bands;
+	const int s1 = lattice->n * s2;
+	const int s0 = lattice->n * s1;
+	const int * restrict index = lattice->index;
+	const int * restrict frac = lattice->frac;
+
+	int x, b;
+	int o0, o1, o2, o3;
+	unsigned int w0, w1, w2, w3;
+
+	if( lattice->in_format == VIPS_FORMAT_UCHAR )
+		LATTICE_FORMAT( unsigned char )
+	else
+		LATTICE_FORMAT( unsigned short )
+}
+
+typedef struct _VipsLut3d {
+	VipsColourCode parent_instance;
+
+	VipsImage *lut;
+
+	VipsLattice *lattice;
+
+} VipsLut3d;
+
+typedef VipsColourCodeClass VipsLut3dClass;
+
+G_DEFINE_TYPE( VipsLut3d, vips_lut3d, VIPS_TYPE_COLOUR_CODE );
+
+static void
+vips_lut3d_dispose( GObject *gobject )
+{
+	VipsLut3d *lut3d = (VipsLut3d *) gobject;
+
+	VIPS_FREEF( vips__lattice_unref, lut3d->lattice );
+
+	G_OBJECT_CLASS( vips_lut3d_parent_class )->dispose( gobject );
+}
+
+static void
+vips_lut3d_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
+{
+	VipsLut3d *lut3d = (VipsLut3d *) colour;
+
+	vips__lattice_process( lut3d->lattice, out, in[0], width );
+}
+
+/* Unpack the LUT image into the lattice table. LUT pixel (i0, i1 + i2 * n)
+ * is lattice point (i0, i1, i2).
+ */
+#define PACK_TABLE( IN, OUT, SCALE ) { \
+	OUT *t = (OUT *) lattice->table; \
+	\
+	for( i2 = 0; i2 < n; i2++ ) \
+		for( i1 = 0; i1 < n; i1++ ) { \
+			IN *p = (IN *) VIPS_IMAGE_ADDR( lut, 0, i1 + i2 * n ); \
+			\
+			for( i0 = 0; i0 < n; i0++ ) { \
+				OUT *q = t + ((i0 * n + i1) * n + i2) * bands; \
+				\
+				for( b = 0; b < bands; b++ ) \
+					q[b] = p[b] * SCALE; \
+				\
+				p += bands; \
+			} \
+		} \
+}
+
+static int
+vips_lut3d_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsColour *colour = (VipsColour *) object;
+	VipsColourCode *code = (VipsColourCode *) object;
+	VipsLut3d *lut3d = (VipsLut3d *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
+
+	VipsImage *lut;
+	VipsLattice *lattice;
+	int n, bands;
+	int i0, i1, i2, b;
+
+	if( code->in )
+		code->input_format =
+			code->in->BandFmt == VIPS_FORMAT_USHORT ?
+			VIPS_FORMAT_USHORT : VIPS_FORMAT_UCHAR;
+
+	if( (lut = lut3d->lut) ) {
+		n = lut->Xsize;
+		bands = lut->Bands;
+
+		if( vips_check_uncoded( class->nickname, lut ) ||
+			vips_check_noncomplex( class->nickname, lut ) )
+			return( -1 );
+		if( n < 2 ||
+			lut->Ysize != n * n ) {
+			vips_error( class->nickname,
+				"%s", _( "LUT must be n by n * n pixels" ) );
+			return( -1 );
+		}
+
+		if( lut->BandFmt != VIPS_FORMAT_UCHAR &&
+			lut->BandFmt != VIPS_FORMAT_USHORT ) {
+			if( vips_cast_float( lut, &t[0], NULL ) )
+				return( -1 );
+			lut = t[0];
+		}
+		if( vips_image_wio_input( lut ) )
+			return( -1 );
+
+		if( !(lattice = vips__lattice_new( n, bands,
+			code->input_format, lut->BandFmt )) )
+			return( -1 );
+		lut3d->lattice = lattice;
+
+		switch( lut->BandFmt ) {
+		case VIPS_FORMAT_UCHAR:
+			PACK_TABLE( unsigned char, guint16, 257 );
+			break;
+
+		case VIPS_FORMAT_USHORT:
+			PACK_TABLE( unsigned short, guint16, 1 );
+			break;
+
+		case VIPS_FORMAT_FLOAT:
+			PACK_TABLE( float, float, 1 );
+			break;
+
+		default:
+			g_assert( 0 );
+		}
+
+		colour->format = lut->BandFmt;
+		colour->bands = bands;
+		colour->interpretation = lut->Type;
+	}
+
+	if( VIPS_OBJECT_CLASS( vips_lut3d_parent_class )->build( object ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_lut3d_class_init( VipsLut3dClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsColourClass *colour_class = VIPS_COLOUR_CLASS( class );
+
+	gobject_class->dispose = vips_lut3d_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "lut3d";
+	object_class->description = _( "map an image through a 3D colour LUT" );
+	object_class->build = vips_lut3d_build;
+
+	colour_class->process_line = vips_lut3d_line;
+
+	VIPS_ARG_IMAGE( class, "lut", 110,
+		_( "LUT" ),
+		_( "3D look-up table image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsLut3d, lut ) );
+}
+
+static void
+vips_lut3d_init( VipsLut3d *lut3d )
+{
+	VipsColour *colour = VIPS_COLOUR( lut3d );
+	VipsColourCode *code = VIPS_COLOUR_CODE( lut3d );
+
+	colour->input_bands = 3;
+
+	code->input_coding = VIPS_CODING_NONE;
+	code->input_format = VIPS_FORMAT_UCHAR;
+}
+
+/**
+ * vips_lut3d:
+ * @in: input image
+ * @out: output image
+ * @lut: 3D look-up table
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Map the first three bands of @in through a 3D colour lattice.
+ *
+ * @lut is an n by n * n pixel image: the pixel at (i0, i1 + i2 * n) is the
+ * output for the lattice point (i0, i1, i2), with band 0 of @in along i0.
+ * A 33 by 1089 pixel LUT, for example, samples the input cube at 33
+ * points along each axis. @lut can have any number of bands.
+ *
+ * @in is cast to uchar, unless it is ushort, and the first and last
+ * lattice points along each axis are 0 and 255 (or 65535). Output
+ * pixels are interpolated from the four corners of one of the six
+ * tetrahedra that split each lattice cell, in fixed point.
+ *
+ * Output has the format and interpretation of @lut, with uchar and ushort
+ * LUTs making uchar and ushort output and everything else making float.
+ * Any extra bands in @in are cast to the output format and appended.
+ *
+ * See also: vips_maplut(), vips_icc_transform().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_lut3d( VipsImage *in, VipsImage **out, VipsImage *lut, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, lut );
+	result = vips_call_split( "lut3d", ap, in, out, lut );
+	va_end( ap );
+
+	return( result );
+}
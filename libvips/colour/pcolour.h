@@ -35,6 +35,8 @@
 extern "C" {
 #endif /*__cplusplus*/
 
+#include <math.h>
+
 #include <vips/vips.h>
 
 #define VIPS_TYPE_COLOUR (vips_colour_get_type())
@@ -70,6 +72,12 @@ typedef struct _VipsColour {
 	 */
 	int input_bands; 
 
+	/* Subclasses set this to have LABQ inputs unpacked to float Lab a 
+	 * line at a time as they are read, rather than by a separate 
+	 * LabQ2Lab.
+	 */
+	gboolean decode_labq;
+
 	VipsImage *out;
 
 	/* Set fields on ->out from these.
@@ -205,6 +213,163 @@ GType vips_colour_difference_get_type( void );
 void vips__pythagoras_line( VipsColour *colour, 
 	VipsPel *out, VipsPel **in, int width );
 
+/* Branch-free versions of the per-pixel colour maths. These are written so 
+ * the compiler can vectorise loops over whole lines: no calls, no tables, 
+ * only selects. They are not exact, so operations use them only after 
+ * vips_colour_set_fast(), see vips_colour_get_fast(). sRGB2scRGB's 
+ * whole-line loop is exact and does not use them, so it still keys on 
+ * vips_vector_isenabled().
+ */
+
+/* Cube root by a bit-twiddled first guess for x ** -1/3, then three 
+ * Newton steps, which are just multiplies. Relative error is under 1e-6 
+ * for normal, positive @x. 
+ */
+static inline float
+vips__col_cbrt( float x )
+{
+	union {
+		float f;
+		guint32 i;
+	} u;
+	float r;
+
+	u.f = x;
+	u.i = 0x54a2fa8c - u.i / 3;
+	r = u.f;
+
+	r = r * (4.0f - x * r * r * r) * (1.0f / 3.0f);
+	r = r * (4.0f - x * r * r * r) * (1.0f / 3.0f);
+	r = r * (4.0f - x * r * r * r) * (1.0f / 3.0f);
+
+	return( x * r * r );
+}
+
+/* Nonzero for a normal float, ie. not zero, denormal, Inf or NaN, like 
+ * isnormal(). 
+ */
+static inline int
+vips__col_isnormal( float x )
+{
+	union {
+		float f;
+		guint32 i;
+	} u;
+	guint32 e;
+
+	u.f = x;
+	e = (u.i >> 23) & 0xff;
+
+	return( e != 0 && e != 0xff );
+}
+
+/* The CIE f() for XYZ -> Lab, @t is eg. X / X0. Above 1 we extend in a 
+ * straight line, as the table in XYZ2Lab does.
+ */
+static inline float
+vips__col_XYZ2Lab_f( float t )
+{
+	float c = vips__col_cbrt( VIPS_CLIP( 0.008856f, t, 1.0f ) ); 
+	float f;
+
+	f = t < 0.008856f ? 7.787f * t + (16.0f / 116.0f) : c;
+	f = t > 1.0f ? 1.0f + (t - 1.0f) * (1.0f / 3.0f) : f;
+
+	return( f );
+}
+
+static inline void
+vips__col_XYZ2Lab_vector( float X, float Y, float Z, 
+	float rX0, float rY0, float rZ0, 
+	float *L, float *a, float *b )
+{
+	float cbx = vips__col_XYZ2Lab_f( X * rX0 );
+	float cby = vips__col_XYZ2Lab_f( Y * rY0 );
+	float cbz = vips__col_XYZ2Lab_f( Z * rZ0 );
+
+	*L = 116.0f * cby - 16.0f;
+	*a = 500.0f * (cbx - cby);
+	*b = 200.0f * (cby - cbz);
+}
+
+/* Linear light to sRGB gamma, 0 - 1 in, 0 - 1 out. The 1 / 2.4 power is 
+ * c * c ** 1/4, where c is the cube root, so this is within 1e-6 of pow().
+ */
+static inline float
+vips__col_sRGB_encode( float Y )
+{
+	float c;
+	float v;
+
+	Y = VIPS_CLIP( 0.0f, Y, 1.0f );
+	c = vips__col_cbrt( VIPS_MAX( Y, 0.0031308f ) );
+	v = 1.055f * c * sqrtf( sqrtf( c ) ) - 0.055f;
+
+	return( Y <= 0.0031308f ? 12.92f * Y : v );
+}
+
+/* scRGB to sRGB with @maxval (eg. 255) as the output range. Like 
+ * vips_col_scRGB2sRGB_8(), if any of RGB is not normal, we write black.
+ */
+static inline void
+vips__col_scRGB2sRGB_vector( float R, float G, float B, int maxval,
+	int *r, int *g, int *b )
+{
+	int ok = vips__col_isnormal( R ) & 
+		vips__col_isnormal( G ) &
+		vips__col_isnormal( B );
+
+	*r = ok ? (int) (maxval * vips__col_sRGB_encode( R ) + 0.5f) : 0;
+	*g = ok ? (int) (maxval * vips__col_sRGB_encode( G ) + 0.5f) : 0;
+	*b = ok ? (int) (maxval * vips__col_sRGB_encode( B ) + 0.5f) : 0;
+}
+
+void vips__col_sRGB2scRGB_line_8( float * restrict q, 
+	VipsPel * restrict p, int n );
+void vips__col_sRGB2scRGB_line_16( float * restrict q, 
+	unsigned short * restrict p, int n );
+
+/* The LabQ codecs work in blocks of this many pixels. Each block is split
+ * into L, a and b planes, worked on, then interleaved again, so every inner 
+ * loop is a fixed-length run of a single type which the compiler can 
+ * vectorise. 
+ */
+#define VIPS_LABQ_BLOCK (64)
+
+/* A 3D colour lattice: @n points along each axis, each point holding @bands
+ * output values. Point (i0, i1, i2) is at ((i0 * n + i1) * n + i2) * bands
+ * in @table.
+ *
+ * Integer lattices hold 16-bit values and make uchar or ushort output, 
+ * float lattices make float output. Input is 3 band uchar or ushort, 
+ * mapped so that 0 is the first point and 255 or 65535 is the last.
+ */
+typedef struct _VipsLattice {
+	int ref_count;
+
+	int n;
+	int bands;
+	VipsBandFormat in_format;
+	VipsBandFormat format;
+
+	/* guint16 for integer @format, float for float.
+	 */
+	void *table;
+
+	/* For each input value, the lattice index below it and the 
+	 * fractional distance to the next point.
+	 */
+	int *index;
+	int *frac;
+} VipsLattice;
+
+VipsLattice *vips__lattice_new( int n, int bands, 
+	VipsBandFormat in_format, VipsBandFormat format );
+VipsLattice *vips__lattice_ref( VipsLattice *lattice );
+void vips__lattice_unref( VipsLattice *lattice );
+void vips__lattice_process( VipsLattice *lattice, 
+	VipsPel *out, VipsPel *in, int width );
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
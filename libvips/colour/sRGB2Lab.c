@@ -0,0 +1,271 @@
+/* Turn displayable rgb files directly to Lab or LCh.
+ *
+ * 20/10/14
+ * 	- from sRGB2scRGB.c, fuse the sRGB -> scRGB -> XYZ -> Lab chain
+ * 	- follow XYZ2Lab onto the fast path
+ */
+
+/*
+
+    This file is part of VIPS.
+    
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <math.h>
+
+#include <vips/vips.h>
+
+#include "pcolour.h"
+
+typedef VipsColourCode VipssRGB2Lab;
+typedef VipsColourCodeClass VipssRGB2LabClass;
+
+G_DEFINE_TYPE( VipssRGB2Lab, vips_sRGB2Lab, VIPS_TYPE_COLOUR_CODE );
+
+typedef VipsColourCode VipssRGB2LCh;
+typedef VipsColourCodeClass VipssRGB2LChClass;
+
+G_DEFINE_TYPE( VipssRGB2LCh, vips_sRGB2LCh, VIPS_TYPE_COLOUR_CODE );
+
+/* Each pixel goes through the same per-pixel functions the separate
+ * sRGB2scRGB, scRGB2XYZ, XYZ2Lab and Lab2LCh operations use, so results are 
+ * identical to the long route, we just skip the three float intermediate 
+ * images. After vips_colour_set_fast(), XYZ2Lab computes the cube root 
+ * directly, so we must too.
+ */
+#define SRGB2LAB( TYPE, SRGB2SCRGB ) { \
+	TYPE * restrict p = (TYPE *) in; \
+	\
+	for( i = 0; i < width; i++ ) { \
+		float R, G, B; \
+		float X, Y, Z; \
+		float L, a, b; \
+		\
+		SRGB2SCRGB( p[0], p[1], p[2], &R, &G, &B ); \
+		p += 3; \
+		\
+		vips_col_scRGB2XYZ( R, G, B, &X, &Y, &Z ); \
+		if( fast ) \
+			vips__col_XYZ2Lab_vector( X, Y, Z, \
+				rX0, rY0, rZ0, &L, &a, &b ); \
+		else \
+			vips_col_XYZ2Lab( X, Y, Z, &L, &a, &b ); \
+		\
+		if( LCh ) \
+			vips_col_ab2Ch( a, b, &a, &b ); \
+		\
+		q[0] = L; \
+		q[1] = a; \
+		q[2] = b; \
+		q += 3; \
+	} \
+}
+
+static void
+vips_sRGB2Lab_line_LCh( VipsColour *colour, 
+	float * restrict q, VipsPel *in, int width, gboolean LCh )
+{
+	gboolean fast = vips_colour_get_fast();
+	float rX0 = 1.0 / VIPS_D65_X0;
+	float rY0 = 1.0 / VIPS_D65_Y0;
+	float rZ0 = 1.0 / VIPS_D65_Z0;
+
+	int i;
+
+	if( colour->in[0]->BandFmt == VIPS_FORMAT_UCHAR )
+		SRGB2LAB( VipsPel, vips_col_sRGB2scRGB_8 )
+	else
+		SRGB2LAB( unsigned short, vips_col_sRGB2scRGB_16 )
+}
+
+static void
+vips_sRGB2Lab_line( VipsColour *colour, 
+	VipsPel *out, VipsPel **in, int width )
+{
+	vips_sRGB2Lab_line_LCh( colour, (float *) out, in[0], width, FALSE );
+}
+
+static void
+vips_sRGB2LCh_line( VipsColour *colour, 
+	VipsPel *out, VipsPel **in, int width )
+{
+	vips_sRGB2Lab_line_LCh( colour, (float *) out, in[0], width, TRUE );
+}
+
+/* 16-bit input stays 16-bit, everything else is cast to 8-bit.
+ */
+static void
+vips_sRGB2Lab_set_input_format( VipsColourCode *code )
+{
+	if( code->in ) 
+		code->input_format = 
+			code->in->BandFmt == VIPS_FORMAT_USHORT ? 
+			VIPS_FORMAT_USHORT : VIPS_FORMAT_UCHAR;
+}
+
+static int
+vips_sRGB2Lab_build( VipsObject *object )
+{
+	vips_sRGB2Lab_set_input_format( (VipsColourCode *) object );
+
+	if( VIPS_OBJECT_CLASS( vips_sRGB2Lab_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_sRGB2Lab_class_init( VipssRGB2LabClass *class )
+{
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsColourClass *colour_class = VIPS_COLOUR_CLASS( class );
+
+	object_class->nickname = "sRGB2Lab";
+	object_class->description = _( "convert an sRGB image to Lab" );
+	object_class->build = vips_sRGB2Lab_build;
+
+	colour_class->process_line = vips_sRGB2Lab_line;
+}
+
+static void
+vips_sRGB2Lab_init_code( VipsColourCode *code, 
+	VipsInterpretation interpretation )
+{
+	VipsColour *colour = VIPS_COLOUR( code );
+
+	colour->coding = VIPS_CODING_NONE;
+	colour->interpretation = interpretation;
+	colour->format = VIPS_FORMAT_FLOAT;
+	colour->input_bands = 3;
+	colour->bands = 3;
+
+	code->input_coding = VIPS_CODING_NONE;
+
+	/* The default. This can get changed in _build if we see a 
+	 * 16-bit input.
+	 */
+	code->input_format = VIPS_FORMAT_UCHAR;
+}
+
+static void
+vips_sRGB2Lab_init( VipssRGB2Lab *sRGB2Lab )
+{
+	vips_sRGB2Lab_init_code( VIPS_COLOUR_CODE( sRGB2Lab ), 
+		VIPS_INTERPRETATION_LAB );
+}
+
+static int
+vips_sRGB2LCh_build( VipsObject *object )
+{
+	vips_sRGB2Lab_set_input_format( (VipsColourCode *) object );
+
+	if( VIPS_OBJECT_CLASS( vips_sRGB2LCh_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_sRGB2LCh_class_init( VipssRGB2LChClass *class )
+{
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsColourClass *colour_class = VIPS_COLOUR_CLASS( class );
+
+	object_class->nickname = "sRGB2LCh";
+	object_class->description = _( "convert an sRGB image to LCh" );
+	object_class->build = vips_sRGB2LCh_build;
+
+	colour_class->process_line = vips_sRGB2LCh_line;
+}
+
+static void
+vips_sRGB2LCh_init( VipssRGB2LCh *sRGB2LCh )
+{
+	vips_sRGB2Lab_init_code( VIPS_COLOUR_CODE( sRGB2LCh ), 
+		VIPS_INTERPRETATION_LCH );
+}
+
+/**
+ * vips_sRGB2Lab:
+ * @in: input image
+ * @out: output image
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Convert an sRGB image to Lab, D65. 8 and 16-bit sRGB are supported. 
+ *
+ * This gives the same result as vips_sRGB2scRGB(), vips_scRGB2XYZ() and 
+ * vips_XYZ2Lab() in turn, but does it in one pass with no intermediate 
+ * images. vips_colourspace() uses it for sRGB to Lab.
+ *
+ * See also: vips_sRGB2LCh(), vips_Lab2sRGB().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_sRGB2Lab( VipsImage *in, VipsImage **out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "sRGB2Lab", ap, in, out );
+	va_end( ap );
+
+	return( result );
+}
+
+/**
+ * vips_sRGB2LCh:
+ * @in: input image
+ * @out: output image
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Convert an sRGB image to LCh, D65. 8 and 16-bit sRGB are supported. 
+ *
+ * This is vips_sRGB2Lab() followed by vips_Lab2LCh(), but in one pass.
+ *
+ * See also: vips_sRGB2Lab(), vips_LCh2sRGB().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_sRGB2LCh( VipsImage *in, VipsImage **out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "sRGB2LCh", ap, in, out );
+	va_end( ap );
+
+	return( result );
+}
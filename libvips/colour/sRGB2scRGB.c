@@ -13,6 +13,8 @@
  * 	- add 16-bit sRGB import
  * 11/12/12
  * 	- cut about to make sRGB2scRGB.c
+ * 20/10/14
+ * 	- whole-line path when vector is enabled
  */
 
 /*
@@ -51,6 +53,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 
 #include "pcolour.h"
 
@@ -116,12 +119,22 @@ static void
 vips_sRGB2scRGB_line( VipsColour *colour, 
 	VipsPel *out, VipsPel **in, int width )
 {
-	if( colour->in[0]->BandFmt == VIPS_FORMAT_UCHAR )
-		vips_sRGB2scRGB_line_8( (float *) out, 
-			(VipsPel *) in[0], width );
-	else
-		vips_sRGB2scRGB_line_16( (float *) out, 
-			(unsigned short *) in[0], width );
+	if( vips_vector_isenabled() ) {
+		if( colour->in[0]->BandFmt == VIPS_FORMAT_UCHAR )
+			vips__col_sRGB2scRGB_line_8( (float *) out, 
+				(VipsPel *) in[0], width * 3 );
+		else
+			vips__col_sRGB2scRGB_line_16( (float *) out, 
+				(unsigned short *) in[0], width * 3 );
+	}
+	else {
+		if( colour->in[0]->BandFmt == VIPS_FORMAT_UCHAR )
+			vips_sRGB2scRGB_line_8( (float *) out, 
+				(VipsPel *) in[0], width );
+		else
+			vips_sRGB2scRGB_line_16( (float *) out, 
+				(unsigned short *) in[0], width );
+	}
 }
 
 static int
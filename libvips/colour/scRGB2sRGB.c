@@ -25,6 +25,8 @@
  * 	- added 16-bit option
  * 11/12/12
  * 	- cut about to make scRGB2sRGB.c
+ * 20/10/14
+ * 	- compute the gamma with no LUT, see vips_colour_set_fast()
  */
 
 /*
@@ -129,13 +131,50 @@ vips_scRGB2sRGB_line_16( unsigned short * restrict q, float * restrict p,
 	}
 }
 
+/* The vector path: no tables and no branches, so the compiler can vectorise 
+ * the loop. Within 1 of the LUT path.
+ */
+#define SCRGB2SRGB_VECTOR( TYPE, MAXVAL ) { \
+	TYPE * restrict q = (TYPE *) out; \
+	float * restrict p = (float *) in[0]; \
+	\
+	for( i = 0; i < width; i++ ) { \
+		int r, g, b; \
+		\
+		vips__col_scRGB2sRGB_vector( p[0], p[1], p[2], MAXVAL, \
+			&r, &g, &b ); \
+		p += 3; \
+		\
+		q[0] = r; \
+		q[1] = g; \
+		q[2] = b; \
+		q += 3; \
+	} \
+}
+
 static void
-vips_scRGB2sRGB_line( VipsColour *colour, 
+vips_scRGB2sRGB_line_vector( VipsColour *colour, 
 	VipsPel *out, VipsPel **in, int width )
 {
 	VipsscRGB2sRGB *scRGB2sRGB = (VipsscRGB2sRGB *) colour;
 
+	int i;
+
 	if( scRGB2sRGB->depth == 16 ) 
+		SCRGB2SRGB_VECTOR( unsigned short, 65535 )
+	else
+		SCRGB2SRGB_VECTOR( VipsPel, 255 )
+}
+
+static void
+vips_scRGB2sRGB_line( VipsColour *colour, 
+	VipsPel *out, VipsPel **in, int width )
+{
+	VipsscRGB2sRGB *scRGB2sRGB = (VipsscRGB2sRGB *) colour;
+
+	if( vips_colour_get_fast() ) 
+		vips_scRGB2sRGB_line_vector( colour, out, in, width );
+	else if( scRGB2sRGB->depth == 16 ) 
 		vips_scRGB2sRGB_line_16( (unsigned short *) out, 
 			(float *) in[0], width );
 	else
@@ -229,6 +268,10 @@ vips_scRGB2sRGB_init( VipsscRGB2sRGB *scRGB2sRGB )
  *
  * Convert an scRGB image to sRGB. Set @depth to 16 to get 16-bit output.
  *
+ * The sRGB gamma is interpolated from a table. After vips_colour_set_fast(),
+ * it's computed directly instead. The two paths can differ by 1 in the 
+ * output. 
+ *
  * See also: vips_LabS2LabQ(), vips_scRGB2sRGB(), vips_rad2float().
  *
  * Returns: 0 on success, -1 on error.
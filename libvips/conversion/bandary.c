@@ -26,6 +26,8 @@
  * 	- rewrite as a class
  * 20/11/11
  * 	- from bandjoin
+ * 20/10/14
+ * 	- add vips_bandary_copy_bands(), vips_bandary_producer()
  */
 
 /*
@@ -213,3 +215,83 @@ vips_bandary_copy( VipsBandary *bandary )
 
 	return( vips_image_write( bandary->in[0], conversion->out ) );
 }
+
+/* If @image is being made by a bandary, return the operation, or NULL. The 
+ * operation is kept alive by the image it made.
+ */
+VipsBandary *
+vips_bandary_producer( VipsImage *image )
+{
+	if( image->generate_fn == vips_bandary_gen ) 
+		return( (VipsBandary *) image->client2 );
+
+	return( NULL );
+}
+
+/* Copy @n bands of @width pixels as whole elements of TYPE. Strides are in 
+ * TYPEs.
+ */
+#define VIPS_BANDARY_COPY( TYPE, N ) { \
+	TYPE *tq = (TYPE *) q; \
+	TYPE *tp = (TYPE *) p; \
+	int tqs = qs / sizeof( TYPE ); \
+	int tps = ps / sizeof( TYPE ); \
+	\
+	for( x = 0; x < width; x++ ) { \
+		for( z = 0; z < N; z++ ) \
+			tq[z] = tp[z]; \
+		\
+		tq += tqs; \
+		tp += tps; \
+	} \
+}
+
+/* Fix N for the common band counts so the inner loop unrolls.
+ */
+#define VIPS_BANDARY_SWITCH( TYPE ) \
+	switch( n ) { \
+	case 1:	VIPS_BANDARY_COPY( TYPE, 1 ); break; \
+	case 2:	VIPS_BANDARY_COPY( TYPE, 2 ); break; \
+	case 3:	VIPS_BANDARY_COPY( TYPE, 3 ); break; \
+	case 4:	VIPS_BANDARY_COPY( TYPE, 4 ); break; \
+	default: VIPS_BANDARY_COPY( TYPE, n ); \
+	}
+
+/* Copy @n bands of @width pixels from @p to @q. Pixels are @ps and @qs bytes
+ * apart, and elements are @es bytes. This is the inner loop of bandjoin and
+ * extract_band, so we copy whole elements rather than bytes.
+ */
+void
+vips_bandary_copy_bands( VipsPel *q, int qs, VipsPel *p, int ps, 
+	int es, int n, int width )
+{
+	int x, z;
+
+	/* dpcomplex moves as pairs of doubles.
+	 */
+	if( es == 16 ) {
+		es = 8;
+		n *= 2;
+	}
+
+	switch( es ) {
+	case 1:
+		VIPS_BANDARY_SWITCH( unsigned char ); 
+		break;
+
+	case 2:
+		VIPS_BANDARY_SWITCH( unsigned short ); 
+		break;
+
+	case 4:
+		VIPS_BANDARY_SWITCH( guint32 ); 
+		break;
+
+	case 8:
+		VIPS_BANDARY_SWITCH( guint64 ); 
+		break;
+
+	default:
+		g_assert( 0 );
+	}
+}
@@ -92,6 +92,12 @@ typedef struct _VipsBandaryClass {
 GType vips_bandary_get_type( void );
 
 int vips_bandary_copy( VipsBandary *bandary );
+VipsBandary *vips_bandary_producer( VipsImage *image );
+void vips_bandary_copy_bands( VipsPel *q, int qs, VipsPel *p, int ps, 
+	int es, int n, int width );
+
+gboolean vips_extract_band_source( VipsImage *image, 
+	VipsImage **in, int *band, int *n );
 
 #ifdef __cplusplus
 }
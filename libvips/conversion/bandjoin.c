@@ -24,6 +24,10 @@
  * 	- sizealike inputs
  * 27/10/11
  * 	- rewrite as a class
+ * 20/10/14
+ * 	- copy whole elements
+ * 	- a join of extract_band of adjacent bands of one image becomes a 
+ * 	  single extract_band
  */
 
 /*
@@ -105,22 +109,43 @@ vips_bandjoin_buffer( VipsBandary *bandary, VipsPel *q, VipsPel **p, int width )
 		 */
 		int ips = VIPS_IMAGE_SIZEOF_PEL( in[i] );
 
-		VipsPel *p1, *q1;
-		int x, z;
+		vips_bandary_copy_bands( q, ops, p[i], ips, 
+			VIPS_IMAGE_SIZEOF_ELEMENT( in[i] ), in[i]->Bands, 
+			width );
 
-		q1 = q;
-		p1 = p[i];
+		q += ips;
+	}
+}
 
-		for( x = 0; x < width; x++ ) {
-			for( z = 0; z < ips; z++ )
-				q1[z] = p1[z];
+/* Are all the inputs extract_band of adjacent runs of bands, in order, from 
+ * one image? If they are, set @source, @band and @n to the whole run.
+ */
+static gboolean
+vips_bandjoin_adjacent( VipsBandary *bandary, 
+	VipsImage **source, int *band, int *n )
+{
+	int i;
 
-			p1 += ips;
-			q1 += ops;
-		}
+	for( i = 0; i < bandary->n; i++ ) {
+		VipsImage *in;
+		int b, m;
 
-		q += ips;
+		if( !vips_extract_band_source( bandary->in[i], &in, &b, &m ) )
+			return( FALSE );
+
+		if( i == 0 ) {
+			*source = in;
+			*band = b;
+			*n = m;
+		}
+		else if( in != *source ||
+			b != *band + *n )
+			return( FALSE );
+		else
+			*n += m;
 	}
+
+	return( TRUE );
 }
 
 static int
@@ -128,6 +153,12 @@ vips_bandjoin_build( VipsObject *object )
 {
 	VipsBandary *bandary = (VipsBandary *) object;
 	VipsBandjoin *bandjoin = (VipsBandjoin *) object;
+	VipsConversion *conversion = (VipsConversion *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
+
+	VipsImage *source;
+	int band;
+	int n;
 
 	if( bandjoin->in ) {
 		bandary->in = VIPS_AREA( bandjoin->in )->data;
@@ -135,6 +166,20 @@ vips_bandjoin_build( VipsObject *object )
 
 		if( bandary->n == 1 ) 
 			return( vips_bandary_copy( bandary ) );
+		else if( vips_bandjoin_adjacent( bandary, 
+			&source, &band, &n ) ) {
+			/* Just pull the run out of the source in one go, 
+			 * or copy it if that's all of it.
+			 */
+			g_object_set( bandjoin, "out", vips_image_new(), NULL );
+
+			if( vips_extract_band( source, &t[0], band, 
+				"n", n, NULL ) ||
+				vips_image_write( t[0], conversion->out ) )
+				return( -1 );
+
+			return( 0 );
+		}
 		else {
 			int i;
 
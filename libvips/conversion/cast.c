@@ -47,6 +47,11 @@
  * 	- redone as a class
  * 10/4/12
  * 	- cast to uint now removes <0 values
+ * 20/10/14
+ * 	- add @count, only count under and overflows if asked
+ * 	- add @shift
+ * 	- add @round
+ * 	- most real casts run in fixed-size blocks the compiler can vectorise
  */
 
 /*
@@ -101,10 +106,23 @@ typedef struct _VipsCast {
 
 	VipsImage *in;
 	VipsBandFormat format;
+	gboolean count;
+	gboolean shift;
+	gboolean round;
 
 	int underflow;		/* Number of underflows */
 	int overflow;		/* Number of overflows */
 
+	/* For int to int casts with @shift, shift left or right this many
+	 * bits.
+	 */
+	int left;
+	int right;
+
+	/* Added to float values before floor(), 0.5 for @round.
+	 */
+	double bias;
+
 } VipsCast;
 
 typedef VipsConversionClass VipsCastClass;
@@ -179,14 +197,16 @@ vips_cast_start( VipsImage *out, void *a, void *b )
 	return( seq );
 }
 
-/* Cast int types to an int type.
+/* Cast int types to an int type. Shift left with a multiply, since 
+ * left-shifting a negative value is undefined.
  */
 #define VIPS_CLIP_INT_INT( ITYPE, OTYPE, VIPS_CLIP ) { \
 	ITYPE * restrict p = (ITYPE *) in; \
 	OTYPE * restrict q = (OTYPE *) out; \
 	\
 	for( x = 0; x < sz; x++ ) { \
-		int t = p[x]; \
+		gint64 t = ((gint64) p[x] * ((gint64) 1 << cast->left)) >> \
+			cast->right; \
 		\
 		VIPS_CLIP( t, seq ); \
 		\
@@ -201,7 +221,7 @@ vips_cast_start( VipsImage *out, void *a, void *b )
 	OTYPE * restrict q = (OTYPE *) out; \
 	\
 	for( x = 0; x < sz; x++ ) { \
-		ITYPE v = floor( p[x] ); \
+		ITYPE v = floor( p[x] + cast->bias ); \
 		\
 		VIPS_CLIP( v, seq ); \
 		\
@@ -216,7 +236,7 @@ vips_cast_start( VipsImage *out, void *a, void *b )
 	OTYPE * restrict q = (OTYPE *) out; \
 	\
 	for( x = 0; x < sz; x++ ) { \
-		ITYPE v = floor( p[0] ); \
+		ITYPE v = floor( p[0] + cast->bias ); \
 		p += 2; \
 		\
 		VIPS_CLIP( v, seq ); \
@@ -321,6 +341,213 @@ vips_cast_start( VipsImage *out, void *a, void *b )
 	} \
 }
 
+/* The fast casts work in blocks of this many elements. The inner loops have
+ * a fixed length and no branches, so the compiler can vectorise them.
+ */
+#define VIPS_CAST_BLOCK (64)
+
+/* Make a fast cast from ITYPE to OTYPE. SAT makes an output value, clipped
+ * to LO and HI. 
+ */
+#define VIPS_CAST_FN( NAME, ITYPE, OTYPE, SAT, LO, HI ) \
+static void \
+NAME( VipsPel * restrict out, VipsPel * restrict in, \
+	int sz, int left, int right ) \
+{ \
+	ITYPE *p = (ITYPE *) in; \
+	OTYPE *q = (OTYPE *) out; \
+	\
+	int x, i; \
+	\
+	for( x = 0; x + VIPS_CAST_BLOCK <= sz; x += VIPS_CAST_BLOCK ) \
+		for( i = 0; i < VIPS_CAST_BLOCK; i++ ) \
+			q[x + i] = SAT( ITYPE, p[x + i], LO, HI ); \
+	\
+	for( ; x < sz; x++ ) \
+		q[x] = SAT( ITYPE, p[x], LO, HI ); \
+}
+
+/* Shift and saturate an int. Multiply rather than shift left, since V can
+ * be negative.
+ */
+#define VIPS_SAT_INT( ITYPE, V, LO, HI ) \
+	VIPS_CLIP( LO, ((V) * (1 << left)) >> right, HI )
+
+/* uint is never shifted left, since the output is always narrower, and can't
+ * be less than zero. 
+ */
+#define VIPS_SAT_UINT( ITYPE, V, LO, HI ) \
+	VIPS_MIN( (unsigned int) HI, (V) >> right )
+
+/* Saturate a float to an unsigned type. Once it's clipped to [0, HI],
+ * truncation is the same as floor(), and the conversion can't overflow.
+ */
+#define VIPS_SAT_FLOAT( ITYPE, V, LO, HI ) \
+	((int) VIPS_CLIP( (ITYPE) 0, (V), (ITYPE) HI ))
+
+/* The same, but round to nearest. The clipped value plus 0.5 still 
+ * truncates to at most HI.
+ */
+#define VIPS_SAT_FLOAT_ROUND( ITYPE, V, LO, HI ) \
+	((int) (VIPS_CLIP( (ITYPE) 0, (V), (ITYPE) HI ) + (ITYPE) 0.5))
+
+#define VIPS_SAT_NONE( ITYPE, V, LO, HI ) (V)
+
+#define UC unsigned char
+#define C signed char
+#define US unsigned short
+#define S signed short
+#define UI unsigned int
+#define I signed int
+#define F float
+#define D double
+
+VIPS_CAST_FN( vips_cast_uchar_char, UC, C, VIPS_SAT_INT, SCHAR_MIN, SCHAR_MAX )
+VIPS_CAST_FN( vips_cast_uchar_ushort, UC, US, VIPS_SAT_INT, 0, USHRT_MAX )
+VIPS_CAST_FN( vips_cast_uchar_short, UC, S, VIPS_SAT_INT, SHRT_MIN, SHRT_MAX )
+VIPS_CAST_FN( vips_cast_uchar_float, UC, F, VIPS_SAT_NONE, 0, 0 )
+VIPS_CAST_FN( vips_cast_uchar_double, UC, D, VIPS_SAT_NONE, 0, 0 )
+
+VIPS_CAST_FN( vips_cast_char_uchar, C, UC, VIPS_SAT_INT, 0, UCHAR_MAX )
+VIPS_CAST_FN( vips_cast_char_ushort, C, US, VIPS_SAT_INT, 0, USHRT_MAX )
+VIPS_CAST_FN( vips_cast_char_short, C, S, VIPS_SAT_INT, SHRT_MIN, SHRT_MAX )
+VIPS_CAST_FN( vips_cast_char_float, C, F, VIPS_SAT_NONE, 0, 0 )
+VIPS_CAST_FN( vips_cast_char_double, C, D, VIPS_SAT_NONE, 0, 0 )
+
+VIPS_CAST_FN( vips_cast_ushort_uchar, US, UC, VIPS_SAT_INT, 0, UCHAR_MAX )
+VIPS_CAST_FN( vips_cast_ushort_char, US, C, VIPS_SAT_INT, SCHAR_MIN, SCHAR_MAX )
+VIPS_CAST_FN( vips_cast_ushort_short, US, S, VIPS_SAT_INT, SHRT_MIN, SHRT_MAX )
+VIPS_CAST_FN( vips_cast_ushort_float, US, F, VIPS_SAT_NONE, 0, 0 )
+VIPS_CAST_FN( vips_cast_ushort_double, US, D, VIPS_SAT_NONE, 0, 0 )
+
+VIPS_CAST_FN( vips_cast_short_uchar, S, UC, VIPS_SAT_INT, 0, UCHAR_MAX )
+VIPS_CAST_FN( vips_cast_short_char, S, C, VIPS_SAT_INT, SCHAR_MIN, SCHAR_MAX )
+VIPS_CAST_FN( vips_cast_short_ushort, S, US, VIPS_SAT_INT, 0, USHRT_MAX )
+VIPS_CAST_FN( vips_cast_short_float, S, F, VIPS_SAT_NONE, 0, 0 )
+VIPS_CAST_FN( vips_cast_short_double, S, D, VIPS_SAT_NONE, 0, 0 )
+
+VIPS_CAST_FN( vips_cast_uint_uchar, UI, UC, VIPS_SAT_UINT, 0, UCHAR_MAX )
+VIPS_CAST_FN( vips_cast_uint_char, UI, C, VIPS_SAT_UINT, 0, SCHAR_MAX )
+VIPS_CAST_FN( vips_cast_uint_ushort, UI, US, VIPS_SAT_UINT, 0, USHRT_MAX )
+VIPS_CAST_FN( vips_cast_uint_short, UI, S, VIPS_SAT_UINT, 0, SHRT_MAX )
+VIPS_CAST_FN( vips_cast_uint_float, UI, F, VIPS_SAT_NONE, 0, 0 )
+VIPS_CAST_FN( vips_cast_uint_double, UI, D, VIPS_SAT_NONE, 0, 0 )
+
+VIPS_CAST_FN( vips_cast_int_uchar, I, UC, VIPS_SAT_INT, 0, UCHAR_MAX )
+VIPS_CAST_FN( vips_cast_int_char, I, C, VIPS_SAT_INT, SCHAR_MIN, SCHAR_MAX )
+VIPS_CAST_FN( vips_cast_int_ushort, I, US, VIPS_SAT_INT, 0, USHRT_MAX )
+VIPS_CAST_FN( vips_cast_int_short, I, S, VIPS_SAT_INT, SHRT_MIN, SHRT_MAX )
+VIPS_CAST_FN( vips_cast_int_float, I, F, VIPS_SAT_NONE, 0, 0 )
+VIPS_CAST_FN( vips_cast_int_double, I, D, VIPS_SAT_NONE, 0, 0 )
+
+VIPS_CAST_FN( vips_cast_float_uchar, F, UC, VIPS_SAT_FLOAT, 0, UCHAR_MAX )
+VIPS_CAST_FN( vips_cast_float_ushort, F, US, VIPS_SAT_FLOAT, 0, USHRT_MAX )
+VIPS_CAST_FN( vips_cast_float_double, F, D, VIPS_SAT_NONE, 0, 0 )
+
+VIPS_CAST_FN( vips_cast_double_uchar, D, UC, VIPS_SAT_FLOAT, 0, UCHAR_MAX )
+VIPS_CAST_FN( vips_cast_double_ushort, D, US, VIPS_SAT_FLOAT, 0, USHRT_MAX )
+VIPS_CAST_FN( vips_cast_double_float, D, F, VIPS_SAT_NONE, 0, 0 )
+
+VIPS_CAST_FN( vips_cast_float_uchar_round, 
+	F, UC, VIPS_SAT_FLOAT_ROUND, 0, UCHAR_MAX )
+VIPS_CAST_FN( vips_cast_float_ushort_round, 
+	F, US, VIPS_SAT_FLOAT_ROUND, 0, USHRT_MAX )
+VIPS_CAST_FN( vips_cast_double_uchar_round, 
+	D, UC, VIPS_SAT_FLOAT_ROUND, 0, UCHAR_MAX )
+VIPS_CAST_FN( vips_cast_double_ushort_round, 
+	D, US, VIPS_SAT_FLOAT_ROUND, 0, USHRT_MAX )
+
+#undef UC
+#undef C
+#undef US
+#undef S
+#undef UI
+#undef I
+#undef F
+#undef D
+
+typedef void (*VipsCastFn)( VipsPel *out, VipsPel *in, 
+	int sz, int left, int right );
+
+/* The fast casts, indexed by input and output format. Casts which are NULL
+ * here (to complex, from complex, to int and uint, and float to signed
+ * types) go through the general loops.
+ */
+static const VipsCastFn vips_cast_fast[10][10] = {
+	/* From uchar.
+	 */
+	{ NULL, vips_cast_uchar_char, vips_cast_uchar_ushort,
+	  vips_cast_uchar_short, NULL, NULL, vips_cast_uchar_float, NULL,
+	  vips_cast_uchar_double, NULL },
+	/* From char.
+	 */
+	{ vips_cast_char_uchar, NULL, vips_cast_char_ushort,
+	  vips_cast_char_short, NULL, NULL, vips_cast_char_float, NULL,
+	  vips_cast_char_double, NULL },
+	/* From ushort.
+	 */
+	{ vips_cast_ushort_uchar, vips_cast_ushort_char, NULL,
+	  vips_cast_ushort_short, NULL, NULL, vips_cast_ushort_float, NULL,
+	  vips_cast_ushort_double, NULL },
+	/* From short.
+	 */
+	{ vips_cast_short_uchar, vips_cast_short_char,
+	  vips_cast_short_ushort, NULL, NULL, NULL, vips_cast_short_float,
+	  NULL, vips_cast_short_double, NULL },
+	/* From uint.
+	 */
+	{ vips_cast_uint_uchar, vips_cast_uint_char, vips_cast_uint_ushort,
+	  vips_cast_uint_short, NULL, NULL, vips_cast_uint_float, NULL,
+	  vips_cast_uint_double, NULL },
+	/* From int.
+	 */
+	{ vips_cast_int_uchar, vips_cast_int_char, vips_cast_int_ushort,
+	  vips_cast_int_short, NULL, NULL, vips_cast_int_float, NULL,
+	  vips_cast_int_double, NULL },
+	/* From float.
+	 */
+	{ vips_cast_float_uchar, NULL, vips_cast_float_ushort, NULL, NULL,
+	  NULL, NULL, NULL, vips_cast_float_double, NULL },
+	/* From complex.
+	 */
+	{ NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL },
+	/* From double.
+	 */
+	{ vips_cast_double_uchar, NULL, vips_cast_double_ushort, NULL, NULL,
+	  NULL, vips_cast_double_float, NULL, NULL, NULL },
+	/* From dpcomplex.
+	 */
+	{ NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+/* The fast cast for a pair of formats. With @round, float to int casts need
+ * their own set.
+ */
+static VipsCastFn
+vips_cast_fast_fn( VipsCast *cast, VipsBandFormat format )
+{
+	if( cast->round &&
+		vips_band_format_isfloat( format ) &&
+		vips_band_format_isint( cast->format ) ) {
+		if( format == VIPS_FORMAT_FLOAT &&
+			cast->format == VIPS_FORMAT_UCHAR )
+			return( vips_cast_float_uchar_round );
+		if( format == VIPS_FORMAT_FLOAT &&
+			cast->format == VIPS_FORMAT_USHORT )
+			return( vips_cast_float_ushort_round );
+		if( format == VIPS_FORMAT_DOUBLE &&
+			cast->format == VIPS_FORMAT_UCHAR )
+			return( vips_cast_double_uchar_round );
+		if( format == VIPS_FORMAT_DOUBLE &&
+			cast->format == VIPS_FORMAT_USHORT )
+			return( vips_cast_double_ushort_round );
+
+		return( NULL );
+	}
+
+	return( vips_cast_fast[format][cast->format] );
+}
+
 static int
 vips_cast_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	gboolean *stop )
@@ -334,8 +561,18 @@ vips_cast_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	int to = r->top;
 	int bo = VIPS_RECT_BOTTOM( r );
 	int sz = VIPS_REGION_N_ELEMENTS( or );
+	VipsBandFormat format = ir->im->BandFmt;
+
+	VipsCastFn fast;
 	int x, y;
 
+	/* Counting under and overflows needs the general loops.
+	 */
+	if( cast->count )
+		fast = NULL;
+	else
+		fast = vips_cast_fast_fn( cast, format );
+
 	if( vips_region_prepare( ir, r ) )
 		return( -1 );
 
@@ -345,7 +582,12 @@ vips_cast_gen( VipsRegion *or, void *vseq, void *a, void *b,
 		VipsPel *in = VIPS_REGION_ADDR( ir, le, y ); 
 		VipsPel *out = VIPS_REGION_ADDR( or, le, y ); 
 
-		switch( cast->in->BandFmt ) { 
+		if( fast ) {
+			fast( out, in, sz, cast->left, cast->right );
+			continue;
+		}
+
+		switch( format ) { 
 		case VIPS_FORMAT_UCHAR: 
 			BAND_SWITCH_INNER( unsigned char,
 				VIPS_CLIP_INT_INT, 
@@ -456,10 +698,30 @@ vips_cast_build( VipsObject *object )
 
 	conversion->out->BandFmt = cast->format;
 
-	g_signal_connect( in, "preeval", 
-		G_CALLBACK( vips_cast_preeval ), cast );
-	g_signal_connect( in, "posteval", 
-		G_CALLBACK( vips_cast_posteval ), cast );
+	cast->bias = cast->round ? 0.5 : 0.0;
+
+	/* Shift int to int casts by the difference in bit width.
+	 */
+	cast->left = 0;
+	cast->right = 0;
+	if( cast->shift &&
+		vips_band_format_isint( in->BandFmt ) &&
+		vips_band_format_isint( cast->format ) ) {
+		int bits = 8 * ((int) vips_format_sizeof( cast->format ) - 
+			(int) vips_format_sizeof( in->BandFmt ));
+
+		if( bits > 0 )
+			cast->left = bits;
+		else
+			cast->right = -bits;
+	}
+
+	if( cast->count ) {
+		g_signal_connect( in, "preeval", 
+			G_CALLBACK( vips_cast_preeval ), cast );
+		g_signal_connect( in, "posteval", 
+			G_CALLBACK( vips_cast_posteval ), cast );
+	}
 
 	if( vips_image_generate( conversion->out,
 		vips_cast_start, vips_cast_gen, vips_cast_stop, 
@@ -499,6 +761,27 @@ vips_cast_class_init( VipsCastClass *class )
 		VIPS_ARGUMENT_REQUIRED_INPUT,
 		G_STRUCT_OFFSET( VipsCast, format ),
 		VIPS_TYPE_BAND_FORMAT, VIPS_FORMAT_UCHAR ); 
+
+	VIPS_ARG_BOOL( class, "count", 7, 
+		_( "Count" ), 
+		_( "Count and warn about out of range values" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsCast, count ),
+		FALSE );
+
+	VIPS_ARG_BOOL( class, "shift", 8, 
+		_( "Shift" ), 
+		_( "Shift integer values up and down" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsCast, shift ),
+		FALSE );
+
+	VIPS_ARG_BOOL( class, "round", 9, 
+		_( "Round" ), 
+		_( "Round float values to nearest, not down" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsCast, round ),
+		FALSE );
 }
 
 static void
@@ -519,11 +802,26 @@ vips_castv( VipsImage *in, VipsImage **out, VipsBandFormat format, va_list ap )
  * @format: format to convert to
  * @...: %NULL-terminated list of optional named arguments
  *
+ * Optional arguments:
+ *
+ * @count: count and warn about out of range values
+ * @shift: shift integer values up and down
+ * @round: round float values to nearest
+ *
  * Convert @in to @format. You can convert between any pair of formats.
- * Floats are truncated (not rounded). Out of range values are clipped.
+ * Floats are rounded down with floor(), or to nearest if @round is set, 
+ * with halves going up. Out of range values are clipped.
  *
  * Casting from complex to real returns the real part. 
  *
+ * If @count is set, vips_cast() counts the values it has to clip and 
+ * prints a warning when the computation finishes. Counting stops the 
+ * common casts running as vector code, so it's off by default.
+ *
+ * If @shift is set, integer values are shifted by the difference in bit 
+ * width between the formats, so for example casting ushort to uchar divides
+ * by 256 and casting uchar to ushort multiplies by 256. 
+ *
  * See also: im_scale(), im_ri2c().
  *
  * Returns: 0 on success, -1 on error
@@ -37,6 +37,9 @@
  * 	- gtkdoc
  * 26/10/11
  * 	- redone as a class
+ * 20/10/14
+ * 	- an extract of an extract reads directly from the first input
+ * 	- extract_band copies whole elements
  */
 
 /*
@@ -99,6 +102,13 @@ typedef struct _VipsExtractArea {
 	int width;
 	int height;
 
+	/* Pixels really come from this area of this image. This is @in, 
+	 * unless @in is itself an extract, see build.
+	 */
+	VipsImage *source;
+	int source_left;
+	int source_top;
+
 } VipsExtractArea;
 
 typedef VipsConversionClass VipsExtractAreaClass;
@@ -119,8 +129,8 @@ vips_extract_area_gen( VipsRegion *or, void *seq, void *a, void *b,
 	 * demand in ir's space.
 	 */
 	iarea = or->valid;
-	iarea.left += extract->left;
-	iarea.top += extract->top;
+	iarea.left += extract->source_left;
+	iarea.top += extract->source_top;
 	if( vips_region_prepare( ir, &iarea ) )
 		return( -1 );
 
@@ -164,9 +174,25 @@ vips_extract_area_build( VipsObject *object )
         conversion->out->Xoffset = -extract->left;
         conversion->out->Yoffset = -extract->top;
 
+	/* If our input is an extract, read straight from its source and skip 
+	 * a level of region attaching on every request. The upstream extract 
+	 * is kept alive by the image it made, our input.
+	 */
+	extract->source = extract->in;
+	extract->source_left = extract->left;
+	extract->source_top = extract->top;
+	if( extract->in->generate_fn == vips_extract_area_gen ) {
+		VipsExtractArea *upstream = 
+			(VipsExtractArea *) extract->in->client2;
+
+		extract->source = upstream->source;
+		extract->source_left += upstream->source_left;
+		extract->source_top += upstream->source_top;
+	}
+
 	if( vips_image_generate( conversion->out,
 		vips_start_one, vips_extract_area_gen, vips_stop_one, 
-		extract->in, extract ) )
+		extract->source, extract ) )
 		return( -1 );
 
 	return( 0 );
@@ -352,18 +378,8 @@ vips_extract_band_buffer( VipsBandary *bandary,
 	int ips = VIPS_IMAGE_SIZEOF_PEL( im );
 	const int ops = VIPS_IMAGE_SIZEOF_PEL( conversion->out );
 
-	VipsPel *p, *q;
-	int x, z;
-
-	p = in[0] + extract->band * es;
-	q = out;
-	for( x = 0; x < width; x++ ) {
-		for( z = 0; z < ops; z++ )
-			q[z] = p[z];
-
-		p += ips;
-		q += ops;
-	}
+	vips_bandary_copy_bands( out, ops, in[0] + extract->band * es, ips, 
+		es, extract->n, width );
 }
 
 static int
@@ -400,6 +416,29 @@ vips_extract_band_build( VipsObject *object )
 	return( 0 );
 }
 
+/* If @image is being made by an extract_band, set @in, @band and @n to 
+ * what it is extracting.
+ */
+gboolean
+vips_extract_band_source( VipsImage *image, 
+	VipsImage **in, int *band, int *n )
+{
+	VipsBandary *bandary;
+	VipsExtractBand *extract;
+
+	if( !(bandary = vips_bandary_producer( image )) ||
+		!G_TYPE_CHECK_INSTANCE_TYPE( bandary, 
+			vips_extract_band_get_type() ) )
+		return( FALSE );
+	extract = (VipsExtractBand *) bandary;
+
+	*in = extract->in;
+	*band = extract->band;
+	*n = extract->n;
+
+	return( TRUE );
+}
+
 static void
 vips_extract_band_class_init( VipsExtractBandClass *class )
 {
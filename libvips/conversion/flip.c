@@ -17,6 +17,9 @@
  * 	- gtkdoc
  * 17/10/11
  * 	- redone as a class
+ * 20/10/14
+ * 	- flip left/right copies whole pixels for the common sizes
+ * 	- flipping a flip in the same direction just copies the first input
  */
 
 /*
@@ -127,6 +130,21 @@ vips_flip_vertical_gen( VipsRegion *or, void *seq, void *a, void *b,
 	return( 0 );
 }
 
+/* Copy and reverse a line, moving pixels as N TYPEs.
+ */
+#define VIPS_FLIP_LINE( TYPE, N ) { \
+	TYPE *tp = (TYPE *) p; \
+	TYPE *tq = (TYPE *) q; \
+	\
+	for( x = le; x < ri; x++ ) { \
+		for( z = 0; z < N; z++ ) \
+			tq[z] = tp[z]; \
+		\
+		tq += N; \
+		tp -= N; \
+	} \
+}
+
 static int
 vips_flip_horizontal_gen( VipsRegion *or, void *seq, void *a, void *b, 
 	gboolean *stop )
@@ -168,16 +186,45 @@ vips_flip_horizontal_gen( VipsRegion *or, void *seq, void *a, void *b,
 		p = VIPS_REGION_ADDR( ir, lastx, y );
 		q = VIPS_REGION_ADDR( or, le, y );
 
-		for( x = le; x < ri; x++ ) {
-			/* Copy the pel.
-			 */
-			for( z = 0; z < ps; z++ )
-				q[z] = p[z];
-
-			/* Skip forwards in out, back in in.
-			 */
-			q += ps;
-			p -= ps;
+		/* Skip forwards in out, back in in. The common pixel 
+		 * sizes get a fixed count so the inner loop goes away.
+		 */
+		switch( ps ) {
+		case 1:
+			VIPS_FLIP_LINE( unsigned char, 1 );
+			break;
+
+		case 2:
+			VIPS_FLIP_LINE( unsigned short, 1 );
+			break;
+
+		case 3:
+			VIPS_FLIP_LINE( unsigned char, 3 );
+			break;
+
+		case 4:
+			VIPS_FLIP_LINE( unsigned int, 1 );
+			break;
+
+		case 6:
+			VIPS_FLIP_LINE( unsigned short, 3 );
+			break;
+
+		case 8:
+			VIPS_FLIP_LINE( guint64, 1 );
+			break;
+
+		case 12:
+			VIPS_FLIP_LINE( unsigned int, 3 );
+			break;
+
+		case 16:
+			VIPS_FLIP_LINE( guint64, 2 );
+			break;
+
+		default:
+			VIPS_FLIP_LINE( unsigned char, ps );
+			break;
 		}
 	}
 
@@ -195,6 +242,19 @@ vips_flip_build( VipsObject *object )
 	if( VIPS_OBJECT_CLASS( vips_flip_parent_class )->build( object ) )
 		return( -1 );
 
+	/* A flip of a flip in the same direction is the upstream flip's 
+	 * input again, so don't touch the pixels at all. The upstream flip is
+	 * kept alive by the image it made, our input.
+	 */
+	if( (flip->in->generate_fn == vips_flip_horizontal_gen &&
+		flip->direction == VIPS_DIRECTION_HORIZONTAL) ||
+		(flip->in->generate_fn == vips_flip_vertical_gen &&
+		 flip->direction == VIPS_DIRECTION_VERTICAL) ) {
+		VipsFlip *upstream = (VipsFlip *) flip->in->client2;
+
+		return( vips_image_write( upstream->in, conversion->out ) );
+	}
+
 	if( vips_image_pio_input( flip->in ) )
 		return( -1 );
 
@@ -26,6 +26,9 @@
  * 	- gtkdoc
  * 4/11/11
  * 	- rewrite as a class
+ * 20/10/14
+ * 	- rot90 and rot270 transpose in small blocks, copying whole pixels
+ * 	- a rot of a rot is folded into a single rot of the first input
  */
 
 /*
@@ -91,6 +94,87 @@ typedef VipsConversionClass VipsRotClass;
 
 G_DEFINE_TYPE( VipsRot, vips_rot, VIPS_TYPE_CONVERSION );
 
+/* rot90 and rot270 work in blocks of this many pixels square. Each block 
+ * reads a few cache lines from each of a few input lines, so the whole 
+ * block stays in cache however far apart the input lines are.
+ */
+#define VIPS_ROT_BLOCK (8)
+
+/* Copy a block, moving whole pixels as N TYPEs.
+ */
+#define VIPS_ROT_COPY( TYPE, N ) { \
+	for( y = 0; y < bh; y++ ) { \
+		TYPE *tq = (TYPE *) (q + (by + y) * qls + bx * ps); \
+		VipsPel *tp = p + (by + y) * py + bx * px; \
+		\
+		for( x = 0; x < bw; x++ ) { \
+			for( i = 0; i < N; i++ ) \
+				tq[i] = ((TYPE *) tp)[i]; \
+			\
+			tq += N; \
+			tp += px; \
+		} \
+	} \
+}
+
+/* Fill a @width by @height area of pixels at @q, with line skip @qls. Moving
+ * right one pixel in @q moves @px bytes in @p, moving down one line moves 
+ * @py bytes.
+ */
+static void
+vips_rot_transpose( VipsPel *q, int qls, VipsPel *p, int px, int py, 
+	int ps, int width, int height )
+{
+	int bx, by, x, y, i;
+
+	for( by = 0; by < height; by += VIPS_ROT_BLOCK ) 
+		for( bx = 0; bx < width; bx += VIPS_ROT_BLOCK ) {
+			int bw = VIPS_MIN( VIPS_ROT_BLOCK, width - bx );
+			int bh = VIPS_MIN( VIPS_ROT_BLOCK, height - by );
+
+			/* Pick a unit to copy pixels with. The common sizes
+			 * get a fixed count so the inner loop goes away.
+			 */
+			switch( ps ) {
+			case 1:
+				VIPS_ROT_COPY( unsigned char, 1 );
+				break;
+
+			case 2:
+				VIPS_ROT_COPY( unsigned short, 1 );
+				break;
+
+			case 3:
+				VIPS_ROT_COPY( unsigned char, 3 );
+				break;
+
+			case 4:
+				VIPS_ROT_COPY( unsigned int, 1 );
+				break;
+
+			case 6:
+				VIPS_ROT_COPY( unsigned short, 3 );
+				break;
+
+			case 8:
+				VIPS_ROT_COPY( guint64, 1 );
+				break;
+
+			case 12:
+				VIPS_ROT_COPY( unsigned int, 3 );
+				break;
+
+			case 16:
+				VIPS_ROT_COPY( guint64, 2 );
+				break;
+
+			default:
+				VIPS_ROT_COPY( unsigned char, ps );
+				break;
+			}
+		}
+}
+
 static int
 vips_rot90_gen( VipsRegion *or, void *seq, void *a, void *b,
 	gboolean *stop )
@@ -104,9 +188,6 @@ vips_rot90_gen( VipsRegion *or, void *seq, void *a, void *b,
 	int le = r->left;
 	int ri = VIPS_RECT_RIGHT(r);
 	int to = r->top;
-	int bo = VIPS_RECT_BOTTOM(r);
-
-	int x, y, i;
 
 	/* Pixel geometry.
 	 */
@@ -128,27 +209,16 @@ vips_rot90_gen( VipsRegion *or, void *seq, void *a, void *b,
 	ps = VIPS_IMAGE_SIZEOF_PEL( in );
 	ls = VIPS_REGION_LSKIP( ir );
 
-	/* Rotate the bit we now have.
+	/* Rotate the bit we now have. Output (le, to) comes from the bottom
+	 * left of need, right in the output is up in ir, down in the output
+	 * is right in ir.
 	 */
-	for( y = to; y < bo; y++ ) {
-		/* Start of this output line.
-		 */
-		VipsPel *q = VIPS_REGION_ADDR( or, le, y );
-
-		/* Corresponding position in ir.
-		 */
-		VipsPel *p = VIPS_REGION_ADDR( ir, 
-			need.left + y - to, 
-			need.top + need.height - 1 );
-
-		for( x = le; x < ri; x++ ) {
-			for( i = 0; i < ps; i++ )
-				q[i] = p[i];
-
-			q += ps;
-			p -= ls;
-		}
-	}
+	vips_rot_transpose( VIPS_REGION_ADDR( or, le, to ), 
+		VIPS_REGION_LSKIP( or ),
+		VIPS_REGION_ADDR( ir, 
+			need.left, need.top + need.height - 1 ),
+		-ls, ps, 
+		ps, r->width, r->height );
 
 	return( 0 );
 }
@@ -225,12 +295,9 @@ vips_rot270_gen( VipsRegion *or, void *seq, void *a, void *b,
 	 */
 	VipsRect *r = &or->valid;
 	int le = r->left;
-	int ri = VIPS_RECT_RIGHT(r);
 	int to = r->top;
 	int bo = VIPS_RECT_BOTTOM(r);
 
-	int x, y, i;
-
 	/* Pixel geometry.
 	 */
 	int ps, ls;
@@ -251,27 +318,15 @@ vips_rot270_gen( VipsRegion *or, void *seq, void *a, void *b,
 	ps = VIPS_IMAGE_SIZEOF_PEL( in );
 	ls = VIPS_REGION_LSKIP( ir );
 
-	/* Rotate the bit we now have.
+	/* Rotate the bit we now have. Output (le, to) comes from the top 
+	 * right of need, right in the output is down in ir, down in the 
+	 * output is left in ir.
 	 */
-	for( y = to; y < bo; y++ ) {
-		/* Start of this output line.
-		 */
-		VipsPel *q = VIPS_REGION_ADDR( or, le, y );
-
-		/* Corresponding position in ir.
-		 */
-		VipsPel *p = VIPS_REGION_ADDR( ir, 
-			need.left + need.width - (y - to) - 1,
-			need.top );
-
-		for( x = le; x < ri; x++ ) {
-			for( i = 0; i < ps; i++ )
-				q[i] = p[i];
-
-			q += ps;
-			p += ls;
-		}
-	}
+	vips_rot_transpose( VIPS_REGION_ADDR( or, le, to ), 
+		VIPS_REGION_LSKIP( or ),
+		VIPS_REGION_ADDR( ir, need.left + need.width - 1, need.top ),
+		ls, -ps, 
+		ps, r->width, r->height );
 
 	return( 0 );
 }
@@ -282,28 +337,53 @@ vips_rot_build( VipsObject *object )
 	VipsConversion *conversion = VIPS_CONVERSION( object );
 	VipsRot *rot = (VipsRot *) object;
 
+	VipsImage *in;
+	VipsAngle angle;
 	VipsGenerateFn generate_fn;
 	VipsDemandStyle hint;
 
 	if( VIPS_OBJECT_CLASS( vips_rot_parent_class )->build( object ) )
 		return( -1 );
 
+	/* Nothing to do. Check before folding, or we'd fold a D0 into the
+	 * rot upstream of us and get its angle.
+	 */
 	if( rot->angle == VIPS_ANGLE_D0 )
 		return( vips_image_write( rot->in, conversion->out ) );
 
+	/* If our input was made by another rot, rotate that rot's input by 
+	 * the sum of the two angles instead and save a pass over the pixels.
+	 * The upstream rot is kept alive by the image it made, our input.
+	 */
+	in = rot->in;
+	angle = rot->angle;
+	while( in->generate_fn == vips_rot90_gen ||
+		in->generate_fn == vips_rot180_gen ||
+		in->generate_fn == vips_rot270_gen ) {
+		VipsRot *upstream = (VipsRot *) in->client2;
+
+		angle = (angle + upstream->angle) % 4;
+		in = upstream->in;
+	}
+
+	if( angle == VIPS_ANGLE_D0 )
+		return( vips_image_write( in, conversion->out ) );
+
 	if( vips_image_pio_input( rot->in ) )
 		return( -1 );
 
-	hint = rot->angle == VIPS_ANGLE_D180 ? 
+	hint = angle == VIPS_ANGLE_D180 ? 
 		VIPS_DEMAND_STYLE_THINSTRIP :
 		VIPS_DEMAND_STYLE_SMALLTILE; 
 
 	if( vips_image_pipelinev( conversion->out, hint, rot->in, NULL ) )
 		return( -1 );
 
+	/* The geometry comes from the rot we were asked for, so Xoffset and
+	 * Yoffset are still relative to @in.
+	 */
 	switch( rot->angle ) {
 	case VIPS_ANGLE_D90:
-		generate_fn = vips_rot90_gen;
 		conversion->out->Xsize = rot->in->Ysize;
 		conversion->out->Ysize = rot->in->Xsize;
 		conversion->out->Xoffset = rot->in->Ysize;
@@ -311,13 +391,11 @@ vips_rot_build( VipsObject *object )
 		break;
 
 	case VIPS_ANGLE_D180:
-		generate_fn = vips_rot180_gen;
 		conversion->out->Xoffset = rot->in->Xsize;
 		conversion->out->Yoffset = rot->in->Ysize;
 		break;
 
 	case VIPS_ANGLE_D270:
-		generate_fn = vips_rot270_gen;
 		conversion->out->Xsize = rot->in->Ysize;
 		conversion->out->Ysize = rot->in->Xsize;
 		conversion->out->Xoffset = 0;
@@ -332,9 +410,30 @@ vips_rot_build( VipsObject *object )
 		return( 0 );
 	}
 
+	switch( angle ) {
+	case VIPS_ANGLE_D90:
+		generate_fn = vips_rot90_gen;
+		break;
+
+	case VIPS_ANGLE_D180:
+		generate_fn = vips_rot180_gen;
+		break;
+
+	case VIPS_ANGLE_D270:
+		generate_fn = vips_rot270_gen;
+		break;
+
+	default:
+		g_assert( 0 );
+
+		/* Keep -Wall happy.
+		 */
+		return( 0 );
+	}
+
 	if( vips_image_generate( conversion->out,
 		vips_start_one, generate_fn, vips_stop_one, 
-		rot->in, rot ) )
+		in, rot ) )
 		return( -1 );
 
 	return( 0 );
@@ -31,6 +31,12 @@
  * 	- cache minimisation is optional, see "persistent" flag
  * 26/8/14 Lovell
  * 	- free the hash table in _dispose()
+ * 20/10/14
+ * 	- split threaded caches into stripes, each with a lock
+ * 	- wait on the tile we need, not on any new tile
+ * 	- keep unreffed tiles on a free list for O(1) recycling
+ * 	- add "max_compressed", a compressed tier for evicted tiles
+ * 	- add "spill", a disc tier for evicted tiles
  */
 
 /*
@@ -80,10 +86,17 @@
 
 #include "pconversion.h"
 
+/* The most stripes we split a threaded cache into, and the fewest tiles we
+ * allow in each stripe.
+ */
+#define VIPS_TILE_CACHE_STRIPES (16)
+#define VIPS_TILE_CACHE_STRIPE_MIN (8)
+
 /* A tile in cache can be in one of three states:
  *
  * DATA		- the tile holds valid pixels 
- * CALC		- some thread somewhere is calculating it
+ * CALC		- some thread somewhere is calculating it, or fetching it
+ * 		  from the compressed or spill tier
  * PEND		- some thread somewhere wants it
  */
 typedef enum VipsTileState {
@@ -96,6 +109,7 @@ typedef enum VipsTileState {
  */
 typedef struct _VipsTile {
 	struct _VipsBlockCache *cache;
+	struct _VipsTileStripe *stripe;
 
 	VipsTileState state;
 
@@ -112,9 +126,73 @@ typedef struct _VipsTile {
 	 */
 	VipsRect pos; 
 
-	int time;			/* Time of last use for flush */
+	/* Signalled when the tile goes from CALC to DATA. Threads wait on
+	 * this with the stripe lock held.
+	 */
+	GCond *ready;
+
+	/* Unreffed tiles are linked on the stripe free list.
+	 */
+	gboolean free;
+	struct _VipsTile *prev;
+	struct _VipsTile *next;
 } VipsTile;
 
+/* A tile evicted to the compressed tier.
+ */
+typedef struct _VipsTileCompressed {
+	struct _VipsTileStripe *stripe;
+
+	VipsRect pos;			/* Key for the hash table */
+
+	/* Row-wise delta + RLE, or a plain copy of the pixels if that didn't
+	 * save anything.
+	 */
+	gboolean raw;
+	size_t length;
+	VipsPel *data;
+
+	/* Linked oldest first for eviction.
+	 */
+	struct _VipsTileCompressed *prev;
+	struct _VipsTileCompressed *next;
+} VipsTileCompressed;
+
+/* The cache is split into stripes by tile position. Each stripe has its own
+ * lock and its own share of max_tiles, and tiles never move between stripes,
+ * so threads working on different parts of the image don't contend.
+ */
+typedef struct _VipsTileStripe {
+	GMutex *lock;			/* Lock everything in this stripe */
+	GHashTable *tiles;		/* Tiles, hashed by coordinates */
+	int ntiles;			/* Current stripe size */
+	int max_tiles;			/* Max stripe size, or -1 */
+
+	/* Unreffed tiles, in the order we should recycle them. For random
+	 * access this is least-recently-used first, for sequential access
+	 * it's topmost first.
+	 */
+	VipsTile *free_head;
+	VipsTile *free_tail;
+
+	/* Tiles evicted from the stripe can be kept here compressed, and
+	 * are decompressed again on a hit.
+	 */
+	GHashTable *compressed;
+	int ncompressed;
+	int max_compressed;
+	VipsTileCompressed *compressed_head;
+	VipsTileCompressed *compressed_tail;
+
+	/* Stats for the compressed and spill tiers.
+	 */
+	int hits;
+	int spill_hits;
+	int misses;
+	gint64 raw_bytes;
+	gint64 compressed_bytes;
+} VipsTileStripe;
+
 typedef struct _VipsBlockCache {
 	VipsConversion parent_instance;
 
@@ -125,12 +203,29 @@ typedef struct _VipsBlockCache {
 	VipsAccess access;
 	gboolean threaded;
 	gboolean persistent;
+	int max_compressed;
+	gboolean spill;
 
-	int time;			/* Update ticks for LRU here */
-	int ntiles;			/* Current cache size */
-	GMutex *lock;			/* Lock everything here */
-	GCond *new_tile;		/* A new tile is ready */
-	GHashTable *tiles;		/* Tiles, hashed by coordinates */
+	/* Evicted tiles can be spilled to a temp file. Each tile position
+	 * has a fixed slot in the file, and the file is sparse, so only
+	 * positions we have spilled take space on disc. A tile's pixels never
+	 * change, so once spilled, a slot stays valid.
+	 *
+	 * Each slot belongs to a single stripe, and spilled[] for that slot
+	 * is only touched with that stripe's lock held.
+	 */
+	int spill_fd;
+	gint64 spill_slot_size;
+	int spill_across;
+	VipsPel *spilled;
+
+	/* In non-threaded mode, only one thread at once is allowed in
+	 * _gen(), and it holds this lock.
+	 */
+	GMutex *lock;
+
+	int n_stripes;
+	VipsTileStripe *stripes;
 } VipsBlockCache;
 
 typedef VipsConversionClass VipsBlockCacheClass;
@@ -139,54 +234,213 @@ G_DEFINE_TYPE( VipsBlockCache, vips_block_cache, VIPS_TYPE_CONVERSION );
 
 #define VIPS_TYPE_BLOCK_CACHE (vips_block_cache_get_type())
 
-static void
+static void 
 vips_block_cache_drop_all( VipsBlockCache *cache )
 {
+	int i;
+
 	/* FIXME this is a disaster if active threads are working on tiles. We
 	 * should have something to block new requests, and only dispose once
 	 * all tiles are unreffed.
 	 */
-	g_hash_table_remove_all( cache->tiles ); 
+	for( i = 0; i < cache->n_stripes; i++ ) {
+		g_hash_table_remove_all( cache->stripes[i].tiles );
+		g_hash_table_remove_all( cache->stripes[i].compressed );
+	}
 }
 
+/* Sum the compressed and spill tier stats over all stripes.
+ */
 static void
+vips_block_cache_stats( VipsBlockCache *cache,
+	int *hits, int *spill_hits, int *misses, double *ratio )
+{
+	gint64 raw_bytes;
+	gint64 compressed_bytes;
+	int i;
+
+	*hits = 0;
+	*spill_hits = 0;
+	*misses = 0;
+	raw_bytes = 0;
+	compressed_bytes = 0;
+	for( i = 0; i < cache->n_stripes; i++ ) {
+		VipsTileStripe *stripe = &cache->stripes[i];
+
+		g_mutex_lock( stripe->lock );
+		*hits += stripe->hits;
+		*spill_hits += stripe->spill_hits;
+		*misses += stripe->misses;
+		raw_bytes += stripe->raw_bytes;
+		compressed_bytes += stripe->compressed_bytes;
+		g_mutex_unlock( stripe->lock );
+	}
+
+	*ratio = compressed_bytes > 0 ?
+		(double) raw_bytes / compressed_bytes : 1.0;
+}
+
+static void 
 vips_block_cache_dispose( GObject *gobject )
 {
 	VipsBlockCache *cache = (VipsBlockCache *) gobject;
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( cache );
+	int i;
+
+	if( (cache->max_compressed > 0 || cache->spill) &&
+		cache->n_stripes > 0 ) {
+		int hits;
+		int spill_hits;
+		int misses;
+		double ratio;
+
+		vips_block_cache_stats( cache, 
+			&hits, &spill_hits, &misses, &ratio );
+		vips_info( class->nickname,
+			"compressed tier: %d hits, ratio %.2f; "
+			"spill tier: %d hits; %d misses",
+			hits, ratio, spill_hits, misses );
+	}
 
 	vips_block_cache_drop_all( cache );
+
+	for( i = 0; i < cache->n_stripes; i++ ) {
+		VipsTileStripe *stripe = &cache->stripes[i];
+
+		g_assert( stripe->ntiles == 0 );
+		g_assert( stripe->ncompressed == 0 );
+		VIPS_FREEF( g_hash_table_destroy, stripe->tiles );
+		VIPS_FREEF( g_hash_table_destroy, stripe->compressed );
+		VIPS_FREEF( vips_g_mutex_free, stripe->lock );
+	}
+	VIPS_FREE( cache->stripes );
+	cache->n_stripes = 0;
+
 	VIPS_FREEF( vips_g_mutex_free, cache->lock );
-	VIPS_FREEF( vips_g_cond_free, cache->new_tile );
 
-	if( cache->tiles )
-		g_assert( g_hash_table_size( cache->tiles ) == 0 );
-	VIPS_FREEF( g_hash_table_destroy, cache->tiles );
+	if( cache->spill_fd != -1 ) {
+		vips_tracked_close( cache->spill_fd );
+		cache->spill_fd = -1;
+	}
+	VIPS_FREE( cache->spilled );
 
 	G_OBJECT_CLASS( vips_block_cache_parent_class )->dispose( gobject );
 }
 
-static void
-vips_tile_touch( VipsTile *tile )
+/* The stripe that a tile position belongs to. Neighbouring tiles go to
+ * different stripes.
+ */
+static VipsTileStripe *
+vips_block_cache_stripe( VipsBlockCache *cache, int x, int y )
 {
-	g_assert( tile->cache->ntiles >= 0 );
+	guint tx = x / cache->tile_width;
+	guint ty = y / cache->tile_height;
 
-	tile->time = tile->cache->time++;
+	return( &cache->stripes[(tx + 7 * ty) % cache->n_stripes] );
+}
+
+/* Take a tile off the free list.
+ */
+static void 
+vips_tile_free_unlink( VipsTile *tile )
+{
+	VipsTileStripe *stripe = tile->stripe;
+
+	if( !tile->free )
+		return;
+
+	if( tile->prev )
+		tile->prev->next = tile->next;
+	else
+		stripe->free_head = tile->next;
+	if( tile->next )
+		tile->next->prev = tile->prev;
+	else
+		stripe->free_tail = tile->prev;
+
+	tile->prev = NULL;
+	tile->next = NULL;
+	tile->free = FALSE;
+}
+
+/* Put a tile on the free list. Random access just appends, so the head is
+ * always the least-recently-used tile. Sequential access keeps the list
+ * sorted by tile top. Tiles are mostly released in top-to-bottom order, so
+ * this search from the tail will usually stop straight away.
+ */
+static void 
+vips_tile_free_link( VipsTile *tile )
+{
+	VipsTileStripe *stripe = tile->stripe;
+
+	VipsTile *prev;
+
+	g_assert( !tile->free );
+	g_assert( tile->ref_count == 0 );
+
+	prev = stripe->free_tail;
+	if( tile->cache->access != VIPS_ACCESS_RANDOM )
+		while( prev &&
+			prev->pos.top > tile->pos.top )
+			prev = prev->prev;
+
+	tile->prev = prev;
+	if( prev ) {
+		tile->next = prev->next;
+		prev->next = tile;
+	}
+	else { 
+		tile->next = stripe->free_head;
+		stripe->free_head = tile;
+	}
+	if( tile->next )
+		tile->next->prev = tile;
+	else
+		stripe->free_tail = tile;
+
+	tile->free = TRUE;
+}
+
+/* Call these with the stripe lock held.
+ */
+static void 
+vips_tile_ref( VipsTile *tile )
+{
+	if( tile->ref_count == 0 )
+		vips_tile_free_unlink( tile );
+
+	tile->ref_count += 1;
+
+	g_assert( tile->ref_count > 0 );
+}
+
+static void 
+vips_tile_unref( VipsTile *tile )
+{
+	g_assert( tile->ref_count > 0 );
+
+	tile->ref_count -= 1;
+
+	if( tile->ref_count == 0 )
+		vips_tile_free_link( tile );
 }
 
 static int
 vips_tile_move( VipsTile *tile, int x, int y )
 {
+	VipsTileStripe *stripe = tile->stripe;
+
 	/* We are changing x/y and therefore the hash value. We must unlink
 	 * from the old hash position and relink at the new place.
 	 */
-	g_hash_table_steal( tile->cache->tiles, &tile->pos );
+	g_hash_table_steal( stripe->tiles, &tile->pos );
 
 	tile->pos.left = x;
 	tile->pos.top = y;
 	tile->pos.width = tile->cache->tile_width;
 	tile->pos.height = tile->cache->tile_height;
 
-	g_hash_table_insert( tile->cache->tiles, &tile->pos, tile );
+	g_hash_table_insert( stripe->tiles, &tile->pos, tile );
 
 	if( vips_region_buffer( tile->region, &tile->pos ) )
 		return( -1 );
@@ -199,7 +453,7 @@ vips_tile_move( VipsTile *tile, int x, int y )
 }
 
 static VipsTile *
-vips_tile_new( VipsBlockCache *cache, int x, int y )
+vips_tile_new( VipsBlockCache *cache, VipsTileStripe *stripe, int x, int y )
 {
 	VipsTile *tile;
 
@@ -207,27 +461,31 @@ vips_tile_new( VipsBlockCache *cache, int x, int y )
 		return( NULL );
 
 	tile->cache = cache;
+	tile->stripe = stripe;
 	tile->state = VIPS_TILE_STATE_PEND;
 	tile->ref_count = 0;
 	tile->region = NULL;
-	tile->time = cache->time;
+	tile->ready = vips_g_cond_new();
+	tile->free = FALSE;
+	tile->prev = NULL;
+	tile->next = NULL;
 	tile->pos.left = x;
 	tile->pos.top = y;
 	tile->pos.width = cache->tile_width;
 	tile->pos.height = cache->tile_height;
-	g_hash_table_insert( cache->tiles, &tile->pos, tile );
-	g_assert( cache->ntiles >= 0 );
-	cache->ntiles += 1;
+	g_hash_table_insert( stripe->tiles, &tile->pos, tile );
+	g_assert( stripe->ntiles >= 0 );
+	stripe->ntiles += 1;
 
 	if( !(tile->region = vips_region_new( cache->in )) ) {
-		g_hash_table_remove( cache->tiles, &tile->pos );
+		g_hash_table_remove( stripe->tiles, &tile->pos );
 		return( NULL );
 	}
 
 	vips__region_no_ownership( tile->region );
 
 	if( vips_tile_move( tile, x, y ) ) {
-		g_hash_table_remove( cache->tiles, &tile->pos );
+		g_hash_table_remove( stripe->tiles, &tile->pos );
 		return( NULL );
 	}
 
@@ -237,134 +495,549 @@ vips_tile_new( VipsBlockCache *cache, int x, int y )
 /* Do we have a tile in the cache?
  */
 static VipsTile *
-vips_tile_search( VipsBlockCache *cache, int x, int y )
+vips_tile_search( VipsBlockCache *cache, VipsTileStripe *stripe, int x, int y )
 {
-	VipsRect pos;
+	VipsRect pos; 
 	VipsTile *tile;
 
 	pos.left = x;
 	pos.top = y;
 	pos.width = cache->tile_width;
 	pos.height = cache->tile_height;
-	tile = (VipsTile *) g_hash_table_lookup( cache->tiles, &pos );
+	tile = (VipsTile *) g_hash_table_lookup( stripe->tiles, &pos );
 
 	return( tile );
 }
 
-typedef struct _VipsTileSearch {
-	VipsTile *tile;
+/* The pixel codec for the compressed tier. Each byte is differenced against
+ * the same byte of the previous pixel, so smooth areas turn into runs of
+ * small values, then runs are coded PackBits-style: a control byte n < 128
+ * is followed by n + 1 literal bytes, n > 128 by a single byte to be
+ * repeated 257 - n times. This is lossless for any band format.
+ */
+#define DELTA( P, I, PS ) \
+	((I) < (PS) ? (P)[I] : (VipsPel) ((P)[I] - (P)[(I) - (PS)]))
+
+/* Code @n bytes of pixels with @ps bytes per pixel. The output can be up to
+ * n + n / 128 + 1 bytes.
+ */
+static size_t
+vips_tile_rle_encode( VipsPel *q, VipsPel *p, int n, int ps )
+{
+	VipsPel *q0 = q;
 
-	int oldest;
-	int topmost;
-} VipsTileSearch;
+	int i, j, k;
 
-static void 
-vips_tile_search_recycle( gpointer key, gpointer value, gpointer user_data )
+	i = 0;
+	while( i < n ) {
+		VipsPel d = DELTA( p, i, ps );
+
+		for( j = i + 1; j < n && j - i < 128; j++ )
+			if( DELTA( p, j, ps ) != d )
+				break;
+
+		if( j - i > 2 ) {
+			*q++ = 257 - (j - i);
+			*q++ = d;
+		}
+		else {
+			/* Literals up to the start of the next run of three or
+			 * more.
+			 */
+			for( j = i; j < n && j - i < 128; j++ )
+				if( j + 2 < n &&
+					DELTA( p, j, ps ) ==
+						DELTA( p, j + 1, ps ) &&
+					DELTA( p, j, ps ) ==
+						DELTA( p, j + 2, ps ) )
+					break;
+
+			*q++ = j - i - 1;
+			for( k = i; k < j; k++ )
+				*q++ = DELTA( p, k, ps );
+		}
+
+		i = j;
+	}
+
+	return( q - q0 );
+}
+
+/* Decode @n bytes of pixels to @q, return the next byte of input.
+ */
+static VipsPel *
+vips_tile_rle_decode( VipsPel *q, VipsPel *p, int n, int ps )
 {
-	VipsTile *tile = (VipsTile *) value;
-	VipsBlockCache *cache = tile->cache;
-	VipsTileSearch *search = (VipsTileSearch *) user_data;
+	int i, j;
+
+	i = 0;
+	while( i < n ) {
+		int c = *p++;
+
+		g_assert( c != 128 );
+
+		if( c < 128 )
+			for( j = 0; j <= c; j++ )
+				q[i++] = *p++;
+		else {
+			VipsPel d = *p++;
+
+			for( j = 0; j < 257 - c; j++ )
+				q[i++] = d;
+		}
+	}
+
+	for( i = ps; i < n; i++ )
+		q[i] += q[i - ps];
+
+	return( p );
+}
+
+/* Unlink a compressed tile from the eviction list. Call with the stripe lock
+ * held.
+ */
+static void
+vips_tile_compressed_unlink( VipsTileCompressed *compressed )
+{
+	VipsTileStripe *stripe = compressed->stripe;
+
+	if( compressed->prev )
+		compressed->prev->next = compressed->next;
+	else
+		stripe->compressed_head = compressed->next;
+	if( compressed->next )
+		compressed->next->prev = compressed->prev;
+	else
+		stripe->compressed_tail = compressed->prev;
+
+	compressed->prev = NULL;
+	compressed->next = NULL;
+
+	stripe->ncompressed -= 1;
+	g_assert( stripe->ncompressed >= 0 );
+}
+
+static void
+vips_tile_compressed_free( VipsTileCompressed *compressed )
+{
+	VIPS_FREE( compressed->data );
+	vips_free( compressed );
+}
 
-	/* Only consider unreffed tiles for recycling.
+/* Add a compressed tile to the tier, replacing any older copy, and drop the
+ * oldest until we're within the limit. Call with the stripe lock held.
+ */
+static void
+vips_tile_compressed_link( VipsTileCompressed *compressed )
+{
+	VipsTileStripe *stripe = compressed->stripe;
+
+	/* Link at the tail, the most recent end.
 	 */
-	if( !tile->ref_count ) {
-		switch( cache->access ) {
-		case VIPS_ACCESS_RANDOM:
-			if( tile->time < search->oldest ) {
-				search->oldest = tile->time;
-				search->tile = tile;
-			}
-			break;
+	compressed->next = NULL;
+	compressed->prev = stripe->compressed_tail;
+	if( stripe->compressed_tail )
+		stripe->compressed_tail->next = compressed;
+	else
+		stripe->compressed_head = compressed;
+	stripe->compressed_tail = compressed;
+
+	g_hash_table_replace( stripe->compressed,
+		&compressed->pos, compressed );
+	stripe->ncompressed += 1;
+
+	while( stripe->ncompressed > stripe->max_compressed )
+		g_hash_table_remove( stripe->compressed,
+			&stripe->compressed_head->pos );
+}
 
-		case VIPS_ACCESS_SEQUENTIAL:
-		case VIPS_ACCESS_SEQUENTIAL_UNBUFFERED:
-			if( tile->pos.top < search->topmost ) {
-				search->topmost = tile->pos.top;
-				search->tile = tile;
-			}
-			break;
+/* Take the compressed copy of a tile out of the tier, if there is one. Call
+ * with the stripe lock held.
+ */
+static VipsTileCompressed *
+vips_tile_compressed_take( VipsTileStripe *stripe, VipsRect *pos )
+{
+	VipsTileCompressed *compressed;
+
+	if( !(compressed = (VipsTileCompressed *)
+		g_hash_table_lookup( stripe->compressed, pos )) )
+		return( NULL );
+
+	g_hash_table_steal( stripe->compressed, pos );
+	vips_tile_compressed_unlink( compressed );
 
-		default:
-			g_assert( 0 );
+	return( compressed );
+}
+
+/* Compress the pixels in a DATA tile we are about to recycle. This is slow,
+ * so it's called without the stripe lock, see vips_tile_evict().
+ */
+static VipsTileCompressed *
+vips_tile_compress( VipsTile *tile )
+{
+	VipsRegion *region = tile->region;
+	VipsRect *valid = &region->valid;
+	int ps = VIPS_IMAGE_SIZEOF_PEL( region->im );
+	int n = VIPS_REGION_SIZEOF_LINE( region );
+	size_t raw = (size_t) n * valid->height;
+	size_t max = (size_t) (n + n / 128 + 1) * valid->height;
+
+	VipsTileCompressed *compressed;
+	VipsPel *buf;
+	size_t length;
+	int y;
+
+	g_assert( tile->state == VIPS_TILE_STATE_DATA );
+
+	if( !(buf = VIPS_ARRAY( NULL, max, VipsPel )) )
+		return( NULL );
+
+	length = 0;
+	for( y = 0; y < valid->height; y++ )
+		length += vips_tile_rle_encode( buf + length,
+			VIPS_REGION_ADDR( region, valid->left, valid->top + y ),
+			n, ps );
+
+	if( !(compressed = VIPS_NEW( NULL, VipsTileCompressed )) ) {
+		vips_free( buf );
+		return( NULL );
+	}
+	compressed->stripe = tile->stripe;
+	compressed->pos = tile->pos;
+	compressed->raw = length >= raw;
+	compressed->length = compressed->raw ? raw : length;
+	compressed->prev = NULL;
+	compressed->next = NULL;
+	if( !(compressed->data =
+		VIPS_ARRAY( NULL, compressed->length, VipsPel )) ) {
+		vips_free( compressed );
+		vips_free( buf );
+		return( NULL );
+	}
+
+	if( compressed->raw )
+		for( y = 0; y < valid->height; y++ )
+			memcpy( compressed->data + y * n,
+				VIPS_REGION_ADDR( region,
+					valid->left, valid->top + y ),
+				n );
+	else
+		memcpy( compressed->data, buf, length );
+
+	vips_free( buf );
+
+	return( compressed );
+}
+
+/* Decompress into a tile we have marked as CALC. Nothing else will touch the
+ * tile until it's DATA, so we don't need the stripe lock.
+ */
+static void
+vips_tile_uncompress( VipsTile *tile, VipsTileCompressed *compressed )
+{
+	VipsRegion *region = tile->region;
+	VipsRect *valid = &region->valid;
+	int ps = VIPS_IMAGE_SIZEOF_PEL( region->im );
+	int n = VIPS_REGION_SIZEOF_LINE( region );
+
+	VipsPel *p;
+	int y;
+
+	g_assert( tile->state == VIPS_TILE_STATE_CALC );
+
+	p = compressed->data;
+	for( y = 0; y < valid->height; y++ ) {
+		VipsPel *q =
+			VIPS_REGION_ADDR( region, valid->left, valid->top + y );
+
+		if( compressed->raw ) {
+			memcpy( q, p, n );
+			p += n;
 		}
+		else
+			p = vips_tile_rle_decode( q, p, n, ps );
 	}
+	g_assert( p - compressed->data == compressed->length );
+}
+
+/* The spill slot for a tile position.
+ */
+static int
+vips_block_cache_slot( VipsBlockCache *cache, int x, int y )
+{
+	return( (y / cache->tile_height) * cache->spill_across + 
+		x / cache->tile_width );
+}
+
+/* Write the pixels in a DATA tile we are about to recycle to its slot in the
+ * spill file. Like compression, this is called without the stripe lock, see
+ * vips_tile_evict(). 
+ *
+ * The tile region is a buffer, so its pixels are a single block of memory.
+ */
+static gboolean
+vips_tile_spill( VipsTile *tile )
+{
+	VipsBlockCache *cache = tile->cache;
+	VipsRegion *region = tile->region;
+	VipsRect *valid = &region->valid;
+	size_t length = 
+		(size_t) VIPS_REGION_SIZEOF_LINE( region ) * valid->height;
+	int slot = vips_block_cache_slot( cache, 
+		tile->pos.left, tile->pos.top );
+
+	g_assert( tile->state == VIPS_TILE_STATE_DATA );
+	g_assert( VIPS_REGION_LSKIP( region ) == 
+		VIPS_REGION_SIZEOF_LINE( region ) );
+
+	/* Spilling is best-effort: if we can't write, the tile will just be
+	 * recalculated. 
+	 */
+	if( vips__pwrite( cache->spill_fd, 
+		VIPS_REGION_ADDR( region, valid->left, valid->top ), length, 
+		slot * cache->spill_slot_size ) ) {
+		vips_error_clear();
+		return( FALSE );
+	}
+
+	return( TRUE );
+}
+
+/* Read a CALC tile back from its slot in the spill file. As with 
+ * decompression, we don't need the stripe lock.
+ */
+static gboolean
+vips_tile_unspill( VipsTile *tile )
+{
+	VipsBlockCache *cache = tile->cache;
+	VipsRegion *region = tile->region;
+	VipsRect *valid = &region->valid;
+	size_t length = 
+		(size_t) VIPS_REGION_SIZEOF_LINE( region ) * valid->height;
+	int slot = vips_block_cache_slot( cache, 
+		tile->pos.left, tile->pos.top );
+
+	g_assert( tile->state == VIPS_TILE_STATE_CALC );
+	g_assert( VIPS_REGION_LSKIP( region ) == 
+		VIPS_REGION_SIZEOF_LINE( region ) );
+
+	if( vips__pread( cache->spill_fd, 
+		VIPS_REGION_ADDR( region, valid->left, valid->top ), length, 
+		slot * cache->spill_slot_size ) ) {
+		vips_error_clear();
+		return( FALSE );
+	}
+
+	return( TRUE );
+}
+
+/* See if any of the lower tiers have the pixels for a tile we have marked as
+ * CALC. We only need the stripe lock to take the compressed copy out of the
+ * tier, or to check the tile has been spilled. We decompress or read back
+ * without it.
+ */
+static gboolean
+vips_tile_fetch( VipsTile *tile )
+{
+	VipsBlockCache *cache = tile->cache;
+	VipsTileStripe *stripe = tile->stripe;
+
+	VipsTileCompressed *compressed;
+	gboolean spilled;
+
+	if( stripe->max_compressed == 0 &&
+		cache->spill_fd == -1 )
+		return( FALSE );
+
+	g_mutex_lock( stripe->lock );
+
+	compressed = vips_tile_compressed_take( stripe, &tile->pos );
+	spilled = !compressed &&
+		cache->spill_fd != -1 &&
+		cache->spilled[vips_block_cache_slot( cache, 
+			tile->pos.left, tile->pos.top )];
+	if( compressed )
+		stripe->hits += 1;
+	else if( spilled )
+		stripe->spill_hits += 1;
+	else
+		stripe->misses += 1;
+
+	g_mutex_unlock( stripe->lock );
+
+	if( compressed ) {
+		vips_tile_uncompress( tile, compressed );
+		vips_tile_compressed_free( compressed );
+
+		return( TRUE );
+	}
+
+	if( spilled ) {
+		if( vips_tile_unspill( tile ) )
+			return( TRUE );
+
+		/* The read failed, so it's a miss after all.
+		 */
+		g_mutex_lock( stripe->lock );
+		stripe->spill_hits -= 1;
+		stripe->misses += 1;
+		g_mutex_unlock( stripe->lock );
+	}
+
+	return( FALSE );
+}
+
+/* Copy the pixels in a DATA tile we are about to recycle to the lower tiers.
+ * Call with the stripe lock held and the tile off the free list.
+ *
+ * We drop the lock while we compress and write. The tile stays DATA, so 
+ * other threads can still find it and paste from it, and the ref we hold 
+ * stops anyone else recycling it. If someone else has reffed it by the time
+ * we retake the lock, they want the tile where it is: return FALSE and it'll
+ * go back on the free list when they're done with it.
+ *
+ * A tile position is only in one tile at once, and its pixels never change, 
+ * so a slot in the spill file is written at most once, and we only mark it
+ * as spilled once it's been written.
+ */
+static gboolean
+vips_tile_evict( VipsTile *tile )
+{
+	VipsBlockCache *cache = tile->cache;
+	VipsTileStripe *stripe = tile->stripe;
+	VipsRegion *region = tile->region;
+
+	int slot;
+	gboolean spill;
+	VipsTileCompressed *compressed;
+
+	g_assert( tile->state == VIPS_TILE_STATE_DATA );
+	g_assert( tile->ref_count == 0 );
+	g_assert( !tile->free );
+
+	slot = -1;
+	spill = FALSE;
+	if( cache->spill_fd != -1 ) {
+		slot = vips_block_cache_slot( cache, 
+			tile->pos.left, tile->pos.top );
+		spill = !cache->spilled[slot];
+	}
+
+	if( stripe->max_compressed == 0 &&
+		!spill )
+		return( TRUE );
+
+	tile->ref_count += 1;
+
+	g_mutex_unlock( stripe->lock );
+
+	compressed = NULL;
+	if( stripe->max_compressed > 0 )
+		compressed = vips_tile_compress( tile );
+	if( spill )
+		spill = vips_tile_spill( tile );
+
+	g_mutex_lock( stripe->lock );
+
+	tile->ref_count -= 1;
+
+	if( compressed ) {
+		stripe->raw_bytes += (gint64) 
+			VIPS_REGION_SIZEOF_LINE( region ) * 
+			region->valid.height;
+		stripe->compressed_bytes += compressed->length;
+		vips_tile_compressed_link( compressed );
+	}
+
+	if( spill )
+		cache->spilled[slot] = 1;
+
+	return( tile->ref_count == 0 );
 }
 
 /* Find existing tile, make a new tile, or if we have a full set of tiles, 
- * reuse one.
+ * reuse one. Call with the stripe lock held.
  */
 static VipsTile *
-vips_tile_find( VipsBlockCache *cache, int x, int y )
+vips_tile_find( VipsBlockCache *cache, VipsTileStripe *stripe, int x, int y )
 {
 	VipsTile *tile;
-	VipsTileSearch search;
 
 	/* In cache already?
 	 */
-	if( (tile = vips_tile_search( cache, x, y )) ) {
+	if( (tile = vips_tile_search( cache, stripe, x, y )) ) {
 		VIPS_DEBUG_MSG_RED( "vips_tile_find: "
 			"tile %d x %d in cache\n", x, y ); 
 		return( tile );
 	}
 
-	/* VipsBlockCache not full?
+	/* Stripe not full? Otherwise, reuse an old one. The head of the free
+	 * list is the best tile to recycle.
+	 *
+	 * If there are no tiles we can reuse, we have to make another for
+	 * now. They will get culled down again next time around.
 	 */
-	if( cache->max_tiles == -1 ||
-		cache->ntiles < cache->max_tiles ) {
+	if( stripe->max_tiles == -1 ||
+		stripe->ntiles < stripe->max_tiles ||
+		!stripe->free_head ) {
 		VIPS_DEBUG_MSG_RED( "vips_tile_find: "
 			"making new tile at %d x %d\n", x, y ); 
-		if( !(tile = vips_tile_new( cache, x, y )) )
+		if( !(tile = vips_tile_new( cache, stripe, x, y )) )
 			return( NULL );
-
-		return( tile );
 	}
+	else {
+		tile = stripe->free_head;
 
-	/* Reuse an old one.
-	 */
-	search.oldest = cache->time;
-	search.topmost = cache->in->Ysize;
-	search.tile = NULL;
-	g_hash_table_foreach( cache->tiles, vips_tile_search_recycle, &search );
-	tile = search.tile; 
-
-	if( !tile ) {
-		/* There are no tiles we can reuse -- we have to make another
-		 * for now. They will get culled down again next time around.
-		 */
-		if( !(tile = vips_tile_new( cache, x, y )) ) 
-			return( NULL );
+		VIPS_DEBUG_MSG_RED( "vips_tile_find: reusing tile %d x %d\n", 
+			tile->pos.left, tile->pos.top );
 
-		return( tile );
-	}
+		vips_tile_free_unlink( tile );
 
-	VIPS_DEBUG_MSG_RED( "vips_tile_find: reusing tile %d x %d\n", 
-		tile->pos.left, tile->pos.top );
+		/* Evicting can drop the lock, so by the time it returns
+		 * someone else might be using this tile, or might have made
+		 * the tile we want. Start again if so.
+		 */
+		if( tile->state == VIPS_TILE_STATE_DATA &&
+			(stripe->max_compressed > 0 ||
+			 cache->spill_fd != -1) ) {
+			if( !vips_tile_evict( tile ) )
+				return( vips_tile_find( cache, stripe, x, y ) );
+
+			if( vips_tile_search( cache, stripe, x, y ) ) {
+				vips_tile_free_link( tile );
+				return( vips_tile_find( cache, stripe, x, y ) );
+			}
+		}
 
-	if( vips_tile_move( tile, x, y ) )
-		return( NULL );
+		if( vips_tile_move( tile, x, y ) ) {
+			vips_tile_free_link( tile );
+			return( NULL );
+		}
+	}
 
 	return( tile );
 }
 
-static gboolean            
-vips_tile_unlocked( gpointer key, gpointer value, gpointer user_data )
-{
-	VipsTile *tile = (VipsTile *) value;
-
-	return( !tile->ref_count );
-}
-
-static void
+static void 
 vips_block_cache_minimise( VipsImage *image, VipsBlockCache *cache )
 {
-	/* We can't drop tiles that are in use.
+	int i;
+
+	/* We can't drop tiles that are in use, but everything on the free
+	 * lists can go.
 	 */
-	g_mutex_lock( cache->lock );
+	for( i = 0; i < cache->n_stripes; i++ ) {
+		VipsTileStripe *stripe = &cache->stripes[i];
 
-	g_hash_table_foreach_remove( cache->tiles, 
-		vips_tile_unlocked, NULL );
+		g_mutex_lock( stripe->lock );
 
-	g_mutex_unlock( cache->lock );
+		while( stripe->free_head )
+			g_hash_table_remove( stripe->tiles,
+				&stripe->free_head->pos );
+		g_hash_table_remove_all( stripe->compressed );
+
+		g_mutex_unlock( stripe->lock );
+	}
 }
 
 static int
@@ -390,7 +1063,7 @@ vips_block_cache_build( VipsObject *object )
 	return( 0 );
 }
 
-static void
+static void 
 vips_block_cache_class_init( VipsBlockCacheClass *class )
 {
 	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
@@ -459,30 +1132,135 @@ vips_rect_hash( VipsRect *pos )
 	return( hash );
 }
 
-static gboolean 
+static gboolean            
 vips_rect_equal( VipsRect *a, VipsRect *b )
 {
 	return( a->left == b->left && a->top == b->top );
 }
 
-static void
+static void 
 vips_tile_destroy( VipsTile *tile )
 {
-	VipsBlockCache *cache = tile->cache;
+	VipsTileStripe *stripe = tile->stripe;
 
 	VIPS_DEBUG_MSG_RED( "vips_tile_destroy: tile %d, %d (%p)\n", 
 		tile->pos.left, tile->pos.top, tile ); 
 
-	cache->ntiles -= 1;
-	g_assert( cache->ntiles >= 0 );
+	vips_tile_free_unlink( tile );
+
+	stripe->ntiles -= 1;
+	g_assert( stripe->ntiles >= 0 );
 	tile->cache = NULL;
+	tile->stripe = NULL;
 
 	VIPS_UNREF( tile->region );
+	VIPS_FREEF( vips_g_cond_free, tile->ready );
 
 	vips_free( tile );
 }
 
 static void
+vips_tile_compressed_destroy( VipsTileCompressed *compressed )
+{
+	vips_tile_compressed_unlink( compressed );
+	vips_tile_compressed_free( compressed );
+}
+
+/* Split the cache into @n_stripes. Call this from subclass _build() once
+ * max_tiles is known.
+ */
+static int
+vips_block_cache_stripes( VipsBlockCache *cache, int n_stripes )
+{
+	int i;
+
+	g_assert( !cache->stripes );
+	g_assert( n_stripes > 0 );
+
+	if( !(cache->stripes = VIPS_ARRAY( NULL, n_stripes, VipsTileStripe )) )
+		return( -1 );
+	cache->n_stripes = n_stripes;
+
+	for( i = 0; i < n_stripes; i++ ) {
+		VipsTileStripe *stripe = &cache->stripes[i];
+
+		stripe->lock = vips_g_mutex_new();
+		stripe->tiles = g_hash_table_new_full(
+			(GHashFunc) vips_rect_hash,
+			(GEqualFunc) vips_rect_equal,
+			NULL,
+			(GDestroyNotify) vips_tile_destroy );
+		stripe->ntiles = 0;
+		stripe->max_tiles = cache->max_tiles == -1 ?
+			-1 : (cache->max_tiles + n_stripes - 1) / n_stripes;
+		stripe->free_head = NULL;
+		stripe->free_tail = NULL;
+
+		stripe->compressed = g_hash_table_new_full(
+			(GHashFunc) vips_rect_hash,
+			(GEqualFunc) vips_rect_equal,
+			NULL,
+			(GDestroyNotify) vips_tile_compressed_destroy );
+		stripe->ncompressed = 0;
+		stripe->max_compressed =
+			(cache->max_compressed + n_stripes - 1) / n_stripes;
+		stripe->compressed_head = NULL;
+		stripe->compressed_tail = NULL;
+		stripe->hits = 0;
+		stripe->spill_hits = 0;
+		stripe->misses = 0;
+		stripe->raw_bytes = 0;
+		stripe->compressed_bytes = 0;
+	}
+
+	return( 0 );
+}
+
+/* Make the spill file. 
+ */
+static int
+vips_block_cache_spill_open( VipsBlockCache *cache )
+{
+	VipsImage *in = cache->in;
+	int across = (in->Xsize + cache->tile_width - 1) / cache->tile_width;
+	int down = (in->Ysize + cache->tile_height - 1) / cache->tile_height;
+
+	char *filename;
+
+	g_assert( cache->spill_fd == -1 );
+
+	cache->spill_slot_size = (gint64) cache->tile_width * 
+		cache->tile_height * VIPS_IMAGE_SIZEOF_PEL( in );
+	cache->spill_across = across;
+	if( !(cache->spilled = VIPS_ARRAY( NULL, across * down, VipsPel )) )
+		return( -1 );
+	memset( cache->spilled, 0, across * down );
+
+	if( !(filename = vips__temp_name( "%s.tiles" )) )
+		return( -1 );
+	if( (cache->spill_fd = vips__open_image_write( filename, TRUE )) < 0 ) {
+		g_free( filename );
+		return( -1 );
+	}
+
+	/* On *nix, unlinking now means the file is reclaimed when we close 
+	 * it, or if we crash. This fails on Windows, but there we've set
+	 * O_TEMPORARY.
+	 */
+	g_unlink( filename );
+	g_free( filename );
+
+	/* Size the file to hold every tile. It's sparse, so this takes no
+	 * space on disc.
+	 */
+	if( vips__ftruncate( cache->spill_fd, 
+		cache->spill_slot_size * across * down ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void 
 vips_block_cache_init( VipsBlockCache *cache )
 {
 	cache->tile_width = 128;
@@ -491,16 +1269,17 @@ vips_block_cache_init( VipsBlockCache *cache )
 	cache->access = VIPS_ACCESS_RANDOM;
 	cache->threaded = FALSE;
 	cache->persistent = FALSE;
+	cache->max_compressed = 0;
+	cache->spill = FALSE;
+
+	cache->spill_fd = -1;
+	cache->spill_slot_size = 0;
+	cache->spill_across = 0;
+	cache->spilled = NULL;
 
-	cache->time = 0;
-	cache->ntiles = 0;
 	cache->lock = vips_g_mutex_new();
-	cache->new_tile = vips_g_cond_new();
-	cache->tiles = g_hash_table_new_full( 
-		(GHashFunc) vips_rect_hash, 
-		(GEqualFunc) vips_rect_equal,
-		NULL,
-		(GDestroyNotify) vips_tile_destroy );
+	cache->n_stripes = 0;
+	cache->stripes = NULL;
 }
 
 typedef struct _VipsTileCache {
@@ -512,37 +1291,28 @@ typedef VipsBlockCacheClass VipsTileCacheClass;
 
 G_DEFINE_TYPE( VipsTileCache, vips_tile_cache, VIPS_TYPE_BLOCK_CACHE );
 
-static void
-vips_tile_unref( VipsTile *tile )
-{
-	g_assert( tile->ref_count > 0 );
-
-	tile->ref_count -= 1;
-}
-
-static void
-vips_tile_ref( VipsTile *tile )
-{
-	tile->ref_count += 1;
-
-	g_assert( tile->ref_count > 0 );
-}
-
-static void
+static void 
 vips_tile_cache_unref( GSList *work )
 {
 	GSList *p;
 
-	for( p = work; p; p = p->next ) 
-		vips_tile_unref( (VipsTile *) p->data ); 
+	for( p = work; p; p = p->next ) {
+		VipsTile *tile = (VipsTile *) p->data;
+		VipsTileStripe *stripe = tile->stripe;
+
+		g_mutex_lock( stripe->lock );
+		vips_tile_unref( tile );
+		g_mutex_unlock( stripe->lock );
+	}
 
 	g_slist_free( work );
 }
 
-/* Make a set of work tiles.
+/* Make a set of work tiles. We lock each stripe just long enough to find and
+ * ref the tile, and once reffed a tile can't be recycled.
  */
-static GSList *
-vips_tile_cache_ref( VipsBlockCache *cache, VipsRect *r )
+static int
+vips_tile_cache_ref( VipsBlockCache *cache, VipsRect *r, GSList **work )
 {
 	const int tw = cache->tile_width;
 	const int th = cache->tile_height;
@@ -552,37 +1322,49 @@ vips_tile_cache_ref( VipsBlockCache *cache, VipsRect *r )
 	const int xs = (r->left / tw) * tw;
 	const int ys = (r->top / th) * th;
 
-	GSList *work;
 	VipsTile *tile;
 	int x, y;
 
 	/* Ref all the tiles we will need.
 	 */
-	work = NULL;
+	*work = NULL;
 	for( y = ys; y < VIPS_RECT_BOTTOM( r ); y += th )
 		for( x = xs; x < VIPS_RECT_RIGHT( r ); x += tw ) {
-			if( !(tile = vips_tile_find( cache, x, y )) ) {
-				vips_tile_cache_unref( work );
-				return( NULL );
-			}
+			VipsTileStripe *stripe =
+				vips_block_cache_stripe( cache, x, y );
+
+			VIPS_GATE_START( "vips_tile_cache_ref: wait" );
+
+			g_mutex_lock( stripe->lock );
 
-			vips_tile_touch( tile );
+			VIPS_GATE_STOP( "vips_tile_cache_ref: wait" );
+
+			if( !(tile = vips_tile_find( cache, stripe, x, y )) ) {
+				g_mutex_unlock( stripe->lock );
+				vips_tile_cache_unref( *work );
+				*work = NULL;
+				return( -1 );
+			}
 
 			vips_tile_ref( tile ); 
 
-			/* We must append, since we want to keep tile ordering
-			 * for sequential sources.
+			g_mutex_unlock( stripe->lock );
+
+			/* We must keep tile ordering for sequential sources,
+			 * so prepend and reverse at the end.
 			 */
-			work = g_slist_append( work, tile );
+			*work = g_slist_prepend( *work, tile );
 
 			VIPS_DEBUG_MSG_RED( "vips_tile_cache_ref: "
 				"tile %d, %d (%p)\n", x, y, tile ); 
 		}
 
-	return( work );
+	*work = g_slist_reverse( *work );
+
+	return( 0 );
 }
 
-static void
+static void 
 vips_tile_paste( VipsTile *tile, VipsRegion *or )
 {
 	VipsRect hit;
@@ -594,6 +1376,55 @@ vips_tile_paste( VipsTile *tile, VipsRegion *or )
 		vips_region_copy( tile->region, or, &hit, hit.left, hit.top ); 
 }
 
+/* Calculate a tile we have marked as CALC, then wake anyone waiting for it.
+ */
+static void 
+vips_tile_calc( VipsBlockCache *cache, VipsRegion *in, VipsTile *tile )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( cache );
+	VipsTileStripe *stripe = tile->stripe;
+
+	VIPS_DEBUG_MSG_RED( "vips_tile_calc: calc of %p\n", tile );
+
+	/* The lower tiers might have the pixels. If not, calculate them.
+	 *
+	 * If there was an error calculating this tile, just warn and carry
+	 * on.
+	 *
+	 * This can happen with things like reading .scn files via
+	 * openslide. We don't want the read to fail because of one broken
+	 * tile.
+	 */
+	if( !vips_tile_fetch( tile ) &&
+		vips_region_prepare_to( in, tile->region,
+			&tile->pos, tile->pos.left, tile->pos.top ) ) {
+		VIPS_DEBUG_MSG_RED( "vips_tile_calc: "
+			"error on tile %p\n", tile );
+
+		vips_warn( class->nickname,
+			_( "error reading tile %dx%d: %s" ),
+			tile->pos.left, tile->pos.top,
+			vips_error_buffer() );
+		vips_error_clear();
+
+		vips_region_black( tile->region );
+	}
+
+	VIPS_GATE_START( "vips_tile_calc: wait" );
+
+	g_mutex_lock( stripe->lock );
+
+	VIPS_GATE_STOP( "vips_tile_calc: wait" );
+
+	tile->state = VIPS_TILE_STATE_DATA;
+
+	/* Only threads waiting for this tile need to wake up.
+	 */
+	g_cond_broadcast( tile->ready );
+
+	g_mutex_unlock( stripe->lock );
+}
+
 /* Also called from vips_line_cache_gen(), beware.
  */
 static int
@@ -602,18 +1433,23 @@ vips_tile_cache_gen( VipsRegion *or,
 {
 	VipsRegion *in = (VipsRegion *) seq;
 	VipsBlockCache *cache = (VipsBlockCache *) b;
-	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( cache );
 	VipsRect *r = &or->valid;
 
 	VipsTile *tile;
+	VipsTile *wait;
 	GSList *work;
 	GSList *p;
 
-	VIPS_GATE_START( "vips_tile_cache_gen: wait1" );
+	/* In non-threaded mode we hold this lock for the whole of the
+	 * request and make other threads wait.
+	 */
+	if( !cache->threaded ) {
+		VIPS_GATE_START( "vips_tile_cache_gen: wait1" );
 
-	g_mutex_lock( cache->lock );
+		g_mutex_lock( cache->lock );
 
-	VIPS_GATE_STOP( "vips_tile_cache_gen: wait1" );
+		VIPS_GATE_STOP( "vips_tile_cache_gen: wait1" );
+	}
 
 	VIPS_DEBUG_MSG_RED( "vips_tile_cache_gen: "
 		"left = %d, top = %d, width = %d, height = %d\n",
@@ -621,22 +1457,44 @@ vips_tile_cache_gen( VipsRegion *or,
 
 	/* Ref all the tiles we will need.
 	 */
-	work = vips_tile_cache_ref( cache, r );
+	if( vips_tile_cache_ref( cache, r, &work ) ) {
+		if( !cache->threaded )
+			g_mutex_unlock( cache->lock );
+
+		return( -1 );
+	}
 
 	while( work ) {
-		/* Search for data tiles: easy, we can just paste those in.
+		/* Run down the work list. We can paste DATA tiles straight
+		 * away, and we calculate PEND tiles ourselves. Tiles which
+		 * another thread is calculating are left for the next pass.
 		 */
-		for(;;) { 
-			for( p = work; p; p = p->next ) { 
-				tile = (VipsTile *) p->data;
+		wait = NULL;
+		for( p = work; p; ) {
+			VipsTileState state;
 
-				if( tile->state == VIPS_TILE_STATE_DATA ) 
-					break;
+			tile = (VipsTile *) p->data;
+			p = p->next;
+
+			g_mutex_lock( tile->stripe->lock );
+			state = tile->state;
+			if( state == VIPS_TILE_STATE_PEND )
+				tile->state = VIPS_TILE_STATE_CALC;
+			g_mutex_unlock( tile->stripe->lock );
+
+			if( state == VIPS_TILE_STATE_CALC ) {
+				if( !wait )
+					wait = tile;
+				continue;
 			}
 
-			if( !p )
-				break;
+			if( state == VIPS_TILE_STATE_PEND )
+				vips_tile_calc( cache, in, tile );
 
+			/* The tile is now DATA, and since we hold a ref it
+			 * can't be recycled, so we can paste without the
+			 * lock.
+			 */
 			VIPS_DEBUG_MSG_RED( "vips_tile_cache_gen: "
 				"pasting %p\n", tile ); 
 
@@ -645,100 +1503,26 @@ vips_tile_cache_gen( VipsRegion *or,
 			/* We're done with this tile.
 			 */
 			work = g_slist_remove( work, tile );
-			vips_tile_unref( tile ); 
-		}
-
-		/* Calculate the first PEND tile we find on the work list. We
-		 * don't calculate all PEND tiles since after the first, more
-		 * DATA tiles might heve been made available by other threads
-		 * and we want to get them out of the way as soon as we can.
-		 */
-		for( p = work; p; p = p->next ) { 
-			tile = (VipsTile *) p->data;
-
-			if( tile->state == VIPS_TILE_STATE_PEND ) {
-				int result;
-
-				tile->state = VIPS_TILE_STATE_CALC;
-
-				VIPS_DEBUG_MSG_RED( "vips_tile_cache_gen: "
-					"calc of %p\n", tile ); 
-
-				/* In threaded mode, we let other threads run
-				 * while we calc this tile. In non-threaded
-				 * mode, we keep the lock and make 'em wait.
-				 */
-				if( cache->threaded ) 
-					g_mutex_unlock( cache->lock );
-
-				result = vips_region_prepare_to( in, 
-					tile->region, 
-					&tile->pos, 
-					tile->pos.left, tile->pos.top );
-
-				if( cache->threaded ) {
-					VIPS_GATE_START( "vips_tile_cache_gen: "
-						"wait2" );
-
-					g_mutex_lock( cache->lock );
-
-					VIPS_GATE_STOP( "vips_tile_cache_gen: "
-						"wait2" );
-				}
-
-				/* If there was an error calculating this
-				 * tile, just warn and carry on.
-				 *
-				 * This can happen with things like reading
-				 * .scn files via openslide. We don't want the
-				 * read to fail because of one broken tile.
-				 */
-				if( result ) {
-					VIPS_DEBUG_MSG_RED( 
-						"vips_tile_cache_gen: "
-						"error on tile %p\n", tile ); 
-
-					vips_warn( class->nickname,
-						_( "error reading tile %dx%d: "
-							"%s" ),
-						tile->pos.left, tile->pos.top,
-						vips_error_buffer() ); 
-					vips_error_clear();
-
-					vips_region_black( tile->region );
-				}
-
-				tile->state = VIPS_TILE_STATE_DATA;
-
-				vips_tile_touch( tile );
-
-				/* Let everyone know there's a new DATA tile. 
-				 * They need to all check their work lists.
-				 */
-				g_cond_broadcast( cache->new_tile );
 
-				break;
-			}
+			g_mutex_lock( tile->stripe->lock );
+			vips_tile_unref( tile ); 
+			g_mutex_unlock( tile->stripe->lock );
 		}
 
-		/* There are no PEND or DATA tiles, we must need a tile some
-		 * other thread is currently calculating.
-		 *
-		 * We must block until the CALC tiles we need are done.
+		/* Everything left is being calculated by some other thread.
+		 * Block until the first of them is done.
 		 */
-		if( !p && 
-			work ) {
-			for( p = work; p; p = p->next ) { 
-				tile = (VipsTile *) p->data;
-
-				g_assert( tile->state == VIPS_TILE_STATE_CALC );
-			}
+		if( work ) {
+			g_assert( wait );
 
 			VIPS_DEBUG_MSG_RED( "vips_tile_cache_gen: waiting\n" ); 
 
 			VIPS_GATE_START( "vips_tile_cache_gen: wait3" );
 
-			g_cond_wait( cache->new_tile, cache->lock );
+			g_mutex_lock( wait->stripe->lock );
+			while( wait->state == VIPS_TILE_STATE_CALC )
+				g_cond_wait( wait->ready, wait->stripe->lock );
+			g_mutex_unlock( wait->stripe->lock );
 
 			VIPS_GATE_STOP( "vips_tile_cache_gen: wait3" );
 
@@ -746,7 +1530,8 @@ vips_tile_cache_gen( VipsRegion *or,
 		}
 	}
 
-	g_mutex_unlock( cache->lock );
+	if( !cache->threaded )
+		g_mutex_unlock( cache->lock );
 
 	return( 0 );
 }
@@ -758,12 +1543,34 @@ vips_tile_cache_build( VipsObject *object )
 	VipsBlockCache *block_cache = (VipsBlockCache *) object;
 	VipsTileCache *cache = (VipsTileCache *) object;
 
+	int n_stripes;
+
 	VIPS_DEBUG_MSG( "vips_tile_cache_build\n" );
 
 	if( VIPS_OBJECT_CLASS( vips_tile_cache_parent_class )->
 		build( object ) )
 		return( -1 );
 
+	/* Threaded caches are striped, but keep enough tiles in each stripe
+	 * that recycling still works well.
+	 */
+	n_stripes = 1;
+	if( block_cache->threaded ) {
+		if( block_cache->max_tiles == -1 )
+			n_stripes = VIPS_TILE_CACHE_STRIPES;
+		else
+			n_stripes = VIPS_CLIP( 1, 
+				block_cache->max_tiles / 
+					VIPS_TILE_CACHE_STRIPE_MIN,
+				VIPS_TILE_CACHE_STRIPES );
+	}
+	if( vips_block_cache_stripes( block_cache, n_stripes ) )
+		return( -1 );
+
+	if( block_cache->spill &&
+		vips_block_cache_spill_open( block_cache ) )
+		return( -1 );
+
 	if( vips_image_pio_input( block_cache->in ) )
 		return( -1 );
 
@@ -808,6 +1615,20 @@ vips_tile_cache_class_init( VipsTileCacheClass *class )
 		G_STRUCT_OFFSET( VipsBlockCache, max_tiles ),
 		-1, 1000000, 1000 );
 
+	VIPS_ARG_INT( class, "max_compressed", 9,
+		_( "Max compressed" ),
+		_( "Maximum number of evicted tiles to keep compressed" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsBlockCache, max_compressed ),
+		0, 1000000, 0 );
+
+	VIPS_ARG_BOOL( class, "spill", 10,
+		_( "Spill" ),
+		_( "Spill evicted tiles to a temporary file" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsBlockCache, spill ),
+		FALSE );
+
 }
 
 static void
@@ -829,6 +1650,8 @@ vips_tile_cache_init( VipsTileCache *cache )
  * @access: hint expected access pattern #VipsAccess
  * @threaded: allow many threads
  * @persistent: don't drop cache at end of computation
+ * @max_compressed: maximum number of evicted tiles to keep compressed
+ * @spill: write evicted tiles to a temporary file
  *
  * This operation behaves rather like vips_copy() between images
  * @in and @out, except that it keeps a cache of computed pixels. 
@@ -849,11 +1672,30 @@ vips_tile_cache_init( VipsTileCache *cache )
  *
  * Normally, only a single thread at once is allowed to calculate tiles. If
  * you set @threaded to %TRUE, vips_tilecache() will allow many threads to
- * calculate tiles at once, and share the cache between them.
+ * calculate tiles at once, and share the cache between them. A threaded 
+ * cache is split into a set of stripes by tile position, each with its own
+ * lock and its own share of @max_tiles, and a thread waiting for a tile
+ * only wakes when that tile is ready.
  *
  * Normally the cache is dropped when computation finishes. Set @persistent to
  * %TRUE to keep the cache between computations.
  *
+ * Set @max_compressed to keep up to that many tiles evicted from the cache
+ * in a compressed form, and to decompress them again if they are needed,
+ * rather than recalculate them. Tiles are compressed losslessly with a
+ * simple delta and run-length code, so this works best for images with large
+ * smooth areas, such as slide scans. 
+ *
+ * Set @spill to write tiles evicted from the cache to a temporary file and
+ * read them back from there if they are needed again. The file is sparse, 
+ * so only the parts of the image that have been evicted take space on disc.
+ * Putting a small spilling cache after a sequential loader gives random
+ * access with bounded memory use, without decoding the whole image to disc
+ * first. 
+ *
+ * The hits, misses and compression ratio for these tiers are reported with 
+ * vips_info() when the cache closes.
+ *
  * See also: vips_cache(), vips_linecache().
  *
  * Returns: 0 on success, -1 on error.
@@ -888,23 +1730,27 @@ vips_line_cache_gen( VipsRegion *or,
 {
 	VipsBlockCache *block_cache = (VipsBlockCache *) b;
 
+	/* A line cache always has a single stripe.
+	 */
+	VipsTileStripe *stripe = &block_cache->stripes[0];
+
 	VIPS_GATE_START( "vips_line_cache_gen: wait" );
 
-	g_mutex_lock( block_cache->lock );
+	g_mutex_lock( stripe->lock );
 
 	VIPS_GATE_STOP( "vips_line_cache_gen: wait" );
 
 	/* We size up the cache to the largest request.
 	 */
 	if( or->valid.height > 
-		block_cache->max_tiles * block_cache->tile_height ) {
-		block_cache->max_tiles = 
+		stripe->max_tiles * block_cache->tile_height ) {
+		stripe->max_tiles = 
 			1 + (or->valid.height / block_cache->tile_height);
 		VIPS_DEBUG_MSG( "vips_line_cache_gen: bumped max_tiles to %d\n",
-			block_cache->max_tiles ); 
+			stripe->max_tiles ); 
 	}
 
-	g_mutex_unlock( block_cache->lock );
+	g_mutex_unlock( stripe->lock );
 
 	return( vips_tile_cache_gen( or, seq, a, b, stop ) ); 
 }
@@ -964,6 +1810,9 @@ vips_line_cache_build( VipsObject *object )
 		 block_cache->tile_height * 
 		 VIPS_IMAGE_SIZEOF_PEL( block_cache->in )) / (1024 * 1024.0) );
 
+	if( vips_block_cache_stripes( block_cache, 1 ) )
+		return( -1 );
+
 	if( vips_image_pio_input( block_cache->in ) )
 		return( -1 );
 
@@ -0,0 +1,326 @@
+/* box blur with a summed-area table
+ *
+ * 19/10/14
+ * 	- from stdif.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+typedef struct _VipsBoxblur {
+	VipsOperation parent_instance;
+
+	VipsImage *in;
+	VipsImage *out;
+
+	int width;
+	int height;
+
+} VipsBoxblur;
+
+typedef VipsOperationClass VipsBoxblurClass;
+
+G_DEFINE_TYPE( VipsBoxblur, vips_boxblur, VIPS_TYPE_OPERATION );
+
+/* Our sequence value: the region this sequence is using, and the table of
+ * sums for it.
+ */
+typedef struct {
+	VipsRegion *ir;
+	VipsIntegral *integral;
+} VipsBoxblurSequence;
+
+static int
+vips_boxblur_stop( void *vseq, void *a, void *b )
+{
+	VipsBoxblurSequence *seq = (VipsBoxblurSequence *) vseq;
+
+	VIPS_UNREF( seq->ir );
+	VIPS_FREEF( vips__integral_free, seq->integral );
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_boxblur_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+	VipsBoxblurSequence *seq;
+
+	if( !(seq = VIPS_NEW( NULL, VipsBoxblurSequence )) )
+		 return( NULL );
+	seq->ir = NULL;
+	seq->integral = NULL;
+
+	if( !(seq->ir = vips_region_new( in )) ||
+		!(seq->integral = vips__integral_new( FALSE )) ) {
+		vips_boxblur_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+/* Integer types round to nearest, float types just take the mean.
+ */
+#define BOX_INT( TYPE ) { \
+	TYPE *q = (TYPE *) VIPS_REGION_ADDR( or, r->left, r->top + y ); \
+	\
+	for( x = 0; x < r->width; x++ ) \
+		for( i = 0; i < bands; i++ ) { \
+			double s = VIPS_INTEGRAL_WINDOW( integral, sum, \
+				x, y, boxblur->width, boxblur->height, i ); \
+			\
+			*q++ = floor( s / npel + 0.5 ); \
+		} \
+}
+
+#define BOX_FLOAT( TYPE ) { \
+	TYPE *q = (TYPE *) VIPS_REGION_ADDR( or, r->left, r->top + y ); \
+	\
+	for( x = 0; x < r->width; x++ ) \
+		for( i = 0; i < bands; i++ ) { \
+			double s = VIPS_INTEGRAL_WINDOW( integral, sum, \
+				x, y, boxblur->width, boxblur->height, i ); \
+			\
+			*q++ = s / npel; \
+		} \
+}
+
+static int
+vips_boxblur_generate( VipsRegion *or,
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsBoxblurSequence *seq = (VipsBoxblurSequence *) vseq;
+	VipsImage *in = (VipsImage *) a;
+	VipsBoxblur *boxblur = (VipsBoxblur *) b;
+	VipsRect *r = &or->valid;
+	VipsIntegral *integral = seq->integral;
+	int bands = in->Bands;
+	double npel = boxblur->width * boxblur->height;
+
+	VipsRect irect;
+	int x, y, i;
+
+	/* What part of ir do we need?
+	 */
+	irect.left = r->left;
+	irect.top = r->top;
+	irect.width = r->width + boxblur->width - 1;
+	irect.height = r->height + boxblur->height - 1;
+	if( vips_region_prepare( seq->ir, &irect ) ||
+		vips__integral_region( integral, seq->ir, &irect ) )
+		return( -1 );
+
+	for( y = 0; y < r->height; y++ ) {
+		switch( in->BandFmt ) {
+		case VIPS_FORMAT_UCHAR:
+			BOX_INT( unsigned char ); break;
+		case VIPS_FORMAT_CHAR:
+			BOX_INT( signed char ); break;
+		case VIPS_FORMAT_USHORT:
+			BOX_INT( unsigned short ); break;
+		case VIPS_FORMAT_SHORT:
+			BOX_INT( signed short ); break;
+		case VIPS_FORMAT_UINT:
+			BOX_INT( unsigned int ); break;
+		case VIPS_FORMAT_INT:
+			BOX_INT( signed int ); break;
+		case VIPS_FORMAT_FLOAT:
+			BOX_FLOAT( float ); break;
+		case VIPS_FORMAT_DOUBLE:
+			BOX_FLOAT( double ); break;
+
+		default:
+			g_assert( 0 );
+		}
+	}
+
+	return( 0 );
+}
+
+static int
+vips_boxblur_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsBoxblur *boxblur = (VipsBoxblur *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 2 );
+
+	VipsImage *in;
+
+	if( VIPS_OBJECT_CLASS( vips_boxblur_parent_class )->build( object ) )
+		return( -1 );
+
+	in = boxblur->in;
+
+	if( vips_image_decode( in, &t[0] ) )
+		return( -1 );
+	in = t[0];
+
+	if( vips_check_noncomplex( class->nickname, in ) )
+		return( -1 );
+
+	if( boxblur->width > in->Xsize ||
+		boxblur->height > in->Ysize ) {
+		vips_error( class->nickname, "%s", _( "window too large" ) );
+		return( -1 );
+	}
+
+	/* Expand the input.
+	 */
+	if( vips_embed( in, &t[1],
+		boxblur->width / 2, boxblur->height / 2,
+		in->Xsize + boxblur->width - 1,
+		in->Ysize + boxblur->height - 1,
+		"extend", VIPS_EXTEND_COPY,
+		NULL ) )
+		return( -1 );
+	in = t[1];
+
+	g_object_set( object, "out", vips_image_new(), NULL );
+
+	/* SMALLTILE keeps the overlap between the input areas of adjacent
+	 * tiles small relative to the tile, so we don't sum too many pixels
+	 * twice.
+	 */
+	if( vips_image_pipelinev( boxblur->out,
+		VIPS_DEMAND_STYLE_SMALLTILE, in, NULL ) )
+		return( -1 );
+	boxblur->out->Xsize -= boxblur->width - 1;
+	boxblur->out->Ysize -= boxblur->height - 1;
+
+	if( vips_image_generate( boxblur->out,
+		vips_boxblur_start,
+		vips_boxblur_generate,
+		vips_boxblur_stop,
+		in, boxblur ) )
+		return( -1 );
+
+	boxblur->out->Xoffset = 0;
+	boxblur->out->Yoffset = 0;
+
+	return( 0 );
+}
+
+static void
+vips_boxblur_class_init( VipsBoxblurClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsOperationClass *operation_class = VIPS_OPERATION_CLASS( class );
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "boxblur";
+	object_class->description = _( "box blur" );
+	object_class->build = vips_boxblur_build;
+
+	operation_class->flags = VIPS_OPERATION_SEQUENTIAL;
+
+	VIPS_ARG_IMAGE( class, "in", 1,
+		_( "Input" ),
+		_( "Input image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsBoxblur, in ) );
+
+	VIPS_ARG_IMAGE( class, "out", 2,
+		_( "Output" ),
+		_( "Output image" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsBoxblur, out ) );
+
+	VIPS_ARG_INT( class, "width", 3,
+		_( "Width" ),
+		_( "Window width in pixels" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsBoxblur, width ),
+		1, 1000000, 3 );
+
+	VIPS_ARG_INT( class, "height", 4,
+		_( "Height" ),
+		_( "Window height in pixels" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsBoxblur, height ),
+		1, 1000000, 3 );
+
+}
+
+static void
+vips_boxblur_init( VipsBoxblur *boxblur )
+{
+	boxblur->width = 3;
+	boxblur->height = 3;
+}
+
+/**
+ * vips_boxblur:
+ * @in: input image
+ * @out: output image
+ * @width: width of window
+ * @height: height of window
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Each output pixel is the mean of a @width by @height window of @in
+ * centred on that pixel. Integer formats are rounded to nearest.
+ *
+ * Window sums are found from a summed-area table built for each tile, so
+ * the time taken does not depend on the window size.
+ *
+ * The output image is the same size and format as the input image. The
+ * edge pixels are created by copying edge pixels of the input image
+ * outwards.
+ *
+ * See also: vips_integral(), vips_gaussblur(), vips_conv().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_boxblur( VipsImage *in, VipsImage **out, int width, int height, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, height );
+	result = vips_call_split( "boxblur", ap, in, out, width, height );
+	va_end( ap );
+
+	return( result );
+}
@@ -156,6 +156,7 @@ vips_convolution_operation_init( void )
 	extern int vips_spcor_get_type( void ); 
 	extern int vips_sharpen_get_type( void ); 
 	extern int vips_gaussblur_get_type( void ); 
+	extern int vips_boxblur_get_type( void ); 
 
 	vips_conv_get_type(); 
 	vips_compass_get_type(); 
@@ -164,4 +165,5 @@ vips_convolution_operation_init( void )
 	vips_spcor_get_type(); 
 	vips_sharpen_get_type(); 
 	vips_gaussblur_get_type(); 
+	vips_boxblur_get_type(); 
 }
@@ -67,11 +67,10 @@ vips_correlation_gen( VipsRegion *or,
 	irect.width = r->width + correlation->ref_ready->Xsize - 1;
 	irect.height = r->height + correlation->ref_ready->Ysize - 1;
 
-	if( vips_region_prepare( ir, &irect ) )
+	if( vips_region_prepare( ir, &irect ) ||
+		cclass->correlation( correlation, ir, or ) )
 		return( -1 );
 
-	cclass->correlation( correlation, ir, or );
-
 	return( 0 );
 }
 
@@ -80,7 +80,9 @@ typedef struct {
 	 */
 	int (*pre_generate)( VipsCorrelation * );  
 
-	void (*correlation)( VipsCorrelation *, 
+	/* Fill out from in. Return non-zero on error.
+	 */
+	int (*correlation)( VipsCorrelation *, 
 		VipsRegion *in, VipsRegion *out ); 
 
 } VipsCorrelationClass;
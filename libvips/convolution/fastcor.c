@@ -131,7 +131,7 @@ G_DEFINE_TYPE( VipsFastcor, vips_fastcor, VIPS_TYPE_CORRELATION );
 	} \
 }
 
-static void
+static int
 vips_fastcor_correlation( VipsCorrelation *correlation,
 	VipsRegion *in, VipsRegion *out )
 {
@@ -182,6 +182,8 @@ vips_fastcor_correlation( VipsCorrelation *correlation,
         default:
 		g_assert( 0 );
         }
+
+	return( 0 );
 }
 
 /* Save a bit of typing.
@@ -36,6 +36,8 @@
  * 	- cleanups
  * 7/11/13
  * 	- redone as a class
+ * 19/10/14
+ * 	- window sums and sums of squares from a summed-area table
  */
 
 /*
@@ -74,6 +76,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/internal.h>
 
 #include "pconvolution.h"
 #include "correlation.h"
@@ -149,6 +152,9 @@ vips_spcor_pre_generate( VipsCorrelation *correlation )
 	return( 0 );
 }
 
+/* The window sum and sum of squares on in come from the summed-area table, 
+ * so we only need to loop for the sum of products.
+ */
 #define LOOP( IN ) { \
 	IN *r1 = ((IN *) ref->data) + b; \
 	IN *p1 = ((IN *) p) + b; \
@@ -156,23 +162,10 @@ vips_spcor_pre_generate( VipsCorrelation *correlation )
 	IN *r1a; \
 	IN *p1a; \
  	\
-	/* Mean of area of in corresponding to ref. \
-	 */ \
-	p1a = p1; \
-	sum1 = 0.0; \
-	for( j = 0; j < ref->Ysize; j++ ) { \
-		for( i = 0; i < sz; i += bands ) \
-			sum1 += p1a[i]; \
-		p1a += in_lsk;  \
-	} \
-	imean = sum1 / VIPS_IMAGE_N_PELS( ref ); \
- 	\
-	/* Calculate sum-of-squares-of-differences for this window on \
-	 * in, and also sum-of-products-of-differences from mean. \
+	/* Calculate sum-of-products-of-differences from mean. \
 	 */ \
 	p1a = p1; \
 	r1a = r1; \
-	sum2 = 0.0; \
 	sum3 = 0.0; \
 	for( j = 0; j < ref->Ysize; j++ ) { \
 		for( i = 0; i < sz; i += bands ) { \
@@ -181,14 +174,6 @@ vips_spcor_pre_generate( VipsCorrelation *correlation )
 			IN ip = p1a[i]; \
 			IN rp = r1a[i]; \
 			\
-			/* Accumulate sum-of-squares-of- \
-			 * differences for input image. \
-			 */ \
-			double t = ip - imean; \
-			sum2 += t * t; \
-			\
-			/* Accumulate product-of-difference from mean. \
-			 */ \
 			sum3 += (rp - spcor->rmean[b]) * (ip - imean); \
 		} \
 		\
@@ -197,7 +182,7 @@ vips_spcor_pre_generate( VipsCorrelation *correlation )
 	} \
 }
 
-static void
+static int
 vips_spcor_correlation( VipsCorrelation *correlation,
 	VipsRegion *in, VipsRegion *out )
 {
@@ -208,7 +193,10 @@ vips_spcor_correlation( VipsCorrelation *correlation,
 		ref->Bands * 2 : ref->Bands; 
 	int sz = ref->Xsize * bands; 
 	int lsk = VIPS_REGION_LSKIP( in ); 
+	double npel = VIPS_IMAGE_N_PELS( ref );
 
+	VipsIntegral *integral;
+	VipsRect irect;
 	int x, y, b, j, i;
 
 	double imean;
@@ -216,6 +204,18 @@ vips_spcor_correlation( VipsCorrelation *correlation,
 	double sum2, sum3;
 	double c2, cc;
 
+	/* Sums and sums of squares of in for every window position.
+	 */
+	irect.left = r->left;
+	irect.top = r->top;
+	irect.width = r->width + ref->Xsize - 1;
+	irect.height = r->height + ref->Ysize - 1;
+	if( !(integral = vips__integral_new( TRUE )) ||
+		vips__integral_region( integral, in, &irect ) ) {
+		VIPS_FREEF( vips__integral_free, integral );
+		return( -1 );
+	}
+
 	for( y = 0; y < r->height; y++ ) {
 		float *q = (float *) 
 			VIPS_REGION_ADDR( out, r->left, r->top + y );
@@ -225,6 +225,17 @@ vips_spcor_correlation( VipsCorrelation *correlation,
 				VIPS_REGION_ADDR( in, r->left + x, r->top + y );
 
 			for( b = 0; b < bands; b++ ) { 
+				/* Mean of area of in corresponding to ref, 
+				 * and sum-of-squares-of-differences from that
+				 * mean.
+				 */
+				sum1 = VIPS_INTEGRAL_WINDOW( integral, sum, 
+					x, y, ref->Xsize, ref->Ysize, b );
+				sum2 = VIPS_INTEGRAL_WINDOW( integral, sum2, 
+					x, y, ref->Xsize, ref->Ysize, b );
+				imean = sum1 / npel;
+				sum2 = VIPS_MAX( 0.0, sum2 - imean * sum1 );
+
 				switch( vips_image_get_format( ref ) ) {
 				case VIPS_FORMAT_UCHAR:	
 					LOOP( unsigned char ); 
@@ -251,18 +262,17 @@ vips_spcor_correlation( VipsCorrelation *correlation,
 					break; 
 
 				case VIPS_FORMAT_FLOAT:	
-				case VIPS_FORMAT_COMPLEX: 
 					LOOP( float ); 
 					break; 
 
 				case VIPS_FORMAT_DOUBLE: 
-				case VIPS_FORMAT_DPCOMPLEX: 
 					LOOP( double ); 
 					break;
 
 				default:
 					g_assert( 0 );
-					return; 
+					vips__integral_free( integral );
+					return( -1 ); 
 				}
 
 				c2 = sqrt( sum2 );
@@ -272,6 +282,10 @@ vips_spcor_correlation( VipsCorrelation *correlation,
 			}
 		}
 	}
+
+	vips__integral_free( integral );
+
+	return( 0 );
 }
 
 /* Save a bit of typing.
@@ -21,6 +21,11 @@
  * 	- redo as a class
  * 9/9/13
  * 	- any number of bands
+ * 19/10/14
+ * 	- walk tiles in serpentine order, so we never rebuild the histogram 
+ * 	  from scratch
+ * 	- two-level histograms
+ * 	- ushort support
  */
 
 /*
@@ -82,9 +87,16 @@ G_DEFINE_TYPE( VipsHistLocal, vips_hist_local, VIPS_TYPE_OPERATION );
 typedef struct {
 	VipsRegion *ir;		/* Input region */
 
-	/* A 256-element hist for evry band.
+	/* A two-level hist for every band. fine has a bin for every pixel
+	 * value, coarse has a bin for every run of (1 << shift) values, so 
+	 * we can count the pixels below a value in a few steps.
 	 */
-	unsigned int **hist;
+	unsigned int **fine;
+	unsigned int **coarse;
+
+	int n_fine;
+	int n_coarse;
+	int shift;
 } VipsHistLocalSequence;
 
 static int
@@ -94,14 +106,18 @@ vips_hist_local_stop( void *vseq, void *a, void *b )
 	VipsImage *in = (VipsImage *) a;
 
 	VIPS_UNREF( seq->ir );
-	if( seq->hist &&
-		in ) {
+	if( in ) {
 		int i; 
 
-		for( i = 0; i < in->Bands; i++ )
-			VIPS_FREE( seq->hist[i] );
-		VIPS_FREE( seq->hist );
+		for( i = 0; i < in->Bands; i++ ) {
+			if( seq->fine )
+				VIPS_FREE( seq->fine[i] );
+			if( seq->coarse )
+				VIPS_FREE( seq->coarse[i] );
+		}
 	}
+	VIPS_FREE( seq->fine );
+	VIPS_FREE( seq->coarse );
 	VIPS_FREE( seq );
 
 	return( 0 );
@@ -118,23 +134,112 @@ vips_hist_local_start( VipsImage *out, void *a, void *b )
 	if( !(seq = VIPS_NEW( NULL, VipsHistLocalSequence )) )
 		 return( NULL );
 	seq->ir = NULL;
-	seq->hist = NULL;
+	seq->fine = NULL;
+	seq->coarse = NULL;
+
+	/* 16 x 16 for uchar, 256 x 256 for ushort.
+	 */
+	if( in->BandFmt == VIPS_FORMAT_UCHAR ) { 
+		seq->n_fine = 256;
+		seq->shift = 4;
+	}
+	else {
+		seq->n_fine = 65536;
+		seq->shift = 8;
+	}
+	seq->n_coarse = seq->n_fine >> seq->shift;
 
 	if( !(seq->ir = vips_region_new( in )) || 
-		!(seq->hist = VIPS_ARRAY( NULL, in->Bands, unsigned int * )) ) {
+		!(seq->fine = VIPS_ARRAY( NULL, in->Bands, unsigned int * )) ||
+		!(seq->coarse = VIPS_ARRAY( NULL, 
+			in->Bands, unsigned int * )) ) {
 		vips_hist_local_stop( seq, NULL, NULL );
 		return( NULL ); 
 	}
 
-	for( i = 0; i < in->Bands; i++ )
-		if( !(seq->hist[i] = VIPS_ARRAY( NULL, 256, unsigned int )) ) {
-		vips_hist_local_stop( seq, NULL, NULL );
-		return( NULL ); 
+	for( i = 0; i < in->Bands; i++ ) {
+		seq->fine[i] = NULL;
+		seq->coarse[i] = NULL;
 	}
 
+	for( i = 0; i < in->Bands; i++ ) 
+		if( !(seq->fine[i] = VIPS_ARRAY( NULL, 
+				seq->n_fine, unsigned int )) ||
+			!(seq->coarse[i] = VIPS_ARRAY( NULL, 
+				seq->n_coarse, unsigned int )) ) {
+			vips_hist_local_stop( seq, in, NULL );
+			return( NULL ); 
+		}
+
 	return( seq );
 }
 
+#define UPDATE( TYPE ) { \
+	for( i = 0; i < n; i++ ) { \
+		TYPE *p1 = (TYPE *) p; \
+		\
+		for( b = 0; b < bands; b++ ) { \
+			int v = p1[b]; \
+			\
+			seq->fine[b][v] += d; \
+			seq->coarse[b][v >> shift] += d; \
+		} \
+		\
+		p += stride; \
+	} \
+}
+
+/* Add (d == 1) or remove (d == -1) n pixels to the hists, stepping stride 
+ * bytes between pixels.
+ */
+static void
+vips_hist_local_update( VipsHistLocalSequence *seq, VipsImage *in,
+	VipsPel *p, int n, int stride, int d )
+{
+	int bands = in->Bands;
+	int shift = seq->shift;
+
+	int i, b;
+
+	if( in->BandFmt == VIPS_FORMAT_UCHAR )
+		UPDATE( unsigned char )
+	else
+		UPDATE( unsigned short )
+}
+
+/* Number of pixels in the window less than target.
+ */
+static unsigned int
+vips_hist_local_below( VipsHistLocalSequence *seq, int b, int target )
+{
+	unsigned int *fine = seq->fine[b];
+	unsigned int *coarse = seq->coarse[b];
+	int top = target >> seq->shift;
+
+	unsigned int sum;
+	int i;
+
+	sum = 0;
+	for( i = 0; i < top; i++ )
+		sum += coarse[i];
+	for( i = top << seq->shift; i < target; i++ )
+		sum += fine[i];
+
+	return( sum );
+}
+
+#define WRITE( TYPE ) { \
+	TYPE *p1 = (TYPE *) VIPS_REGION_ADDR( seq->ir, \
+		r->left + x + local->width / 2, \
+		r->top + y + local->height / 2 ); \
+	TYPE *q = (TYPE *) VIPS_REGION_ADDR( or, \
+		r->left + x, r->top + y ); \
+	\
+	for( b = 0; b < bands; b++ ) \
+		q[b] = (guint64) seq->n_fine * \
+			vips_hist_local_below( seq, b, p1[b] ) / npel; \
+}
+
 static int
 vips_hist_local_generate( VipsRegion *or, 
 	void *vseq, void *a, void *b, gboolean *stop )
@@ -144,79 +249,86 @@ vips_hist_local_generate( VipsRegion *or,
 	const VipsHistLocal *local = (VipsHistLocal *) b;
 	VipsRect *r = &or->valid;
 	int bands = in->Bands; 
+	guint64 npel = (guint64) local->width * local->height;
+	int psize = VIPS_IMAGE_SIZEOF_PEL( in );
 
 	VipsRect irect;
-	int y;
 	int lsk;
-	int centre;		/* Offset to move to centre of window */
+	int x, y, i, j;
 
 	/* What part of ir do we need?
 	 */
 	irect.left = r->left;
 	irect.top = r->top;
-	irect.width = r->width + local->width; 
-	irect.height = r->height + local->height; 
+	irect.width = r->width + local->width - 1; 
+	irect.height = r->height + local->height - 1; 
 	if( vips_region_prepare( seq->ir, &irect ) )
 		return( -1 );
 
 	lsk = VIPS_REGION_LSKIP( seq->ir );
-	centre = lsk * (local->height / 2) + bands * local->width / 2;
-
-	for( y = 0; y < r->height; y++ ) {
-		/* Get input and output pointers for this line.
-		 */
-		VipsPel *p = VIPS_REGION_ADDR( seq->ir, r->left, r->top + y );
-		VipsPel *q = VIPS_REGION_ADDR( or, r->left, r->top + y );
 
-		VipsPel *p1;
-		int x, i, j, b;
+	/* Find histogram for the top-left window.
+	 */
+	for( i = 0; i < bands; i++ ) {
+		memset( seq->fine[i], 0, seq->n_fine * sizeof( unsigned int ) );
+		memset( seq->coarse[i], 0, 
+			seq->n_coarse * sizeof( unsigned int ) );
+	}
+	for( j = 0; j < local->height; j++ ) 
+		vips_hist_local_update( seq, in, 
+			VIPS_REGION_ADDR( seq->ir, r->left, r->top + j ),
+			local->width, psize, 1 );
 
-		/* Find histogram for start of this line.
-		 */
-		for( b = 0; b < bands; b++ )
-			memset( seq->hist[b], 0, 256 * sizeof( unsigned int ) );
-		p1 = p;
-		for( j = 0; j < local->height; j++ ) {
-			i = 0; 
-			for( x = 0; x < local->width; x++ )
-				for( b = 0; b < bands; b++ )
-					seq->hist[b][p1[i++]] += 1;
-			
-			p1 += lsk;
+	/* Walk the tile in serpentine order, so we only ever add and remove 
+	 * a single line or column of pixels between output pixels.
+	 */
+	x = 0;
+	for( y = 0; y < r->height; y++ ) {
+		int dx = (y & 1) ? -1 : 1;
+
+		for( i = 0; i < r->width; i++ ) {
+			int b;
+
+			if( in->BandFmt == VIPS_FORMAT_UCHAR )
+				WRITE( unsigned char )
+			else
+				WRITE( unsigned short )
+
+			if( i == r->width - 1 )
+				break;
+
+			/* Adapt histogram --- remove the pels from 
+			 * the trailing column, add in pels for a 
+			 * new leading column.
+			 */
+			vips_hist_local_update( seq, in, 
+				VIPS_REGION_ADDR( seq->ir, 
+					r->left + (dx > 0 ? 
+						x : x + local->width - 1), 
+					r->top + y ),
+				local->height, lsk, -1 );
+			vips_hist_local_update( seq, in, 
+				VIPS_REGION_ADDR( seq->ir, 
+					r->left + (dx > 0 ? 
+						x + local->width : x - 1), 
+					r->top + y ),
+				local->height, lsk, 1 );
+
+			x += dx;
 		}
 
-		/* Loop for output pels.
+		if( y == r->height - 1 )
+			break;
+
+		/* And step down a line.
 		 */
-		for( x = 0; x < r->width; x++ ) {
-			for( b = 0; b < bands; b++ ) {
-				/* Sum histogram up to current pel.
-				 */
-				unsigned int *hist = seq->hist[b]; 
-				int target = p[centre];
-				int sum;
-
-				sum = 0;
-				for( i = 0; i < target; i++ )
-					sum += hist[i];
-
-				*q++ = 256 * sum / 
-					(local->width * local->height);
-
-				/* Adapt histogram --- remove the pels from 
-				 * the left hand column, add in pels for a 
-				 * new right-hand column.
-				 */
-				p1 = p;
-				for( j = 0; j < local->height; j++ ) {
-					hist[p1[0]] -= 1;
-					hist[p1[bands * local->width]] += 1;
-
-					p1 += lsk;
-				}
-
-				p += 1;
-			}
-		}
+		vips_hist_local_update( seq, in, 
+			VIPS_REGION_ADDR( seq->ir, r->left + x, r->top + y ),
+			local->width, psize, -1 );
+		vips_hist_local_update( seq, in, 
+			VIPS_REGION_ADDR( seq->ir, 
+				r->left + x, r->top + y + local->height ),
+			local->width, psize, 1 );
 	}
 
 	return( 0 );
@@ -240,7 +352,7 @@ vips_hist_local_build( VipsObject *object )
 		return( -1 );
 	in = t[0]; 
 
-	if( vips_check_format( class->nickname, in, VIPS_FORMAT_UCHAR ) )
+	if( vips_check_u8or16( class->nickname, in ) )
 		return( -1 );
 
 	if( local->width > in->Xsize || 
@@ -337,7 +449,15 @@ vips_hist_local_init( VipsHistLocal *local )
  * @...: %NULL-terminated list of optional named arguments
  *
  * Performs local histogram equalisation on @in using a
- * window of size @xwin by @ywin centered on the input pixel. 
+ * window of size @width by @height centered on the input pixel. 
+ *
+ * @in can be uchar or ushort, with any number of bands. Each band is
+ * equalised separately, and @out has the same format as @in.
+ *
+ * Each tile of @out is computed by sliding a histogram over the window 
+ * positions in serpentine order, adding and removing one line or column
+ * of pixels at each step, so time per pixel grows only with the window 
+ * width or height, not its area.
  *
  * The output image is the same size as the input image. The edge pixels are
  * created by copy edge pixels of the input image outwards.
@@ -33,6 +33,12 @@
  * 	- convert to a class
  * 2/10/13
  * 	- add --band arg, replacing im_tone_map()
+ * 20/10/14
+ * 	- add @count, only count overflows if asked
+ * 	- pad tables out to the range of uchar and ushort input, so we can 
+ * 	  index without clipping
+ * 	- one-band input through a many-band lut uses an interleaved table
+ * 	- special loops for uchar -> uchar with 1, 3 or 4 bands
  */
 
 /*
@@ -73,23 +79,37 @@
 
 #include <vips/vips.h>
 
-typedef struct _VipsMaplut {
+typedef struct _VipsMaplut VipsMaplut;
+
+/* Map @n input elements from @p to @q. 
+ */
+typedef void (*VipsMaplutFn)( VipsMaplut *maplut, 
+	VipsPel * restrict q, VipsPel * restrict p, int n );
+
+struct _VipsMaplut {
 	VipsOperation parent_instance;
 
 	VipsImage *in;
 	VipsImage *out;
 	VipsImage *lut;
 	int band; 
+	gboolean count;
 
 	int fmt;		/* LUT image BandFmt */
 	int nb;			/* Number of bands in lut */
 	int es;			/* VIPS_IMAGE_SIZEOF_ELEMENT() for lut image */
 	int sz;			/* Number of elements in minor dimension */
 	int clp;		/* Value we clip against */
+	int tsz;		/* Elements in each table, sz padded to range */
 	VipsPel **table;	/* Lut converted to 2d array */
+	VipsPel *combined;	/* Bands interleaved, for 1-band input */
 	int overflow;		/* Number of overflows for non-uchar lut */
 
-} VipsMaplut;
+	/* A loop for this combination of bands and formats, or NULL.
+	 */
+	VipsMaplutFn fast;
+
+};
 
 typedef VipsOperationClass VipsMaplutClass;
 
@@ -142,31 +162,31 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 	return( seq );
 }
 
-/* Map through n non-complex luts.
+/* Map through n non-complex luts. Step along the pixels rather than the 
+ * bands, so we pass through memory just once.
  */
-#define loop( OUT ) { \
+#define loop( IN, OUT ) { \
 	int b = maplut->nb; \
+	OUT **tlut = (OUT **) maplut->table; \
 	\
 	for( y = to; y < bo; y++ ) { \
-		for( z = 0; z < b; z++ ) { \
-			VipsPel *p = VIPS_REGION_ADDR( ir, le, y ); \
-			OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-			OUT *tlut = (OUT *) maplut->table[z]; \
-			\
-			for( x = z; x < ne; x += b ) \
-				q[x] = tlut[p[x]]; \
-		} \
+		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
+		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
+		\
+		for( i = 0, x = 0; x < np; x++ ) \
+			for( z = 0; z < b; z++, i++ ) \
+				q[i] = tlut[z][p[i]]; \
 	} \
 }
 
 /* Map through n complex luts.
  */
-#define loopc( OUT ) { \
+#define loopc( IN, OUT ) { \
 	int b = in->Bands; \
 	\
 	for( y = to; y < bo; y++ ) { \
 		for( z = 0; z < b; z++ ) { \
-			VipsPel *p = VIPS_REGION_ADDR( ir, le, y ) + z; \
+			IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ) + z; \
 			OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ) + z * 2; \
 			OUT *tlut = (OUT *) maplut->table[z]; \
 			\
@@ -183,24 +203,23 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 
 #define loopg( IN, OUT ) { \
 	int b = maplut->nb; \
+	OUT **tlut = (OUT **) maplut->table; \
 	\
 	for( y = to; y < bo; y++ ) { \
-		for( z = 0; z < b; z++ ) { \
-			IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
-			OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-			OUT *tlut = (OUT *) maplut->table[z]; \
-			\
-			for( x = z; x < ne; x += b ) { \
-				int index = p[x]; \
+		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
+		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
+		\
+		for( i = 0, x = 0; x < np; x++ ) \
+			for( z = 0; z < b; z++, i++ ) { \
+				int index = p[i]; \
 				\
 				if( index > maplut->clp ) { \
 					index = maplut->clp; \
 					seq->overflow++; \
 				} \
 				\
-				q[x] = tlut[index]; \
+				q[i] = tlut[z][index]; \
 			} \
-		} \
 	} \
 }
 
@@ -232,12 +251,12 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 
 /* Map image through one non-complex lut.
  */
-#define loop1( OUT ) { \
+#define loop1( IN, OUT ) { \
 	OUT *tlut = (OUT *) maplut->table[0]; \
 	\
 	for( y = to; y < bo; y++ ) { \
 		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-		VipsPel *p = VIPS_REGION_ADDR( ir, le, y ); \
+		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
 		\
 		for( x = 0; x < ne; x++ ) \
 			q[x] = tlut[p[x]]; \
@@ -246,12 +265,12 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 
 /* Map image through one complex lut.
  */
-#define loop1c( OUT ) { \
+#define loop1c( IN, OUT ) { \
 	OUT *tlut = (OUT *) maplut->table[0]; \
 	\
 	for( y = to; y < bo; y++ ) { \
 		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-		VipsPel *p = VIPS_REGION_ADDR( ir, le, y ); \
+		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
 		\
 		for( x = 0; x < ne; x++ ) { \
 			int n = p[x] * 2; \
@@ -308,41 +327,41 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 	} \
 }
 
-/* Map 1-band image through a many-band non-complex lut.
+/* Map 1-band image through a many-band non-complex lut. The bands of each
+ * lut entry are next to each other in @combined.
  */
-#define loop1m( OUT ) { \
-	OUT **tlut = (OUT **) maplut->table; \
+#define loop1m( IN, OUT ) { \
+	int b = maplut->nb; \
+	OUT *tlut = (OUT *) maplut->combined; \
 	\
 	for( y = to; y < bo; y++ ) { \
 		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-		VipsPel *p = VIPS_REGION_ADDR( ir, le, y ); \
+		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
 		\
 		for( i = 0, x = 0; x < np; x++ ) { \
-			int n = p[x]; \
+			OUT *e = tlut + p[x] * b; \
 			\
-			for( z = 0; z < maplut->nb; z++, i++ ) \
-				q[i] = tlut[z][n]; \
+			for( z = 0; z < b; z++, i++ ) \
+				q[i] = e[z]; \
 		} \
 	} \
 }
 
 /* Map 1-band image through many-band complex lut.
  */
-#define loop1cm( OUT ) { \
-	OUT **tlut = (OUT **) maplut->table; \
+#define loop1cm( IN, OUT ) { \
+	int b = maplut->nb * 2; \
+	OUT *tlut = (OUT *) maplut->combined; \
 	\
 	for( y = to; y < bo; y++ ) { \
 		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-		VipsPel *p = VIPS_REGION_ADDR( ir, le, y ); \
+		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
 		\
-		for( x = 0; x < np; x++ ) { \
-			int n = p[x] * 2; \
+		for( i = 0, x = 0; x < np; x++ ) { \
+			OUT *e = tlut + p[x] * b; \
 			\
-			for( z = 0; z < maplut->nb; z++ ) { \
-				q[0] = tlut[z][n]; \
-				q[1] = tlut[z][n+1]; \
-				q += 2; \
-			} \
+			for( z = 0; z < b; z++, i++ ) \
+				q[i] = e[z]; \
 		} \
 	} \
 }
@@ -350,7 +369,8 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 /* Map 1-band uint or ushort image through a many-band non-complex LUT.
  */
 #define loop1gm( IN, OUT ) { \
-	OUT **tlut = (OUT **) maplut->table; \
+	int b = maplut->nb; \
+	OUT *tlut = (OUT *) maplut->combined; \
 	\
 	for( y = to; y < bo; y++ ) { \
 		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
@@ -358,14 +378,16 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 		\
 		for( i = 0, x = 0; x < np; x++ ) { \
 			int n = p[x]; \
+			OUT *e; \
 			\
 			if( n > maplut->clp ) { \
 				n = maplut->clp; \
 				seq->overflow++; \
 			} \
 			\
-			for( z = 0; z < maplut->nb; z++, i++ ) \
-				q[i] = tlut[z][n]; \
+			e = tlut + n * b; \
+			for( z = 0; z < b; z++, i++ ) \
+				q[i] = e[z]; \
 		} \
 	} \
 }
@@ -373,66 +395,166 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 /* Map 1-band uint or ushort image through a many-band complex LUT.
  */
 #define loop1cgm( IN, OUT ) { \
-	OUT **tlut = (OUT **) maplut->table; \
+	int b = maplut->nb * 2; \
+	OUT *tlut = (OUT *) maplut->combined; \
 	\
 	for( y = to; y < bo; y++ ) { \
 		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
 		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
 		\
-		for( x = 0; x < np; x++ ) { \
+		for( i = 0, x = 0; x < np; x++ ) { \
 			int n = p[x]; \
+			OUT *e; \
 			\
 			if( n > maplut->clp ) { \
 				n = maplut->clp; \
 				seq->overflow++; \
 			} \
 			\
-			for( z = 0; z < maplut->nb; z++ ) { \
-				q[0] = tlut[z][n * 2]; \
-				q[1] = tlut[z][n * 2 + 1]; \
-				q += 2; \
-			} \
+			e = tlut + n * b; \
+			for( z = 0; z < b; z++, i++ ) \
+				q[i] = e[z]; \
 		} \
 	} \
 }
 
-/* Switch for input types. Has to be uint type!
+/* uchar -> uchar loops for the common cases. The tables are padded to 256 
+ * entries, so we can index without checks. These run over @n input 
+ * elements.
  */
-#define inner_switch( UCHAR, GEN, OUT ) \
+static void
+vips_maplut_uchar1( VipsMaplut *maplut, 
+	VipsPel * restrict q, VipsPel * restrict p, int n )
+{
+	VipsPel *t = maplut->table[0];
+
+	int x;
+
+	for( x = 0; x < n; x++ )
+		q[x] = t[p[x]];
+}
+
+static void
+vips_maplut_uchar3( VipsMaplut *maplut, 
+	VipsPel * restrict q, VipsPel * restrict p, int n )
+{
+	VipsPel *t0 = maplut->table[0];
+	VipsPel *t1 = maplut->table[1];
+	VipsPel *t2 = maplut->table[2];
+
+	int x;
+
+	for( x = 0; x < n; x += 3 ) {
+		q[x] = t0[p[x]];
+		q[x + 1] = t1[p[x + 1]];
+		q[x + 2] = t2[p[x + 2]];
+	}
+}
+
+static void
+vips_maplut_uchar4( VipsMaplut *maplut, 
+	VipsPel * restrict q, VipsPel * restrict p, int n )
+{
+	VipsPel *t0 = maplut->table[0];
+	VipsPel *t1 = maplut->table[1];
+	VipsPel *t2 = maplut->table[2];
+	VipsPel *t3 = maplut->table[3];
+
+	int x;
+
+	for( x = 0; x < n; x += 4 ) {
+		q[x] = t0[p[x]];
+		q[x + 1] = t1[p[x + 1]];
+		q[x + 2] = t2[p[x + 2]];
+		q[x + 3] = t3[p[x + 3]];
+	}
+}
+
+/* One band in, three or four out: a single lookup finds all the bands of 
+ * an entry.
+ */
+static void
+vips_maplut_uchar1to3( VipsMaplut *maplut, 
+	VipsPel * restrict q, VipsPel * restrict p, int n )
+{
+	VipsPel *t = maplut->combined;
+
+	int x;
+
+	for( x = 0; x < n; x++ ) {
+		VipsPel *e = t + p[x] * 3;
+
+		q[0] = e[0];
+		q[1] = e[1];
+		q[2] = e[2];
+		q += 3;
+	}
+}
+
+static void
+vips_maplut_uchar1to4( VipsMaplut *maplut, 
+	VipsPel * restrict q, VipsPel * restrict p, int n )
+{
+	VipsPel *t = maplut->combined;
+
+	int x;
+
+	for( x = 0; x < n; x++ ) {
+		VipsPel *e = t + p[x] * 4;
+
+		q[0] = e[0];
+		q[1] = e[1];
+		q[2] = e[2];
+		q[3] = e[3];
+		q += 4;
+	}
+}
+
+/* Switch for input types. Has to be uint type! The tables are padded out 
+ * to cover all uchar values, and all ushort values unless we're counting 
+ * overflows, so only the GEN loops need to clip.
+ */
+#define inner_switch( DIRECT, GEN, OUT ) \
 	switch( ir->im->BandFmt ) { \
-	case VIPS_FORMAT_UCHAR:		UCHAR( OUT ); break; \
-	case VIPS_FORMAT_USHORT:	GEN( unsigned short, OUT ); break; \
-	case VIPS_FORMAT_UINT:		GEN( unsigned int, OUT ); break; \
+	case VIPS_FORMAT_UCHAR:	\
+		DIRECT( unsigned char, OUT ); break; \
+	case VIPS_FORMAT_USHORT: \
+		if( maplut->count ) \
+			GEN( unsigned short, OUT ) \
+		else \
+			DIRECT( unsigned short, OUT ) \
+		break; \
+	case VIPS_FORMAT_UINT: \
+		GEN( unsigned int, OUT ); break; \
 	default: \
 		g_assert( 0 ); \
 	}
 
 /* Switch for LUT types. One function for non-complex images, a
- * variant for complex ones. Another pair as well, in case the input is not
- * uchar.
+ * variant for complex ones. Another pair as well, for input we must clip.
  */
-#define outer_switch( UCHAR_F, UCHAR_FC, GEN_F, GEN_FC ) \
+#define outer_switch( DIRECT_F, DIRECT_FC, GEN_F, GEN_FC ) \
 	switch( maplut->fmt ) { \
 	case VIPS_FORMAT_UCHAR: \
-		inner_switch( UCHAR_F, GEN_F, unsigned char ); break; \
+		inner_switch( DIRECT_F, GEN_F, unsigned char ); break; \
 	case VIPS_FORMAT_CHAR:\
-		inner_switch( UCHAR_F, GEN_F, char ); break; \
+		inner_switch( DIRECT_F, GEN_F, char ); break; \
 	case VIPS_FORMAT_USHORT: \
-		inner_switch( UCHAR_F, GEN_F, unsigned short ); break; \
+		inner_switch( DIRECT_F, GEN_F, unsigned short ); break; \
 	case VIPS_FORMAT_SHORT: \
-		inner_switch( UCHAR_F, GEN_F, short ); break; \
+		inner_switch( DIRECT_F, GEN_F, short ); break; \
 	case VIPS_FORMAT_UINT: \
-		inner_switch( UCHAR_F, GEN_F, unsigned int ); break; \
+		inner_switch( DIRECT_F, GEN_F, unsigned int ); break; \
 	case VIPS_FORMAT_INT: \
-		inner_switch( UCHAR_F, GEN_F, int ); break; \
+		inner_switch( DIRECT_F, GEN_F, int ); break; \
 	case VIPS_FORMAT_FLOAT: \
-		inner_switch( UCHAR_F, GEN_F, float ); break; \
+		inner_switch( DIRECT_F, GEN_F, float ); break; \
 	case VIPS_FORMAT_DOUBLE: \
-		inner_switch( UCHAR_F, GEN_F, double ); break; \
+		inner_switch( DIRECT_F, GEN_F, double ); break; \
 	case VIPS_FORMAT_COMPLEX: \
-		inner_switch( UCHAR_FC, GEN_FC, float ); break; \
+		inner_switch( DIRECT_FC, GEN_FC, float ); break; \
 	case VIPS_FORMAT_DPCOMPLEX: \
-		inner_switch( UCHAR_FC, GEN_FC, double ); break; \
+		inner_switch( DIRECT_FC, GEN_FC, double ); break; \
 	default: \
 		g_assert( 0 ); \
 	}
@@ -459,6 +581,16 @@ vips_maplut_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	if( vips_region_prepare( ir, r ) )
 		return( -1 );
 
+	if( maplut->fast ) {
+		for( y = to; y < bo; y++ ) 
+			maplut->fast( maplut,
+				VIPS_REGION_ADDR( or, le, y ), 
+				VIPS_REGION_ADDR( ir, le, y ), 
+				np * in->Bands ); 
+
+		return( 0 );
+	}
+
 	if( maplut->nb == 1 )
 		/* One band lut.
 		 */
@@ -508,52 +640,59 @@ static int bandfmt_maplut[10] = {
 
 /* Repack lut into a set of band arrays. If we're just passing one band of the
  * image through the lut, put the identity function in the other bands. 
+ * Tables are padded out to @tsz by repeating the last element.
  */ 
 #define PACK_TABLE( TYPE ) { \
 	TYPE *data = (TYPE *) lut->data; \
 	int x, b; \
 	\
-	for( x = 0; x < maplut->sz; x++ ) \
+	for( x = 0; x < maplut->tsz; x++ ) { \
+		int i = VIPS_MIN( x, maplut->clp ); \
+		\
 		for( b = 0; b < maplut->nb; b++ ) { \
 			TYPE *q = (TYPE *) maplut->table[b];  \
 			\
 			if( maplut->band >= 0 && \
 				lut->Bands == 1 ) { \
 				if( b == maplut->band ) \
-					q[x] = data[x]; \
+					q[x] = data[i]; \
 				else \
-					q[x] = x; \
+					q[x] = i; \
 			} \
 			else \
-				q[x] = data[x * lut->Bands + b]; \
+				q[x] = data[i * lut->Bands + b]; \
 		} \
+	} \
 }
 
 #define PACK_TABLEC( TYPE ) { \
 	TYPE *data = (TYPE *) lut->data; \
 	int x, b; \
 	\
-	for( x = 0; x < maplut->sz; x++ ) \
+	for( x = 0; x < maplut->tsz; x++ ) { \
+		int i = VIPS_MIN( x, maplut->clp ); \
+		\
 		for( b = 0; b < maplut->nb; b++ ) { \
 			TYPE *q = (TYPE *) maplut->table[b];  \
 			\
 			if( maplut->band >= 0 && \
 				lut->Bands == 1 ) { \
 				if( b == maplut->band ) { \
-					q[2 * x] = data[2 * x]; \
-					q[2 * x + 1] = data[2 * x + 1]; \
+					q[2 * x] = data[2 * i]; \
+					q[2 * x + 1] = data[2 * i + 1]; \
 				} \
 				else { \
-					q[2 * x] = x; \
+					q[2 * x] = i; \
 					q[2 * x + 1] = 0; \
 				} \
 			} \
 			else { \
-				q[2 * x] = data[2 * (x * lut->Bands + b)]; \
+				q[2 * x] = data[2 * (i * lut->Bands + b)]; \
 				q[2 * x + 1] = \
-					data[2 * (x * lut->Bands + b) + 1]; \
+					data[2 * (i * lut->Bands + b) + 1]; \
 			} \
 		} \
+	} \
 }
 
 static int
@@ -565,7 +704,7 @@ vips_maplut_build( VipsObject *object )
 
 	VipsImage *in;
 	VipsImage *lut;
-	int i;
+	int i, x;
 
 	g_object_set( object, "out", vips_image_new(), NULL ); 
 
@@ -609,10 +748,12 @@ vips_maplut_build( VipsObject *object )
 	if( lut->Bands != 1 )
 		maplut->out->Type = lut->Type;
 
-	g_signal_connect( in, "preeval", 
-		G_CALLBACK( vips_maplut_preeval ), maplut );
-	g_signal_connect( in, "posteval", 
-		G_CALLBACK( vips_maplut_posteval ), maplut );
+	if( maplut->count ) {
+		g_signal_connect( in, "preeval", 
+			G_CALLBACK( vips_maplut_preeval ), maplut );
+		g_signal_connect( in, "posteval", 
+			G_CALLBACK( vips_maplut_posteval ), maplut );
+	}
 
 	/* Make luts. We unpack the LUT image into a 2D C array to speed
 	 * processing.
@@ -622,6 +763,19 @@ vips_maplut_build( VipsObject *object )
 	maplut->sz = lut->Xsize * lut->Ysize;
 	maplut->clp = maplut->sz - 1;
 
+	/* Pad the tables out to the range of the index image, so uchar, and
+	 * ushort if we're not counting, can skip the clip. Luts can't have
+	 * more than 65536 elements, so this keeps ushort tables small enough 
+	 * to stay in cache.
+	 */
+	if( in->BandFmt == VIPS_FORMAT_UCHAR )
+		maplut->tsz = VIPS_MAX( maplut->sz, 256 );
+	else if( in->BandFmt == VIPS_FORMAT_USHORT &&
+		!maplut->count )
+		maplut->tsz = VIPS_MAX( maplut->sz, 65536 );
+	else
+		maplut->tsz = maplut->sz;
+
 	/* If @bands is >= 0, we need to expand the lut to the number of bands
 	 * in the input image. 
 	 */
@@ -637,7 +791,7 @@ vips_maplut_build( VipsObject *object )
                 return( -1 );
 	for( i = 0; i < maplut->nb; i++ )
 		if( !(maplut->table[i] = VIPS_ARRAY( maplut, 
-			maplut->sz * maplut->es, VipsPel )) )
+			maplut->tsz * maplut->es, VipsPel )) )
 			return( -1 );
 
 	/* Scan LUT and fill table.
@@ -667,6 +821,44 @@ vips_maplut_build( VipsObject *object )
 		g_assert( 0 ); 
 	}
 
+	/* A 1-band image through a many-band lut reads all the bands of an 
+	 * entry at once, so interleave them.
+	 */
+	if( in->Bands == 1 &&
+		maplut->nb > 1 ) {
+		if( !(maplut->combined = VIPS_ARRAY( maplut, 
+			maplut->tsz * maplut->nb * maplut->es, VipsPel )) )
+			return( -1 );
+
+		for( x = 0; x < maplut->tsz; x++ ) 
+			for( i = 0; i < maplut->nb; i++ ) 
+				memcpy( maplut->combined + 
+					(x * maplut->nb + i) * maplut->es,
+					maplut->table[i] + x * maplut->es,
+					maplut->es );
+	}
+
+	/* uchar -> uchar has loops of its own for the common band counts.
+	 */
+	maplut->fast = NULL;
+	if( in->BandFmt == VIPS_FORMAT_UCHAR &&
+		maplut->fmt == VIPS_FORMAT_UCHAR ) {
+		if( maplut->nb == 1 )
+			maplut->fast = vips_maplut_uchar1;
+		else if( in->Bands == 1 && 
+			maplut->nb == 3 )
+			maplut->fast = vips_maplut_uchar1to3;
+		else if( in->Bands == 1 && 
+			maplut->nb == 4 )
+			maplut->fast = vips_maplut_uchar1to4;
+		else if( in->Bands == 3 && 
+			maplut->nb == 3 )
+			maplut->fast = vips_maplut_uchar3;
+		else if( in->Bands == 4 && 
+			maplut->nb == 4 )
+			maplut->fast = vips_maplut_uchar4;
+	}
+
 	if( vips_image_generate( maplut->out,
 		vips_maplut_start, vips_maplut_gen, vips_maplut_stop, 
 		in, maplut ) )
@@ -716,6 +908,13 @@ vips_maplut_class_init( VipsMaplutClass *class )
 		G_STRUCT_OFFSET( VipsMaplut, band ),
 		-1, 10000, -1 ); 
 
+	VIPS_ARG_BOOL( class, "count", 5, 
+		_( "Count" ), 
+		_( "Count and warn about overflows" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsMaplut, count ),
+		FALSE );
+
 }
 
 static void
@@ -734,6 +933,7 @@ vips_maplut_init( VipsMaplut *maplut )
  * Optional arguments:
  *
  * @band: apply one-band @lut to this band of @in
+ * @count: count and warn about overflows
  *
  * Map an image through another image acting as a LUT (Look Up Table). 
  * The lut may have any type and the output image will be that type.
@@ -743,8 +943,9 @@ vips_maplut_init( VipsMaplut *maplut )
  * 
  * If @lut is too small for the input type (for example, if @in is
  * VIPS_FORMAT_UCHAR but @lut only has 100 elements), the lut is padded out
- * by copying the last element. Overflows are reported at the end of 
- * computation.
+ * by copying the last element. If @count is set, overflows are reported at 
+ * the end of computation. Counting stops ushort images using the fast 
+ * loops, so it's off by default.
  * If @lut is too large, extra values are ignored. 
  * 
  * If @lut has one band and @band is -1 (the default), then all bands of @in 
@@ -24,6 +24,11 @@
  * 10/8/13	
  * 	- wrapped as a class using hist_local.c
  * 	- many bands
+ * 19/10/14
+ * 	- window sums from a summed-area table, so large windows are no
+ * 	  slower than small ones, and no longer overflow
+ * 	- find the centre pixel correctly for multi-band images
+ * 	- divide by width * height, not width * width
  */
 
 /*
@@ -86,20 +91,60 @@ typedef VipsOperationClass VipsStdifClass;
 
 G_DEFINE_TYPE( VipsStdif, vips_stdif, VIPS_TYPE_OPERATION );
 
-/* How ugly and stupid.
+/* Our sequence value: the region this sequence is using, and a table of 
+ * sums and sums of squares for the input.
  */
-#define MAX_BANDS (100)
+typedef struct {
+	VipsRegion *ir;
+	VipsIntegral *integral;
+} VipsStdifSequence;
+
+static int
+vips_stdif_stop( void *vseq, void *a, void *b )
+{
+	VipsStdifSequence *seq = (VipsStdifSequence *) vseq;
+
+	VIPS_UNREF( seq->ir );
+	VIPS_FREEF( vips__integral_free, seq->integral );
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_stdif_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+	VipsStdifSequence *seq;
+
+	if( !(seq = VIPS_NEW( NULL, VipsStdifSequence )) )
+		 return( NULL );
+	seq->ir = NULL;
+	seq->integral = NULL;
+
+	if( !(seq->ir = vips_region_new( in )) || 
+		!(seq->integral = vips__integral_new( TRUE )) ) {
+		vips_stdif_stop( seq, NULL, NULL );
+		return( NULL ); 
+	}
+
+	return( seq );
+}
 
 static int
 vips_stdif_generate( VipsRegion *or, 
 	void *vseq, void *a, void *b, gboolean *stop )
 {
+	VipsStdifSequence *seq = (VipsStdifSequence *) vseq;
 	VipsRect *r = &or->valid;
-	VipsRegion *ir = (VipsRegion *) vseq;
 	VipsImage *in = (VipsImage *) a;
 	VipsStdif *stdif = (VipsStdif *) b;
+	VipsIntegral *integral = seq->integral;
 	int bands = in->Bands; 
-	int npel = stdif->width * stdif->width;
+	int npel = stdif->width * stdif->height;
+	double f1 = stdif->a * stdif->m0;
+	double f2 = 1.0 - stdif->a;
+	double f3 = stdif->b * stdif->s0;
 
 	VipsRect irect;
 	int y;
@@ -110,64 +155,42 @@ vips_stdif_generate( VipsRegion *or,
 	 */
 	irect.left = or->valid.left;
 	irect.top = or->valid.top;
-	irect.width = or->valid.width + stdif->width;
-	irect.height = or->valid.height + stdif->height;
-	if( vips_region_prepare( ir, &irect ) )
+	irect.width = or->valid.width + stdif->width - 1;
+	irect.height = or->valid.height + stdif->height - 1;
+	if( vips_region_prepare( seq->ir, &irect ) )
 		return( -1 );
 
-	lsk = VIPS_REGION_LSKIP( ir );
-	centre = lsk * (stdif->height / 2) + stdif->width / 2;
+	/* Sum and sum of squares for the whole area, then every window sum is 
+	 * just four lookups, whatever the window size.
+	 */
+	if( vips__integral_region( integral, seq->ir, &irect ) )
+		return( -1 );
+
+	lsk = VIPS_REGION_LSKIP( seq->ir );
+	centre = lsk * (stdif->height / 2) + bands * (stdif->width / 2);
 
 	for( y = 0; y < r->height; y++ ) {
 		/* Get input and output pointers for this line.
 		 */
-		VipsPel *p = VIPS_REGION_ADDR( ir, r->left, r->top + y );
+		VipsPel *p = VIPS_REGION_ADDR( seq->ir, r->left, r->top + y );
 		VipsPel *q = VIPS_REGION_ADDR( or, r->left, r->top + y );
 
-		double f1 = stdif->a * stdif->m0;
-		double f2 = 1.0 - stdif->a;
-		double f3 = stdif->b * stdif->s0;
-
-		VipsPel *p1;
-		int x, i, j, b;
+		int x, b;
 
-		/* We will get int overflow for windows larger than about 256
-		 * x 256, sadly.
-		 */
-		unsigned int sum[MAX_BANDS];
-		unsigned int sum2[MAX_BANDS];
-
-		/* Find sum, sum of squares for the start of this line.
-		 */
-		for( b = 0; b < bands; b++ ) {
-			memset( sum, 0, bands * sizeof( unsigned int ) );
-			memset( sum2, 0, bands * sizeof( unsigned int ) );
-		}
-		p1 = p;
-		for( j = 0; j < stdif->height; j++ ) {
-			i = 0;
-			for( x = 0; x < stdif->width; x++ ) {
-				for( b = 0; b < bands; b++ ) { 
-					int t = p1[i++];
-
-					sum[b] += t;
-					sum2[b] += t * t;
-				}
-			}
-
-			p1 += lsk;
-		}
-
-		/* Loop for output pels.
-		 */
 		for( x = 0; x < r->width; x++ ) {
 			for( b = 0; b < bands; b++ ) { 
+				double sum = VIPS_INTEGRAL_WINDOW( integral, 
+					sum, x, y, stdif->width, stdif->height, 
+					b );
+				double sum2 = VIPS_INTEGRAL_WINDOW( integral, 
+					sum2, x, y, stdif->width, stdif->height,
+					b );
+
 				/* Find stats.
 				 */
-				double mean = (double) sum[b] / npel;
-				double var = (double) sum2[b] / npel - 
-					(mean * mean);
-				double sig = sqrt( var );
+				double mean = sum / npel;
+				double var = sum2 / npel - (mean * mean);
+				double sig = sqrt( VIPS_MAX( 0.0, var ) );
 
 				/* Transform.
 				 */
@@ -184,24 +207,6 @@ vips_stdif_generate( VipsRegion *or,
 				else
 					*q++ = res + 0.5;
 
-				/* Adapt sums - remove the pels from the left 
-				 * hand column, add in pels for a new 
-				 * right-hand column.
-				 */
-				p1 = p;
-				for( j = 0; j < stdif->height; j++ ) {
-					int t1 = p1[0];
-					int t2 = p1[bands * stdif->width];
-
-					sum[b] -= t1;
-					sum2[b] -= t1 * t1;
-
-					sum[b] += t2;
-					sum2[b] += t2 * t2;
-
-					p1 += lsk;
-				}
-
 				p += 1;
 			}
 		}
@@ -236,10 +241,6 @@ vips_stdif_build( VipsObject *object )
 		vips_error( class->nickname, "%s", _( "window too large" ) );
 		return( -1 );
 	}
-	if( in->Bands > MAX_BANDS ) {
-		vips_error( class->nickname, "%s", _( "too many bands" ) );
-		return( -1 );
-	}
 
 	/* Expand the input. 
 	 */
@@ -263,9 +264,9 @@ vips_stdif_build( VipsObject *object )
 	stdif->out->Ysize -= stdif->height - 1;
 
 	if( vips_image_generate( stdif->out, 
-		vips_start_one, 
+		vips_stdif_start, 
 		vips_stdif_generate, 
-		vips_stop_one, 
+		vips_stdif_stop, 
 		in, stdif ) )
 		return( -1 );
 
@@ -300,21 +301,19 @@ vips_stdif_class_init( VipsStdifClass *class )
 		VIPS_ARGUMENT_REQUIRED_OUTPUT, 
 		G_STRUCT_OFFSET( VipsStdif, out ) );
 
-	/* Windows larger than 256x256 will overflow sum2, see above.
-	 */
 	VIPS_ARG_INT( class, "width", 4, 
 		_( "Width" ), 
 		_( "Window width in pixels" ),
 		VIPS_ARGUMENT_REQUIRED_INPUT,
 		G_STRUCT_OFFSET( VipsStdif, width ),
-		1, 256, 11 );
+		1, 1000000, 11 );
 
 	VIPS_ARG_INT( class, "height", 5, 
 		_( "Height" ), 
 		_( "Window height in pixels" ),
 		VIPS_ARGUMENT_REQUIRED_INPUT,
 		G_STRUCT_OFFSET( VipsStdif, height ),
-		1, 256, 11 );
+		1, 1000000, 11 );
 
 	VIPS_ARG_DOUBLE( class, "a", 2, 
 		_( "Mean weight" ), 
@@ -392,9 +391,9 @@ vips_stdif_init( VipsStdif *stdif )
  *
  * vips stdif $VIPSHOME/pics/huysum.v fred.v 0.5 128 0.5 50 11 11
  *
- * The operation works on one-band uchar images only, and writes a one-band 
- * uchar image as its result. The output image has the same size as the 
- * input.
+ * The operation works on uchar images with any number of bands, and writes 
+ * a uchar image as its result. Each band is processed separately. The output
+ * image has the same size as the input.
  *
  * See also: vips_hist_local().
  *
@@ -375,8 +375,11 @@ int vips_min( VipsImage *in, double *out, ... )
 	__attribute__((sentinel));
 int vips_max( VipsImage *in, double *out, ... )
 	__attribute__((sentinel));
+int vips_quantile( VipsImage *in, double q, double *out, ... )
+	__attribute__((sentinel));
 int vips_stats( VipsImage *in, VipsImage **out, ... )
 	__attribute__((sentinel));
+int vips_statistic_group( VipsOperation **operations, int n );
 int vips_measure( VipsImage *in, VipsImage **out, int h, int v, ... )
 	__attribute__((sentinel));
 int vips_getpoint( VipsImage *in, double **vector, int *n, int x, int y, ... )
@@ -396,6 +399,8 @@ int vips_project( VipsImage *in, VipsImage **columns, VipsImage **rows, ... )
 	__attribute__((sentinel));
 int vips_profile( VipsImage *in, VipsImage **columns, VipsImage **rows, ... )
 	__attribute__((sentinel));
+int vips_integral( VipsImage *in, VipsImage **out, ... )
+	__attribute__((sentinel));
 
 #ifdef __cplusplus
 }
@@ -111,6 +111,63 @@ int vips_colourspace( VipsImage *in, VipsImage **out,
 	VipsInterpretation space, ... )
 	__attribute__((sentinel));
 
+#define VIPS_TYPE_COLOUR_PIPELINE (vips_colour_pipeline_get_type())
+#define VIPS_COLOUR_PIPELINE( obj ) \
+	(G_TYPE_CHECK_INSTANCE_CAST( (obj), \
+		VIPS_TYPE_COLOUR_PIPELINE, VipsColourPipeline ))
+#define VIPS_COLOUR_PIPELINE_CLASS( klass ) \
+	(G_TYPE_CHECK_CLASS_CAST( (klass), \
+		VIPS_TYPE_COLOUR_PIPELINE, VipsColourPipelineClass))
+#define VIPS_IS_COLOUR_PIPELINE( obj ) \
+	(G_TYPE_CHECK_INSTANCE_TYPE( (obj), VIPS_TYPE_COLOUR_PIPELINE ))
+#define VIPS_IS_COLOUR_PIPELINE_CLASS( klass ) \
+	(G_TYPE_CHECK_CLASS_TYPE( (klass), VIPS_TYPE_COLOUR_PIPELINE ))
+#define VIPS_COLOUR_PIPELINE_GET_CLASS( obj ) \
+	(G_TYPE_INSTANCE_GET_CLASS( (obj), \
+		VIPS_TYPE_COLOUR_PIPELINE, VipsColourPipelineClass ))
+
+struct _VipsColourStage;
+
+typedef struct _VipsColourPipeline {
+	VipsObject parent_object;
+
+	VipsInterpretation from;
+	VipsInterpretation to;
+	VipsBandFormat format;
+
+	/* private ... the compiled stages. If @n is zero we could not 
+	 * compile this route and vips_colour_pipeline_apply() will use 
+	 * vips_colourspace().
+	 */
+	int n;
+	struct _VipsColourStage *stages;
+
+	/* What the first stage takes and the last one makes.
+	 */
+	int in_bands;
+	VipsCoding in_coding;
+	int bands;
+	VipsBandFormat out_format;
+	VipsCoding coding;
+	VipsInterpretation interpretation;
+
+	/* Largest pixel between stages, in bytes.
+	 */
+	int max_psize;
+} VipsColourPipeline;
+
+typedef struct _VipsColourPipelineClass {
+	VipsObjectClass parent_class;
+
+} VipsColourPipelineClass;
+
+GType vips_colour_pipeline_get_type( void );
+
+VipsColourPipeline *vips_colour_pipeline_new( VipsInterpretation from, 
+	VipsInterpretation to, VipsBandFormat format );
+int vips_colour_pipeline_apply( VipsColourPipeline *pipeline, 
+	VipsImage *in, VipsImage **out );
+
 int vips_LabQ2sRGB( VipsImage *in, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_rad2float( VipsImage *in, VipsImage **out, ... )
@@ -146,6 +203,17 @@ int vips_sRGB2scRGB( VipsImage *in, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_scRGB2XYZ( VipsImage *in, VipsImage **out, ... )
 	__attribute__((sentinel));
+int vips_sRGB2Lab( VipsImage *in, VipsImage **out, ... )
+	__attribute__((sentinel));
+int vips_sRGB2LCh( VipsImage *in, VipsImage **out, ... )
+	__attribute__((sentinel));
+int vips_Lab2sRGB( VipsImage *in, VipsImage **out, ... )
+	__attribute__((sentinel));
+int vips_LCh2sRGB( VipsImage *in, VipsImage **out, ... )
+	__attribute__((sentinel));
+
+int vips_lut3d( VipsImage *in, VipsImage **out, VipsImage *lut, ... )
+	__attribute__((sentinel));
 
 int vips_LCh2CMC( VipsImage *in, VipsImage **out, ... )
 	__attribute__((sentinel));
@@ -160,7 +228,11 @@ int vips_LabS2Lab( VipsImage *in, VipsImage **out, ... )
 int vips_Lab2LabS( VipsImage *in, VipsImage **out, ... )
 	__attribute__((sentinel));
 
+void vips_colour_set_fast( gboolean fast );
+gboolean vips_colour_get_fast( void );
+
 int vips_icc_present( void );
+int vips_icc_cache_get_hits( void );
 int vips_icc_transform( VipsImage *in, VipsImage **out, 
 	const char *output_profile, ... )
 	__attribute__((sentinel));
@@ -175,6 +247,8 @@ int vips_dE76( VipsImage *left, VipsImage *right, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_dE00( VipsImage *left, VipsImage *right, VipsImage **out, ... )
 	__attribute__((sentinel));
+int vips_dE00_stats( VipsImage *left, VipsImage *right, double *out, ... )
+	__attribute__((sentinel));
 int vips_dECMC( VipsImage *left, VipsImage *right, VipsImage **out, ... )
 	__attribute__((sentinel));
 
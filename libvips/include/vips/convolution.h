@@ -62,6 +62,8 @@ int vips_sharpen( VipsImage *in, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_gaussblur( VipsImage *in, VipsImage **out, int radius, ... )
 	__attribute__((sentinel));
+int vips_boxblur( VipsImage *in, VipsImage **out, int width, int height, ... )
+	__attribute__((sentinel));
 
 #ifdef __cplusplus
 }
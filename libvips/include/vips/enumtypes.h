@@ -89,6 +89,9 @@ GType vips_combine_mode_get_type (void) G_GNUC_CONST;
 /* enumerations from "../../../libvips/include/vips/object.h" */
 GType vips_argument_flags_get_type (void) G_GNUC_CONST;
 #define VIPS_TYPE_ARGUMENT_FLAGS (vips_argument_flags_get_type())
+/* enumerations from "../../../libvips/include/vips/resample.h" */
+GType vips_kernel_get_type (void) G_GNUC_CONST;
+#define VIPS_TYPE_KERNEL (vips_kernel_get_type())
 G_END_DECLS
 
 #endif /*VIPS_ENUM_TYPES_H*/
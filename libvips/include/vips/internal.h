@@ -89,6 +89,10 @@ extern int vips__leak;
  */
 extern int vips__info;
 
+/* Use the fast, slightly less accurate colour paths.
+ */
+extern gboolean vips__fast_colour;
+
 /* A string giving the image size (in bytes of uncompressed image) above which 
  * we decompress to disc on open. 
  */
@@ -169,6 +173,57 @@ int vips__sizealike( VipsImage *in1, VipsImage *in2,
 int vips__bandalike( const char *domain, 
 	VipsImage *in1, VipsImage *in2, VipsImage **out1, VipsImage **out2 );
 
+/* arithmetic
+ */
+
+/* A summed-area table for an area of a region. The tables have an extra
+ * line and column of zeros at the top and left, so element (x, y) is the
+ * sum of all pixels above and to the left of (x, y), exclusive.
+ */
+typedef struct _VipsIntegral {
+	/* Size of the area we last summed.
+	 */
+	int width;
+	int height;
+	int bands;
+
+	/* Elements per line of the tables, (width + 1) * bands.
+	 */
+	int lskip;
+
+	/* Also make a table of sums of squares.
+	 */
+	gboolean squares;
+
+	double *sum;
+	double *sum2;
+
+	/* Per-band running line sums.
+	 */
+	double *acc;
+
+	/* Elements allocated for each table.
+	 */
+	size_t size;
+} VipsIntegral;
+
+VipsIntegral *vips__integral_new( gboolean squares );
+void vips__integral_free( VipsIntegral *integral );
+int vips__integral_region( VipsIntegral *integral,
+	VipsRegion *region, VipsRect *area );
+
+/* The sum over a width by height window with top-left corner at (x, y) in
+ * the area, for band b.
+ */
+#define VIPS_INTEGRAL_WINDOW( INTEGRAL, TABLE, X, Y, W, H, B ) \
+	(VIPS_INTEGRAL_AT( INTEGRAL, TABLE, (X) + (W), (Y) + (H), B ) - \
+	 VIPS_INTEGRAL_AT( INTEGRAL, TABLE, (X) + (W), (Y), B ) - \
+	 VIPS_INTEGRAL_AT( INTEGRAL, TABLE, (X), (Y) + (H), B ) + \
+	 VIPS_INTEGRAL_AT( INTEGRAL, TABLE, (X), (Y), B ))
+#define VIPS_INTEGRAL_AT( INTEGRAL, TABLE, X, Y, B ) \
+	((INTEGRAL)->TABLE[(Y) * (INTEGRAL)->lskip + \
+		(X) * (INTEGRAL)->bands + (B)])
+
 /* draw
  */
 VipsPel *vips__vector_to_ink( const char *domain, 
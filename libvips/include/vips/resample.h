@@ -38,9 +38,22 @@
 extern "C" {
 #endif /*__cplusplus*/
 
+typedef enum {
+	VIPS_KERNEL_LINEAR,
+	VIPS_KERNEL_CUBIC,
+	VIPS_KERNEL_MITCHELL,
+	VIPS_KERNEL_LANCZOS2,
+	VIPS_KERNEL_LANCZOS3,
+	VIPS_KERNEL_LAST
+} VipsKernel;
+
 int vips_shrink( VipsImage *in, VipsImage **out, 
 	double xshrink, double yshrink, ... )
 	__attribute__((sentinel));
+int vips_reduceh( VipsImage *in, VipsImage **out, double xshrink, ... )
+	__attribute__((sentinel));
+int vips_reducev( VipsImage *in, VipsImage **out, double yshrink, ... )
+	__attribute__((sentinel));
 int vips_similarity( VipsImage *in, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_resize( VipsImage *in, VipsImage **out, 
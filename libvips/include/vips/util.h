@@ -215,6 +215,8 @@ char *vips__gslist_gvalue_get( const GSList *list );
 
 int vips__seek( int fd, gint64 pos );
 int vips__ftruncate( int fd, gint64 pos );
+int vips__pread( int fd, void *buf, size_t n, gint64 pos );
+int vips__pwrite( int fd, const void *buf, size_t n, gint64 pos );
 int vips_existsf( const char *name, ... )
 	__attribute__((format(printf, 1, 2)));
 int vips_mkdirf( const char *name, ... )
@@ -752,6 +752,28 @@ vips_argument_flags_get_type( void )
 
 	return( etype );
 }
+/* enumerations from "../../libvips/include/vips/resample.h" */
+GType
+vips_kernel_get_type( void )
+{
+	static GType etype = 0;
+
+	if( etype == 0 ) {
+		static const GEnumValue values[] = {
+			{VIPS_KERNEL_LINEAR, "VIPS_KERNEL_LINEAR", "linear"},
+			{VIPS_KERNEL_CUBIC, "VIPS_KERNEL_CUBIC", "cubic"},
+			{VIPS_KERNEL_MITCHELL, "VIPS_KERNEL_MITCHELL", "mitchell"},
+			{VIPS_KERNEL_LANCZOS2, "VIPS_KERNEL_LANCZOS2", "lanczos2"},
+			{VIPS_KERNEL_LANCZOS3, "VIPS_KERNEL_LANCZOS3", "lanczos3"},
+			{VIPS_KERNEL_LAST, "VIPS_KERNEL_LAST", "last"},
+			{0, NULL, NULL}
+		};
+		
+		etype = g_enum_register_static( "VipsKernel", values );
+	}
+
+	return( etype );
+}
 
 /* Generated data ends here */
 
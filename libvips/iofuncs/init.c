@@ -258,6 +258,11 @@ vips_init( const char *argv0 )
 		g_getenv( "IM_INFO" ) ) 
 		vips__info = 1;
 
+	/* And the fast colour paths.
+	 */
+	if( g_getenv( "VIPS_FAST_COLOUR" ) ) 
+		vips__fast_colour = TRUE;
+
 	/* Register base vips types.
 	 */
 	(void) vips_image_get_type();
@@ -549,6 +554,9 @@ static GOptionEntry option_entries[] = {
 	{ "vips-novector", 0, G_OPTION_FLAG_REVERSE, 
 		G_OPTION_ARG_NONE, &vips__vector_enabled, 
 		N_( "disable vectorised versions of operations" ), NULL },
+	{ "vips-fast-colour", 0, 0, 
+		G_OPTION_ARG_NONE, &vips__fast_colour, 
+		N_( "use faster, less accurate colour conversions" ), NULL },
 	{ "vips-cache-max", 0, 0, 
 		G_OPTION_ARG_STRING, &vips__cache_max, 
 		N_( "cache at most N operations" ), "N" },
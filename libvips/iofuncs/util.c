@@ -990,6 +990,91 @@ vips__ftruncate( int fd, gint64 pos )
 	return( 0 );
 }
 
+/* Read or write @n bytes at @pos without moving the file pointer, so 
+ * several threads can share an fd. 
+ */
+int
+vips__pread( int fd, void *buf, size_t n, gint64 pos )
+{
+#ifdef OS_WIN32
+{
+	HANDLE hFile = (HANDLE) _get_osfhandle( fd );
+	OVERLAPPED overlapped;
+	DWORD nread;
+
+	memset( &overlapped, 0, sizeof( overlapped ) );
+	overlapped.Offset = (DWORD) pos;
+	overlapped.OffsetHigh = (DWORD) (pos >> 32);
+	if( !ReadFile( hFile, buf, n, &nread, &overlapped ) ||
+		nread != n ) {
+                vips_error_system( GetLastError(), "vips__pread", 
+			"%s", _( "unable to read" ) );
+		return( -1 );
+	}
+}
+#else /*!OS_WIN32*/
+	while( n > 0 ) {
+		ssize_t nread = pread( fd, buf, n, pos );
+
+		if( nread == -1 && 
+			errno == EINTR )
+			continue;
+		if( nread <= 0 ) {
+			vips_error_system( errno, "vips__pread", 
+				"%s", _( "unable to read" ) );
+			return( -1 );
+		}
+
+		buf = (char *) buf + nread;
+		n -= nread;
+		pos += nread;
+	}
+#endif /*OS_WIN32*/
+
+	return( 0 );
+}
+
+int
+vips__pwrite( int fd, const void *buf, size_t n, gint64 pos )
+{
+#ifdef OS_WIN32
+{
+	HANDLE hFile = (HANDLE) _get_osfhandle( fd );
+	OVERLAPPED overlapped;
+	DWORD nwritten;
+
+	memset( &overlapped, 0, sizeof( overlapped ) );
+	overlapped.Offset = (DWORD) pos;
+	overlapped.OffsetHigh = (DWORD) (pos >> 32);
+	if( !WriteFile( hFile, buf, n, &nwritten, &overlapped ) ||
+		nwritten != n ) {
+                vips_error_system( GetLastError(), "vips__pwrite", 
+			"%s", _( "unable to write" ) );
+		return( -1 );
+	}
+}
+#else /*!OS_WIN32*/
+	while( n > 0 ) {
+		ssize_t nwritten = pwrite( fd, buf, n, pos );
+
+		if( nwritten == -1 && 
+			errno == EINTR )
+			continue;
+		if( nwritten <= 0 ) {
+			vips_error_system( errno, "vips__pwrite", 
+				"%s", _( "unable to write" ) );
+			return( -1 );
+		}
+
+		buf = (const char *) buf + nwritten;
+		n -= nwritten;
+		pos += nwritten;
+	}
+#endif /*OS_WIN32*/
+
+	return( 0 );
+}
+
 /* Test for file exists.
  */
 int
@@ -84,6 +84,9 @@
  * 1/8/14
  * 	- revise transform ... again
  * 	- see new stress test in nip2/test/extras
+ * 20/10/14
+ * 	- separable path for bilinear and bicubic scaling of uchar, ushort 
+ * 	  and float images, with per-column and per-row weight tables
  */
 
 /*
@@ -136,6 +139,14 @@
 
 #include "presample.h"
 
+/* The interpolators we have a separable path for.
+ */
+typedef enum {
+	VIPS_AFFINE_KERNEL_NONE,
+	VIPS_AFFINE_KERNEL_BILINEAR,
+	VIPS_AFFINE_KERNEL_BICUBIC
+} VipsAffineKernel;
+
 typedef struct _VipsAffine {
 	VipsResample parent_instance;
 
@@ -149,6 +160,23 @@ typedef struct _VipsAffine {
 
 	VipsTransformation trn;
 
+	/* Set for a pure scale with an interpolator we have a separable path
+	 * for, see vips_affine_separable().
+	 */
+	VipsAffineKernel kernel;
+
+	/* Per output column and row, the index of the top-left of the 
+	 * stencil in space 2, or -1 if the pixel is outside iarea. Then 
+	 * n_weights fixed-point and n_weights double weights per entry.
+	 */
+	int n_weights;
+	int *xindex;
+	int *xweighti;
+	double *xweightf;
+	int *yindex;
+	int *yweighti;
+	double *yweightf;
+
 } VipsAffine;
 
 typedef VipsResampleClass VipsAffineClass;
@@ -209,11 +237,493 @@ G_DEFINE_TYPE( VipsAffine, vips_affine, VIPS_TYPE_RESAMPLE );
  * output image, and that affinei_gen() is asked for.
  */
 
+/* Our sequence value: the input region, plus the output of the horizontal
+ * pass of the separable path, one line for each line of the stencil.
+ */
+typedef struct {
+	VipsRegion *ir;
+
+	/* The input line each buffer holds, or -1.
+	 */
+	void *line[4];
+	int line_y[4];
+
+	/* Bytes allocated for each line.
+	 */
+	size_t line_size;
+} VipsAffineSequence;
+
 static int
-vips_affine_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
+vips_affine_stop( void *vseq, void *a, void *b )
 {
-	VipsRegion *ir = (VipsRegion *) seq;
-	const VipsAffine *affine = (VipsAffine *) b;
+	VipsAffineSequence *seq = (VipsAffineSequence *) vseq;
+
+	int i;
+
+	VIPS_UNREF( seq->ir );
+	for( i = 0; i < 4; i++ )
+		VIPS_FREE( seq->line[i] );
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_affine_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+	VipsAffineSequence *seq;
+
+	int i;
+
+	if( !(seq = VIPS_NEW( NULL, VipsAffineSequence )) )
+		return( NULL );
+	for( i = 0; i < 4; i++ ) {
+		seq->line[i] = NULL;
+		seq->line_y[i] = -1;
+	}
+	seq->line_size = 0;
+
+	if( !(seq->ir = vips_region_new( in )) ) {
+		vips_affine_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+/* Find the stencil position and weights for coordinate p in space 2. lo and 
+ * hi are the clip limits, also in space 2. Bilinear weights are
+ * calculated as vips_interpolate_bilinear_interpolate() does, and bicubic 
+ * weights come from the bicubic interpolator's own tables. 
+ *
+ * The general path steps along each output line by adding to the input 
+ * position, and we find each position directly, so the two can pick 
+ * slightly different weights, and results can differ by rounding. 
+ */
+static void
+vips_affine_weights( VipsAffine *affine, double p, int lo, int hi,
+	gboolean vertical, int *index, int *wi, double *wf )
+{
+	const int fp = FAST_PSEUDO_FLOOR( p );
+
+	int i;
+
+	for( i = 0; i < affine->n_weights; i++ ) {
+		wi[i] = 0;
+		wf[i] = 0.0;
+	}
+
+	if( fp < lo || 
+		fp >= hi ) {
+		*index = -1;
+		return;
+	}
+
+	if( affine->kernel == VIPS_AFFINE_KERNEL_BILINEAR ) {
+		const int ip = (int) p;
+
+		*index = ip;
+
+		/* The bilinear interpolator has the vertical weight negated.
+		 */
+		if( vertical )
+			wi[0] = (ip - p) * VIPS_INTERPOLATE_SCALE;
+		else
+			wi[0] = (p - ip) * VIPS_INTERPOLATE_SCALE;
+		wf[0] = p - ip;
+	}
+#ifdef ENABLE_CXX
+	else {
+		const int sp = p * VIPS_TRANSFORM_SCALE * 2;
+		const int sip = sp & (VIPS_TRANSFORM_SCALE * 2 - 1);
+		const int tp = (sip + 1) >> 1;
+
+		*index = (int) p - 1;
+		vips__bicubic_coefficients( tp, wi, wf );
+	}
+#endif /*ENABLE_CXX*/
+}
+
+/* Build the per-column and per-row tables for the separable path. 
+ */
+static int
+vips_affine_build_tables( VipsAffine *affine, 
+	int window_offset )
+{
+	const VipsTransformation *trn = &affine->trn;
+	const int n = affine->n_weights;
+	const int width = trn->oarea.width;
+	const int height = trn->oarea.height;
+
+	/* Input clipping rectangle in space 2, as vips_affine_gen().
+	 */
+	const int ile = trn->iarea.left + window_offset;
+	const int ito = trn->iarea.top + window_offset;
+	const int iri = ile + trn->iarea.width;
+	const int ibo = ito + trn->iarea.height;
+
+	int x, y;
+
+	if( !(affine->xindex = VIPS_ARRAY( affine, width, int )) ||
+		!(affine->xweighti = VIPS_ARRAY( affine, width * n, int )) ||
+		!(affine->xweightf = VIPS_ARRAY( affine, width * n, double )) ||
+		!(affine->yindex = VIPS_ARRAY( affine, height, int )) ||
+		!(affine->yweighti = VIPS_ARRAY( affine, height * n, int )) ||
+		!(affine->yweightf = VIPS_ARRAY( affine, height * n, double )) )
+		return( -1 );
+
+	/* Space 5 to space 2. There's no rotation, so ib and ic are zero.
+	 */
+	for( x = 0; x < width; x++ ) {
+		const double ox = x + trn->oarea.left - trn->odx;
+		const double ix = trn->ia * ox - trn->idx + window_offset;
+
+		vips_affine_weights( affine, ix, ile, iri, FALSE,
+			affine->xindex + x, 
+			affine->xweighti + x * n, 
+			affine->xweightf + x * n );
+	}
+
+	for( y = 0; y < height; y++ ) {
+		const double oy = y + trn->oarea.top - trn->ody;
+		const double iy = trn->id * oy - trn->idy + window_offset;
+
+		vips_affine_weights( affine, iy, ito, ibo, TRUE,
+			affine->yindex + y, 
+			affine->yweighti + y * n, 
+			affine->yweightf + y * n );
+	}
+
+	return( 0 );
+}
+
+/* Horizontal pass, bilinear. Fixed-point, the top (or bottom) half of 
+ * BILINEAR_INT in interpolate.c.
+ */
+#define HLINE_BILINEAR( TYPE ) { \
+	int * restrict h = (int *) line; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		if( xindex[x] >= 0 ) { \
+			const TYPE * restrict p1 = (TYPE *) p + \
+				(xindex[x] - ir->valid.left) * bands; \
+			const TYPE * restrict p2 = p1 + bands; \
+			const int X = xweighti[x]; \
+			\
+			for( z = 0; z < bands; z++ ) \
+				h[z] = p1[z] + ((X * (p2[z] - p1[z])) >> \
+					VIPS_INTERPOLATE_SHIFT); \
+		} \
+		\
+		h += bands; \
+	} \
+}
+
+/* Horizontal pass, bicubic, fixed-point. As bicubic_unsigned_int().
+ */
+#define HLINE_BICUBIC_INT( TYPE ) { \
+	int * restrict h = (int *) line; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		if( xindex[x] >= 0 ) { \
+			const TYPE * restrict p1 = (TYPE *) p + \
+				(xindex[x] - ir->valid.left) * bands; \
+			const int * restrict cx = xweighti + x * 4; \
+			\
+			for( z = 0; z < bands; z++ ) \
+				h[z] = (cx[0] * p1[z] + \
+					cx[1] * p1[z + bands] + \
+					cx[2] * p1[z + 2 * bands] + \
+					cx[3] * p1[z + 3 * bands] + \
+					(VIPS_INTERPOLATE_SCALE >> 1)) >> \
+						VIPS_INTERPOLATE_SHIFT; \
+		} \
+		\
+		h += bands; \
+	} \
+}
+
+/* Horizontal pass, bicubic, double. As bicubic_float().
+ */
+#define HLINE_BICUBIC_FLOAT( TYPE ) { \
+	double * restrict h = (double *) line; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		if( xindex[x] >= 0 ) { \
+			const TYPE * restrict p1 = (TYPE *) p + \
+				(xindex[x] - ir->valid.left) * bands; \
+			const double * restrict cx = xweightf + x * 4; \
+			\
+			for( z = 0; z < bands; z++ ) \
+				h[z] = cx[0] * p1[z] + \
+					cx[1] * p1[z + bands] + \
+					cx[2] * p1[z + 2 * bands] + \
+					cx[3] * p1[z + 3 * bands]; \
+		} \
+		\
+		h += bands; \
+	} \
+}
+
+/* Interpolate input line iy into a line buffer.
+ */
+static void
+vips_affine_hline( VipsAffine *affine, VipsRegion *ir, const VipsRect *r, 
+	int iy, void *line )
+{
+	const int width = r->width;
+	const int bands = ir->im->Bands;
+	const int *xindex = affine->xindex + r->left;
+	const int *xweighti = affine->xweighti + r->left * affine->n_weights;
+	const double *xweightf = affine->xweightf + r->left * affine->n_weights;
+	const VipsPel *p = VIPS_REGION_ADDR( ir, ir->valid.left, iy );
+
+	int x, z;
+
+	if( affine->kernel == VIPS_AFFINE_KERNEL_BILINEAR )
+		switch( ir->im->BandFmt ) {
+		case VIPS_FORMAT_UCHAR:
+			HLINE_BILINEAR( unsigned char ); break;
+		case VIPS_FORMAT_USHORT:
+			HLINE_BILINEAR( unsigned short ); break;
+
+		default:
+			g_assert( 0 );
+		}
+	else 
+		switch( ir->im->BandFmt ) {
+		case VIPS_FORMAT_UCHAR:
+			HLINE_BICUBIC_INT( unsigned char ); break;
+		case VIPS_FORMAT_USHORT:
+			HLINE_BICUBIC_INT( unsigned short ); break;
+		case VIPS_FORMAT_FLOAT:
+			HLINE_BICUBIC_FLOAT( float ); break;
+
+		default:
+			g_assert( 0 );
+		}
+}
+
+/* Vertical pass, bilinear, fixed-point.
+ */
+#define VLINE_BILINEAR( TYPE ) { \
+	TYPE * restrict tq = (TYPE *) q; \
+	const int * restrict top = (int *) line[0]; \
+	const int * restrict bot = (int *) line[1]; \
+	const int Y = yweighti[0]; \
+	\
+	for( i = 0; i < n; i++ ) \
+		tq[i] = top[i] - ((Y * (bot[i] - top[i])) >> \
+			VIPS_INTERPOLATE_SHIFT); \
+}
+
+/* Vertical pass, bicubic, fixed-point, clipped to the range of TYPE.
+ */
+#define VLINE_BICUBIC_INT( TYPE, MAX ) { \
+	TYPE * restrict tq = (TYPE *) q; \
+	const int * restrict r0 = (int *) line[0]; \
+	const int * restrict r1 = (int *) line[1]; \
+	const int * restrict r2 = (int *) line[2]; \
+	const int * restrict r3 = (int *) line[3]; \
+	const int * restrict cy = yweighti; \
+	\
+	for( i = 0; i < n; i++ ) { \
+		int v = (cy[0] * r0[i] + \
+			cy[1] * r1[i] + \
+			cy[2] * r2[i] + \
+			cy[3] * r3[i] + \
+			(VIPS_INTERPOLATE_SCALE >> 1)) >> \
+				VIPS_INTERPOLATE_SHIFT; \
+		\
+		tq[i] = VIPS_CLIP( 0, v, MAX ); \
+	} \
+}
+
+/* Vertical pass, bicubic, double.
+ */
+#define VLINE_BICUBIC_FLOAT( TYPE ) { \
+	TYPE * restrict tq = (TYPE *) q; \
+	const double * restrict r0 = (double *) line[0]; \
+	const double * restrict r1 = (double *) line[1]; \
+	const double * restrict r2 = (double *) line[2]; \
+	const double * restrict r3 = (double *) line[3]; \
+	const double * restrict cy = yweightf; \
+	\
+	for( i = 0; i < n; i++ ) \
+		tq[i] = cy[0] * r0[i] + \
+			cy[1] * r1[i] + \
+			cy[2] * r2[i] + \
+			cy[3] * r3[i]; \
+}
+
+/* Float bilinear is not separable without changing the rounding, so we run 
+ * the whole of BILINEAR_FLOAT from interpolate.c, but with the weights
+ * from the tables. This path skips the column zeroing at the end of 
+ * vips_affine_separable(), so zero columns outside iarea here.
+ */
+#define LINE_BILINEAR_FLOAT( TYPE ) { \
+	TYPE * restrict tq = (TYPE *) q; \
+	const TYPE * restrict p = (TYPE *) \
+		VIPS_REGION_ADDR( ir, ir->valid.left, yindex[y] ); \
+	const int ls = VIPS_REGION_LSKIP( ir ) / sizeof( TYPE ); \
+	\
+	float Y = yweightf[0]; \
+	float Yd = 1.0f - Y; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		if( xindex[x] >= 0 ) { \
+			const TYPE * restrict p1 = p + \
+				(xindex[x] - ir->valid.left) * bands; \
+			const TYPE * restrict p2 = p1 + bands; \
+			const TYPE * restrict p3 = p1 + ls; \
+			const TYPE * restrict p4 = p3 + bands; \
+			\
+			float X = xweightf[x]; \
+			float c4 = Y  * X; \
+			float c2 = Yd * X; \
+			float c3 = Y  - c4; \
+			float c1 = Yd - c2; \
+			\
+			for( z = 0; z < bands; z++ ) \
+				tq[z] = c1 * p1[z] + c2 * p2[z] + \
+					c3 * p3[z] + c4 * p4[z]; \
+		} \
+		else \
+			for( z = 0; z < bands; z++ ) \
+				tq[z] = 0; \
+		\
+		tq += bands; \
+	} \
+}
+
+/* The separable path: for each output line, interpolate the input lines
+ * under the stencil horizontally into line buffers, then interpolate the
+ * buffers vertically. When upsizing, consecutive output lines share input 
+ * lines, so we keep line buffers between output lines and only make the 
+ * ones we don't already have. There are no per-pixel function calls and 
+ * no per-pixel weight calculations, and the inner loops are simple enough
+ * for the compiler to vectorise.
+ */
+static int
+vips_affine_separable( VipsAffine *affine, VipsAffineSequence *seq, 
+	VipsRegion *or )
+{
+	VipsRegion *ir = seq->ir;
+	const VipsRect *r = &or->valid;
+	const int ps = VIPS_IMAGE_SIZEOF_PEL( ir->im );
+	const int bands = ir->im->Bands;
+	const int width = r->width;
+	const int n = width * bands;
+	const int n_lines = affine->kernel == VIPS_AFFINE_KERNEL_BILINEAR ? 
+		2 : 4;
+	const int *xindex = affine->xindex + r->left;
+	const double *xweightf = affine->xweightf + r->left * affine->n_weights;
+	const size_t line_size = (size_t) n * sizeof( double );
+
+	int x, y, z, i, k;
+
+	/* Line buffers hold ints or doubles, so size for double.
+	 */
+	if( seq->line_size < line_size ) {
+		for( k = 0; k < 4; k++ ) {
+			VIPS_FREE( seq->line[k] );
+			if( !(seq->line[k] = vips_malloc( NULL, line_size )) )
+				return( -1 );
+		}
+		seq->line_size = line_size;
+	}
+
+	/* Buffers are only good for a single set of columns.
+	 */
+	for( k = 0; k < 4; k++ )
+		seq->line_y[k] = -1;
+
+	for( y = r->top; y < VIPS_RECT_BOTTOM( r ); y++ ) {
+		const int *yindex = affine->yindex;
+		const int *yweighti = affine->yweighti + y * affine->n_weights;
+		const double *yweightf = affine->yweightf + y * affine->n_weights;
+
+		VipsPel *q = VIPS_REGION_ADDR( or, r->left, y );
+		void *line[4];
+
+		if( yindex[y] < 0 ) {
+			memset( q, 0, (size_t) width * ps );
+			continue;
+		}
+
+		if( ir->im->BandFmt == VIPS_FORMAT_FLOAT &&
+			affine->kernel == VIPS_AFFINE_KERNEL_BILINEAR ) {
+			LINE_BILINEAR_FLOAT( float );
+			continue;
+		}
+
+		/* Make any lines under the stencil we don't have. Lines go 
+		 * into buffers by input line number, so we can keep lines
+		 * between output lines.
+		 */
+		for( k = 0; k < n_lines; k++ ) {
+			const int iy = yindex[y] + k;
+			const int slot = iy % n_lines;
+
+			if( seq->line_y[slot] != iy ) {
+				vips_affine_hline( affine, ir, r, 
+					iy, seq->line[slot] );
+				seq->line_y[slot] = iy;
+			}
+
+			line[k] = seq->line[slot];
+		}
+
+		switch( affine->kernel ) {
+		case VIPS_AFFINE_KERNEL_BILINEAR:
+			switch( ir->im->BandFmt ) {
+			case VIPS_FORMAT_UCHAR:
+				VLINE_BILINEAR( unsigned char ); break;
+			case VIPS_FORMAT_USHORT:
+				VLINE_BILINEAR( unsigned short ); break;
+
+			default:
+				g_assert( 0 );
+			}
+			break;
+
+		case VIPS_AFFINE_KERNEL_BICUBIC:
+			switch( ir->im->BandFmt ) {
+			case VIPS_FORMAT_UCHAR:
+				VLINE_BICUBIC_INT( unsigned char, UCHAR_MAX ); 
+				break;
+			case VIPS_FORMAT_USHORT:
+				VLINE_BICUBIC_INT( unsigned short, USHRT_MAX ); 
+				break;
+			case VIPS_FORMAT_FLOAT:
+				VLINE_BICUBIC_FLOAT( float ); break;
+
+			default:
+				g_assert( 0 );
+			}
+			break;
+
+		default:
+			g_assert( 0 );
+		}
+
+		/* Zero any columns which fell outside iarea.
+		 */
+		for( x = 0; x < width; x++ )
+			if( xindex[x] < 0 )
+				memset( q + x * ps, 0, ps );
+	}
+
+	return( 0 );
+}
+
+static int
+vips_affine_gen( VipsRegion *or, void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsAffineSequence *seq = (VipsAffineSequence *) vseq;
+	VipsRegion *ir = seq->ir;
+	VipsAffine *affine = (VipsAffine *) b;
 	const VipsImage *in = (VipsImage *) a;
 	const int window_size = 
 		vips_interpolate_get_window_size( affine->interpolate );
@@ -304,6 +814,16 @@ vips_affine_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
 	if( vips_region_prepare( ir, &clipped ) )
 		return( -1 );
 
+	if( affine->kernel != VIPS_AFFINE_KERNEL_NONE ) {
+		int result;
+
+		VIPS_GATE_START( "vips_affine_gen: work" ); 
+		result = vips_affine_separable( affine, seq, or );
+		VIPS_GATE_STOP( "vips_affine_gen: work" ); 
+
+		return( result );
+	}
+
 	VIPS_GATE_START( "vips_affine_gen: work" ); 
 
 	/* Resample! x/y loop over pixels in the output image (5).
@@ -507,6 +1027,40 @@ vips_affine_build( VipsObject *object )
 		return( -1 );
 	in = t[2];
 
+	/* A pure scale with bilinear or bicubic on uchar, ushort or float
+	 * can use the separable path. Bilinear ushort and uchar only need 
+	 * int weights, bicubic float needs double. 
+	 */
+	if( affine->trn.b == 0.0 && 
+		affine->trn.c == 0.0 ) {
+		const char *nickname = 
+			VIPS_OBJECT_GET_CLASS( affine->interpolate )->nickname;
+
+		if( strcmp( nickname, "bilinear" ) == 0 &&
+			(in->BandFmt == VIPS_FORMAT_UCHAR ||
+			 in->BandFmt == VIPS_FORMAT_USHORT ||
+			 in->BandFmt == VIPS_FORMAT_FLOAT) ) {
+			affine->kernel = VIPS_AFFINE_KERNEL_BILINEAR;
+			affine->n_weights = 1;
+		}
+#ifdef ENABLE_CXX
+		/* The bicubic interpolator, and the tables we borrow from it,
+		 * are only built with C++.
+		 */
+		else if( strcmp( nickname, "bicubic" ) == 0 &&
+			(in->BandFmt == VIPS_FORMAT_UCHAR ||
+			 in->BandFmt == VIPS_FORMAT_USHORT ||
+			 in->BandFmt == VIPS_FORMAT_FLOAT) ) {
+			affine->kernel = VIPS_AFFINE_KERNEL_BICUBIC;
+			affine->n_weights = 4;
+		}
+#endif /*ENABLE_CXX*/
+
+		if( affine->kernel != VIPS_AFFINE_KERNEL_NONE &&
+			vips_affine_build_tables( affine, window_offset ) )
+			return( -1 );
+	}
+
 	/* Normally SMALLTILE ... except if this is strictly a size 
 	 * up/down affine.
 	 */
@@ -536,7 +1090,7 @@ vips_affine_build( VipsObject *object )
 	/* Generate!
 	 */
 	if( vips_image_generate( resample->out, 
-		vips_start_one, vips_affine_gen, vips_stop_one, 
+		vips_affine_start, vips_affine_gen, vips_affine_stop, 
 		in, affine ) )
 		return( -1 );
 
@@ -615,6 +1169,7 @@ vips_affine_class_init( VipsAffineClass *class )
 static void
 vips_affine_init( VipsAffine *affine )
 {
+	affine->kernel = VIPS_AFFINE_KERNEL_NONE;
 }
 
 /**
@@ -656,6 +1211,11 @@ vips_affine_init( VipsAffine *affine )
  *
  * @idx, @idy, @odx, @ody default to zero.
  *
+ * A pure scale (@b and @c zero) of a uchar, ushort or float image with
+ * bilinear or bicubic interpolation runs as two one-dimensional passes. 
+ * This is much faster, but the result can differ from the general path by 
+ * rounding.
+ *
  * See also: vips_shrink(), #VipsInterpolate.
  *
  * Returns: 0 on success, -1 on error
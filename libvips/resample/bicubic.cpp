@@ -51,6 +51,7 @@
 #include <vips/internal.h>
 
 #include "templates.h"
+#include "presample.h"
 
 #ifdef WITH_DMALLOC
 #include <dmalloc.h>
@@ -517,6 +518,23 @@ vips_interpolate_bicubic_class_init( VipsInterpolateBicubicClass *iclass )
 	}
 }
 
+/* The coefficients for mask index @t, see
+ * vips_interpolate_bicubic_interpolate(). affine uses these to build the
+ * tables for its separable path, so it uses the same weights we do.
+ * The tables are built on class init, so there must be a bicubic
+ * interpolator in existence.
+ */
+extern "C" void
+vips__bicubic_coefficients( int t, int ci[4], double cf[4] )
+{
+	g_assert( t >= 0 && t <= VIPS_TRANSFORM_SCALE );
+
+	for( int i = 0; i < 4; i++ ) {
+		ci[i] = vips_bicubic_matrixi[t][i];
+		cf[i] = vips_bicubic_matrixf[t][i];
+	}
+}
+
 static void
 vips_interpolate_bicubic_init( VipsInterpolateBicubic *bicubic )
 {
@@ -65,6 +65,18 @@ typedef struct _VipsResampleClass {
 
 GType vips_resample_get_type( void );
 
+void vips__bicubic_coefficients( int t, int ci[4], double cf[4] );
+
+/* Masks wider than this are too coarse in fixed point, since each 
+ * coefficient is only a few steps of VIPS_INTERPOLATE_SCALE, so reduceh and
+ * reducev switch to double arithmetic for 8 and 16-bit images.
+ */
+#define VIPS_REDUCE_MAX_FIXED_POINTS (12)
+
+int vips__reduce_get_points( VipsKernel kernel, double shrink );
+void vips__reduce_make_mask( VipsKernel kernel, double shrink, double x,
+	double *cf, int *ci );
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
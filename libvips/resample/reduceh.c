@@ -0,0 +1,550 @@
+/* horizontal reduce by a float factor with a kernel
+ *
+ * 20/10/14
+ * 	- from shrink.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+
+#include <vips/vips.h>
+#include <vips/debug.h>
+#include <vips/internal.h>
+
+#include "presample.h"
+
+/**
+ * VipsKernel:
+ * @VIPS_KERNEL_LINEAR: convolve with a triangle filter
+ * @VIPS_KERNEL_CUBIC: convolve with a Catmull-Rom cubic
+ * @VIPS_KERNEL_MITCHELL: convolve with a Mitchell-Netravali cubic
+ * @VIPS_KERNEL_LANCZOS2: convolve with a two-lobe Lanczos kernel
+ * @VIPS_KERNEL_LANCZOS3: convolve with a three-lobe Lanczos kernel
+ *
+ * The resampling kernels vips supports. See vips_reduceh(), for example.
+ *
+ * The kernel is stretched by the reduce factor, so it filters out
+ * frequencies the output can't represent.
+ */
+
+/* The kernel support, in output pixels, either side of the centre.
+ */
+static double
+vips_reduce_get_support( VipsKernel kernel )
+{
+	switch( kernel ) {
+	case VIPS_KERNEL_LINEAR:
+		return( 1.0 );
+
+	case VIPS_KERNEL_CUBIC:
+	case VIPS_KERNEL_MITCHELL:
+	case VIPS_KERNEL_LANCZOS2:
+		return( 2.0 );
+
+	case VIPS_KERNEL_LANCZOS3:
+		return( 3.0 );
+
+	default:
+		g_assert( 0 );
+		return( 0.0 );
+	}
+}
+
+/* The Mitchell-Netravali family of cubics. B = 0, C = 0.5 is Catmull-Rom.
+ */
+static double
+vips_reduce_bc( double x, double B, double C )
+{
+	if( x < 1.0 )
+		return( ((12.0 - 9.0 * B - 6.0 * C) * x * x * x +
+			(-18.0 + 12.0 * B + 6.0 * C) * x * x +
+			(6.0 - 2.0 * B)) / 6.0 );
+	else if( x < 2.0 )
+		return( ((-B - 6.0 * C) * x * x * x +
+			(6.0 * B + 30.0 * C) * x * x +
+			(-12.0 * B - 48.0 * C) * x +
+			(8.0 * B + 24.0 * C)) / 6.0 );
+	else
+		return( 0.0 );
+}
+
+static double
+vips_reduce_lanczos( double x, double a )
+{
+	if( x == 0.0 )
+		return( 1.0 );
+	else if( x < a ) {
+		const double px = VIPS_PI * x;
+
+		return( a * sin( px ) * sin( px / a ) / (px * px) );
+	}
+	else
+		return( 0.0 );
+}
+
+/* The kernel at x, in output pixels.
+ */
+static double
+vips_reduce_filter( VipsKernel kernel, double x )
+{
+	x = fabs( x );
+
+	switch( kernel ) {
+	case VIPS_KERNEL_LINEAR:
+		return( x < 1.0 ? 1.0 - x : 0.0 );
+
+	case VIPS_KERNEL_CUBIC:
+		return( vips_reduce_bc( x, 0.0, 0.5 ) );
+
+	case VIPS_KERNEL_MITCHELL:
+		return( vips_reduce_bc( x, 1.0 / 3.0, 1.0 / 3.0 ) );
+
+	case VIPS_KERNEL_LANCZOS2:
+		return( vips_reduce_lanczos( x, 2.0 ) );
+
+	case VIPS_KERNEL_LANCZOS3:
+		return( vips_reduce_lanczos( x, 3.0 ) );
+
+	default:
+		g_assert( 0 );
+		return( 0.0 );
+	}
+}
+
+/* The number of input pixels each output pixel is computed from. Always
+ * even.
+ */
+int
+vips__reduce_get_points( VipsKernel kernel, double shrink )
+{
+	return( 2 * ceil( vips_reduce_get_support( kernel ) * shrink ) );
+}
+
+/* Make the mask for an output pixel whose centre is @x of the way from
+ * input pixel (n_points / 2 - 1) to the next one, @x in [0, 1].
+ *
+ * The double mask sums to 1, the fixed-point mask sums to exactly
+ * VIPS_INTERPOLATE_SCALE so flat areas stay flat.
+ */
+void
+vips__reduce_make_mask( VipsKernel kernel, double shrink, double x,
+	double *cf, int *ci )
+{
+	const int n_points = vips__reduce_get_points( kernel, shrink );
+
+	double sum;
+	int isum;
+	int i, biggest;
+
+	g_assert( x >= 0.0 && x <= 1.0 );
+
+	sum = 0.0;
+	for( i = 0; i < n_points; i++ ) {
+		const double d = i - (n_points / 2 - 1) - x;
+
+		cf[i] = vips_reduce_filter( kernel, d / shrink );
+		sum += cf[i];
+	}
+
+	isum = 0;
+	biggest = 0;
+	for( i = 0; i < n_points; i++ ) {
+		cf[i] /= sum;
+		ci[i] = VIPS_RINT( cf[i] * VIPS_INTERPOLATE_SCALE );
+		isum += ci[i];
+
+		if( ci[i] > ci[biggest] )
+			biggest = i;
+	}
+
+	/* Put any rounding error on the largest coefficient.
+	 */
+	ci[biggest] += VIPS_INTERPOLATE_SCALE - isum;
+}
+
+typedef struct _VipsReduceh {
+	VipsResample parent_instance;
+
+	double xshrink;
+	VipsKernel kernel;
+
+	/* Number of points in kernel.
+	 */
+	int n_points;
+
+	/* Precalculated masks, one for each of VIPS_TRANSFORM_SCALE + 1
+	 * sub-pixel positions. Fixed-point for 8 and 16-bit types, double for
+	 * the rest.
+	 */
+	int *matrixi[VIPS_TRANSFORM_SCALE + 1];
+	double *matrixf[VIPS_TRANSFORM_SCALE + 1];
+
+	/* Set if 8 and 16-bit types can use the fixed-point masks, see 
+	 * VIPS_REDUCE_MAX_FIXED_POINTS.
+	 */
+	gboolean fixed;
+
+} VipsReduceh;
+
+typedef VipsResampleClass VipsReducehClass;
+
+G_DEFINE_TYPE( VipsReduceh, vips_reduceh, VIPS_TYPE_RESAMPLE );
+
+/* Fixed-point, clipped to the range of TYPE. The sum can go negative on
+ * the kernel lobes, so we round with an arithmetic shift.
+ */
+#define REDUCEH_FIXED( TYPE, MIN, MAX ) { \
+	TYPE * restrict tp = (TYPE *) p; \
+	TYPE * restrict tq = (TYPE *) q; \
+	const int * restrict c = reduceh->matrixi[tx]; \
+	\
+	for( z = 0; z < bands; z++ ) { \
+		int sum; \
+		\
+		sum = 0; \
+		for( i = 0; i < n; i++ ) \
+			sum += c[i] * tp[z + i * bands]; \
+		sum = (sum + (VIPS_INTERPOLATE_SCALE >> 1)) >> \
+			VIPS_INTERPOLATE_SHIFT; \
+		\
+		tq[z] = VIPS_CLIP( MIN, sum, MAX ); \
+	} \
+}
+
+/* Int types, double arithmetic, round and clip.
+ */
+#define REDUCEH_INT_DOUBLE( TYPE, MIN, MAX ) { \
+	TYPE * restrict tp = (TYPE *) p; \
+	TYPE * restrict tq = (TYPE *) q; \
+	const double * restrict c = reduceh->matrixf[tx]; \
+	\
+	for( z = 0; z < bands; z++ ) { \
+		double sum; \
+		\
+		sum = 0.0; \
+		for( i = 0; i < n; i++ ) \
+			sum += c[i] * tp[z + i * bands]; \
+		sum = VIPS_CLIP( MIN, sum, MAX ); \
+		\
+		tq[z] = floor( sum + 0.5 ); \
+	} \
+}
+
+/* 8 and 16-bit types, fixed-point unless the mask is too wide.
+ */
+#define REDUCEH_INT( TYPE, MIN, MAX ) { \
+	if( reduceh->fixed ) \
+		REDUCEH_FIXED( TYPE, MIN, MAX ) \
+	else \
+		REDUCEH_INT_DOUBLE( TYPE, MIN, MAX ) \
+}
+
+#define REDUCEH_FLOAT( TYPE ) { \
+	TYPE * restrict tp = (TYPE *) p; \
+	TYPE * restrict tq = (TYPE *) q; \
+	const double * restrict c = reduceh->matrixf[tx]; \
+	\
+	for( z = 0; z < bands; z++ ) { \
+		double sum; \
+		\
+		sum = 0.0; \
+		for( i = 0; i < n; i++ ) \
+			sum += c[i] * tp[z + i * bands]; \
+		\
+		tq[z] = sum; \
+	} \
+}
+
+/* The position of the centre of output pixel x in the input, and the
+ * position of the left of the kernel in the expanded input.
+ */
+#define CENTRE( X ) (((X) + 0.5) * reduceh->xshrink - 0.5)
+#define LEFT( CX ) ((int) (CX) + 1)
+
+static int
+vips_reduceh_gen( VipsRegion *or, void *seq,
+	void *a, void *b, gboolean *stop )
+{
+	VipsImage *in = (VipsImage *) a;
+	VipsReduceh *reduceh = (VipsReduceh *) b;
+	VipsRegion *ir = (VipsRegion *) seq;
+	VipsRect *r = &or->valid;
+	const int n = reduceh->n_points;
+	const int ps = VIPS_IMAGE_SIZEOF_PEL( in );
+	const int bands = in->Bands;
+
+	VipsRect s;
+	int x, y, z, i;
+
+#ifdef DEBUG
+	printf( "vips_reduceh_gen: generating %d x %d at %d x %d\n",
+		r->width, r->height, r->left, r->top );
+#endif /*DEBUG*/
+
+	s.left = LEFT( CENTRE( r->left ) );
+	s.top = r->top;
+	s.width = LEFT( CENTRE( VIPS_RECT_RIGHT( r ) - 1 ) ) + n - s.left;
+	s.height = r->height;
+	if( vips_region_prepare( ir, &s ) )
+		return( -1 );
+
+	VIPS_GATE_START( "vips_reduceh_gen: work" );
+
+	for( y = 0; y < r->height; y ++ ) {
+		VipsPel *q = VIPS_REGION_ADDR( or, r->left, r->top + y );
+
+		for( x = r->left; x < VIPS_RECT_RIGHT( r ); x++ ) {
+			const double cx = CENTRE( x );
+			const int ix = (int) cx;
+			const int tx = (cx - ix) * VIPS_TRANSFORM_SCALE + 0.5;
+			const VipsPel *p =
+				VIPS_REGION_ADDR( ir, LEFT( cx ), r->top + y );
+
+			switch( in->BandFmt ) {
+			case VIPS_FORMAT_UCHAR:
+				REDUCEH_INT( unsigned char, 0, UCHAR_MAX );
+				break;
+			case VIPS_FORMAT_CHAR:
+				REDUCEH_INT( signed char, SCHAR_MIN, SCHAR_MAX );
+				break;
+			case VIPS_FORMAT_USHORT:
+				REDUCEH_INT( unsigned short, 0, USHRT_MAX );
+				break;
+			case VIPS_FORMAT_SHORT:
+				REDUCEH_INT( signed short, SHRT_MIN, SHRT_MAX );
+				break;
+			case VIPS_FORMAT_UINT:
+				REDUCEH_INT_DOUBLE( unsigned int, 0, UINT_MAX );
+				break;
+			case VIPS_FORMAT_INT:
+				REDUCEH_INT_DOUBLE( signed int, 
+					INT_MIN, INT_MAX );
+				break;
+			case VIPS_FORMAT_FLOAT:
+				REDUCEH_FLOAT( float );
+				break;
+			case VIPS_FORMAT_DOUBLE:
+				REDUCEH_FLOAT( double );
+				break;
+
+			default:
+				g_assert( 0 );
+			}
+
+			q += ps;
+		}
+	}
+
+	VIPS_GATE_STOP( "vips_reduceh_gen: work" );
+
+	return( 0 );
+}
+
+static int
+vips_reduceh_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsResample *resample = VIPS_RESAMPLE( object );
+	VipsReduceh *reduceh = (VipsReduceh *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 2 );
+
+	VipsImage *in;
+	int x;
+
+	if( VIPS_OBJECT_CLASS( vips_reduceh_parent_class )->build( object ) )
+		return( -1 );
+
+	in = resample->in;
+
+	if( reduceh->xshrink < 1.0 ) {
+		vips_error( class->nickname,
+			"%s", _( "reduce factors should be >= 1" ) );
+		return( -1 );
+	}
+
+	if( reduceh->xshrink == 1.0 )
+		return( vips_image_write( in, resample->out ) );
+
+	/* Build the tables of pre-computed coefficients.
+	 */
+	reduceh->n_points =
+		vips__reduce_get_points( reduceh->kernel, reduceh->xshrink );
+	for( x = 0; x < VIPS_TRANSFORM_SCALE + 1; x++ ) {
+		if( !(reduceh->matrixf[x] =
+			VIPS_ARRAY( object, reduceh->n_points, double )) ||
+			!(reduceh->matrixi[x] =
+				VIPS_ARRAY( object, reduceh->n_points, int )) )
+			return( -1 );
+
+		vips__reduce_make_mask( reduceh->kernel, reduceh->xshrink,
+			(double) x / VIPS_TRANSFORM_SCALE,
+			reduceh->matrixf[x], reduceh->matrixi[x] );
+	}
+
+	/* Unpack for processing.
+	 */
+	if( vips_image_decode( in, &t[0] ) )
+		return( -1 );
+	in = t[0];
+
+	if( vips_check_noncomplex( class->nickname, in ) )
+		return( -1 );
+
+	reduceh->fixed = reduceh->n_points <= VIPS_REDUCE_MAX_FIXED_POINTS;
+
+	/* Add new pixels around the input so we can interpolate at the edges.
+	 */
+	if( vips_embed( in, &t[1],
+		reduceh->n_points / 2, 0,
+		in->Xsize + reduceh->n_points, in->Ysize,
+		"extend", VIPS_EXTEND_COPY,
+		NULL ) )
+		return( -1 );
+	in = t[1];
+
+	if( vips_image_pipelinev( resample->out,
+		VIPS_DEMAND_STYLE_THINSTRIP, in, NULL ) )
+		return( -1 );
+
+	/* Size output. We round to nearest, so the centre of the last
+	 * output pixel is always inside the input.
+	 */
+	resample->out->Xsize = VIPS_RINT(
+		(in->Xsize - reduceh->n_points) / reduceh->xshrink );
+	if( resample->out->Xsize <= 0 ) {
+		vips_error( class->nickname,
+			"%s", _( "image has shrunk to nothing" ) );
+		return( -1 );
+	}
+
+#ifdef DEBUG
+	printf( "vips_reduceh_build: reducing %d x %d image to %d x %d\n",
+		in->Xsize - reduceh->n_points, in->Ysize,
+		resample->out->Xsize, resample->out->Ysize );
+	printf( "vips_reduceh_build: %d point mask\n", reduceh->n_points );
+#endif /*DEBUG*/
+
+	if( vips_image_generate( resample->out,
+		vips_start_one, vips_reduceh_gen, vips_stop_one,
+		in, reduceh ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_reduceh_class_init( VipsReducehClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *vobject_class = VIPS_OBJECT_CLASS( class );
+	VipsOperationClass *operation_class = VIPS_OPERATION_CLASS( class );
+
+	VIPS_DEBUG_MSG( "vips_reduceh_class_init\n" );
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	vobject_class->nickname = "reduceh";
+	vobject_class->description = _( "shrink an image horizontally" );
+	vobject_class->build = vips_reduceh_build;
+
+	operation_class->flags = VIPS_OPERATION_SEQUENTIAL;
+
+	VIPS_ARG_DOUBLE( class, "xshrink", 3,
+		_( "Xshrink" ),
+		_( "Horizontal shrink factor" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsReduceh, xshrink ),
+		1.0, 1000000, 1 );
+
+	VIPS_ARG_ENUM( class, "kernel", 4,
+		_( "Kernel" ),
+		_( "Resampling kernel" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsReduceh, kernel ),
+		VIPS_TYPE_KERNEL, VIPS_KERNEL_LANCZOS3 );
+
+}
+
+static void
+vips_reduceh_init( VipsReduceh *reduceh )
+{
+	reduceh->kernel = VIPS_KERNEL_LANCZOS3;
+}
+
+/**
+ * vips_reduceh:
+ * @in: input image
+ * @out: output image
+ * @xshrink: horizontal reduce
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * @kernel: #VipsKernel to use to interpolate (default: lanczos3)
+ *
+ * Reduce @in horizontally by a float factor. The pixels in @out are
+ * interpolated with a 1D mask generated from @kernel, stretched by
+ * @xshrink so the result does not alias.
+ *
+ * Masks are precomputed for a set of sub-pixel positions. 8 and 16-bit
+ * images are processed in fixed point, unless the mask is wide enough that
+ * fixed-point coefficients would lose precision. Other formats, and large 
+ * reductions, use double.
+ *
+ * The output is @xshrink times smaller, rounded to the nearest pixel.
+ *
+ * See also: vips_reducev(), vips_shrink(), vips_resize(), vips_affine().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_reduceh( VipsImage *in, VipsImage **out, double xshrink, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, xshrink );
+	result = vips_call_split( "reduceh", ap, in, out, xshrink );
+	va_end( ap );
+
+	return( result );
+}
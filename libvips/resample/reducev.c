@@ -0,0 +1,457 @@
+/* vertical reduce by a float factor with a kernel
+ *
+ * 20/10/14
+ * 	- from reduceh.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+
+#include <vips/vips.h>
+#include <vips/debug.h>
+#include <vips/internal.h>
+
+#include "presample.h"
+
+typedef struct _VipsReducev {
+	VipsResample parent_instance;
+
+	double yshrink;
+	VipsKernel kernel;
+
+	/* Number of points in kernel.
+	 */
+	int n_points;
+
+	/* Precalculated masks, see reduceh.c.
+	 */
+	int *matrixi[VIPS_TRANSFORM_SCALE + 1];
+	double *matrixf[VIPS_TRANSFORM_SCALE + 1];
+
+	/* Set if 8 and 16-bit types can use the fixed-point masks.
+	 */
+	gboolean fixed;
+
+} VipsReducev;
+
+typedef VipsResampleClass VipsReducevClass;
+
+G_DEFINE_TYPE( VipsReducev, vips_reducev, VIPS_TYPE_RESAMPLE );
+
+/* We loop over the whole output line, with the mask points on the outside, 
+ * so the inner loop runs along the line and the compiler can vectorise it.
+ * sum is a line of int or double accumulators.
+ */
+#define REDUCEV_FIXED( TYPE, MIN, MAX ) { \
+	int * restrict tsum = (int *) sum; \
+	TYPE * restrict tq = (TYPE *) q; \
+	const int * restrict c = reducev->matrixi[ty]; \
+	\
+	for( x = 0; x < ne; x++ ) \
+		tsum[x] = 0; \
+	\
+	for( i = 0; i < n; i++ ) { \
+		const TYPE * restrict tp = (TYPE *) (p + i * ls); \
+		const int ci = c[i]; \
+		\
+		for( x = 0; x < ne; x++ ) \
+			tsum[x] += ci * tp[x]; \
+	} \
+	\
+	for( x = 0; x < ne; x++ ) { \
+		int v = (tsum[x] + (VIPS_INTERPOLATE_SCALE >> 1)) >> \
+			VIPS_INTERPOLATE_SHIFT; \
+		\
+		tq[x] = VIPS_CLIP( MIN, v, MAX ); \
+	} \
+}
+
+#define REDUCEV_SUM( TYPE ) { \
+	double * restrict tsum = (double *) sum; \
+	const double * restrict c = reducev->matrixf[ty]; \
+	\
+	for( x = 0; x < ne; x++ ) \
+		tsum[x] = 0.0; \
+	\
+	for( i = 0; i < n; i++ ) { \
+		const TYPE * restrict tp = (TYPE *) (p + i * ls); \
+		const double ci = c[i]; \
+		\
+		for( x = 0; x < ne; x++ ) \
+			tsum[x] += ci * tp[x]; \
+	} \
+}
+
+/* Int types, double arithmetic, round and clip.
+ */
+#define REDUCEV_INT_DOUBLE( TYPE, MIN, MAX ) { \
+	double * restrict tsum = (double *) sum; \
+	TYPE * restrict tq = (TYPE *) q; \
+	\
+	REDUCEV_SUM( TYPE ); \
+	\
+	for( x = 0; x < ne; x++ ) { \
+		double v = VIPS_CLIP( MIN, tsum[x], MAX ); \
+		\
+		tq[x] = floor( v + 0.5 ); \
+	} \
+}
+
+/* 8 and 16-bit types, fixed-point unless the mask is too wide.
+ */
+#define REDUCEV_INT( TYPE, MIN, MAX ) { \
+	if( reducev->fixed ) \
+		REDUCEV_FIXED( TYPE, MIN, MAX ) \
+	else \
+		REDUCEV_INT_DOUBLE( TYPE, MIN, MAX ) \
+}
+
+#define REDUCEV_FLOAT( TYPE ) { \
+	double * restrict tsum = (double *) sum; \
+	TYPE * restrict tq = (TYPE *) q; \
+	\
+	REDUCEV_SUM( TYPE ); \
+	\
+	for( x = 0; x < ne; x++ ) \
+		tq[x] = tsum[x]; \
+}
+
+/* The position of the centre of output line y in the input, and the
+ * position of the top of the kernel in the expanded input.
+ */
+#define CENTRE( Y ) (((Y) + 0.5) * reducev->yshrink - 0.5)
+#define TOP( CY ) ((int) (CY) + 1)
+
+/* Our sequence value: the input region and a line of accumulators.
+ */
+typedef struct {
+	VipsRegion *ir;
+
+	VipsPel *sum;
+	size_t sum_size;
+} VipsReducevSequence;
+
+static int
+vips_reducev_stop( void *vseq, void *a, void *b )
+{
+	VipsReducevSequence *seq = (VipsReducevSequence *) vseq;
+
+	VIPS_UNREF( seq->ir );
+	VIPS_FREE( seq->sum );
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_reducev_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+	VipsReducevSequence *seq;
+
+	if( !(seq = VIPS_NEW( NULL, VipsReducevSequence )) )
+		return( NULL );
+	seq->ir = NULL;
+	seq->sum = NULL;
+	seq->sum_size = 0;
+
+	if( !(seq->ir = vips_region_new( in )) ) {
+		vips_reducev_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+static int
+vips_reducev_gen( VipsRegion *or, void *vseq,
+	void *a, void *b, gboolean *stop )
+{
+	VipsReducevSequence *seq = (VipsReducevSequence *) vseq;
+	VipsImage *in = (VipsImage *) a;
+	VipsReducev *reducev = (VipsReducev *) b;
+	VipsRegion *ir = seq->ir;
+	VipsRect *r = &or->valid;
+	const int n = reducev->n_points;
+	const int ne = r->width * in->Bands;
+	const size_t sum_size = (size_t) ne * sizeof( double );
+
+	VipsRect s;
+	VipsPel *sum;
+	int ls;
+	int x, y, i;
+
+#ifdef DEBUG
+	printf( "vips_reducev_gen: generating %d x %d at %d x %d\n",
+		r->width, r->height, r->left, r->top );
+#endif /*DEBUG*/
+
+	/* Accumulators are int or double, so size for double.
+	 */
+	if( seq->sum_size < sum_size ) {
+		VIPS_FREE( seq->sum );
+		if( !(seq->sum = vips_malloc( NULL, sum_size )) )
+			return( -1 );
+		seq->sum_size = sum_size;
+	}
+	sum = seq->sum;
+
+	s.left = r->left;
+	s.top = TOP( CENTRE( r->top ) );
+	s.width = r->width;
+	s.height = TOP( CENTRE( VIPS_RECT_BOTTOM( r ) - 1 ) ) + n - s.top;
+	if( vips_region_prepare( ir, &s ) )
+		return( -1 );
+	ls = VIPS_REGION_LSKIP( ir );
+
+	VIPS_GATE_START( "vips_reducev_gen: work" );
+
+	for( y = r->top; y < VIPS_RECT_BOTTOM( r ); y++ ) {
+		const double cy = CENTRE( y );
+		const int iy = (int) cy;
+		const int ty = (cy - iy) * VIPS_TRANSFORM_SCALE + 0.5;
+		const VipsPel *p = VIPS_REGION_ADDR( ir, r->left, TOP( cy ) );
+		VipsPel *q = VIPS_REGION_ADDR( or, r->left, y );
+
+		switch( in->BandFmt ) {
+		case VIPS_FORMAT_UCHAR:
+			REDUCEV_INT( unsigned char, 0, UCHAR_MAX );
+			break;
+		case VIPS_FORMAT_CHAR:
+			REDUCEV_INT( signed char, SCHAR_MIN, SCHAR_MAX );
+			break;
+		case VIPS_FORMAT_USHORT:
+			REDUCEV_INT( unsigned short, 0, USHRT_MAX );
+			break;
+		case VIPS_FORMAT_SHORT:
+			REDUCEV_INT( signed short, SHRT_MIN, SHRT_MAX );
+			break;
+		case VIPS_FORMAT_UINT:
+			REDUCEV_INT_DOUBLE( unsigned int, 0, UINT_MAX );
+			break;
+		case VIPS_FORMAT_INT:
+			REDUCEV_INT_DOUBLE( signed int, INT_MIN, INT_MAX );
+			break;
+		case VIPS_FORMAT_FLOAT:
+			REDUCEV_FLOAT( float );
+			break;
+		case VIPS_FORMAT_DOUBLE:
+			REDUCEV_FLOAT( double );
+			break;
+
+		default:
+			g_assert( 0 );
+		}
+	}
+
+	VIPS_GATE_STOP( "vips_reducev_gen: work" );
+
+	return( 0 );
+}
+
+static int
+vips_reducev_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsResample *resample = VIPS_RESAMPLE( object );
+	VipsReducev *reducev = (VipsReducev *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 2 );
+
+	VipsImage *in;
+	int y;
+
+	if( VIPS_OBJECT_CLASS( vips_reducev_parent_class )->build( object ) )
+		return( -1 );
+
+	in = resample->in;
+
+	if( reducev->yshrink < 1.0 ) {
+		vips_error( class->nickname,
+			"%s", _( "reduce factors should be >= 1" ) );
+		return( -1 );
+	}
+
+	if( reducev->yshrink == 1.0 )
+		return( vips_image_write( in, resample->out ) );
+
+	reducev->n_points =
+		vips__reduce_get_points( reducev->kernel, reducev->yshrink );
+	for( y = 0; y < VIPS_TRANSFORM_SCALE + 1; y++ ) {
+		if( !(reducev->matrixf[y] =
+			VIPS_ARRAY( object, reducev->n_points, double )) ||
+			!(reducev->matrixi[y] =
+				VIPS_ARRAY( object, reducev->n_points, int )) )
+			return( -1 );
+
+		vips__reduce_make_mask( reducev->kernel, reducev->yshrink,
+			(double) y / VIPS_TRANSFORM_SCALE,
+			reducev->matrixf[y], reducev->matrixi[y] );
+	}
+
+	/* Unpack for processing.
+	 */
+	if( vips_image_decode( in, &t[0] ) )
+		return( -1 );
+	in = t[0];
+
+	if( vips_check_noncomplex( class->nickname, in ) )
+		return( -1 );
+
+	reducev->fixed = reducev->n_points <= VIPS_REDUCE_MAX_FIXED_POINTS;
+
+	/* Add new lines top and bottom so we can interpolate at the edges.
+	 */
+	if( vips_embed( in, &t[1],
+		0, reducev->n_points / 2,
+		in->Xsize, in->Ysize + reducev->n_points,
+		"extend", VIPS_EXTEND_COPY,
+		NULL ) )
+		return( -1 );
+	in = t[1];
+
+	/* Each output strip needs a taller strip of input, so FATSTRIP is 
+	 * best, and it keeps us sequential.
+	 */
+	if( vips_image_pipelinev( resample->out,
+		VIPS_DEMAND_STYLE_FATSTRIP, in, NULL ) )
+		return( -1 );
+
+	resample->out->Ysize = VIPS_RINT(
+		(in->Ysize - reducev->n_points) / reducev->yshrink );
+	if( resample->out->Ysize <= 0 ) {
+		vips_error( class->nickname,
+			"%s", _( "image has shrunk to nothing" ) );
+		return( -1 );
+	}
+
+#ifdef DEBUG
+	printf( "vips_reducev_build: reducing %d x %d image to %d x %d\n",
+		in->Xsize, in->Ysize - reducev->n_points,
+		resample->out->Xsize, resample->out->Ysize );
+	printf( "vips_reducev_build: %d point mask\n", reducev->n_points );
+#endif /*DEBUG*/
+
+	if( vips_image_generate( resample->out,
+		vips_reducev_start, vips_reducev_gen, vips_reducev_stop,
+		in, reducev ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_reducev_class_init( VipsReducevClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *vobject_class = VIPS_OBJECT_CLASS( class );
+	VipsOperationClass *operation_class = VIPS_OPERATION_CLASS( class );
+
+	VIPS_DEBUG_MSG( "vips_reducev_class_init\n" );
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	vobject_class->nickname = "reducev";
+	vobject_class->description = _( "shrink an image vertically" );
+	vobject_class->build = vips_reducev_build;
+
+	operation_class->flags = VIPS_OPERATION_SEQUENTIAL;
+
+	VIPS_ARG_DOUBLE( class, "yshrink", 3,
+		_( "Yshrink" ),
+		_( "Vertical shrink factor" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsReducev, yshrink ),
+		1.0, 1000000, 1 );
+
+	VIPS_ARG_ENUM( class, "kernel", 4,
+		_( "Kernel" ),
+		_( "Resampling kernel" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsReducev, kernel ),
+		VIPS_TYPE_KERNEL, VIPS_KERNEL_LANCZOS3 );
+
+}
+
+static void
+vips_reducev_init( VipsReducev *reducev )
+{
+	reducev->kernel = VIPS_KERNEL_LANCZOS3;
+}
+
+/**
+ * vips_reducev:
+ * @in: input image
+ * @out: output image
+ * @yshrink: vertical reduce
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * @kernel: #VipsKernel to use to interpolate (default: lanczos3)
+ *
+ * Reduce @in vertically by a float factor. The pixels in @out are
+ * interpolated with a 1D mask generated from @kernel, stretched by
+ * @yshrink so the result does not alias.
+ *
+ * Masks are precomputed for a set of sub-pixel positions. 8 and 16-bit
+ * images are processed in fixed point, unless the mask is wide enough that
+ * fixed-point coefficients would lose precision. Other formats, and large 
+ * reductions, use double.
+ *
+ * The output is @yshrink times smaller, rounded to the nearest pixel.
+ *
+ * See also: vips_reduceh(), vips_shrink(), vips_resize(), vips_affine().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_reducev( VipsImage *in, VipsImage **out, double yshrink, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, yshrink );
+	result = vips_call_split( "reducev", ap, in, out, yshrink );
+	va_end( ap );
+
+	return( result );
+}
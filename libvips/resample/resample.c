@@ -112,12 +112,16 @@ void
 vips_resample_operation_init( void )
 {
 	extern GType vips_shrink_get_type( void ); 
+	extern GType vips_reduceh_get_type( void ); 
+	extern GType vips_reducev_get_type( void ); 
 	extern GType vips_quadratic_get_type( void ); 
 	extern GType vips_affine_get_type( void ); 
 	extern GType vips_similarity_get_type( void ); 
 	extern GType vips_resize_get_type( void ); 
 
 	vips_shrink_get_type(); 
+	vips_reduceh_get_type(); 
+	vips_reducev_get_type(); 
 	vips_quadratic_get_type(); 
 	vips_affine_get_type(); 
 	vips_similarity_get_type(); 
@@ -1,7 +1,11 @@
-/* resize an image ... a simple wrapper over affine
+/* resize an image ... reduce to shrink, affine to enlarge
  *
  * 13/8/14
  * 	- from affine.c
+ * 20/10/14
+ * 	- use reduceh/reducev for downsizing, affine just to enlarge
+ * 	- add @kernel
+ * 	- oops, vips_resize() called affine
  */
 
 /*
@@ -60,6 +64,7 @@ typedef struct _VipsResize {
 	double h_scale;
 	double v_scale;
 	VipsInterpolate *interpolate;
+	VipsKernel kernel;
 	double idx;
 	double idy;
 
@@ -78,22 +83,65 @@ vips_resize_build( VipsObject *object )
 	VipsImage **t = (VipsImage **) 
 		vips_object_local_array( object, 4 );
 
-	double a, b, c, d; 
+	VipsImage *in;
+	double a, d; 
+	double idx, idy;
 
 	if( VIPS_OBJECT_CLASS( vips_resize_parent_class )->build( object ) )
 		return( -1 );
 
+	in = resample->in;
 	a = resize->h_scale;
-	b = 0.0;
-	c = 0.0;
 	d = resize->v_scale;
-
-	if( vips_affine( resample->in, &t[0], a, b, c, d, 
-		"interpolate", resize->interpolate,
-		"idx", resize->idx,
-		"idy", resize->idy,
-		NULL ) ||
-		vips_image_write( t[0], resample->out ) )
+	idx = resize->idx;
+	idy = resize->idy;
+
+	/* Downsize in a single pass with reduceh / reducev. These filter 
+	 * with a kernel stretched by the reduce factor, so there's no need 
+	 * for a box shrink first. Complex images go to affine.
+	 *
+	 * Any input displacement on a reduced axis is scaled with it.
+	 */
+	if( !vips_band_format_iscomplex( in->BandFmt ) ) {
+		if( a > 0.0 &&
+			a < 1.0 ) {
+			if( vips_reduceh( in, &t[0], 1.0 / a, 
+				"kernel", resize->kernel, 
+				NULL ) )
+				return( -1 );
+			in = t[0];
+			idx *= a;
+			a = 1.0;
+		}
+
+		if( d > 0.0 &&
+			d < 1.0 ) {
+			if( vips_reducev( in, &t[1], 1.0 / d, 
+				"kernel", resize->kernel, 
+				NULL ) )
+				return( -1 );
+			in = t[1];
+			idy *= d;
+			d = 1.0;
+		}
+	}
+
+	/* Anything left to do is an enlarge, or a displacement.
+	 */
+	if( a != 1.0 ||
+		d != 1.0 ||
+		idx != 0.0 ||
+		idy != 0.0 ) {
+		if( vips_affine( in, &t[2], a, 0.0, 0.0, d, 
+			"interpolate", resize->interpolate,
+			"idx", idx,
+			"idy", idy,
+			NULL ) )
+			return( -1 ); 
+		in = t[2];
+	}
+
+	if( vips_image_write( in, resample->out ) )
 		return( -1 ); 
 
 	return( 0 );
@@ -137,6 +185,13 @@ vips_resize_class_init( VipsResizeClass *class )
 		VIPS_ARGUMENT_OPTIONAL_INPUT, 
 		G_STRUCT_OFFSET( VipsResize, interpolate ) );
 
+	VIPS_ARG_ENUM( class, "kernel", 3, 
+		_( "Kernel" ), 
+		_( "Resampling kernel for downsizing" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT, 
+		G_STRUCT_OFFSET( VipsResize, kernel ),
+		VIPS_TYPE_KERNEL, VIPS_KERNEL_LANCZOS3 );
+
 	VIPS_ARG_DOUBLE( class, "idx", 115, 
 		_( "Input offset" ), 
 		_( "Horizontal input displacement" ),
@@ -155,6 +210,7 @@ vips_resize_class_init( VipsResizeClass *class )
 static void
 vips_resize_init( VipsResize *resize )
 {
+	resize->kernel = VIPS_KERNEL_LANCZOS3;
 }
 
 /**
@@ -168,14 +224,22 @@ vips_resize_init( VipsResize *resize )
  * Optional arguments:
  *
  * @interpolate: interpolate pixels with this
+ * @kernel: #VipsKernel to reduce with
  * @idx: input horizontal offset
  * @idy: input vertical offset
  *
+ * Resize an image. When downsizing, each axis is reduced in a single pass 
+ * with vips_reduceh() and vips_reducev() using @kernel. When 
+ * upsizing, the image is enlarged with vips_affine() using @interpolate.
+ *
  * @interpolate defaults to bilinear. 
  *
+ * @kernel defaults to #VIPS_KERNEL_LANCZOS3.
+ *
  * @idx, @idy default to zero.
  *
- * See also: vips_shrink(), vips_affine(), #VipsInterpolate.
+ * See also: vips_reduceh(), vips_reducev(), vips_affine(), 
+ * #VipsInterpolate.
  *
  * Returns: 0 on success, -1 on error
  */
@@ -187,7 +251,7 @@ vips_resize( VipsImage *in, VipsImage **out,
 	int result;
 
 	va_start( ap, v_scale );
-	result = vips_call_split( "affine", ap, in, out, h_scale, v_scale );
+	result = vips_call_split( "resize", ap, in, out, h_scale, v_scale );
 	va_end( ap );
 
 	return( result );
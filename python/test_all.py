@@ -5,6 +5,9 @@ import unittest
 from test_arithmetic import TestArithmetic
 from test_colour import TestColour
 from test_conversion import TestConversion
+from test_convolution import TestConvolution
+from test_histogram import TestHistogram
+from test_resample import TestResample
 
 if __name__ == '__main__':
     unittest.main()
@@ -283,6 +283,45 @@ class TestArithmetic(unittest.TestCase):
         [self.run_testunary(fn.func_name + ' image', x.cast(y), fn)
          for x in images for y in fmt]
 
+    def test_linear(self):
+        # enough bands that the constants run across block edges, and an odd
+        # width so lines end part way through a block
+        im = Vips.Image.xyz(37, 3).extract_band(0)
+        im = Vips.Image.bandjoin([im + i for i in range(7)])
+        a = [i + 1 for i in range(7)]
+        b = [i * 2 for i in range(7)]
+        for fmt in noncomplex_formats:
+            test = im.cast(fmt)
+
+            result = test.linear(a, b)
+            uc = test.linear([-x for x in a], [200 - x for x in b], 
+                             uchar = True)
+            for x in [0, 9, 36]:
+                before = test.getpoint(x, 1)
+                after = [p * s + o for p, s, o in zip(before, a, b)]
+                self.assertAlmostEqualObjects(result.getpoint(x, 1), after)
+                after = [max(0, 200 - o - p * s) 
+                         for p, s, o in zip(before, a, b)]
+                self.assertAlmostEqualObjects(uc.getpoint(x, 1), after)
+
+        # int and uint values too large for float must scale exactly
+        black = Vips.Image.black(37, 3, bands = 3)
+        t = (black + 10000).cast(Vips.BandFormat.UINT)
+        one = (black + 1).cast(Vips.BandFormat.UINT)
+        big = t * t + one
+        for fmt in [Vips.BandFormat.UINT, Vips.BandFormat.INT]:
+            test = big.cast(fmt)
+            self.assertEqual(test.getpoint(36, 2), [100000001] * 3)
+
+            result = test.linear([1, 2, 3], 
+                                 [-100000000, -200000000, -300000000])
+            uc = test.linear([1, 2, 3], 
+                             [-100000000, -200000000, -300000000], 
+                             uchar = True)
+            for x in [0, 9, 36]:
+                self.assertEqual(result.getpoint(x, 1), [1, 2, 3])
+                self.assertEqual(uc.getpoint(x, 1), [1, 2, 3])
+
     def test_abs(self):
         def my_abs(x):
             return abs(x)
@@ -356,6 +395,33 @@ class TestArithmetic(unittest.TestCase):
         for fmt in noncomplex_formats:
             self.assertAlmostEqual(test.cast(fmt).deviate(), 50, places = 2)
 
+    def test_statistic_group(self):
+        im = Vips.Image.black(50, 100)
+        test = im.insert(im + 100, 50, 0, expand = True)
+        test = test.insert(im + 10, 10, 10)
+
+        for fmt in [Vips.BandFormat.UCHAR, Vips.BandFormat.FLOAT]:
+            x = test.cast(fmt)
+
+            names = ["avg", "deviate", "min", "max", "stats", "hist_find"]
+            ops = []
+            for name in names:
+                op = Vips.Operation.new(name)
+                op.set_property("in", x)
+                ops.append(op)
+
+            Vips.statistic_group(ops)
+
+            avg, deviate, min, max, stats, hist = \
+                [op.get_property("out") for op in ops]
+
+            self.assertAlmostEqual(avg, x.avg())
+            self.assertAlmostEqual(deviate, x.deviate())
+            self.assertAlmostEqual(min, x.min())
+            self.assertAlmostEqual(max, x.max())
+            self.assertEqual((stats - x.stats()).abs().max(), 0)
+            self.assertEqual((hist - x.hist_find()).abs().max(), 0)
+
     def test_polar(self):
         im = Vips.Image.black(100, 100) + 100
         im = im.complexform(im)
@@ -406,6 +472,21 @@ class TestArithmetic(unittest.TestCase):
             self.assertAlmostEqualObjects(hist.getpoint(20,0), [5000])
             self.assertAlmostEqualObjects(hist.getpoint(5,0), [0])
 
+        # a width which is not a multiple of four, so some pixels fall off
+        # the end of the unrolled loops
+        test = Vips.Image.xyz(103, 7)
+        test = test.bandjoin(test[0])
+
+        for fmt in [Vips.BandFormat.UCHAR, Vips.BandFormat.USHORT]:
+            hist = test.cast(fmt).hist_find()
+            self.assertAlmostEqualObjects(hist.getpoint(0,0), [7, 103, 7])
+            self.assertAlmostEqualObjects(hist.getpoint(102,0), [7, 0, 7])
+            self.assertEqual(hist.avg() * hist.width * hist.bands, 
+                    103 * 7 * 3)
+
+            hist = test.cast(fmt).hist_find(band = 0)
+            self.assertAlmostEqualObjects(hist.getpoint(101,0), [7])
+
     def test_histfind_indexed(self):
         im = Vips.Image.black(50, 100)
         test = im.insert(im + 10, 50, 0, expand = True)
@@ -420,6 +501,14 @@ class TestArithmetic(unittest.TestCase):
                 self.assertAlmostEqualObjects(hist.getpoint(0,0), [0])
                 self.assertAlmostEqualObjects(hist.getpoint(1,0), [50000])
 
+        # each column is a separate bin, and the width is not a multiple
+        # of four
+        index = Vips.Image.xyz(103, 7).extract_band(0)
+        test = Vips.Image.black(103, 7) + [1, 2]
+        hist = test.hist_find_indexed(index.cast(Vips.BandFormat.UCHAR))
+        self.assertAlmostEqualObjects(hist.getpoint(0,0), [7, 14])
+        self.assertAlmostEqualObjects(hist.getpoint(102,0), [7, 14])
+
     def test_histfind_ndim(self):
         im = Vips.Image.black(100, 100) + [1, 2, 3]
 
@@ -624,6 +713,40 @@ class TestArithmetic(unittest.TestCase):
             self.assertAlmostEqual(x, 40)
             self.assertAlmostEqual(y, 50)
 
+    def test_max_size(self):
+        test = Vips.Image.black(100, 100)
+        for i in range(20):
+            test = test.draw_rect(i + 1, i * 3, i * 4, 1, 1)
+
+        v, opts = test.max(size = 5, 
+                           out_array = True, x_array = True, y_array = True)
+        self.assertAlmostEqual(v, 20)
+        self.assertAlmostEqualObjects(opts['out_array'], [16, 17, 18, 19, 20])
+        self.assertAlmostEqualObjects(opts['x_array'], [45, 48, 51, 54, 57])
+        self.assertAlmostEqualObjects(opts['y_array'], [60, 64, 68, 72, 76])
+
+        v, opts = (100 - test).min(size = 5, 
+                                   out_array = True, x_array = True)
+        self.assertAlmostEqual(v, 80)
+        self.assertAlmostEqualObjects(opts['out_array'], [84, 83, 82, 81, 80])
+        self.assertAlmostEqualObjects(opts['x_array'], [45, 48, 51, 54, 57])
+
+    def test_quantile(self):
+        # a ramp, so each value is equally common
+        test = Vips.Image.xyz(1000, 1000).extract_band(0)
+
+        for fmt in [Vips.BandFormat.USHORT, Vips.BandFormat.INT,
+                    Vips.BandFormat.FLOAT, Vips.BandFormat.DOUBLE]:
+            a = test.cast(fmt)
+
+            self.assertAlmostEqual(a.quantile(0.5), 500, delta = 10)
+
+            v, opts = a.quantile(0.1, q_array = [0.25, 0.75, 0.99], 
+                                 out_array = True)
+            self.assertAlmostEqual(v, 100, delta = 10)
+            for x, y in zip(opts['out_array'], [250, 750, 990]):
+                self.assertAlmostEqual(x, y, delta = 10)
+
     def test_measure(self):
         im = Vips.Image.black(50, 50)
         test = im.insert(im + 10, 50, 0, expand = True)
@@ -665,6 +788,51 @@ class TestArithmetic(unittest.TestCase):
 
             self.assertAlmostEqualObjects(rows.getpoint(0,10), [50 * 10])
 
+    def test_integral(self):
+        im = Vips.Image.black(50, 50)
+        test = im.insert(im + 10, 50, 0, expand = True)
+
+        for fmt in noncomplex_formats:
+            sat = test.cast(fmt).integral()
+
+            self.assertEqual(sat.format, Vips.BandFormat.DOUBLE)
+            self.assertAlmostEqualObjects(sat.getpoint(49, 49), [0])
+            self.assertAlmostEqualObjects(sat.getpoint(59, 0), [10 * 10])
+            self.assertAlmostEqualObjects(sat.getpoint(99, 49), 
+                                          [50 * 50 * 10])
+
+    def test_fuse(self):
+        # a chain of arithmetic operations runs as a single pass, with a 
+        # shared input and mixed formats and bands along the way
+        def chain(x):
+            a = x * 2 + 1
+            b = a - x
+            return abs(b * b) + a / 3
+
+        for fmt in noncomplex_formats:
+            im = self.colour.cast(fmt)
+            result = chain(im)
+
+            for x, y in [[50, 50], [10, 10]]:
+                v = [chain(p) for p in im.getpoint(x, y)]
+                self.assertAlmostEqualObjects(result.getpoint(x, y), v)
+
+        # diamonds: the same upstream operation reached along several 
+        # paths, and the same image used as several inputs
+        def diamond(x):
+            a = x + 1
+            b = a * a
+            c = (a - 2) + (a * 3)
+            return b - c + x * x
+
+        for fmt in noncomplex_formats:
+            im = self.colour.cast(fmt)
+            result = diamond(im)
+
+            for x, y in [[50, 50], [10, 10]]:
+                v = [diamond(p) for p in im.getpoint(x, y)]
+                self.assertAlmostEqualObjects(result.getpoint(x, y), v)
+
     def test_stats(self):
         im = Vips.Image.black(50, 50)
         test = im.insert(im + 10, 50, 0, expand = True)
@@ -687,6 +855,27 @@ class TestArithmetic(unittest.TestCase):
             self.assertAlmostEqualObjects(matrix.getpoint(4, 1), [a.avg()])
             self.assertAlmostEqualObjects(matrix.getpoint(5, 1), [a.deviate()])
 
+        # wide enough to need several blocks, check positions too
+        im = Vips.Image.black(1000, 10, bands = 3) + [10, 20, 30]
+        dot = Vips.Image.black(1, 1, bands = 3)
+        test = im.insert(dot + [10, 1, 30], 700, 3)
+        test = test.insert(dot + [10, 20, 200], 300, 5)
+
+        for x in noncomplex_formats:
+            a = test.cast(x)
+            matrix = a.stats()
+
+            self.assertAlmostEqualObjects(matrix.getpoint(0, 2), [1])
+            self.assertAlmostEqualObjects(matrix.getpoint(6, 2), [700])
+            self.assertAlmostEqualObjects(matrix.getpoint(7, 2), [3])
+            self.assertAlmostEqualObjects(matrix.getpoint(1, 3), [200])
+            self.assertAlmostEqualObjects(matrix.getpoint(8, 3), [300])
+            self.assertAlmostEqualObjects(matrix.getpoint(9, 3), [5])
+            self.assertAlmostEqualObjects(matrix.getpoint(2, 1), 
+                                          [1000 * 10 * 10])
+            self.assertAlmostEqualObjects(matrix.getpoint(4, 3), 
+                                          [a.extract_band(2).avg()])
+
     def test_sum(self):
         for fmt in all_formats:
             im = Vips.Image.black(50, 50)
@@ -159,6 +159,149 @@ class TestColour(unittest.TestCase):
                 # but 8-bit we should hit exactly
                 self.assertLess(abs(after - before), 1)
 
+    def test_fused(self):
+        # the one-pass sRGB <-> Lab / LCh converters should match the long
+        # route through scRGB and XYZ exactly
+        im = self.colour.cast(Vips.BandFormat.UCHAR)
+        im = im.copy(interpretation = Vips.Interpretation.SRGB)
+
+        im2 = im.sRGB2scRGB().scRGB2XYZ().XYZ2Lab()
+        self.assertEqual(im.sRGB2Lab().interpretation, 
+                         Vips.Interpretation.LAB)
+        self.assertEqual((im.sRGB2Lab() - im2).abs().max(), 0)
+        self.assertEqual((im.sRGB2LCh() - im2.Lab2LCh()).abs().max(), 0)
+
+        im16 = im.sRGB2scRGB().scRGB2sRGB(depth = 16)
+        im2 = im16.sRGB2scRGB().scRGB2XYZ().XYZ2Lab()
+        self.assertEqual((im16.sRGB2Lab() - im2).abs().max(), 0)
+
+        lab = im.sRGB2Lab()
+        im2 = lab.Lab2XYZ().XYZ2scRGB().scRGB2sRGB()
+        self.assertEqual(lab.Lab2sRGB().format, Vips.BandFormat.UCHAR)
+        self.assertEqual((lab.Lab2sRGB() - im2).abs().max(), 0)
+        self.assertEqual((lab.Lab2LCh().LCh2sRGB() - im2).abs().max(), 0)
+
+        # and extra bands should pass through
+        alpha = (im.extract_band(0) * 0 + 42).cast(Vips.BandFormat.UCHAR)
+        im2 = im.bandjoin2(alpha).sRGB2Lab()
+        self.assertEqual(im2.bands, 4)
+        self.assertAlmostEqual(im2.getpoint(10, 10)[3], 42)
+
+    def test_labq(self):
+        # an odd width, so we test the ragged end of lines too
+        im = Vips.Image.xyz(257, 100)
+        x = im.extract_band(0)
+        y = im.extract_band(1)
+        lab = (x / 2.57).bandjoin2(y * 2 - 100).bandjoin2((x - 128) / 2)
+        lab = lab.cast(Vips.BandFormat.FLOAT)
+        lab = lab.copy(interpretation = Vips.Interpretation.LAB)
+
+        # 10 bits of L, 11 of a and b
+        labq = lab.Lab2LabQ()
+        self.assertEqual(labq.coding, Vips.Coding.LABQ)
+        self.assertLess((labq.LabQ2Lab() - lab).abs().max(), 0.07)
+        labs = labq.LabQ2LabS()
+        self.assertEqual((labs.LabS2LabQ().LabQ2Lab() - 
+                          labq.LabQ2Lab()).abs().max(), 0)
+
+        # colour ops unpack LabQ themselves as they read, they should match
+        # an explicit LabQ2Lab exactly
+        unpacked = labq.LabQ2Lab()
+        self.assertEqual((labq.Lab2XYZ() - unpacked.Lab2XYZ()).abs().max(), 
+                         0)
+        self.assertEqual((labq.colourspace(Vips.Interpretation.LCH) - 
+                          unpacked.Lab2LCh()).abs().max(), 0)
+        self.assertEqual((labq.dE76(lab) - 
+                          unpacked.dE76(lab)).abs().max(), 0)
+        self.assertEqual((labq.Lab2LabQ().LabQ2Lab() - 
+                          unpacked).abs().max(), 0)
+
+    def test_pipeline(self):
+        # a compiled pipeline should match vips_colourspace() exactly
+        im = self.colour.cast(Vips.BandFormat.UCHAR)
+        im = im.copy(interpretation = Vips.Interpretation.SRGB)
+        alpha = (im.extract_band(0) * 0 + 42).cast(Vips.BandFormat.UCHAR)
+
+        for end in colour_colourspaces + mono_colourspaces + \
+                coded_colourspaces:
+            pipeline = Vips.ColourPipeline.new(Vips.Interpretation.SRGB, 
+                                               end, 
+                                               Vips.BandFormat.NOTSET)
+            im2 = im.colourspace(end)
+            im3 = pipeline.apply(im)
+            self.assertEqual(im3.interpretation, im2.interpretation)
+            self.assertEqual(im3.format, im2.format)
+            self.assertEqual(im3.coding, im2.coding)
+            self.assertEqual(im3.bands, im2.bands)
+            if im2.coding == Vips.Coding.NONE:
+                self.assertEqual((im3 - im2).abs().max(), 0)
+
+            # apply again, with an alpha
+            if end not in coded_colourspaces:
+                im3 = pipeline.apply(im.bandjoin2(alpha))
+                self.assertEqual(im3.bands, im2.bands + 1)
+                self.assertAlmostEqual(im3.getpoint(10, 10)[-1], 42)
+
+        # a format the pipeline wasn't made for falls back to colourspace
+        pipeline = Vips.ColourPipeline.new(Vips.Interpretation.LAB, 
+                                           Vips.Interpretation.XYZ, 
+                                           Vips.BandFormat.NOTSET)
+        lab = self.colour.copy(interpretation = Vips.Interpretation.LAB)
+        lab = lab.cast(Vips.BandFormat.DOUBLE)
+        im2 = lab.colourspace(Vips.Interpretation.XYZ)
+        self.assertEqual((pipeline.apply(lab) - im2).abs().max(), 0)
+
+    def test_accuracy(self):
+        # the table paths are the default, the fast paths compute cbrt and 
+        # the sRGB gamma directly, check both against pow() 
+        xyz = self.colour * 15
+        xyz = xyz.copy(interpretation = Vips.Interpretation.XYZ)
+        f = (xyz / [95.047, 100.0, 108.883]) ** (1.0 / 3)
+        fx = f.extract_band(0)
+        fy = f.extract_band(1)
+        fz = f.extract_band(2)
+
+        # keep away from the linear segment near black
+        lin = (self.colour - 2) / 5 * 0.9 + 0.05
+        lin = lin.copy(interpretation = Vips.Interpretation.SCRGB)
+        v = (lin ** (1.0 / 2.4)) * 1.055 - 0.055
+
+        self.assertFalse(Vips.colour_get_fast())
+        points = [[0, 0], [10, 10], [50, 50], [99, 99]]
+        results = []
+
+        for fast in [False, True]:
+            Vips.colour_set_fast(fast)
+
+            lab = xyz.XYZ2Lab()
+            self.assertLess((lab.extract_band(0) - 
+                             (fy * 116 - 16)).abs().max(), 0.01)
+            self.assertLess((lab.extract_band(1) - 
+                             (fx - fy) * 500).abs().max(), 0.01)
+            self.assertLess((lab.extract_band(2) - 
+                             (fy - fz) * 200).abs().max(), 0.01)
+
+            im = lin.scRGB2sRGB()
+            self.assertLess((im - v * 255).abs().max(), 1.5)
+            self.assertLess((lin.scRGB2sRGB(depth = 16) - 
+                             v * 65535).abs().max(), 2)
+
+            # and decode should round-trip 8-bit exactly
+            self.assertEqual((im.sRGB2scRGB().scRGB2sRGB() - 
+                              im).abs().max(), 0)
+
+            results.append([[lab.getpoint(x, y), im.getpoint(x, y)] 
+                            for x, y in points])
+
+        Vips.colour_set_fast(False)
+
+        # the two paths should be within the documented tolerance
+        for table, fast in zip(results[0], results[1]):
+            for a, b in zip(table[0], fast[0]):
+                self.assertAlmostEqual(a, b, delta = 0.001)
+            for a, b in zip(table[1], fast[1]):
+                self.assertAlmostEqual(a, b, delta = 1)
+
     # test results from Bruce Lindbloom's calculator:
     # http://www.brucelindbloom.com
 
@@ -169,11 +312,54 @@ class TestColour(unittest.TestCase):
         sample = Vips.Image.black(100, 100) + [40, -20, 10]
         sample = sample.copy(interpretation = Vips.Interpretation.LAB)
 
+        # the exact path by default
+        difference = reference.dE00(sample)
+        exact, alpha = difference.getpoint(10, 10)
+        self.assertAlmostEqual(exact, 30.238, places = 3)
+        self.assertAlmostEqual(alpha, 42.0, places = 3)
+
+        # LCh inputs are used directly
+        difference = reference.Lab2LCh().dE00(sample.Lab2LCh())
+        result, alpha = difference.getpoint(10, 10)
+        self.assertAlmostEqual(result, 30.238, places = 2)
+
+        # the fast path should be within 0.001 of the exact one
+        Vips.colour_set_fast(True)
+
         difference = reference.dE00(sample)
         result, alpha = difference.getpoint(10, 10)
-        self.assertAlmostEqual(result, 30.238, places = 3)
+        self.assertAlmostEqual(result, exact, delta = 0.001)
         self.assertAlmostEqual(alpha, 42.0, places = 3)
 
+        difference = reference.Lab2LCh().dE00(sample.Lab2LCh())
+        result, alpha = difference.getpoint(10, 10)
+        self.assertAlmostEqual(result, 30.238, places = 2)
+
+        Vips.colour_set_fast(False)
+
+    def test_dE00_stats(self):
+        reference = Vips.Image.black(100, 100) + [50, 10, 20]
+        reference = reference.copy(interpretation = Vips.Interpretation.LAB)
+        sample = Vips.Image.black(100, 100) + [40, -20, 10]
+        sample = sample.copy(interpretation = Vips.Interpretation.LAB)
+
+        # half the image differs by 30.238, half by 0
+        sample = reference.insert(sample, 50, 0)
+
+        mean, opts = reference.dE00_stats(sample, max = True, 
+                                          threshold = True)
+        self.assertAlmostEqual(mean, 30.238 / 2, places = 2)
+        self.assertAlmostEqual(opts['max'], 30.238, places = 3)
+        self.assertAlmostEqual(opts['threshold'], 30.238, places = 1)
+
+        mean, opts = reference.dE00_stats(sample, percent = 40, 
+                                          threshold = True)
+        self.assertLess(opts['threshold'], 0.1)
+
+        # should match the mean of the difference image
+        difference = reference.dE00(sample)
+        self.assertAlmostEqual(mean, difference.avg(), places = 3)
+
     def test_dE76(self):
         # put 42 in the extra band, it should be copied unmodified
         reference = Vips.Image.black(100, 100) + [50, 10, 20, 42]
@@ -200,6 +386,27 @@ class TestColour(unittest.TestCase):
         self.assertLess(abs(result - 4.97), 0.5)
         self.assertAlmostEqual(alpha, 42.0, places = 3)
 
+    def test_lut3d(self):
+        # an identity LUT with 17 points per axis
+        xyz = Vips.Image.xyz(17, 17 * 17)
+        x = xyz.extract_band(0)
+        y = xyz.extract_band(1)
+        lut = (x * 255.0 / 16).bandjoin2((y % 17) * 255.0 / 16)
+        lut = lut.bandjoin2((y // 17) * 255.0 / 16)
+
+        im = self.colour.cast(Vips.BandFormat.UCHAR)
+        im2 = im.lut3d(lut)
+        self.assertEqual(im2.format, Vips.BandFormat.FLOAT)
+        self.assertEqual(im2.bands, 3)
+        self.assertLess((im2 - im).abs().max(), 0.01)
+
+        # a uchar LUT makes uchar output ... pick out band 1
+        lut = ((y % 17) * 255.0 / 16 + 0.5).cast(Vips.BandFormat.UCHAR)
+        im2 = im.lut3d(lut)
+        self.assertEqual(im2.format, Vips.BandFormat.UCHAR)
+        self.assertEqual(im2.bands, 1)
+        self.assertLess((im2 - im.extract_band(1)).abs().max(), 1)
+
     def test_icc(self):
         test = Vips.Image.new_from_file("images/IMG_4618.jpg")
 
@@ -235,6 +442,19 @@ class TestColour(unittest.TestCase):
 
         im = test.icc_import(pcs = Vips.PCS.XYZ)
         self.assertEqual(im.interpretation, Vips.Interpretation.XYZ)
+
+        # a second import with the same profile should reuse the transform
+        hits = Vips.icc_cache_get_hits()
+        im = test.crop(0, 0, 10, 10).icc_import()
+        im2 = test.crop(10, 10, 10, 10).icc_import()
+        self.assertLess(hits, Vips.icc_cache_get_hits())
+
+        # baked transforms should be close to the real thing
+        im = test.icc_import()
+        im2 = test.icc_import(lattice = 33)
+        self.assertLess(im.dE76(im2).max(), 3)
+        im3 = im.icc_export(lattice = 33)
+        self.assertLess(im3.dE76(im.icc_export()).max(), 3)
         im = test.icc_import()
         self.assertEqual(im.interpretation, Vips.Interpretation.LAB)
 
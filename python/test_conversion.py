@@ -174,6 +174,34 @@ class TestConversion(unittest.TestCase):
 
         self.run_binary(self.all_images, bandjoin)
 
+        # add and strip alpha, and put extracted bands back together
+        for fmt in all_formats:
+            test = self.colour.cast(fmt)
+
+            rgba = test.bandjoin2(test.extract_band(0))
+            self.assertEqual(rgba.bands, 4)
+            pixel = rgba.getpoint(30, 30)
+            self.assertAlmostEqualObjects(pixel, [2, 3, 4, 2])
+
+            rgb = rgba.extract_band(0, n = 3)
+            self.assertEqual(rgb.bands, 3)
+            self.assertEqual((rgb - test).abs().max(), 0)
+
+            im = Vips.Image.bandjoin([test.extract_band(0), 
+                                      test.extract_band(1, n = 2)])
+            self.assertEqual(im.bands, 3)
+            self.assertEqual((im - test).abs().max(), 0)
+
+            im = Vips.Image.bandjoin([rgba.extract_band(1), 
+                                      rgba.extract_band(2, n = 2)])
+            pixel = im.getpoint(30, 30)
+            self.assertAlmostEqualObjects(pixel, [3, 4, 2])
+
+            im = Vips.Image.bandjoin([test.extract_band(1), 
+                                      test.extract_band(0)])
+            pixel = im.getpoint(30, 30)
+            self.assertAlmostEqualObjects(pixel, [3, 2])
+
     def test_bandmean(self):
         def bandmean(x):
             if isinstance(x, Vips.Image):
@@ -208,6 +236,101 @@ class TestConversion(unittest.TestCase):
 
         self.run_unary(self.all_images, cache)
 
+    def test_tilecache(self):
+        for threaded in [False, True]:
+            for max_tiles in [-1, 2, 100]:
+                def tilecache(x):
+                    if isinstance(x, Vips.Image):
+                        return x.tilecache(tile_width = 10, 
+                                           tile_height = 10,
+                                           max_tiles = max_tiles,
+                                           threaded = threaded)
+                    else:
+                        return x
+
+                self.run_unary(self.all_images, tilecache)
+
+        # a tiny cache with a compressed tier: most tiles will come back 
+        # from the compressed tier, and must be unchanged
+        for threaded in [False, True]:
+            x = self.colour.tilecache(tile_width = 10, tile_height = 10,
+                                      max_tiles = 1, max_compressed = 1000,
+                                      threaded = threaded)
+            y = x.flipver().flipver()
+            self.assertEqual((x - y).abs().max(), 0)
+            self.assertEqual((y - self.colour).abs().max(), 0)
+
+        # and the same for the spill tier
+        for threaded in [False, True]:
+            x = self.colour.tilecache(tile_width = 10, tile_height = 10,
+                                      max_tiles = 1, spill = True,
+                                      threaded = threaded)
+            y = x.flipver().flipver()
+            self.assertEqual((x - y).abs().max(), 0)
+            self.assertEqual((y - self.colour).abs().max(), 0)
+
+    def test_cast(self):
+        # widths which aren't a multiple of the block size, values out of 
+        # range for every format, and fractions either side of zero
+        x = Vips.Image.xyz(301, 3).extract_band(0) - 150
+        for im in [x * 467.3 + 0.25, x / 10.0]:
+            for fmt_in in noncomplex_formats:
+                a = im.cast(fmt_in)
+                for fmt_out in noncomplex_formats:
+                    # count turns off the fast casts
+                    b = a.cast(fmt_out)
+                    c = a.cast(fmt_out, count = True)
+                    self.assertEqual((b - c).abs().max(), 0)
+                    b = a.cast(fmt_out, round = True)
+                    c = a.cast(fmt_out, round = True, count = True)
+                    self.assertEqual((b - c).abs().max(), 0)
+
+        im = (x / 10.0).cast(Vips.BandFormat.UCHAR)
+        self.assertAlmostEqualObjects(im.getpoint(0, 0), [0])
+        self.assertAlmostEqualObjects(im.getpoint(165, 0), [1])
+        im = (x / 10.0).cast(Vips.BandFormat.CHAR)
+        self.assertAlmostEqualObjects(im.getpoint(145, 0), [-1])
+        im = (x * 10).cast(Vips.BandFormat.UCHAR)
+        self.assertAlmostEqualObjects(im.getpoint(300, 0), [255])
+
+        # round goes to nearest, halves go up
+        for fmt in [Vips.BandFormat.FLOAT, Vips.BandFormat.DOUBLE]:
+            a = (x / 10.0).cast(fmt)
+            for fmt_out in [Vips.BandFormat.UCHAR, Vips.BandFormat.USHORT]:
+                im = a.cast(fmt_out, round = True)
+                self.assertAlmostEqualObjects(im.getpoint(164, 0), [1])
+                self.assertAlmostEqualObjects(im.getpoint(165, 0), [2])
+                self.assertAlmostEqualObjects(im.getpoint(0, 0), [0])
+            im = a.cast(Vips.BandFormat.CHAR, round = True)
+            self.assertAlmostEqualObjects(im.getpoint(145, 0), [0])
+            self.assertAlmostEqualObjects(im.getpoint(144, 0), [-1])
+            im = (a * 1000).cast(Vips.BandFormat.UCHAR, round = True)
+            self.assertAlmostEqualObjects(im.getpoint(300, 0), [255])
+
+        # shifting negative values up
+        im = (x / 10.0).cast(Vips.BandFormat.CHAR)
+        self.assertAlmostEqualObjects(im.getpoint(140, 0), [-1])
+        self.assertAlmostEqualObjects(im.cast(Vips.BandFormat.SHORT, 
+                                              shift = True).getpoint(140, 0), 
+                                      [-256])
+        self.assertAlmostEqualObjects(im.cast(Vips.BandFormat.INT, 
+                                              shift = True).getpoint(140, 0), 
+                                      [-(1 << 24)])
+
+        im = Vips.Image.black(70, 1) + 0xff00
+        im = im.cast(Vips.BandFormat.USHORT)
+        self.assertEqual(im.cast(Vips.BandFormat.UCHAR).max(), 255)
+        self.assertEqual(im.cast(Vips.BandFormat.UCHAR, 
+                                 shift = True).max(), 255)
+        im = im.cast(Vips.BandFormat.UCHAR, shift = True)
+        self.assertEqual(im.cast(Vips.BandFormat.USHORT, 
+                                 shift = True).max(), 0xff00)
+
+        im = Vips.Image.black(70, 1) + 0x7f000000
+        im = im.cast(Vips.BandFormat.INT)
+        self.assertEqual(im.cast(Vips.BandFormat.UCHAR, 
+                                 shift = True).max(), 0x7f)
+
     def test_copy(self):
         x = self.colour.copy(interpretation = Vips.Interpretation.LAB)
         self.assertEqual(x.interpretation, Vips.Interpretation.LAB)
@@ -287,6 +410,16 @@ class TestConversion(unittest.TestCase):
             pixel = sub.getpoint(5, 5)
             self.assertAlmostEqualObjects(pixel, [2, 3, 4])
 
+            # an extract of an extract reads from the first image
+            sub = test.extract_area(20, 15, 20, 30).extract_area(5, 10, 10, 10)
+
+            self.assertEqual(sub.width, 10)
+            self.assertEqual(sub.height, 10)
+            pixel = sub.getpoint(5, 5)
+            self.assertAlmostEqualObjects(pixel, [2, 3, 4])
+            diff = (sub - test.extract_area(25, 25, 10, 10)).abs().max()
+            self.assertEqual(diff, 0)
+
             sub = test.extract_band(1, n = 2)
 
             pixel = sub.getpoint(30, 30)
@@ -629,6 +762,54 @@ class TestConversion(unittest.TestCase):
                 diff = (after - im).abs().max()
                 self.assertEqual(diff, 0)
 
+            # a D0 after a rot does nothing
+            im2 = im.rot(Vips.Angle.D90)
+            after = im2.rot(Vips.Angle.D0)
+            self.assertEqual(after.width, im2.width)
+            self.assertEqual(after.height, im2.height)
+            self.assertEqual((after - im2).abs().max(), 0)
+
+        # an odd size, so the edges are partial blocks, and a range of
+        # pixel sizes
+        xy = Vips.Image.xyz(37, 23)
+        for fmt in [Vips.BandFormat.UCHAR, 
+                    Vips.BandFormat.USHORT, 
+                    Vips.BandFormat.FLOAT]:
+            for bands in [1, 3, 4, 5]:
+                im = (xy.extract_band(0) * 7 + 
+                      xy.extract_band(1) * 11) % 200
+                im = Vips.Image.bandjoin([im + i for i in range(bands)])
+                im = im.cast(fmt)
+                h = im.height
+
+                r90 = im.rot(Vips.Angle.D90)
+                r270 = im.rot(Vips.Angle.D270)
+                self.assertEqual(r90.width, 23)
+                self.assertEqual(r90.height, 37)
+                for x, y in [(0, 0), (22, 36), (9, 17), (22, 0), (0, 36)]:
+                    self.assertAlmostEqualObjects(r90.getpoint(x, y),
+                                                  im.getpoint(y, h - 1 - x))
+                    self.assertAlmostEqualObjects(r270.getpoint(x, y),
+                                                  im.getpoint(36 - y, x))
+
+                r = im.flip(Vips.Direction.HORIZONTAL)
+                self.assertAlmostEqualObjects(r.getpoint(3, 5),
+                                              im.getpoint(33, 5))
+
+                # chains of rot fold into a single rot
+                r = r90.rot(Vips.Angle.D90)
+                self.assertEqual((r - im.rot(Vips.Angle.D180)).abs().max(), 0)
+                r = r90.rot(Vips.Angle.D90).rot(Vips.Angle.D90)
+                self.assertEqual(r.width, 23)
+                self.assertEqual((r - r270).abs().max(), 0)
+                r = r270.rot(Vips.Angle.D180).rot(Vips.Angle.D180)
+                self.assertEqual((r - r270).abs().max(), 0)
+
+                for d in [Vips.Direction.HORIZONTAL, 
+                          Vips.Direction.VERTICAL]:
+                    r = im.flip(d).flip(d)
+                    self.assertEqual((r - im).abs().max(), 0)
+
     def test_scale(self):
         for fmt in noncomplex_formats:
             test = self.colour.cast(fmt)
@@ -6,7 +6,63 @@ import math
 #import logging
 #logging.basicConfig(level = logging.DEBUG)
 
-from gi.repository import Vips 
+from gi.repository import Vips
 from vips8 import vips
 
+int_formats = [Vips.BandFormat.UCHAR,
+               Vips.BandFormat.CHAR,
+               Vips.BandFormat.USHORT,
+               Vips.BandFormat.SHORT,
+               Vips.BandFormat.UINT,
+               Vips.BandFormat.INT]
+float_formats = [Vips.BandFormat.FLOAT,
+                 Vips.BandFormat.DOUBLE]
+noncomplex_formats = int_formats + float_formats
 
+# the w x h window centred on x, y, with edge pixels copied outwards, as
+# windowed operations see it
+def window(im, x, y, w, h):
+    big = im.embed(w / 2, h / 2, im.width + w - 1, im.height + h - 1,
+                   extend = Vips.Extend.COPY)
+    return big.extract_area(x, y, w, h)
+
+class TestConvolution(unittest.TestCase):
+    def setUp(self):
+        xy = Vips.Image.xyz(100, 80)
+        im = (xy.extract_band(0) * 7 + xy.extract_band(1) * 11) % 100
+        self.colour = Vips.Image.bandjoin([im, 100 - im, im / 2 + 20])
+        self.mono = im
+
+    def test_boxblur(self):
+        for fmt in noncomplex_formats:
+            for im in [self.mono, self.colour]:
+                test = im.cast(fmt)
+
+                # wide and tall windows, even sizes, and one larger than
+                # the tile size
+                for w, h in [[3, 3], [1, 7], [6, 4], [15, 9], [80, 70]]:
+                    blur = test.boxblur(w, h)
+
+                    self.assertEqual(blur.width, test.width)
+                    self.assertEqual(blur.height, test.height)
+                    self.assertEqual(blur.format, fmt)
+
+                    for x, y in [[0, 0], [50, 40], [99, 79], [3, 70]]:
+                        pixel = blur.getpoint(x, y)
+                        win = window(test, x, y, w, h)
+
+                        for b in range(test.bands):
+                            mean = win.extract_band(b).avg()
+
+                            # integer formats round to nearest, allow for
+                            # a tie going the other way
+                            if fmt in int_formats:
+                                self.assertAlmostEqual(pixel[b],
+                                                       math.floor(mean + 0.5),
+                                                       delta = 1)
+                            else:
+                                self.assertAlmostEqual(pixel[b], mean,
+                                                       places = 3)
+
+if __name__ == '__main__':
+    unittest.main()
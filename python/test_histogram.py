@@ -0,0 +1,168 @@
+#!/usr/bin/python
+
+import unittest
+import math
+
+#import logging
+#logging.basicConfig(level = logging.DEBUG)
+
+from gi.repository import Vips
+from vips8 import vips
+
+# the w x h window centred on x, y, with edge pixels copied outwards, as
+# windowed operations see it
+def window(im, x, y, w, h):
+    big = im.embed(w / 2, h / 2, im.width + w - 1, im.height + h - 1,
+                   extend = Vips.Extend.COPY)
+    return big.extract_area(x, y, w, h)
+
+class TestHistogram(unittest.TestCase):
+    def setUp(self):
+        xy = Vips.Image.xyz(320, 300)
+        im = (xy.extract_band(0) * 7 + xy.extract_band(1) * 11) % 256
+        self.mono = im.cast(Vips.BandFormat.UCHAR)
+        self.colour = Vips.Image.bandjoin([im, 255 - im, im / 2 + 64])
+        self.colour = self.colour.cast(Vips.BandFormat.UCHAR)
+
+    def test_stdif(self):
+        a = 0.5
+        m0 = 128
+        b = 0.5
+        s0 = 50
+
+        for im in [self.mono, self.colour]:
+            # small, non-square and very large windows
+            for w, h in [[3, 3], [11, 5], [64, 64], [301, 257]]:
+                sd = im.stdif(w, h)
+
+                self.assertEqual(sd.width, im.width)
+                self.assertEqual(sd.height, im.height)
+                self.assertEqual(sd.bands, im.bands)
+
+                for x, y in [[0, 0], [160, 150], [319, 299], [10, 290]]:
+                    pixel = sd.getpoint(x, y)
+                    centre = im.getpoint(x, y)
+                    win = window(im, x, y, w, h).cast(Vips.BandFormat.DOUBLE)
+
+                    for i in range(im.bands):
+                        band = win.extract_band(i)
+                        mean = band.avg()
+                        var = (band * band).avg() - mean * mean
+                        sig = math.sqrt(max(0, var))
+
+                        res = a * m0 + (1 - a) * mean + \
+                            (centre[i] - mean) * (b * s0) / (s0 + b * sig)
+                        res = min(255, max(0, math.floor(res + 0.5)))
+
+                        self.assertAlmostEqual(pixel[i], res, delta = 1)
+
+    # count the pixels in each w x h window less than the centre pixel, and
+    # scale to the range of the format, one window offset at a time
+    def hist_local_brute(self, im, w, h, n_fine):
+        big = im.embed(w / 2, h / 2, im.width + w - 1, im.height + h - 1,
+                       extend = Vips.Extend.COPY)
+        count = Vips.Image.black(im.width, im.height, bands = im.bands)
+        for dy in range(h):
+            for dx in range(w):
+                shifted = big.extract_area(dx, dy, im.width, im.height)
+                count += (shifted < im) / 255
+
+        return (count * n_fine / (w * h)).floor()
+
+    def test_hist_local(self):
+        small = self.colour.extract_area(0, 0, 101, 77)
+        tests = [[small.extract_band(0), 256], 
+                 [small, 256], 
+                 [(small * 256 + 255 - small).cast(Vips.BandFormat.USHORT), 
+                  65536]]
+
+        for im, n_fine in tests:
+            # odd and non-square windows, checked at every pixel
+            for w, h in [[1, 1], [3, 3], [5, 7], [9, 3]]:
+                local = im.hist_local(w, h)
+
+                self.assertEqual(local.width, im.width)
+                self.assertEqual(local.height, im.height)
+                self.assertEqual(local.format, im.format)
+
+                brute = self.hist_local_brute(im, w, h, n_fine)
+                self.assertEqual((local - brute).abs().max(), 0)
+
+            # a large window, checked at a few points
+            w = 31
+            h = 45
+            local = im.hist_local(w, h)
+            for x, y in [[0, 0], [50, 38], [100, 76], [17, 70]]:
+                pixel = local.getpoint(x, y)
+                centre = im.getpoint(x, y)
+                win = window(im, x, y, w, h)
+
+                for i in range(im.bands):
+                    below = (win.extract_band(i) < centre[i]) / 255
+                    n = int(round(below.avg() * w * h))
+                    self.assertEqual(pixel[i], n_fine * n / (w * h))
+
+    def test_maplut(self):
+        # a one-band lut, and three and four band luts built from it
+        id = Vips.Image.identity()
+        lut = (255 - id).cast(Vips.BandFormat.UCHAR)
+        lut3 = Vips.Image.bandjoin([lut, id, id / 2])
+        lut3 = lut3.cast(Vips.BandFormat.UCHAR)
+        lut4 = Vips.Image.bandjoin([lut3, id * 0 + 200])
+        lut4 = lut4.cast(Vips.BandFormat.UCHAR)
+
+        # one band in, many bands out
+        im = self.mono
+        for l in [lut3, lut4]:
+            r = im.maplut(l)
+            self.assertEqual(r.bands, l.bands)
+            self.assertEqual(r.format, Vips.BandFormat.UCHAR)
+
+            ref = Vips.Image.bandjoin([255 - im, im, im / 2])
+            if l.bands == 4:
+                ref = Vips.Image.bandjoin([ref, im * 0 + 200])
+            ref = ref.cast(Vips.BandFormat.UCHAR)
+            self.assertEqual((r - ref).abs().max(), 0)
+
+        # three and four band uchar in, one band lut
+        colour4 = Vips.Image.bandjoin([self.colour, self.mono])
+        for im in [self.colour, colour4]:
+            r = im.maplut(lut)
+            self.assertEqual(r.bands, im.bands)
+            self.assertEqual((r - (255 - im)).abs().max(), 0)
+
+        # ushort and uint in, a lut shorter than the range of the input: 
+        # indexes past the end of the lut get the last element
+        for fmt in [Vips.BandFormat.USHORT, Vips.BandFormat.UINT]:
+            im = (self.mono * 5).cast(fmt)
+            ref = (im > 255).ifthenelse(0, 255 - im)
+            for count in [False, True]:
+                r = im.maplut(lut, count = count)
+                self.assertEqual(r.format, Vips.BandFormat.UCHAR)
+                self.assertEqual((r - ref).abs().max(), 0)
+
+        # a one-band lut applied to a single band of a many-band image
+        for band in range(self.colour.bands):
+            r = self.colour.maplut(lut, band = band)
+            self.assertEqual(r.bands, self.colour.bands)
+            for i in range(self.colour.bands):
+                a = r.extract_band(i)
+                b = self.colour.extract_band(i)
+                if i == band:
+                    b = 255 - b
+                self.assertEqual((a - b).abs().max(), 0)
+
+        # counting overflows must not change the result
+        flut = id * 1.5 - 20
+        for im in [self.mono, self.colour, 
+                   (self.mono * 3).cast(Vips.BandFormat.USHORT)]:
+            for l in [lut, lut3, flut]:
+                if im.bands > 1 and l.bands > 1:
+                    continue
+                r1 = im.maplut(l)
+                r2 = im.maplut(l, count = True)
+                self.assertEqual(r1.format, l.format)
+                self.assertEqual((r1 - r2).abs().max(), 0)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,183 @@
+#!/usr/bin/python
+
+import unittest
+import math
+
+#import logging
+#logging.basicConfig(level = logging.DEBUG)
+
+from gi.repository import Vips
+from vips8 import vips
+
+# formats with a separable affine path, and a format each can be checked
+# against which always takes the general path with the same arithmetic
+separable_formats = [[Vips.BandFormat.UCHAR, Vips.BandFormat.SHORT],
+                     [Vips.BandFormat.USHORT, Vips.BandFormat.SHORT],
+                     [Vips.BandFormat.FLOAT, Vips.BandFormat.DOUBLE]]
+
+class TestResample(unittest.TestCase):
+    def setUp(self):
+        # smooth enough that bicubic never overshoots the range of uchar
+        xy = Vips.Image.xyz(97, 83)
+        im = (xy.extract_band(0) * 10).sin() * 40 + \
+            (xy.extract_band(1) * 13).cos() * 40 + 100
+        self.colour = Vips.Image.bandjoin([im, 200 - im, im / 2 + 20])
+        self.mono = im
+
+    def test_affine_separable(self):
+        for name in ["bilinear", "bicubic"]:
+            interpolate = Vips.Interpolate.new(name)
+
+            for fmt, ref_fmt in separable_formats:
+                for im in [self.mono, self.colour]:
+                    test = im.cast(fmt)
+                    ref = im.cast(ref_fmt)
+
+                    # up, down, and a different scale on each axis
+                    for a, d in [[2, 2], [0.6, 0.6], [1.7, 0.45]]:
+                        r1 = test.affine([a, 0, 0, d],
+                                         interpolate = interpolate)
+                        r2 = ref.affine([a, 0, 0, d],
+                                        interpolate = interpolate)
+
+                        self.assertEqual(r1.format, fmt)
+                        self.assertEqual(r1.width, r2.width)
+                        self.assertEqual(r1.height, r2.height)
+
+                        # the separable path finds input positions
+                        # directly, the general path steps along lines, so
+                        # allow a little rounding
+                        diff = (r1 - r2).abs()
+                        self.assertLessEqual(diff.max(), 1)
+                        self.assertLess(diff.avg(), 0.05)
+
+    def test_affine_edge(self):
+        # an output area larger than the transformed input: pixels outside
+        # the input must be zero on the separable path too
+        for name in ["bilinear", "bicubic"]:
+            interpolate = Vips.Interpolate.new(name)
+
+            for fmt, ref_fmt in separable_formats:
+                test = self.colour.cast(fmt)
+                ref = self.colour.cast(ref_fmt)
+                oarea = [-15, -10,
+                         2 * test.width + 30, 2 * test.height + 20]
+
+                r1 = test.affine([2, 0, 0, 2],
+                                 interpolate = interpolate, oarea = oarea)
+                r2 = ref.affine([2, 0, 0, 2],
+                                interpolate = interpolate, oarea = oarea)
+
+                self.assertEqual(r1.width, 2 * test.width + 30)
+                self.assertEqual(r1.height, 2 * test.height + 20)
+
+                for x, y in [[0, 0], [5, 50], [r1.width - 1, 50],
+                             [50, r1.height - 1]]:
+                    self.assertEqual(r1.getpoint(x, y), [0, 0, 0])
+
+                self.assertLessEqual((r1 - r2).abs().max(), 1)
+
+    # compare two images over the area they share, less a border where edge
+    # handling differs
+    def assertCloseImages(self, a, b, border, max_diff, avg_diff):
+        width = min(a.width, b.width) - 2 * border
+        height = min(a.height, b.height) - 2 * border
+        a = a.extract_area(border, border, width, height)
+        b = b.extract_area(border, border, width, height)
+        diff = (a - b).abs()
+        self.assertLessEqual(diff.max(), max_diff)
+        self.assertLessEqual(diff.avg(), avg_diff)
+
+    def test_reduce_flat(self):
+        # every kernel at every factor must keep a flat image flat, even
+        # large shrinks where the mask has many points
+        for kernel in [Vips.Kernel.LINEAR, Vips.Kernel.CUBIC, 
+                       Vips.Kernel.MITCHELL, Vips.Kernel.LANCZOS2, 
+                       Vips.Kernel.LANCZOS3]:
+            for fmt, value in [[Vips.BandFormat.UCHAR, 200], 
+                               [Vips.BandFormat.USHORT, 50000],
+                               [Vips.BandFormat.FLOAT, 1234.5]]:
+                im = (Vips.Image.black(400, 300) + value).cast(fmt)
+
+                for factor in [1.5, 2, 3.7, 8, 25]:
+                    r = im.reduceh(factor, kernel = kernel)
+                    self.assertEqual(r.width, round(400 / factor))
+                    self.assertAlmostEqual(r.min(), value, places = 3)
+                    self.assertAlmostEqual(r.max(), value, places = 3)
+
+                    r = im.reducev(factor, kernel = kernel)
+                    self.assertEqual(r.height, round(300 / factor))
+                    self.assertAlmostEqual(r.min(), value, places = 3)
+                    self.assertAlmostEqual(r.max(), value, places = 3)
+
+    def test_reduce(self):
+        # a slowly varying image, so a plain affine with the pixel centres 
+        # lined up is a good reference for a filtered reduce
+        xy = Vips.Image.xyz(800, 600)
+        smooth = (xy.extract_band(0) * 0.9).sin() * 50 + \
+            (xy.extract_band(1) * 1.1).cos() * 50 + 128
+        interpolate = Vips.Interpolate.new("bicubic")
+
+        for factor in [1.5, 2, 3.7, 8, 20]:
+            offset = -(factor - 1) / 2.0
+            border = 4
+
+            for fmt in [Vips.BandFormat.UCHAR, Vips.BandFormat.USHORT, 
+                        Vips.BandFormat.FLOAT]:
+                im = smooth.cast(fmt)
+                ref_h = im.affine([1.0 / factor, 0, 0, 1], 
+                                  interpolate = interpolate, idx = offset)
+                ref_v = im.affine([1, 0, 0, 1.0 / factor], 
+                                  interpolate = interpolate, idy = offset)
+
+                for kernel in [Vips.Kernel.LINEAR, Vips.Kernel.LANCZOS3]:
+                    rh = im.reduceh(factor, kernel = kernel)
+                    rv = im.reducev(factor, kernel = kernel)
+
+                    self.assertCloseImages(rh, ref_h, border, 2, 0.5)
+                    self.assertCloseImages(rv, ref_v, border, 2, 0.5)
+
+                    # 8 and 16-bit images should lose nothing but the 
+                    # final rounding, however wide the mask
+                    if fmt != Vips.BandFormat.FLOAT:
+                        f = im.cast(Vips.BandFormat.FLOAT)
+                        fh = f.reduceh(factor, kernel = kernel)
+                        fv = f.reducev(factor, kernel = kernel)
+                        self.assertCloseImages(rh, fh, 0, 1, 0.5)
+                        self.assertCloseImages(rv, fv, 0, 1, 0.5)
+
+    def test_resize(self):
+        xy = Vips.Image.xyz(800, 600)
+        smooth = (xy.extract_band(0) * 0.9).sin() * 50 + \
+            (xy.extract_band(1) * 1.1).cos() * 50 + 128
+        im = smooth.cast(Vips.BandFormat.UCHAR)
+
+        # downsizing is reduceh then reducev
+        for scale in [0.7, 0.5, 0.27, 0.05]:
+            r = im.resize(scale, scale)
+            ref = im.reduceh(1.0 / scale).reducev(1.0 / scale)
+
+            self.assertEqual(r.width, ref.width)
+            self.assertEqual(r.height, ref.height)
+            self.assertEqual((r - ref).abs().max(), 0)
+
+            offset = -(1.0 / scale - 1) / 2.0
+            ref = im.affine([scale, 0, 0, scale], 
+                            interpolate = Vips.Interpolate.new("bicubic"),
+                            idx = offset, idy = offset)
+            self.assertCloseImages(r, ref, 4, 2, 0.5)
+
+        # enlarging is affine
+        r = im.resize(2.5, 2.5)
+        ref = im.affine([2.5, 0, 0, 2.5])
+        self.assertEqual(r.width, ref.width)
+        self.assertEqual(r.height, ref.height)
+        self.assertEqual((r - ref).abs().max(), 0)
+
+        # a different scale on each axis
+        r = im.resize(0.3, 2)
+        self.assertEqual(r.width, round(800 * 0.3))
+        self.assertEqual(r.height, 2 * 600)
+
+if __name__ == '__main__':
+    unittest.main()